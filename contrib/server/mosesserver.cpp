@@ -1,19 +1,27 @@
 #include "util/check.hh"
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <cstring>
+#include <ctime>
 
 
+#include "moses/CacheBasedLanguageModel.h"
 #include "moses/ChartManager.h"
 #include "moses/Hypothesis.h"
 #include "moses/Manager.h"
 #include "moses/StaticData.h"
 #include "moses/OnlineLearner.h"
+#include "moses/TranslationModel/PhraseDictionaryCache.h"
 #include "moses/TranslationModel/PhraseDictionaryDynSuffixArray.h"
 #include "moses/TranslationSystem.h"
 #include "moses/TreeInput.h"
 #include "moses/LMList.h"
 #include "moses/LM/ORLM.h"
 
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
 #include <xmlrpc-c/base.hpp>
 #include <xmlrpc-c/registry.hpp>
 #include <xmlrpc-c/server_abyss.hpp>
@@ -35,6 +43,373 @@ const TranslationSystem& getTranslationSystem(params_t params)
 	return StaticData::Instance().GetTranslationSystem(system_id);
 }
 
+/** Compact encoding of the search graph and translation options, used
+ * instead of one xmlrpc struct per node when the client asks for
+ * "sg-binary". Integers are LEB128 varints (signed ones zigzag encoded),
+ * scores are little-endian IEEE floats. Phrases are interned: a varint index
+ * into the strings seen so far in this blob, and if the index equals the
+ * number of strings seen the varint length and UTF-8 bytes follow.
+ *
+ * search graph: "MSG1" nodes:varint, then per node
+ *   hyp:varint stack:varint forward:svarint fscore:float flags:byte
+ *   if flags&1 (has back pointer)
+ *     back:varint score:float transition:float
+ *     recombined:varint (only if flags&2)
+ *     cover-start:varint cover-end:varint out:phrase
+ * options: "MTO1" spans:varint, then per span
+ *   start:varint end:varint count:varint, then per option
+ *     phrase:phrase fscore:float scores:varint score:float...
+ */
+class GraphWriter
+{
+public:
+	explicit GraphWriter(const char* magic) {
+		m_buffer.insert(m_buffer.end(), magic, magic + 4);
+	}
+
+	void PutVarint(uint64_t value) {
+		while (value >= 0x80) {
+			m_buffer.push_back(static_cast<unsigned char>(value | 0x80));
+			value >>= 7;
+		}
+		m_buffer.push_back(static_cast<unsigned char>(value));
+	}
+
+	void PutSignedVarint(int64_t value) {
+		PutVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+	}
+
+	void PutFloat(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		for (size_t i = 0; i < 4; ++i) {
+			m_buffer.push_back(static_cast<unsigned char>(bits >> (8 * i)));
+		}
+	}
+
+	void PutByte(unsigned char value) {
+		m_buffer.push_back(value);
+	}
+
+	void PutPhrase(const string& phrase) {
+		pair<boost::unordered_map<string, size_t>::iterator, bool> ins =
+			m_strings.insert(make_pair(phrase, m_strings.size()));
+		PutVarint(ins.first->second);
+		if (ins.second) {
+			PutVarint(phrase.size());
+			m_buffer.insert(m_buffer.end(), phrase.begin(), phrase.end());
+		}
+	}
+
+	const vector<unsigned char>& GetBuffer() const {
+		return m_buffer;
+	}
+
+private:
+	vector<unsigned char> m_buffer;
+	boost::unordered_map<string, size_t> m_strings;
+};
+
+/** What one translator adapts without disturbing the other users of the
+ * server: the weights learnt from its post-edits and, through
+ * StaticData::UseSession, its own copy of the cache-based models and of the
+ * learnt phrase-pair features. The session reads the shared model until its
+ * first change of each. */
+class Session
+{
+public:
+	Session(const string& id) : m_id(id), m_closed(false) {}
+
+	const string& GetId() const {
+		return m_id;
+	}
+
+	WeightSnapshotPtr GetWeights() const {
+		boost::mutex::scoped_lock lock(m_mutex);
+		return m_weights ? m_weights : StaticData::Instance().GetWeightSnapshot();
+	}
+
+	void SetWeights(const WeightSnapshotPtr& weights) {
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_weights = weights;
+	}
+
+	/** held by the learner thread while it learns for the session, so that
+	 * closing waits for it and no job learns once the state is dropped */
+	boost::mutex& GetLearningMutex() {
+		return m_learningMutex;
+	}
+
+	//! call with the learning mutex held
+	bool IsClosed() const {
+		return m_closed;
+	}
+
+	void MarkClosed() {
+		boost::mutex::scoped_lock lock(m_learningMutex);
+		m_closed = true;
+	}
+
+private:
+	string m_id;
+	mutable boost::mutex m_mutex;
+	WeightSnapshotPtr m_weights;	// empty until the session learns
+	boost::mutex m_learningMutex;
+	bool m_closed;
+};
+typedef boost::shared_ptr<Session> SessionPtr;
+
+/** Sessions by the id clients pass as "session-id". A session is opened by
+ * its first request and lives until close_session, or until it is evicted:
+ * after idleTimeout seconds without a request, or as the least recently used
+ * when opening another would exceed maxSessions. Clients that disconnect
+ * without closing their sessions would otherwise leak them. */
+class SessionRegistry
+{
+public:
+	//! a limit of 0 is no limit
+	SessionRegistry(size_t maxSessions, time_t idleTimeout)
+		: m_maxSessions(maxSessions), m_idleTimeout(idleTimeout) {}
+
+	SessionPtr Get(const string& id) {
+		vector<SessionPtr> evicted;
+		SessionPtr session;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			const time_t now = time(NULL);
+			Evict(now, id, evicted);
+			Entry& entry = m_sessions[id];
+			if (!entry.session) {
+				VERBOSE(1, "Opening session " << id << endl);
+				entry.session.reset(new Session(id));
+			}
+			entry.lastUse = now;
+			session = entry.session;
+		}
+		for (size_t i = 0; i < evicted.size(); ++i) {
+			VERBOSE(1, "Evicting session " << evicted[i]->GetId() << endl);
+			Drop(*evicted[i], false);
+		}
+		return session;
+	}
+
+	/** forgets the session and the caches it changed, after making the
+	 * phrase-pair features it learnt shared if merge is set. Requests of the
+	 * session still running keep its state until they are done */
+	bool Close(const string& id, bool merge) {
+		SessionPtr session;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			std::map<string, Entry>::iterator it = m_sessions.find(id);
+			if (it == m_sessions.end()) {
+				return false;
+			}
+			session = it->second.session;
+			m_sessions.erase(it);
+		}
+		VERBOSE(1, "Closing session " << id << endl);
+		Drop(*session, merge);
+		return true;
+	}
+
+private:
+	struct Entry {
+		SessionPtr session;
+		time_t lastUse;
+		Entry() : lastUse(0) {}
+	};
+
+	// Removes the idle sessions, then the least recently used ones while
+	// there is no room to open keep. Call with m_mutex held.
+	void Evict(time_t now, const string& keep, vector<SessionPtr>& evicted) {
+		if (m_idleTimeout > 0) {
+			for (std::map<string, Entry>::iterator it = m_sessions.begin(); it != m_sessions.end(); ) {
+				if (it->first != keep && now - it->second.lastUse >= m_idleTimeout) {
+					evicted.push_back(it->second.session);
+					m_sessions.erase(it++);
+				} else {
+					++it;
+				}
+			}
+		}
+		if (m_maxSessions == 0 || m_sessions.count(keep)) {
+			return;
+		}
+		while (m_sessions.size() >= m_maxSessions) {
+			std::map<string, Entry>::iterator oldest = m_sessions.begin();
+			for (std::map<string, Entry>::iterator it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+				if (it->second.lastUse < oldest->second.lastUse) {
+					oldest = it;
+				}
+			}
+			evicted.push_back(oldest->second.session);
+			m_sessions.erase(oldest);
+		}
+	}
+
+	void Drop(Session& session, bool merge) {
+		session.MarkClosed();
+		const string& id = session.GetId();
+		const StaticData& staticData = StaticData::Instance();
+		OnlineLearner* learner = staticData.GetOnlineLearningModel();
+		if (learner != NULL) {
+			if (merge) {
+				learner->MergeSession(id);
+			}
+			learner->DropSession(id);
+		}
+		CacheBasedLanguageModel* cblm = staticData.GetTranslationSystem(TranslationSystem::DEFAULT).GetCacheBasedLanguageModel();
+		if (cblm != NULL) {
+			cblm->DropSession(id);
+		}
+		const int idx = staticData.GetPhraseDictionaryCacheIndex();
+		if (idx != -1) {
+			PhraseDictionaryCache* cbtm = dynamic_cast<PhraseDictionaryCache*>(staticData.GetPhraseDictionaryModels().at(idx)->GetDictionary());
+			if (cbtm != NULL) {
+				cbtm->DropSession(id);
+			}
+		}
+	}
+
+	size_t m_maxSessions;
+	time_t m_idleTimeout;
+	boost::mutex m_mutex;
+	std::map<string, Entry> m_sessions;
+};
+
+/** Makes the calling thread read and update the caches of a session until
+ * it goes out of scope. Does nothing without a session. */
+class SessionScope
+{
+public:
+	SessionScope(const Session* session) : m_active(session != NULL) {
+		if (m_active) {
+			StaticData::Instance().UseSession(session->GetId());
+		}
+	}
+
+	~SessionScope() {
+		if (m_active) {
+			StaticData::Instance().UseSession("");
+		}
+	}
+
+private:
+	bool m_active;
+};
+
+/** Makes the calling thread decode with the given weights until it goes out
+ * of scope, whatever the learner publishes in the meantime. */
+class WeightScope
+{
+public:
+	WeightScope(const WeightSnapshotPtr& weights) {
+		StaticData::Instance().UseWeightSnapshot(weights);
+	}
+
+	~WeightScope() {
+		StaticData::Instance().UseWeightSnapshot(WeightSnapshotPtr());
+	}
+};
+
+/** A decoded sentence waiting to be learnt from. The example is taken from
+ * the search on the request thread, which then cleans the search up as
+ * usual, so the job holds no state of the decoder. */
+struct LearningJob
+{
+	LearningExample example;
+	string postEdited;
+	SessionPtr session;	// empty for the shared model
+
+	LearningJob(const Manager& manager, const string& pe, const SessionPtr& sp)
+		: example(manager, StaticData::Instance().GetOnlineLearningNBestSize()), postEdited(pe), session(sp) {}
+};
+
+/** Bounded queue of learning jobs drained by a single learner thread, so
+ * that translate can return as soon as decoding is done. Producers block
+ * while the queue is full; Flush() blocks until every job queued so far has
+ * been learnt from. */
+class LearningQueue
+{
+public:
+	LearningQueue(size_t capacity)
+		: m_capacity(capacity), m_busy(false) {
+		m_thread = new boost::thread(boost::bind(&LearningQueue::Run, this));
+	}
+
+	void Push(LearningJob* job) {
+		boost::mutex::scoped_lock lock(m_mutex);
+		while (m_jobs.size() >= m_capacity) {
+			m_notFull.wait(lock);
+		}
+		m_jobs.push_back(job);
+		m_notEmpty.notify_one();
+	}
+
+	void Flush() {
+		boost::mutex::scoped_lock lock(m_mutex);
+		while (!m_jobs.empty() || m_busy) {
+			m_drained.wait(lock);
+		}
+	}
+
+	size_t GetSize() {
+		boost::mutex::scoped_lock lock(m_mutex);
+		return m_jobs.size();
+	}
+
+private:
+	void Run() {
+		while (true) {
+			LearningJob* job;
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				while (m_jobs.empty()) {
+					m_notEmpty.wait(lock);
+				}
+				job = m_jobs.front();
+				m_jobs.pop_front();
+				m_busy = true;
+				m_notFull.notify_one();
+			}
+			try {
+				OnlineLearner* learner = StaticData::InstanceNonConst().GetOnlineLearningModel();
+				if (job->session) {
+					boost::mutex::scoped_lock learning(job->session->GetLearningMutex());
+					if (job->session->IsClosed()) {
+						VERBOSE(1, "Not learning for closed session " << job->session->GetId() << endl);
+					} else {
+						// the n-best list is scored with the weights of the session
+						SessionScope scope(job->session.get());
+						WeightScope weights(job->session->GetWeights());
+						job->session->SetWeights(learner->RunOnlineLearning(job->example, job->postEdited,
+								job->session->GetId(), job->session->GetWeights()));
+					}
+				} else {
+					learner->RunOnlineLearning(job->example, job->postEdited);
+				}
+			} catch (const std::exception& e) {
+				cerr << "Online learning failed: " << e.what() << endl;
+			}
+			delete job;
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				m_busy = false;
+				if (m_jobs.empty()) {
+					m_drained.notify_all();
+				}
+			}
+		}
+	}
+
+	size_t m_capacity;
+	bool m_busy;	// learner is working on a job already popped off the queue
+	std::deque<LearningJob*> m_jobs;
+	boost::mutex m_mutex;
+	boost::condition_variable m_notEmpty, m_notFull, m_drained;
+	boost::thread* m_thread;
+};
+
 class Updater: public xmlrpc_c::method
 {
 public:
@@ -49,29 +424,32 @@ public:
 	execute(xmlrpc_c::paramList const& paramList,
 			xmlrpc_c::value *   const  retvalP) {
 		const params_t params = paramList.getStruct(0);
-		breakOutParams(params);
+		vector<string> sources, targets, alignments;
+		breakOutParams(params, sources, targets, alignments);
+		bool add2ORLM = (params.find("updateORLM") != params.end());
 		const TranslationSystem& system = getTranslationSystem(params);
 		const PhraseDictionaryFeature* pdf = system.GetPhraseDictionaries()[0];
 		PhraseDictionaryDynSuffixArray* pdsa = (PhraseDictionaryDynSuffixArray*) pdf->GetDictionary();
-		cerr << "Inserting into address " << pdsa << endl;
-		pdsa->insertSnt(source_, target_, alignment_);
-		if(add2ORLM_) {
-			updateORLM();
+		{
+			// concurrent updater calls would otherwise interleave their
+			// suffix array and ORLM insertions
+			boost::mutex::scoped_lock lock(s_updateLock);
+			cerr << "Inserting " << sources.size() << " sentence pairs into address " << pdsa << endl;
+			pdsa->insertSnts(sources, targets, alignments);
+			if(add2ORLM) {
+				updateORLM(targets);
+			}
 		}
 		cerr << "Done inserting\n";
-		//PhraseDictionary* pdsa = (PhraseDictionary*) pdf->GetDictionary(*dummy);
-		map<string, xmlrpc_c::value> retData;
-		//*retvalP = xmlrpc_c::value_struct(retData);
-		pdf = 0;
-		pdsa = 0;
 		*retvalP = xmlrpc_c::value_string("Phrase table updated");
 	}
-	string source_, target_, alignment_;
-	bool bounded_, add2ORLM_;
-	void updateORLM() {
+private:
+	static boost::mutex s_updateLock;
+
+	typedef boost::unordered_map<vector<string>, int> NGramCounts;
+
+	void updateORLM(const vector<string>& targets) {
 		// TODO(level101): this belongs in the language model, not in moseserver.cpp
-		vector<string> vl;
-		map<vector<string>, int> ngSet;
 		LMList lms = StaticData::Instance().GetLMList(); // get LM
 		LMList::const_iterator lmIter = lms.begin();
 		LanguageModelORLM* orlm = static_cast<LanguageModelORLM*>(static_cast<LMRefCount*>(*lmIter)->MosesServerCppShouldNotHaveLMCode());
@@ -79,62 +457,94 @@ public:
 			cerr << "WARNING: Unable to add target sentence to ORLM\n";
 			return;
 		}
-		// break out new ngrams from sentence
+		// break out new ngrams from all sentences of the batch, one count
+		// table per order so that lower orders can be inserted first
 		const int ngOrder(orlm->GetNGramOrder());
 		const std::string sBOS = orlm->GetSentenceStart()->GetString();
 		const std::string sEOS = orlm->GetSentenceEnd()->GetString();
-		Utils::splitToStr(target_, vl, " ");
-		// insert BOS and EOS
-		vl.insert(vl.begin(), sBOS);
-		vl.insert(vl.end(), sEOS);
-		for(int j=0; j < vl.size(); ++j) {
-			int i = (j<ngOrder) ? 0 : j-ngOrder+1;
-			for(int t=j; t >= i; --t) {
-				vector<string> ngVec;
-				for(int s=t; s<=j; ++s) {
-					ngVec.push_back(vl[s]);
-					//cerr << vl[s] << " ";
+		vector<NGramCounts> ngSets(ngOrder);
+		size_t numNGrams = 0;
+		vector<string> vl;
+		for(size_t n = 0; n < targets.size(); ++n) {
+			vl.clear();
+			Utils::splitToStr(targets[n], vl, " ");
+			// insert BOS and EOS
+			vl.insert(vl.begin(), sBOS);
+			vl.insert(vl.end(), sEOS);
+			for(int j=0; j < (int)vl.size(); ++j) {
+				int i = (j<ngOrder) ? 0 : j-ngOrder+1;
+				for(int t=j; t >= i; --t) {
+					vector<string> ngVec(vl.begin() + t, vl.begin() + j + 1);
+					if(ngSets[j-t][ngVec]++ == 0) ++numNGrams;
 				}
-				ngSet[ngVec]++;
-				//cerr << endl;
 			}
 		}
 		// insert into LM in order from 1grams up (for LM well-formedness)
-		cerr << "Inserting " << ngSet.size() << " ngrams into ORLM...\n";
-		for(int i=1; i <= ngOrder; ++i) {
-			iterate(ngSet, it) {
-				if(it->first.size() == i)
-					orlm->UpdateORLM(it->first, it->second);
+		cerr << "Inserting " << numNGrams << " ngrams into ORLM...\n";
+		for(int i=0; i < ngOrder; ++i) {
+			iterate(ngSets[i], it) {
+				orlm->UpdateORLM(it->first, it->second);
 			}
 		}
 	}
-	void breakOutParams(const params_t& params) {
-		params_t::const_iterator si = params.find("source");
-		if(si == params.end())
-			throw xmlrpc_c::fault("Missing source sentence", xmlrpc_c::fault::CODE_PARSE);
-		source_ = xmlrpc_c::value_string(si->second);
-		cerr << "source = " << source_ << endl;
-		si = params.find("target");
+	string getString(const params_t& params, const string& key, const string& what) {
+		params_t::const_iterator si = params.find(key);
 		if(si == params.end())
-			throw xmlrpc_c::fault("Missing target sentence", xmlrpc_c::fault::CODE_PARSE);
-		target_ = xmlrpc_c::value_string(si->second);
-		cerr << "target = " << target_ << endl;
-		si = params.find("alignment");
-		if(si == params.end())
-			throw xmlrpc_c::fault("Missing alignment", xmlrpc_c::fault::CODE_PARSE);
-		alignment_ = xmlrpc_c::value_string(si->second);
-		cerr << "alignment = " << alignment_ << endl;
-		si = params.find("bounded");
-		bounded_ = (si != params.end());
-		si = params.find("updateORLM");
-		add2ORLM_ = (si != params.end());
+			throw xmlrpc_c::fault("Missing " + what, xmlrpc_c::fault::CODE_PARSE);
+		return xmlrpc_c::value_string(si->second);
+	}
+	/** Either a single sentence pair given by source, target and alignment,
+	 * or an array of such structs under "batch" */
+	void breakOutParams(const params_t& params, vector<string>& sources,
+			vector<string>& targets, vector<string>& alignments) {
+		params_t::const_iterator bi = params.find("batch");
+		if(bi == params.end()) {
+			sources.push_back(getString(params, "source", "source sentence"));
+			targets.push_back(getString(params, "target", "target sentence"));
+			alignments.push_back(getString(params, "alignment", "alignment"));
+			cerr << "source = " << sources.back() << endl;
+			cerr << "target = " << targets.back() << endl;
+			cerr << "alignment = " << alignments.back() << endl;
+			return;
+		}
+		const vector<xmlrpc_c::value> batch = xmlrpc_c::value_array(bi->second).vectorValueValue();
+		for(size_t i = 0; i < batch.size(); ++i) {
+			const params_t pair = xmlrpc_c::value_struct(batch[i]);
+			sources.push_back(getString(pair, "source", "source sentence in batch"));
+			targets.push_back(getString(pair, "target", "target sentence in batch"));
+			alignments.push_back(getString(pair, "alignment", "alignment in batch"));
+		}
+	}
+};
+
+boost::mutex Updater::s_updateLock;
+
+class Flusher : public xmlrpc_c::method
+{
+public:
+	Flusher(LearningQueue* learningQueue) : m_learningQueue(learningQueue) {
+		this->_signature = "S:S";
+		this->_help = "Waits until all pending online learning updates are applied";
+	}
+
+	void
+	execute(xmlrpc_c::paramList const& paramList,
+			xmlrpc_c::value *   const  retvalP) {
+		if (m_learningQueue != NULL) {
+			m_learningQueue->Flush();
+		}
+		*retvalP = xmlrpc_c::value_string("Learning queue flushed");
 	}
+
+private:
+	LearningQueue* m_learningQueue;
 };
 
 class Translator : public xmlrpc_c::method
 {
 public:
-	Translator() {
+	Translator(LearningQueue* learningQueue, SessionRegistry* sessions, const string& outputDir)
+		: m_learningQueue(learningQueue), m_sessions(sessions), m_outputDir(outputDir) {
 		// signature and help strings are documentation -- the client
 		// can query this information with a system.methodSignature and
 		// system.methodHelp RPC.
@@ -164,8 +574,16 @@ public:
 		bool addGraphInfo = (si != params.end());
 		si = params.find("topt");
 		bool addTopts = (si != params.end());
+		si = params.find("sg-binary");
+		bool binaryGraph = (si != params.end());
 		si = params.find("report-all-factors");
 		bool reportAllFactors = (si != params.end());
+		SessionPtr session;
+		si = params.find("session-id");
+		if (si != params.end()) {
+			session = m_sessions->Get(xmlrpc_c::value_string(si->second));
+		}
+		SessionScope sessionScope(session.get());
 
 		const StaticData &staticData = StaticData::Instance();
 
@@ -183,6 +601,7 @@ public:
 					staticData.GetInputFactorOrder();
 			stringstream in(source + "\n");
 			tinput.Read(in,inputFactorOrder);
+			WeightScope weightScope(session ? session->GetWeights() : staticData.GetWeightSnapshot(tinput));
 			ChartManager manager(tinput, &system);
 			manager.ProcessSentence();
 			const ChartHypothesis *hypo = manager.GetBestHypothesis();
@@ -193,15 +612,14 @@ public:
 					staticData.GetInputFactorOrder();
 			stringstream in(source + "\n");
 			sentence.Read(in,inputFactorOrder);
+			// every request decodes with the weights it starts with, as the
+			// learner thread may publish new ones at any time
+			WeightScope weightScope(session ? session->GetWeights() : staticData.GetWeightSnapshot(sentence));
+			const string postEdited = sentence.GetPostEditedSentence();
 			size_t lineNumber = 0; // TODO: Include sentence request number here?
 			Manager manager(lineNumber, sentence, staticData.GetSearchAlgorithm(), &system);
 
-			StaticData &SD = StaticData::InstanceNonConst();
 			manager.ProcessSentence();
-			if(staticData.GetOnlineLearningModel()!=NULL){
-				SD.GetOnlineLearningModel()->RunOnlineLearning(manager);
-				SD.GetOnlineLearningModel()->RemoveJunk();
-			}
 
 			const Hypothesis* hypo = manager.GetBestHypothesis();
 
@@ -212,11 +630,26 @@ public:
 			}
 
 			if(addGraphInfo) {
-				insertGraphInfo(manager,retData);
+				if (binaryGraph) {
+					GraphWriter writer("MSG1");
+					writeGraphInfo(manager, writer);
+					insertBinary(params, "sg", writer, retData);
+				} else {
+					insertGraphInfo(manager,retData);
+				}
 				(const_cast<StaticData&>(staticData)).SetOutputSearchGraph(false);
 			}
 			if (addTopts) {
-				insertTranslationOptions(manager,retData);
+				if (binaryGraph) {
+					GraphWriter writer("MTO1");
+					writeTranslationOptions(manager, writer);
+					insertBinary(params, "topt", writer, retData);
+				} else {
+					insertTranslationOptions(manager,retData);
+				}
+			}
+			if (m_learningQueue != NULL && !postEdited.empty()) {
+				m_learningQueue->Push(new LearningJob(manager, postEdited, session));
 			}
 		}
 		pair<string, xmlrpc_c::value>
@@ -329,8 +762,136 @@ public:
 		retData.insert(pair<string, xmlrpc_c::value>("topt", xmlrpc_c::value_array(toptsXml)));
 	}
 
+	void writeGraphInfo(Manager& manager, GraphWriter& writer) {
+		vector<SearchGraphNode> searchGraph;
+		manager.GetSearchGraph(searchGraph);
+		const vector<FactorType>& outputFactorOrder = StaticData::Instance().GetOutputFactorOrder();
+		writer.PutVarint(searchGraph.size());
+		for (vector<SearchGraphNode>::const_iterator i = searchGraph.begin(); i != searchGraph.end(); ++i) {
+			const Hypothesis* hypo = i->hypo;
+			writer.PutVarint(hypo->GetId());
+			writer.PutVarint(hypo->GetWordsBitmap().GetNumWordsCovered());
+			writer.PutSignedVarint(i->forward);
+			writer.PutFloat(i->fscore);
+			if (hypo->GetId() == 0) {
+				writer.PutByte(0);
+				continue;
+			}
+			writer.PutByte(i->recombinationHypo ? 3 : 1);
+			const Hypothesis *prevHypo = hypo->GetPrevHypo();
+			writer.PutVarint(prevHypo->GetId());
+			writer.PutFloat(hypo->GetScore());
+			writer.PutFloat(hypo->GetScore() - prevHypo->GetScore());
+			if (i->recombinationHypo) {
+				writer.PutVarint(i->recombinationHypo->GetId());
+			}
+			writer.PutVarint(hypo->GetCurrSourceWordsRange().GetStartPos());
+			writer.PutVarint(hypo->GetCurrSourceWordsRange().GetEndPos());
+			writer.PutPhrase(hypo->GetCurrTargetPhrase().GetStringRep(outputFactorOrder));
+		}
+	}
+
+	void writeTranslationOptions(Manager& manager, GraphWriter& writer) {
+		const TranslationOptionCollection* toptsColl = manager.getSntTranslationOptions();
+		const vector<FactorType>& outputFactorOrder = StaticData::Instance().GetOutputFactorOrder();
+		vector<WordsRange> spans;
+		for (size_t startPos = 0 ; startPos < toptsColl->GetSize() ; ++startPos) {
+			size_t maxSize = toptsColl->GetSize() - startPos;
+			size_t maxSizePhrase = StaticData::Instance().GetMaxPhraseLength();
+			maxSize = std::min(maxSize, maxSizePhrase);
+
+			for (size_t endPos = startPos ; endPos < startPos + maxSize ; ++endPos) {
+				WordsRange range(startPos,endPos);
+				if (toptsColl->GetTranslationOptionList(range).size()) {
+					spans.push_back(range);
+				}
+			}
+		}
+		writer.PutVarint(spans.size());
+		for (size_t s = 0; s < spans.size(); ++s) {
+			const TranslationOptionList& fullList = toptsColl->GetTranslationOptionList(spans[s]);
+			writer.PutVarint(spans[s].GetStartPos());
+			writer.PutVarint(spans[s].GetEndPos());
+			writer.PutVarint(fullList.size());
+			for (size_t i = 0; i < fullList.size(); i++) {
+				const TranslationOption* topt = fullList.Get(i);
+				writer.PutPhrase(topt->GetTargetPhrase().GetStringRep(outputFactorOrder));
+				writer.PutFloat(topt->GetFutureScore());
+				const std::valarray<FValue> &scores = topt->GetScoreBreakdown().getCoreFeatures();
+				writer.PutVarint(scores.size());
+				for (size_t j = 0; j < scores.size(); ++j) {
+					writer.PutFloat(scores[j]);
+				}
+			}
+		}
+	}
+
+	/** Return the blob base64 encoded under key, or write it to the file
+	 * named by key + "-file" in the server output directory and return
+	 * that name instead */
+	void insertBinary(const params_t& params, const string& key, const GraphWriter& writer, map<string, xmlrpc_c::value>& retData) {
+		params_t::const_iterator fi = params.find(key + "-file");
+		if (fi == params.end()) {
+			retData.insert(pair<string, xmlrpc_c::value>(key, xmlrpc_c::value_bytestring(writer.GetBuffer())));
+			return;
+		}
+		if (m_outputDir.empty()) {
+			throw xmlrpc_c::fault("File output needs --server-output-dir", xmlrpc_c::fault::CODE_REQUEST_REFUSED);
+		}
+		// only bare file names, so that clients cannot leave the output directory
+		const string name = xmlrpc_c::value_string(fi->second);
+		if (name.empty() || name == "." || name == ".." || name.find('/') != string::npos) {
+			throw xmlrpc_c::fault("Invalid " + key + "-file: " + name, xmlrpc_c::fault::CODE_REQUEST_REFUSED);
+		}
+		const string path = m_outputDir + "/" + name;
+		ofstream file(path.c_str(), ios::out | ios::binary);
+		const vector<unsigned char>& buffer = writer.GetBuffer();
+		file.write(reinterpret_cast<const char*>(&buffer[0]), buffer.size());
+		if (!file) {
+			throw xmlrpc_c::fault("Unable to write " + name, xmlrpc_c::fault::CODE_INTERNAL);
+		}
+		retData.insert(pair<string, xmlrpc_c::value>(key + "-file", xmlrpc_c::value_string(name)));
+	}
+
+private:
+	LearningQueue* m_learningQueue;
+	SessionRegistry* m_sessions;
+	string m_outputDir;
+};
 
+class SessionCloser : public xmlrpc_c::method
+{
+public:
+	SessionCloser(LearningQueue* learningQueue, SessionRegistry* sessions)
+		: m_learningQueue(learningQueue), m_sessions(sessions) {
+		this->_signature = "S:S";
+		this->_help = "Forgets the weights and caches adapted by the session given as session-id; "
+				"with merge, the phrase-pair features it learnt are kept for every user";
+	}
+
+	void
+	execute(xmlrpc_c::paramList const& paramList,
+			xmlrpc_c::value *   const  retvalP) {
+		const params_t params = paramList.getStruct(0);
+		paramList.verifyEnd(1);
+		params_t::const_iterator si = params.find("session-id");
+		if (si == params.end()) {
+			throw xmlrpc_c::fault(
+					"Missing session-id",
+					xmlrpc_c::fault::CODE_PARSE);
+		}
+		const string id(xmlrpc_c::value_string(si->second));
+		const bool merge = (params.find("merge") != params.end());
+		// the post-edits the session sent before closing are learnt from first
+		if (m_learningQueue != NULL) {
+			m_learningQueue->Flush();
+		}
+		*retvalP = xmlrpc_c::value_string(m_sessions->Close(id, merge) ? "Session closed" : "Unknown session");
+	}
 
+private:
+	LearningQueue* m_learningQueue;
+	SessionRegistry* m_sessions;
 };
 
 
@@ -343,6 +904,10 @@ int main(int argc, char** argv)
 	int port = 8080;
 	const char* logfile = "/dev/null";
 	bool isSerial = false;
+	size_t learningQueueSize = 64;
+	size_t maxSessions = 1000;
+	time_t sessionTimeout = 3600;
+	string outputDir;
 
 	for (int i = 0; i < argc; ++i) {
 		if (!strcmp(argv[i],"--server-port")) {
@@ -361,6 +926,42 @@ int main(int argc, char** argv)
 			} else {
 				logfile = argv[i];
 			}
+		} else if (!strcmp(argv[i],"--learning-queue-size")) {
+			++i;
+			if (i >= argc) {
+				cerr << "Error: Missing argument to --learning-queue-size" << endl;
+				exit(1);
+			} else {
+				learningQueueSize = atoi(argv[i]);
+				if (learningQueueSize == 0) {
+					cerr << "Error: --learning-queue-size must be positive" << endl;
+					exit(1);
+				}
+			}
+		} else if (!strcmp(argv[i],"--max-sessions")) {
+			++i;
+			if (i >= argc) {
+				cerr << "Error: Missing argument to --max-sessions" << endl;
+				exit(1);
+			} else {
+				maxSessions = atoi(argv[i]);
+			}
+		} else if (!strcmp(argv[i],"--session-timeout")) {
+			++i;
+			if (i >= argc) {
+				cerr << "Error: Missing argument to --session-timeout" << endl;
+				exit(1);
+			} else {
+				sessionTimeout = atoi(argv[i]);
+			}
+		} else if (!strcmp(argv[i],"--server-output-dir")) {
+			++i;
+			if (i >= argc) {
+				cerr << "Error: Missing argument to --server-output-dir" << endl;
+				exit(1);
+			} else {
+				outputDir = argv[i];
+			}
 		} else if (!strcmp(argv[i], "--serial")) {
 			cerr << "Running single-threaded server" << endl;
 			isSerial = true;
@@ -382,11 +983,22 @@ int main(int argc, char** argv)
 
 	xmlrpc_c::registry myRegistry;
 
-	xmlrpc_c::methodPtr const translator(new Translator);
+	LearningQueue* learningQueue = NULL;
+	if (StaticData::Instance().GetOnlineLearningModel() != NULL) {
+		learningQueue = new LearningQueue(learningQueueSize);
+	}
+
+	SessionRegistry* sessions = new SessionRegistry(maxSessions, sessionTimeout);
+
+	xmlrpc_c::methodPtr const translator(new Translator(learningQueue, sessions, outputDir));
 	xmlrpc_c::methodPtr const updater(new Updater);
+	xmlrpc_c::methodPtr const flusher(new Flusher(learningQueue));
+	xmlrpc_c::methodPtr const sessionCloser(new SessionCloser(learningQueue, sessions));
 
 	myRegistry.addMethod("translate", translator);
 	myRegistry.addMethod("updater", updater);
+	myRegistry.addMethod("flush", flusher);
+	myRegistry.addMethod("close_session", sessionCloser);
 
 	xmlrpc_c::serverAbyss myAbyssServer(
 			myRegistry,
@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+# Sample client requesting the search graph and translation options in the
+# compact binary encoding ("sg-binary") and decoding them.
+# See GraphWriter in mosesserver.cpp for the format.
+
+import struct
+import xmlrpclib
+
+url = "http://localhost:8080/RPC2"
+proxy = xmlrpclib.ServerProxy(url)
+
+
+class Reader:
+    def __init__(self, data, magic):
+        if data[:4] != magic:
+            raise ValueError("expected %s blob" % magic)
+        self.data = data
+        self.pos = 4
+        self.strings = []
+
+    def varint(self):
+        value, shift = 0, 0
+        while True:
+            byte = ord(self.data[self.pos])
+            self.pos += 1
+            value |= (byte & 0x7f) << shift
+            if byte < 0x80:
+                return value
+            shift += 7
+
+    def svarint(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def float(self):
+        value = struct.unpack("<f", self.data[self.pos:self.pos + 4])[0]
+        self.pos += 4
+        return value
+
+    def byte(self):
+        self.pos += 1
+        return ord(self.data[self.pos - 1])
+
+    def phrase(self):
+        index = self.varint()
+        if index == len(self.strings):
+            length = self.varint()
+            self.strings.append(self.data[self.pos:self.pos + length].decode("utf8"))
+            self.pos += length
+        return self.strings[index]
+
+
+def read_search_graph(data):
+    r = Reader(data, "MSG1")
+    nodes = []
+    for _ in range(r.varint()):
+        node = {"hyp": r.varint(), "stack": r.varint(),
+                "forward": r.svarint(), "fscore": r.float()}
+        flags = r.byte()
+        if flags & 1:
+            node["back"] = r.varint()
+            node["score"] = r.float()
+            node["transition"] = r.float()
+            if flags & 2:
+                node["recombined"] = r.varint()
+            node["cover-start"] = r.varint()
+            node["cover-end"] = r.varint()
+            node["out"] = r.phrase()
+        nodes.append(node)
+    return nodes
+
+
+def read_translation_options(data):
+    r = Reader(data, "MTO1")
+    options = []
+    for _ in range(r.varint()):
+        start, end = r.varint(), r.varint()
+        for _ in range(r.varint()):
+            option = {"start": start, "end": end,
+                      "phrase": r.phrase(), "fscore": r.float()}
+            option["scores"] = [r.float() for _ in range(r.varint())]
+            options.append(option)
+    return options
+
+
+text = u"il a souhaité que la présidence trace à nice le chemin pour l' avenir ."
+params = {"text": text, "sg": "true", "topt": "true", "sg-binary": "true"}
+
+result = proxy.translate(params)
+print result['text']
+for node in read_search_graph(result['sg'].data):
+    print " ".join("%s=%s" % kv for kv in sorted(node.items()))
+for option in read_translation_options(result['topt'].data):
+    print option
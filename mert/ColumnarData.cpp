@@ -0,0 +1,314 @@
+/*
+ *  ColumnarData.cpp
+ *  mert - Minimum Error Rate Training
+ *
+ *  Binary columnar feature and score data files.
+ *
+ */
+
+#include "ColumnarData.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "util/file.hh"
+
+#include "FeatureArray.h"
+#include "ScoreArray.h"
+
+using namespace std;
+
+namespace MosesTuning
+{
+
+namespace {
+
+const char kFeatureMagic[8] = {'M', 'E', 'R', 'T', 'F', 'C', '0', '1'};
+const char kScoreMagic[8] = {'M', 'E', 'R', 'T', 'S', 'C', '0', '1'};
+
+struct FeatureHeader {
+  char magic[8];
+  uint64_t sentences, rows, features, sparse_names, sparse_values;
+  uint64_t names_bytes, features_bytes;
+};
+
+struct ScoreHeader {
+  char magic[8];
+  uint64_t sentences, rows, scores, type_bytes;
+};
+
+size_t Aligned(size_t bytes) {
+  return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+bool HasMagic(const string& file, const char* magic) {
+  FILE* in = fopen(file.c_str(), "rb");
+  if (!in) return false;
+  char buf[8];
+  const bool found = fread(buf, 1, sizeof(buf), in) == sizeof(buf) &&
+                     memcmp(buf, magic, sizeof(buf)) == 0;
+  fclose(in);
+  return found;
+}
+
+template <class Header>
+void MapFile(const string& file, util::scoped_memory& mapping, Header& header) {
+  util::scoped_fd fd(util::OpenReadOrThrow(file.c_str()));
+  const uint64_t size = util::SizeOrThrow(fd.get());
+  if (size < sizeof(Header)) {
+    throw runtime_error(file + " is truncated");
+  }
+  util::MapRead(util::POPULATE_OR_READ, fd.get(), 0, size, mapping);
+  memcpy(&header, mapping.get(), sizeof(Header));
+}
+
+// hands out the sections of a mapped file in order
+class SectionReader
+{
+public:
+  SectionReader(const util::scoped_memory& mapping, size_t offset, const string& file)
+      : m_at(static_cast<const char*>(mapping.get()) + offset),
+        m_end(static_cast<const char*>(mapping.get()) + mapping.size()),
+        m_file(file) {}
+
+  template <class T> const T* next(size_t count) {
+    const char* at = m_at;
+    if (Aligned(count * sizeof(T)) > static_cast<size_t>(m_end - m_at)) {
+      throw runtime_error(m_file + " is truncated");
+    }
+    m_at += Aligned(count * sizeof(T));
+    return reinterpret_cast<const T*>(at);
+  }
+
+private:
+  const char* m_at;
+  const char* m_end;
+  const string& m_file;
+};
+
+// each section is padded to the next 8-byte boundary
+template <class T> void WriteSection(ostream& out, const T* data, size_t count) {
+  static const char kPadding[8] = {0};
+  const size_t bytes = count * sizeof(T);
+  if (bytes) out.write(reinterpret_cast<const char*>(data), bytes);
+  out.write(kPadding, Aligned(bytes) - bytes);
+}
+
+template <class T> void WriteSection(ostream& out, const vector<T>& data) {
+  WriteSection(out, data.empty() ? NULL : &data[0], data.size());
+}
+
+} // namespace
+
+bool FeatureColumns::IsColumnar(const string& file)
+{
+  return HasMagic(file, kFeatureMagic);
+}
+
+FeatureColumns::FeatureColumns(const string& file)
+{
+  FeatureHeader header;
+  MapFile(file, m_mapping, header);
+  if (memcmp(header.magic, kFeatureMagic, sizeof(kFeatureMagic))) {
+    throw runtime_error(file + " is not a columnar feature file");
+  }
+  m_num_sentences = header.sentences;
+  m_num_features = header.features;
+
+  SectionReader sections(m_mapping, sizeof(header), file);
+  m_indexes = sections.next<int64_t>(header.sentences);
+  m_rows = sections.next<uint64_t>(header.sentences + 1);
+  m_dense = sections.next<float>(header.rows * header.features);
+  m_sparse_rows = sections.next<uint64_t>(header.rows + 1);
+  m_sparse_columns = sections.next<uint32_t>(header.sparse_values);
+  m_sparse_values = sections.next<float>(header.sparse_values);
+  const uint64_t* name_offsets = sections.next<uint64_t>(header.sparse_names + 1);
+  const char* names = sections.next<char>(header.names_bytes);
+  const char* features = sections.next<char>(header.features_bytes);
+  if (m_rows[m_num_sentences] != header.rows ||
+      m_sparse_rows[header.rows] != header.sparse_values ||
+      name_offsets[header.sparse_names] != header.names_bytes) {
+    throw runtime_error(file + " is corrupt");
+  }
+
+  m_sparse_ids.resize(header.sparse_names);
+  for (size_t i = 0; i < header.sparse_names; ++i) {
+    m_sparse_ids[i] = SparseVector::encode(
+        string(names + name_offsets[i], names + name_offsets[i + 1]));
+  }
+  m_features.assign(features, header.features_bytes);
+}
+
+void FeatureColumns::get(size_t sentence, FeatureArray& array, const SparseVector& sparseWeights) const
+{
+  for (size_t row = begin(sentence); row < end(sentence); ++row) {
+    FeatureStats entry(m_num_features);
+    copy(dense(row), dense(row) + m_num_features, entry.getArray());
+    if (sparseWeights.size()) {
+      SparseVector sparse;
+      for (size_t i = sparseBegin(row); i < sparseEnd(row); ++i) {
+        sparse.set(sparseId(i), sparseValue(i));
+      }
+      entry.add(inner_product(sparseWeights, sparse));
+    } else {
+      for (size_t i = sparseBegin(row); i < sparseEnd(row); ++i) {
+        entry.addSparse(sparseId(i), sparseValue(i));
+      }
+    }
+    array.add(entry);
+  }
+}
+
+bool ScoreColumns::IsColumnar(const string& file)
+{
+  return HasMagic(file, kScoreMagic);
+}
+
+ScoreColumns::ScoreColumns(const string& file)
+{
+  ScoreHeader header;
+  MapFile(file, m_mapping, header);
+  if (memcmp(header.magic, kScoreMagic, sizeof(kScoreMagic))) {
+    throw runtime_error(file + " is not a columnar score file");
+  }
+  m_num_sentences = header.sentences;
+  m_num_scores = header.scores;
+
+  SectionReader sections(m_mapping, sizeof(header), file);
+  m_indexes = sections.next<int64_t>(header.sentences);
+  m_rows = sections.next<uint64_t>(header.sentences + 1);
+  m_stats = sections.next<ScoreStatsType>(header.rows * header.scores);
+  const char* score_type = sections.next<char>(header.type_bytes);
+  if (m_rows[m_num_sentences] != header.rows) {
+    throw runtime_error(file + " is corrupt");
+  }
+  m_score_type.assign(score_type, header.type_bytes);
+}
+
+void ScoreColumns::get(size_t sentence, ScoreArray& array) const
+{
+  for (size_t row = begin(sentence); row < end(sentence); ++row) {
+    ScoreStats entry(m_num_scores);
+    copy(stats(row), stats(row) + m_num_scores, entry.getArray());
+    array.add(entry);
+  }
+}
+
+FeatureColumnsWriter::FeatureColumnsWriter()
+    : m_rows(1, 0), m_num_features(0), m_sparse_rows(1, 0) {}
+
+void FeatureColumnsWriter::add(const FeatureArray& array)
+{
+  if (array.size() == 0) return;
+  m_indexes.push_back(array.getIndex());
+  for (size_t i = 0; i < array.size(); ++i) {
+    const FeatureStats& stats = array.get(i);
+    if (m_rows.back() + i == 0) {
+      m_num_features = stats.size();
+    } else if (stats.size() != m_num_features) {
+      throw runtime_error("Error: hypotheses have different numbers of dense features");
+    }
+    m_dense.insert(m_dense.end(), stats.getArray(), stats.getArray() + stats.size());
+
+    const SparseVector& sparse = stats.getSparse();
+    const vector<size_t> ids = sparse.feats();
+    for (size_t j = 0; j < ids.size(); ++j) {
+      map<size_t, uint32_t>::const_iterator column = m_sparse_columns_by_id.find(ids[j]);
+      if (column == m_sparse_columns_by_id.end()) {
+        column = m_sparse_columns_by_id.insert(make_pair(ids[j], static_cast<uint32_t>(m_sparse_names.size()))).first;
+        m_sparse_names.push_back(SparseVector::decode(ids[j]));
+      }
+      m_sparse_columns.push_back(column->second);
+      m_sparse_values.push_back(sparse.get(ids[j]));
+    }
+    m_sparse_rows.push_back(m_sparse_columns.size());
+  }
+  m_rows.push_back(m_rows.back() + array.size());
+}
+
+void FeatureColumnsWriter::save(const string& file) const
+{
+  ofstream out(file.c_str(), ios::out | ios::binary);
+  if (!out) {
+    throw runtime_error("Unable to open feature file: " + file);
+  }
+  vector<uint64_t> name_offsets(1, 0);
+  string names;
+  for (size_t i = 0; i < m_sparse_names.size(); ++i) {
+    names += m_sparse_names[i];
+    name_offsets.push_back(names.size());
+  }
+
+  FeatureHeader header;
+  memcpy(header.magic, kFeatureMagic, sizeof(kFeatureMagic));
+  header.sentences = m_indexes.size();
+  header.rows = m_rows.back();
+  header.features = m_num_features;
+  header.sparse_names = m_sparse_names.size();
+  header.sparse_values = m_sparse_values.size();
+  header.names_bytes = names.size();
+  header.features_bytes = m_features.size();
+  WriteSection(out, &header, 1);
+
+  WriteSection(out, m_indexes);
+  WriteSection(out, m_rows);
+  WriteSection(out, m_dense);
+  WriteSection(out, m_sparse_rows);
+  WriteSection(out, m_sparse_columns);
+  WriteSection(out, m_sparse_values);
+  WriteSection(out, name_offsets);
+  WriteSection(out, names.data(), names.size());
+  WriteSection(out, m_features.data(), m_features.size());
+  out.close();
+  if (!out) {
+    throw runtime_error("Error writing feature file: " + file);
+  }
+}
+
+ScoreColumnsWriter::ScoreColumnsWriter(const string& score_type)
+    : m_rows(1, 0), m_num_scores(0), m_score_type(score_type) {}
+
+void ScoreColumnsWriter::add(const ScoreArray& array)
+{
+  if (array.size() == 0) return;
+  m_indexes.push_back(array.getIndex());
+  for (size_t i = 0; i < array.size(); ++i) {
+    const ScoreStats& stats = array.get(i);
+    if (m_rows.back() + i == 0) {
+      m_num_scores = stats.size();
+    } else if (stats.size() != m_num_scores) {
+      throw runtime_error("Error: hypotheses have different numbers of score statistics");
+    }
+    m_stats.insert(m_stats.end(), stats.getArray(), stats.getArray() + stats.size());
+  }
+  m_rows.push_back(m_rows.back() + array.size());
+}
+
+void ScoreColumnsWriter::save(const string& file) const
+{
+  ofstream out(file.c_str(), ios::out | ios::binary);
+  if (!out) {
+    throw runtime_error("Unable to open score file: " + file);
+  }
+  ScoreHeader header;
+  memcpy(header.magic, kScoreMagic, sizeof(kScoreMagic));
+  header.sentences = m_indexes.size();
+  header.rows = m_rows.back();
+  header.scores = m_num_scores;
+  header.type_bytes = m_score_type.size();
+  WriteSection(out, &header, 1);
+
+  WriteSection(out, m_indexes);
+  WriteSection(out, m_rows);
+  WriteSection(out, m_stats);
+  WriteSection(out, m_score_type.data(), m_score_type.size());
+  out.close();
+  if (!out) {
+    throw runtime_error("Error writing score file: " + file);
+  }
+}
+
+}
@@ -0,0 +1,170 @@
+/*
+ *  ColumnarData.h
+ *  mert - Minimum Error Rate Training
+ *
+ *  Binary columnar feature and score data files.
+ *
+ */
+
+#ifndef MERT_COLUMNAR_DATA_H_
+#define MERT_COLUMNAR_DATA_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "util/mmap.hh"
+
+#include "FeatureStats.h"
+#include "Types.h"
+
+namespace MosesTuning
+{
+
+/**
+ * Feature and score data in a binary columnar layout, memory-mapped rather
+ * than parsed.
+ *
+ * A feature file holds, after a fixed header, the index and the first
+ * hypothesis of each sentence, the dense features as a row-major float
+ * matrix with one row per hypothesis, the sparse features in CSR layout
+ * (row offsets, column ids, values), the sparse feature names and the
+ * dense feature names. A score file holds the sentences the same way, then
+ * the score statistics as a row-major int matrix and the score type.
+ *
+ * Each section starts on an 8-byte boundary. Numbers are in host byte
+ * order, so files are not portable across endianness.
+ */
+class FeatureColumns
+{
+public:
+  /** whether file starts like a columnar feature file */
+  static bool IsColumnar(const std::string& file);
+
+  explicit FeatureColumns(const std::string& file);
+
+  std::size_t NumberOfSentences() const { return m_num_sentences; }
+  int getIndex(std::size_t sentence) const { return m_indexes[sentence]; }
+
+  /** hypotheses of a sentence are the rows [begin, end) */
+  std::size_t begin(std::size_t sentence) const { return m_rows[sentence]; }
+  std::size_t end(std::size_t sentence) const { return m_rows[sentence + 1]; }
+
+  std::size_t NumberOfFeatures() const { return m_num_features; }
+  const std::string& Features() const { return m_features; }
+
+  const float* dense(std::size_t row) const {
+    return m_dense + row * m_num_features;
+  }
+
+  std::size_t sparseBegin(std::size_t row) const { return m_sparse_rows[row]; }
+  std::size_t sparseEnd(std::size_t row) const { return m_sparse_rows[row + 1]; }
+  /** id of a sparse feature as used by SparseVector */
+  std::size_t sparseId(std::size_t i) const { return m_sparse_ids[m_sparse_columns[i]]; }
+  float sparseValue(std::size_t i) const { return m_sparse_values[i]; }
+
+  /**
+   * Append the hypotheses of a sentence to array. If sparseWeights is not
+   * empty, the sparse features are merged into one more dense feature, as
+   * when reading text.
+   */
+  void get(std::size_t sentence, FeatureArray& array, const SparseVector& sparseWeights) const;
+
+private:
+  util::scoped_memory m_mapping;
+  std::size_t m_num_sentences;
+  std::size_t m_num_features;
+  const int64_t* m_indexes;
+  const uint64_t* m_rows;
+  const float* m_dense;
+  const uint64_t* m_sparse_rows;
+  const uint32_t* m_sparse_columns;
+  const float* m_sparse_values;
+  std::vector<std::size_t> m_sparse_ids; // SparseVector ids of the columns
+  std::string m_features;
+};
+
+class ScoreColumns
+{
+public:
+  /** whether file starts like a columnar score file */
+  static bool IsColumnar(const std::string& file);
+
+  explicit ScoreColumns(const std::string& file);
+
+  std::size_t NumberOfSentences() const { return m_num_sentences; }
+  int getIndex(std::size_t sentence) const { return m_indexes[sentence]; }
+
+  std::size_t begin(std::size_t sentence) const { return m_rows[sentence]; }
+  std::size_t end(std::size_t sentence) const { return m_rows[sentence + 1]; }
+
+  std::size_t NumberOfScores() const { return m_num_scores; }
+  const std::string& name() const { return m_score_type; }
+
+  const ScoreStatsType* stats(std::size_t row) const {
+    return m_stats + row * m_num_scores;
+  }
+
+  /** append the hypotheses of a sentence to array */
+  void get(std::size_t sentence, ScoreArray& array) const;
+
+private:
+  util::scoped_memory m_mapping;
+  std::size_t m_num_sentences;
+  std::size_t m_num_scores;
+  const int64_t* m_indexes;
+  const uint64_t* m_rows;
+  const ScoreStatsType* m_stats;
+  std::string m_score_type;
+};
+
+/**
+ * Collects feature arrays and writes them as one columnar file. Sentences
+ * are written in the order they were added; empty ones are left out, as in
+ * the text format.
+ */
+class FeatureColumnsWriter
+{
+public:
+  FeatureColumnsWriter();
+
+  void Features(const std::string& f) { m_features = f; }
+
+  void add(const FeatureArray& array);
+
+  void save(const std::string& file) const;
+
+private:
+  std::vector<int64_t> m_indexes;
+  std::vector<uint64_t> m_rows;
+  std::size_t m_num_features;
+  std::vector<float> m_dense;
+  std::vector<uint64_t> m_sparse_rows;
+  std::vector<uint32_t> m_sparse_columns;
+  std::vector<float> m_sparse_values;
+  std::map<std::size_t, uint32_t> m_sparse_columns_by_id;
+  std::vector<std::string> m_sparse_names;
+  std::string m_features;
+};
+
+class ScoreColumnsWriter
+{
+public:
+  explicit ScoreColumnsWriter(const std::string& score_type);
+
+  void add(const ScoreArray& array);
+
+  void save(const std::string& file) const;
+
+private:
+  std::vector<int64_t> m_indexes;
+  std::vector<uint64_t> m_rows;
+  std::size_t m_num_scores;
+  std::vector<ScoreStatsType> m_stats;
+  std::string m_score_type;
+};
+
+}
+
+#endif  // MERT_COLUMNAR_DATA_H_
@@ -0,0 +1,125 @@
+#include "ColumnarData.h"
+#include "FeatureArray.h"
+#include "FeatureDataIterator.h"
+#include "ScoreArray.h"
+#include "ScoreDataIterator.h"
+
+#define BOOST_TEST_MODULE MertColumnarData
+#include <boost/test/unit_test.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace MosesTuning;
+
+namespace {
+
+struct TempFile {
+  TempFile() {
+    char name[] = "/tmp/columnardataXXXXXX";
+    const int fd = mkstemp(name);
+    BOOST_REQUIRE(fd != -1);
+    close(fd);
+    path = name;
+  }
+  ~TempFile() { std::remove(path.c_str()); }
+  std::string path;
+};
+
+FeatureStats MakeFeatures(float first, float second) {
+  FeatureStats stats;
+  stats.add(first);
+  stats.add(second);
+  return stats;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(feature_columns_roundtrip) {
+  FeatureArray first, second;
+  first.setIndex(3);
+  FeatureStats stats = MakeFeatures(1.5, -2);
+  stats.addSparse("pp_a", 0.5);
+  first.add(stats);
+  stats = MakeFeatures(0, 4);
+  first.add(stats);
+  second.setIndex(7);
+  stats = MakeFeatures(-1, 1);
+  stats.addSparse("pp_b", 2);
+  stats.addSparse("pp_a", 3);
+  second.add(stats);
+
+  TempFile file;
+  FeatureColumnsWriter writer;
+  writer.Features("lm_0 w_0");
+  writer.add(first);
+  writer.add(FeatureArray());
+  writer.add(second);
+  writer.save(file.path);
+
+  BOOST_REQUIRE(FeatureColumns::IsColumnar(file.path));
+  BOOST_CHECK(!ScoreColumns::IsColumnar(file.path));
+  const FeatureColumns columns(file.path);
+  BOOST_REQUIRE_EQUAL(columns.NumberOfSentences(), (std::size_t)2);
+  BOOST_CHECK_EQUAL(columns.getIndex(1), 7);
+  BOOST_CHECK_EQUAL(columns.Features(), "lm_0 w_0");
+  BOOST_CHECK_EQUAL(columns.NumberOfFeatures(), (std::size_t)2);
+
+  FeatureArray loaded;
+  columns.get(0, loaded, SparseVector());
+  BOOST_REQUIRE_EQUAL(loaded.size(), (std::size_t)2);
+  BOOST_CHECK(loaded.get(0) == first.get(0));
+  BOOST_CHECK(loaded.get(1) == first.get(1));
+  BOOST_CHECK(loaded.get(0).getSparse() == first.get(0).getSparse());
+
+  // sparse features are merged into one dense feature under sparse weights
+  SparseVector weights;
+  weights.set("pp_a", 2);
+  loaded.clear();
+  columns.get(1, loaded, weights);
+  BOOST_REQUIRE_EQUAL(loaded.get(0).size(), (std::size_t)3);
+  BOOST_CHECK_EQUAL(loaded.get(0).get(2), 6);
+
+  FeatureDataIterator it(file.path);
+  BOOST_REQUIRE(it != FeatureDataIterator::end());
+  BOOST_CHECK_EQUAL(it->size(), (std::size_t)2);
+  ++it;
+  BOOST_REQUIRE(it != FeatureDataIterator::end());
+  BOOST_CHECK_EQUAL((*it)[0].dense[0], -1);
+  BOOST_CHECK_EQUAL((*it)[0].sparse.get("pp_b"), 2);
+  ++it;
+  BOOST_CHECK(it == FeatureDataIterator::end());
+}
+
+BOOST_AUTO_TEST_CASE(score_columns_roundtrip) {
+  ScoreArray array;
+  array.setIndex(0);
+  ScoreStats stats;
+  stats.add(4);
+  stats.add(9);
+  array.add(stats);
+  stats.reset();
+  stats.add(-1);
+  stats.add(2);
+  array.add(stats);
+
+  TempFile file;
+  ScoreColumnsWriter writer("BLEU");
+  writer.add(array);
+  writer.save(file.path);
+
+  BOOST_REQUIRE(ScoreColumns::IsColumnar(file.path));
+  const ScoreColumns columns(file.path);
+  BOOST_CHECK_EQUAL(columns.name(), "BLEU");
+  ScoreArray loaded;
+  columns.get(0, loaded);
+  BOOST_REQUIRE_EQUAL(loaded.size(), (std::size_t)2);
+  BOOST_CHECK(loaded.get(1) == array.get(1));
+
+  ScoreDataIterator it(file.path);
+  BOOST_REQUIRE(it != ScoreDataIterator::end());
+  BOOST_CHECK_EQUAL((*it)[1][0], -1);
+  ++it;
+  BOOST_CHECK(it == ScoreDataIterator::end());
+}
@@ -9,6 +9,7 @@
 #include "FeatureData.h"
 
 #include <limits>
+#include "ColumnarData.h"
 #include "FileStream.h"
 #include "Util.h"
 
@@ -32,6 +33,14 @@ void FeatureData::save(const string &file, bool bin)
 {
   if (file.empty()) return;
   TRACE_ERR("saving the array into " << file << endl);
+  if (bin) {
+    FeatureColumnsWriter writer;
+    writer.Features(m_features);
+    for (featdata_t::const_iterator i = m_array.begin(); i != m_array.end(); ++i)
+      writer.add(*i);
+    writer.save(file);
+    return;
+  }
   ofstream ofs(file.c_str(), ios::out); // matches a stream with a file. Opens the file
   ostream* os = &ofs;
   save(os, bin);
@@ -69,6 +78,21 @@ void FeatureData::load(istream* is, const SparseVector& sparseWeights)
 void FeatureData::load(const string &file, const SparseVector& sparseWeights)
 {
   TRACE_ERR("loading feature data from " << file << endl);
+  if (FeatureColumns::IsColumnar(file)) {
+    const FeatureColumns columns(file);
+    FeatureArray entry;
+    for (size_t s = 0; s < columns.NumberOfSentences(); ++s) {
+      entry.clear();
+      entry.setIndex(columns.getIndex(s));
+      entry.NumberOfFeatures(columns.NumberOfFeatures());
+      entry.Features(columns.Features());
+      columns.get(s, entry, sparseWeights);
+      if (size() == 0)
+        setFeatureMap(entry.Features());
+      add(entry);
+    }
+    return;
+  }
   inputfilestream input_stream(file); // matches a stream with a file. Opens the file
   if (!input_stream) {
     throw runtime_error("Unable to open feature file: " + file);
@@ -85,8 +109,9 @@ void FeatureData::add(FeatureArray& e)
     size_t pos = getIndex(e.getIndex());
     m_array.at(pos).merge(e);
   } else {
+    m_index_to_array_name[m_array.size()] = e.getIndex();
+    m_array_name_to_index[e.getIndex()] = m_array.size();
     m_array.push_back(e);
-    setIndex();
   }
 }
 
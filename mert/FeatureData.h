@@ -69,6 +69,7 @@ public:
   std::string Features() const { return m_features; }
   void Features(const std::string& f) { m_features = f; }
 
+  // bin writes a columnar file (see ColumnarData.h), which load maps
   void save(const std::string &file, bool bin=false);
   void save(std::ostream* os, bool bin=false);
   void save(bool bin=false);
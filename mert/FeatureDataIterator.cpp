@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "util/file_piece.hh"
 #include "util/tokenize_piece.hh"
 
+#include "ColumnarData.h"
 #include "FeatureArray.h"
 #include "FeatureDataIterator.h"
 
@@ -65,10 +66,14 @@ size_t hash_value(FeatureDataItem const& item) {
 }
 
 
-FeatureDataIterator::FeatureDataIterator() {}
+FeatureDataIterator::FeatureDataIterator() : m_sentence(0) {}
 
-FeatureDataIterator::FeatureDataIterator(const string& filename) {
-  m_in.reset(new FilePiece(filename.c_str()));
+FeatureDataIterator::FeatureDataIterator(const string& filename) : m_sentence(0) {
+  if (FeatureColumns::IsColumnar(filename)) {
+    m_columns.reset(new FeatureColumns(filename));
+  } else {
+    m_in.reset(new FilePiece(filename.c_str()));
+  }
   readNext();
 }
 
@@ -76,6 +81,10 @@ FeatureDataIterator::~FeatureDataIterator() {}
 
 void FeatureDataIterator::readNext() {
   m_next.clear();
+  if (m_columns) {
+    readNextColumns();
+    return;
+  }
   try {
     StringPiece marker = m_in->ReadDelimited();
     if (marker != StringPiece(FEATURES_TXT_BEGIN)) {
@@ -117,12 +126,30 @@ void FeatureDataIterator::readNext() {
   }
 }
 
+void FeatureDataIterator::readNextColumns() {
+  if (m_sentence == m_columns->NumberOfSentences()) {
+    m_columns.reset();
+    return;
+  }
+  const size_t length = m_columns->NumberOfFeatures();
+  for (size_t row = m_columns->begin(m_sentence); row < m_columns->end(m_sentence); ++row) {
+    m_next.push_back(FeatureDataItem());
+    m_next.back().dense.assign(m_columns->dense(row), m_columns->dense(row) + length);
+    for (size_t i = m_columns->sparseBegin(row); i < m_columns->sparseEnd(row); ++i) {
+      m_next.back().sparse.set(m_columns->sparseId(i), m_columns->sparseValue(i));
+    }
+  }
+  ++m_sentence;
+}
+
 void FeatureDataIterator::increment() {
   readNext();
 }
 
 bool FeatureDataIterator::equal(const FeatureDataIterator& rhs) const {
-  if (!m_in && !rhs.m_in) {
+  if (m_columns || rhs.m_columns) {
+    return m_columns == rhs.m_columns && m_sentence == rhs.m_sentence;
+  } else if (!m_in && !rhs.m_in) {
     return true;
   } else if (!m_in) {
     return false;
@@ -41,6 +41,8 @@ namespace util { class FilePiece; }
 
 namespace MosesTuning
 {
+
+class FeatureColumns;
   
 
 class FileFormatException : public util::Exception 
@@ -92,8 +94,11 @@ class FeatureDataIterator :
     const std::vector<FeatureDataItem>& dereference() const;
 
     void readNext();
+    void readNextColumns();
 
     boost::shared_ptr<util::FilePiece> m_in;
+    boost::shared_ptr<FeatureColumns> m_columns; // set for columnar files
+    std::size_t m_sentence; // next sentence of m_columns
     std::vector<FeatureDataItem> m_next;
 };
 
@@ -8,6 +8,13 @@
 #include <cfloat>
 #include <iostream>
 #include <stdint.h>
+#include <algorithm>
+
+#ifdef WITH_THREADS
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include "moses/ThreadPool.h"
+#endif
 
 #include "Point.h"
 #include "Util.h"
@@ -31,6 +38,24 @@ inline float intersect(float m1, float b1, float m2, float b2)
   return isect;
 }
 
+struct Intersection {
+  float x;
+  unsigned sentence;
+  unsigned best;  // the 1best of the sentence right of x
+};
+
+struct CompareGradient {
+  bool operator()(const pair<float, unsigned>& a, const pair<float, unsigned>& b) const {
+    return a.first < b.first;
+  }
+};
+
+struct CompareIntersection {
+  bool operator()(const Intersection& a, const Intersection& b) const {
+    return a.x < b.x;
+  }
+};
+
 } // namespace
 
 namespace MosesTuning
@@ -38,7 +63,7 @@ namespace MosesTuning
   
 
 Optimizer::Optimizer(unsigned Pd, const vector<unsigned>& i2O, const vector<bool>& pos, const vector<parameter_t>& start, unsigned int nrandom)
-  : m_scorer(NULL), m_feature_data(), m_num_random_directions(nrandom), m_positive(pos)
+  : m_scorer(NULL), m_feature_data(), m_num_random_directions(nrandom), m_positive(pos), m_pool(NULL)
 {
   // Warning: the init vector is a full set of parameters, of dimension m_pdim!
   Point::m_pdim = Pd;
@@ -70,187 +95,129 @@ statscore_t Optimizer::GetStatScore(const Point& param) const
   return score;
 }
 
-map<float,diff_t >::iterator AddThreshold(map<float,diff_t >& thresholdmap, float newt, const pair<unsigned,unsigned>& newdiff)
-{
-  map<float,diff_t>::iterator it = thresholdmap.find(newt);
-  if (it != thresholdmap.end()) {
-    // the threshold already exists!! this is very unlikely
-    if (it->second.back().first == newdiff.first)
-      // there was already a diff for this sentence, we change the 1 best;
-      it->second.back().second = newdiff.second;
-    else
-      it->second.push_back(newdiff);
-  } else {
-    // normal case
-    pair<map<float,diff_t>::iterator, bool> ins = thresholdmap.insert(threshold(newt, diff_t(1, newdiff)));
-    CHECK(ins.second);                // we really inserted something
-    it = ins.first;
-  }
-  return it;
-}
-
 statscore_t Optimizer::LineOptimize(const Point& origin, const Point& direction, Point& bestpoint) const
 {
   // We are looking for the best Point on the line y=Origin+x*direction
   float min_int = 0.0001;
-  //typedef pair<unsigned,unsigned> diff;//first the sentence that changes, second is the new 1best for this sentence
-  //list<threshold> thresholdlist;
 
-  map<float,diff_t> thresholdmap;
-  thresholdmap[MIN_FLOAT] = diff_t();
+  // The points where the 1best of a sentence changes, sentence by sentence,
+  // and in increasing x within a sentence.
+  vector<Intersection> intersections;
   vector<unsigned> first1best;       // the vector of nbests for x=-inf
+  vector<pair<float, unsigned> > gradient;
+  vector<float> f0;
   for (unsigned int S = 0; S < size(); S++) {
-    map<float,diff_t >::iterator previnserted = thresholdmap.begin();
     // First, we determine the translation with the best feature score
     // for each sentence and each value of x.
-    //cerr << "Sentence " << S << endl;
-    multimap<float, unsigned> gradient;
-    vector<float> f0;
-    f0.resize(m_feature_data->get(S).size());
-    for (unsigned j = 0; j < m_feature_data->get(S).size(); j++) {
+    const unsigned n = m_feature_data->get(S).size();
+    gradient.resize(n);
+    f0.resize(n);
+    for (unsigned j = 0; j < n; j++) {
       // gradient of the feature function for this particular target sentence
-      gradient.insert(pair<float, unsigned>(direction * (m_feature_data->get(S,j)), j));
+      gradient[j] = make_pair(direction * (m_feature_data->get(S,j)), j);
       // compute the feature function at the origin point
       f0[j] = origin * m_feature_data->get(S, j);
     }
-    // Now let's compute the 1best for each value of x.
-
-    //    vector<pair<float,unsigned> > onebest;
-
-
-    multimap<float,unsigned>::iterator gradientit = gradient.begin();
-    multimap<float,unsigned>::iterator highest_f0 = gradient.begin();
+    // stable, so candidates with the same gradient stay in order
+    stable_sort(gradient.begin(), gradient.end(), CompareGradient());
 
-    float smallest = gradientit->first;//smallest gradient
+    // Now let's compute the 1best for each value of x.
     // Several candidates can have the lowest slope (e.g., for word penalty where the gradient is an integer).
-
-    gradientit++;
-    while (gradientit != gradient.end() && gradientit->first == smallest) {
-      //   cerr<<"ni"<<gradientit->second<<endl;;
-      //cerr<<"fos"<<f0[gradientit->second]<<" "<<f0[index]<<" "<<index<<endl;
-      if (f0[gradientit->second] > f0[highest_f0->second])
-        highest_f0 = gradientit;//the highest line is the one with he highest f0
-      gradientit++;
+    unsigned highest_f0 = 0;
+    for (unsigned k = 1; k < n && gradient[k].first == gradient[0].first; k++) {
+      if (f0[gradient[k].second] > f0[gradient[highest_f0].second])
+        highest_f0 = k;//the highest line is the one with he highest f0
     }
-
-    gradientit = highest_f0;
-    first1best.push_back(highest_f0->second);
+    first1best.push_back(gradient[highest_f0].second);
 
     // Now we look for the intersections points indicating a change of 1 best.
     // We use the fact that the function is convex, which means that the gradient can only go up.
-    while (gradientit != gradient.end()) {
-      map<float,unsigned>::iterator leftmost = gradientit;
-      float m = gradientit->first;
-      float b = f0[gradientit->second];
-      multimap<float,unsigned>::iterator gradientit2 = gradientit;
-      gradientit2++;
+    const size_t sentence_begin = intersections.size();
+    unsigned current = highest_f0;
+    while (current < n) {
+      unsigned leftmost = current;
+      float m = gradient[current].first;
+      float b = f0[gradient[current].second];
       float leftmostx = MAX_FLOAT;
-      for (; gradientit2 != gradient.end(); gradientit2++) {
-        //cerr<<"--"<<d++<<' '<<gradientit2->first<<' '<<gradientit2->second<<endl;
+      for (unsigned k = current + 1; k < n; k++) {
         // Look for all candidate with a gradient bigger than the current one, and
         // find the one with the leftmost intersection.
-        float curintersect;
-        if (m != gradientit2->first) {
-          curintersect = intersect(m, b, gradientit2->first, f0[gradientit2->second]);
-          //cerr << "curintersect: " << curintersect << " leftmostx: " << leftmostx << endl;
-          if (curintersect<=leftmostx) {
-            // We have found an intersection to the left of the leftmost we had so far.
+        if (m != gradient[k].first) {
+          float curintersect = intersect(m, b, gradient[k].first, f0[gradient[k].second]);
+          if (curintersect <= leftmostx) {
             // We might have curintersect==leftmostx for example is 2 candidates are the same
-            // in that case its better its better to update leftmost to gradientit2 to avoid some recomputing later.
+            // in that case its better to update leftmost to avoid some recomputing later.
             leftmostx = curintersect;
-            leftmost = gradientit2; // this is the new reference
+            leftmost = k; // this is the new reference
           }
         }
       }
-      if (leftmost == gradientit) {
+      if (leftmost == current) {
         // We didn't find any more intersections.
         // The rightmost bestindex is the one with the highest slope.
 
         // They should be equal but there might be.
-        CHECK(abs(leftmost->first-gradient.rbegin()->first) < 0.0001);
+        CHECK(abs(gradient[leftmost].first-gradient[n-1].first) < 0.0001);
         // A small difference due to rounding error
         break;
       }
       // We have found the next intersection!
 
-      pair<unsigned,unsigned> newd(S, leftmost->second);//new onebest for Sentence S is leftmost->second
-
-      if (leftmostx-previnserted->first < min_int) {
+      if (intersections.size() > sentence_begin && leftmostx-intersections.back().x < min_int) {
         // Require that the intersection Point be at least min_int to the right of the previous
         // one (for this sentence). If not, we replace the previous intersection Point with
         // this one.
         // Yes, it can even happen that the new intersection Point is slightly to the left of
-        // the old one, because of numerical imprecision. We do not check that we are to the
-        // right of the penultimate point also. It this happen the 1best the interval will
-        // be wrong we are going to replace previnsert by the new one because we do not want to keep
+        // the old one, because of numerical imprecision. We do not keep
         // 2 very close threshold: if the minima is there it could be an artifact.
-
-        map<float,diff_t>::iterator tit = thresholdmap.find(leftmostx);
-        if (tit == previnserted) {
-          // The threshold is the same as before can happen if 2 candidates are the same for example.
-          CHECK(previnserted->second.back().first == newd.first);
-          previnserted->second.back()=newd; // just replace the 1 best for sentence S
-          // previnsert doesn't change
-        } else {
-
-          if (tit == thresholdmap.end()) {
-            thresholdmap[leftmostx]=previnserted->second; // We keep the diffs at previnsert
-            thresholdmap.erase(previnserted); // erase old previnsert
-            previnserted = thresholdmap.find(leftmostx); // point previnsert to the new threshold
-            previnserted->second.back()=newd; // We update the diff for sentence S
-          // Threshold already exists but is not the previous one.
-          } else {
-            // We append the diffs in previnsert to tit before destroying previnsert.
-            tit->second.insert(tit->second.end(),previnserted->second.begin(),previnserted->second.end());
-            CHECK(tit->second.back().first == newd.first);
-            tit->second.back()=newd;    // change diff for sentence S
-            thresholdmap.erase(previnserted); // erase old previnsert
-            previnserted = tit;  // point previnsert to the new threshold
-          }
-        }
-
-        CHECK(previnserted != thresholdmap.end());
+        intersections.back().x = leftmostx;
+        intersections.back().best = gradient[leftmost].second;
       } else { //normal insertion process
-        previnserted = AddThreshold(thresholdmap, leftmostx, newd);
+        Intersection intersection = {leftmostx, S, gradient[leftmost].second};
+        intersections.push_back(intersection);
       }
-      gradientit = leftmost;
-    } // while (gradientit!=gradient.end()){
+      current = leftmost;
+    }
   }   // loop on S
 
-  // Now the thresholdlist is up to date: it contains a list of all the parameter_ts where
-  // the function changed its value, along with the nbest list for the interval after each threshold.
+  // Now sort the intersections into a list of all the parameter_ts where the
+  // function changed its value, along with the nbest changes at each threshold.
+  // Stable, so the changes at one threshold stay in sentence order.
+  stable_sort(intersections.begin(), intersections.end(), CompareIntersection());
+  vector<float> thresholds(1, MIN_FLOAT);  // first diff corrrespond to MIN_FLOAT and first1best
+  diffs_t diffs;
+  for (size_t i = 0; i < intersections.size(); i++) {
+    if (i == 0 || intersections[i].x != intersections[i-1].x) {
+      thresholds.push_back(intersections[i].x);
+      diffs.push_back(diff_t());
+    }
+    diffs.back().push_back(make_pair(intersections[i].sentence, intersections[i].best));
+  }
 
-  map<float,diff_t >::iterator thrit;
   if (verboselevel() > 6) {
-    cerr << "Thresholds:(" << thresholdmap.size() << ")" << endl;
-    for (thrit = thresholdmap.begin(); thrit != thresholdmap.end(); thrit++) {
-      cerr << "x: " << thrit->first << " diffs";
-      for (size_t j = 0; j < thrit->second.size(); ++j) {
-        cerr << " " <<thrit->second[j].first << "," << thrit->second[j].second;
+    cerr << "Thresholds:(" << thresholds.size() << ")" << endl;
+    for (size_t t = 0; t < thresholds.size(); t++) {
+      cerr << "x: " << thresholds[t] << " diffs";
+      if (t > 0) {
+        for (size_t j = 0; j < diffs[t-1].size(); ++j) {
+          cerr << " " << diffs[t-1][j].first << "," << diffs[t-1][j].second;
+        }
       }
       cerr << endl;
     }
   }
 
   // Last thing to do is compute the Stat score (i.e., BLEU) and find the minimum.
-  thrit = thresholdmap.begin();
-  ++thrit;       // first diff corrrespond to MIN_FLOAT and first1best
-  diffs_t diffs;
-  for (; thrit != thresholdmap.end(); thrit++)
-    diffs.push_back(thrit->second);
   vector<statscore_t> scores = GetIncStatScore(first1best, diffs);
 
-  thrit = thresholdmap.begin();
   statscore_t bestscore = MIN_FLOAT;
   float bestx = MIN_FLOAT;
 
-  // We skipped the first el of thresholdlist but GetIncStatScore return 1 more for first1best.
-  CHECK(scores.size() == thresholdmap.size());
+  // GetIncStatScore return 1 more score for first1best.
+  CHECK(scores.size() == thresholds.size());
   for (unsigned int sc = 0; sc != scores.size(); sc++) {
-    //cerr << "x=" << thrit->first << " => " << scores[sc] << endl;
-
     //enforce positivity
-    Point respoint = origin + direction * thrit->first;
+    Point respoint = origin + direction * thresholds[sc];
     bool is_valid = true;
     for (unsigned int k=0; k < respoint.getdim(); k++) {
       if (m_positive[k] && respoint[k] <= 0.0)
@@ -258,9 +225,9 @@ statscore_t Optimizer::LineOptimize(const Point& origin, const Point& direction,
     }
 
     if (is_valid && scores[sc] > bestscore) {
-      // This is the score for the interval [lit2->first, (lit2+1)->first]
+      // This is the score for the interval [thresholds[sc], thresholds[sc+1]]
       // unless we're at the last score, when it's the score
-      // for the interval [lit2->first,+inf].
+      // for the interval [thresholds[sc],+inf].
       bestscore = scores[sc];
 
       // If we're not in [-inf,x1] or [xn,+inf], then just take the value
@@ -268,17 +235,8 @@ statscore_t Optimizer::LineOptimize(const Point& origin, const Point& direction,
       // take x to be the last interval boundary + 0.1, and for the leftmost
       // interval, take x to be the first interval boundary - 1000.
       // These values are taken from cmert.
-      float leftx = thrit->first;
-      if (thrit == thresholdmap.begin()) {
-        leftx = MIN_FLOAT;
-      }
-      ++thrit;
-      float rightx = MAX_FLOAT;
-      if (thrit != thresholdmap.end()) {
-        rightx = thrit->first;
-      }
-      --thrit;
-      //cerr << "leftx: " << leftx << " rightx: " << rightx << endl;
+      float leftx = (sc == 0) ? MIN_FLOAT : thresholds[sc];
+      float rightx = (sc + 1 < thresholds.size()) ? thresholds[sc+1] : MAX_FLOAT;
       if (leftx == MIN_FLOAT) {
         bestx = rightx-1000;
       } else if (rightx == MAX_FLOAT) {
@@ -286,9 +244,7 @@ statscore_t Optimizer::LineOptimize(const Point& origin, const Point& direction,
       } else {
         bestx = 0.5 * (rightx + leftx);
       }
-      //cerr << "x = " << "set new bestx to: " << bestx << endl;
     }
-    ++thrit;
   }
 
   if (abs(bestx) < 0.00015) {
@@ -301,14 +257,94 @@ statscore_t Optimizer::LineOptimize(const Point& origin, const Point& direction,
     if (verboselevel() > 4)
       cerr << "best point on line at origin" << endl;
   }
-  if (verboselevel() > 3) {
-//    cerr<<"end Lineopt, bestx="<<bestx<<endl;
-  }
   bestpoint = direction * bestx + origin;
   bestpoint.SetScore(bestscore);
   return bestscore;
 }
 
+#ifdef WITH_THREADS
+/**
+ * Line searches along several directions from one origin. Each search is
+ * claimed by whoever gets to it first, a pool thread or the thread waiting
+ * for the batch. So the wait cannot deadlock when that thread is itself a
+ * pool thread (mert runs each optimisation as a pool task), and searches a
+ * pool thread picks up after the batch is done are skipped.
+ */
+class LineSearchBatch
+{
+public:
+  LineSearchBatch(const Optimizer& optimizer, const Point& origin, const vector<Point>& directions)
+    : m_optimizer(optimizer), m_origin(origin), m_directions(directions),
+      m_bests(directions.size()), m_scores(directions.size()),
+      m_claimed(directions.size(), false), m_remaining(directions.size()) {}
+
+  void Run(size_t d) {
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      if (m_claimed[d]) return;
+      m_claimed[d] = true;
+    }
+    m_scores[d] = m_optimizer.LineOptimize(m_origin, m_directions[d], m_bests[d]);
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (--m_remaining == 0) m_finished.notify_all();
+  }
+
+  void Wait() {
+    for (size_t d = 0; d < m_directions.size(); ++d) Run(d);
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (m_remaining > 0) m_finished.wait(lock);
+  }
+
+  const vector<Point>& GetBests() const { return m_bests; }
+  const vector<statscore_t>& GetScores() const { return m_scores; }
+
+private:
+  const Optimizer& m_optimizer;
+  const Point m_origin;
+  const vector<Point> m_directions;
+  vector<Point> m_bests;
+  vector<statscore_t> m_scores;
+  boost::mutex m_mutex;
+  boost::condition_variable m_finished;
+  vector<bool> m_claimed;
+  size_t m_remaining;
+};
+
+class LineSearchTask : public Moses::Task
+{
+public:
+  LineSearchTask(const boost::shared_ptr<LineSearchBatch>& batch, size_t direction)
+    : m_batch(batch), m_direction(direction) {}
+  virtual void Run() {
+    m_batch->Run(m_direction);
+  }
+private:
+  boost::shared_ptr<LineSearchBatch> m_batch;
+  size_t m_direction;
+};
+#endif
+
+void Optimizer::LineOptimize(const Point& origin, const vector<Point>& directions,
+                             vector<Point>& bests, vector<statscore_t>& scores) const
+{
+#ifdef WITH_THREADS
+  if (m_pool) {
+    boost::shared_ptr<LineSearchBatch> batch(new LineSearchBatch(*this, origin, directions));
+    // the first direction is left to this thread, which would otherwise only wait
+    for (size_t d = 1; d < directions.size(); ++d)
+      m_pool->Submit(new LineSearchTask(batch, d));
+    batch->Wait();
+    bests = batch->GetBests();
+    scores = batch->GetScores();
+    return;
+  }
+#endif
+  bests.resize(directions.size());
+  scores.resize(directions.size());
+  for (size_t d = 0; d < directions.size(); ++d)
+    scores[d] = LineOptimize(origin, directions[d], bests[d]);
+}
+
 void Optimizer::Get1bests(const Point& P, vector<unsigned>& bests) const
 {
   CHECK(m_feature_data);
@@ -393,30 +429,36 @@ statscore_t SimpleOptimizer::TrueRun(Point& P) const
       cerr << "last diff=" << bestscore-prevscore << " nrun " << nrun << endl;
     prevscore = bestscore;
 
-    Point  linebest;
-
-    for (unsigned int d = 0; d < Point::getdim() + m_num_random_directions; d++) {
-      if (verboselevel() > 4) {
-        //	cerr<<"minimizing along direction "<<d<<endl;
-        cerr << "starting point: " << P << " => " << prevscore << endl;
-      }
-      Point direction;
+    // the directions are drawn here, in order, so the run does not depend on
+    // the order the searches finish in
+    vector<Point> directions(Point::getdim() + m_num_random_directions);
+    for (unsigned int d = 0; d < directions.size(); d++) {
       if (d < Point::getdim()) { // regular updates along one dimension
         for (unsigned int i = 0; i < Point::getdim(); i++)
-          direction[i]=0.0;
-        direction[d]=1.0;
+          directions[d][i]=0.0;
+        directions[d][d]=1.0;
       }
       else { // random direction update
-        direction.Randomize();
+        directions[d].Randomize();
       }
-      statscore_t curscore = LineOptimize(P, direction, linebest);//find the minimum on the line
+    }
+    if (verboselevel() > 4) {
+      cerr << "starting point: " << P << " => " << prevscore << endl;
+    }
+
+    vector<Point> linebests;
+    vector<statscore_t> linescores;
+    LineOptimize(P, directions, linebests, linescores);//find the minimum on each line
+
+    for (unsigned int d = 0; d < directions.size(); d++) {
+      statscore_t curscore = linescores[d];
       if (verboselevel() > 5) {
         cerr << "direction: " << d << " => " << curscore << endl;
-        cerr << "\tending point: "<< linebest << " => " << curscore << endl;
+        cerr << "\tending point: "<< linebests[d] << " => " << curscore << endl;
       }
       if (curscore > bestscore) {
         bestscore = curscore;
-        best = linebest;
+        best = linebests[d];
         if (verboselevel() > 3) {
           cerr << "new best dir:" << d << " (" << nrun << ")" << endl;
           cerr << "new best Point " << best << " => "  << curscore << endl;
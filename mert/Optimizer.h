@@ -10,6 +10,11 @@
 
 static const float kMaxFloat = std::numeric_limits<float>::max();
 
+namespace Moses
+{
+class ThreadPool;
+}
+
 namespace MosesTuning
 {
   
@@ -27,12 +32,21 @@ protected:
   unsigned int m_num_random_directions;
 
   const std::vector<bool>& m_positive;
+  Moses::ThreadPool *m_pool;  // runs line searches concurrently, if set
+
+  /**
+   * Line searches from origin along each of the directions, concurrently on
+   * the thread pool if there is one.
+   */
+  void LineOptimize(const Point& origin, const std::vector<Point>& directions,
+                    std::vector<Point>& bests, std::vector<statscore_t>& scores) const;
 
 public:
   Optimizer(unsigned Pd, const std::vector<unsigned>& i2O, const std::vector<bool>& positive, const std::vector<parameter_t>& start, unsigned int nrandom);
 
   void SetScorer(Scorer *scorer) { m_scorer = scorer; }
   void SetFeatureData(FeatureDataHandle feature_data) { m_feature_data = feature_data; }
+  void SetThreadPool(Moses::ThreadPool *pool) { m_pool = pool; }
   virtual ~Optimizer();
 
   unsigned size() const {
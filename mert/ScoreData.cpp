@@ -10,6 +10,7 @@
 
 #include <iostream>
 #include <fstream>
+#include "ColumnarData.h"
 #include "Scorer.h"
 #include "Util.h"
 #include "FileStream.h"
@@ -42,6 +43,13 @@ void ScoreData::save(const string &file, bool bin)
 {
   if (file.empty()) return;
   TRACE_ERR("saving the array into " << file << endl);
+  if (bin) {
+    ScoreColumnsWriter writer(m_score_type);
+    for (scoredata_t::const_iterator i = m_array.begin(); i != m_array.end(); ++i)
+      writer.add(*i);
+    writer.save(file);
+    return;
+  }
 
   // matches a stream with a file. Opens the file.
   ofstream ofs(file.c_str(), ios::out);
@@ -74,6 +82,20 @@ void ScoreData::load(istream* is)
 void ScoreData::load(const string &file)
 {
   TRACE_ERR("loading score data from " << file << endl);
+  if (ScoreColumns::IsColumnar(file)) {
+    const ScoreColumns columns(file);
+    string score_type = columns.name();
+    ScoreArray entry;
+    for (size_t s = 0; s < columns.NumberOfSentences(); ++s) {
+      entry.clear();
+      entry.setIndex(columns.getIndex(s));
+      entry.NumberOfScores(columns.NumberOfScores());
+      entry.name(score_type);
+      columns.get(s, entry);
+      add(entry);
+    }
+    return;
+  }
   inputfilestream input_stream(file); // matches a stream with a file. Opens the file
   if (!input_stream) {
     throw runtime_error("Unable to open score file: " + file);
@@ -90,8 +112,9 @@ void ScoreData::add(ScoreArray& e)
     size_t pos = getIndex(e.getIndex());
     m_array.at(pos).merge(e);
   } else {
+    m_index_to_array_name[m_array.size()] = e.getIndex();
+    m_array_name_to_index[e.getIndex()] = m_array.size();
     m_array.push_back(e);
-    setIndex();
   }
 }
 
@@ -78,6 +78,7 @@ public:
   std::size_t NumberOfScores() const { return m_num_scores; }
   std::size_t size() const { return m_array.size(); }
 
+  // bin writes a columnar file (see ColumnarData.h), which load maps
   void save(const std::string &file, bool bin=false);
   void save(std::ostream* os, bool bin=false);
   void save(bool bin=false);
@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "util/file_piece.hh"
 #include "util/tokenize_piece.hh"
 
+#include "ColumnarData.h"
 #include "ScoreArray.h"
 #include "ScoreDataIterator.h"
 
@@ -31,10 +32,14 @@ namespace MosesTuning
 {
   
 
-ScoreDataIterator::ScoreDataIterator() {}
+ScoreDataIterator::ScoreDataIterator() : m_sentence(0) {}
 
-ScoreDataIterator::ScoreDataIterator(const string& filename) {
-  m_in.reset(new FilePiece(filename.c_str()));
+ScoreDataIterator::ScoreDataIterator(const string& filename) : m_sentence(0) {
+  if (ScoreColumns::IsColumnar(filename)) {
+    m_columns.reset(new ScoreColumns(filename));
+  } else {
+    m_in.reset(new FilePiece(filename.c_str()));
+  }
   readNext();
 }
 
@@ -42,6 +47,10 @@ ScoreDataIterator::~ScoreDataIterator() {}
 
 void ScoreDataIterator::readNext() {
   m_next.clear();
+  if (m_columns) {
+    readNextColumns();
+    return;
+  }
   try {
     StringPiece marker = m_in->ReadDelimited();
     if (marker != StringPiece(SCORES_TXT_BEGIN)) {
@@ -71,13 +80,27 @@ void ScoreDataIterator::readNext() {
   }
 }
 
+void ScoreDataIterator::readNextColumns() {
+  if (m_sentence == m_columns->NumberOfSentences()) {
+    m_columns.reset();
+    return;
+  }
+  const size_t length = m_columns->NumberOfScores();
+  for (size_t row = m_columns->begin(m_sentence); row < m_columns->end(m_sentence); ++row) {
+    m_next.push_back(ScoreDataItem(m_columns->stats(row), m_columns->stats(row) + length));
+  }
+  ++m_sentence;
+}
+
 void ScoreDataIterator::increment() {
   readNext();
 }
 
 
 bool ScoreDataIterator::equal(const ScoreDataIterator& rhs) const {
-  if (!m_in && !rhs.m_in) {
+  if (m_columns || rhs.m_columns) {
+    return m_columns == rhs.m_columns && m_sentence == rhs.m_sentence;
+  } else if (!m_in && !rhs.m_in) {
     return true;
   } else if (!m_in) {
     return false;
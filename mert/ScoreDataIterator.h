@@ -37,6 +37,8 @@ namespace util { class FilePiece; }
 
 namespace MosesTuning
 {
+
+class ScoreColumns;
   
 
 typedef std::vector<float> ScoreDataItem;
@@ -64,8 +66,11 @@ class ScoreDataIterator :
     const std::vector<ScoreDataItem>& dereference() const;
 
     void readNext();
+    void readNextColumns();
 
     boost::shared_ptr<util::FilePiece> m_in;
+    boost::shared_ptr<ScoreColumns> m_columns; // set for columnar files
+    std::size_t m_sentence; // next sentence of m_columns
     std::vector<ScoreDataItem> m_next;
 };
 
@@ -0,0 +1,83 @@
+/**
+ * Convert feature or score data files from the text format written by
+ * extractor into the columnar format that mert, pro and kbmira map.
+ **/
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "ColumnarData.h"
+#include "FeatureArray.h"
+#include "FileStream.h"
+#include "ScoreArray.h"
+
+using namespace std;
+using namespace MosesTuning;
+
+namespace {
+
+void usage()
+{
+  cerr << "usage: binarize-data (features|scores) input output" << endl;
+  cerr << "The input may be gzipped; it is read one sentence at a time." << endl;
+  exit(1);
+}
+
+void BinarizeFeatures(istream* is, const string& output)
+{
+  FeatureColumnsWriter writer;
+  const SparseVector noSparseWeights;
+  FeatureArray entry;
+  bool first = true;
+  while (is->good()) {
+    entry.clear();
+    entry.load(is, noSparseWeights);
+    if (entry.size() == 0) break;
+    if (first) writer.Features(entry.Features());
+    first = false;
+    writer.add(entry);
+  }
+  writer.save(output);
+}
+
+void BinarizeScores(istream* is, const string& output)
+{
+  ScoreArray entry;
+  entry.load(is);
+  ScoreColumnsWriter writer(entry.name());
+  while (entry.size() > 0) {
+    writer.add(entry);
+    if (!is->good()) break;
+    entry.clear();
+    entry.load(is);
+  }
+  writer.save(output);
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+  if (argc != 4) usage();
+  const string type(argv[1]);
+  if (type != "features" && type != "scores") usage();
+
+  try {
+    inputfilestream input(argv[2]);
+    if (!input) {
+      throw runtime_error(string("Unable to open ") + argv[2]);
+    }
+    if (type == "features") {
+      BinarizeFeatures(&input, argv[3]);
+    } else {
+      BinarizeScores(&input, argv[3]);
+    }
+    input.close();
+    return EXIT_SUCCESS;
+  } catch (const exception& e) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+}
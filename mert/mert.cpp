@@ -49,14 +49,32 @@ const char kOutputFile[] = "weights.txt";
 class OptimizationTask : public Moses::Task {
  public:
   OptimizationTask(Optimizer* optimizer, const Point& point)
-      : m_optimizer(optimizer), m_point(point) {}
+      : m_optimizer(optimizer), m_point(point)
+#ifdef WITH_THREADS
+      , m_done(false)
+#endif
+  {}
 
   ~OptimizationTask() {}
 
   virtual void Run() {
     m_score = m_optimizer->Run(m_point);
+#ifdef WITH_THREADS
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_done = true;
+    m_finished.notify_all();
+#endif
   }
 
+#ifdef WITH_THREADS
+  // The optimisation submits its line searches to the pool, so the pool
+  // must not be stopped before it is done.
+  void Wait() {
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (!m_done) m_finished.wait(lock);
+  }
+#endif
+
   virtual bool DeleteAfterExecution() {
     return false;
   }
@@ -83,6 +101,11 @@ class OptimizationTask : public Moses::Task {
   Optimizer* m_optimizer;
   Point m_point;
   statscore_t m_score;
+#ifdef WITH_THREADS
+  boost::mutex m_mutex;
+  boost::condition_variable m_finished;
+  bool m_done;
+#endif
 };
 
 bool WriteFinalWeights(const char* filename, const Point& point) {
@@ -466,6 +489,9 @@ int main(int argc, char **argv)
     Optimizer *optimizer = OptimizerFactory::BuildOptimizer(option.pdim, to_optimize, positive, start_list[0], option.optimize_type, option.nrandom);
     optimizer->SetScorer(data_ref.getScorer());
     optimizer->SetFeatureData(data_ref.getFeatureData());
+#ifdef WITH_THREADS
+    optimizer->SetThreadPool(&pool);
+#endif
     // A task for each start point
     for (size_t j = 0; j < startingPoints.size(); ++j) {
       OptimizationTask* task = new OptimizationTask(optimizer, startingPoints[j]);
@@ -480,6 +506,11 @@ int main(int argc, char **argv)
 
   // wait for all threads to finish
 #ifdef WITH_THREADS
+  for (size_t i = 0; i < allTasks.size(); ++i) {
+    for (size_t j = 0; j < allTasks[i].size(); ++j) {
+      allTasks[i][j]->Wait();
+    }
+  }
   pool.Stop(true);
 #endif
 
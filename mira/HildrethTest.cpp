@@ -25,7 +25,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "Hildreth.h"
 #include "Optimiser.h"
-#include "ScoreComponentCollection.h"
+#include "moses/ScoreComponentCollection.h"
 
 using namespace std;
 using namespace Moses;
@@ -34,21 +34,29 @@ using namespace Mira;
 namespace MosesTest
 {
 
-class MockSingleFeature : public StatelessFeatureFunction {
+class MockStatelessFeatureFunction : public StatelessFeatureFunction {
   public:
-    MockSingleFeature(): StatelessFeatureFunction("MockSingle",1) {}
+    MockStatelessFeatureFunction(const string& desc, size_t n) :
+      StatelessFeatureFunction(desc,n) {}
+    virtual void Evaluate(const PhraseBasedFeatureContext&, ScoreComponentCollection*) const {}
+    virtual void EvaluateChart(const ChartBasedFeatureContext&, ScoreComponentCollection*) const {}
+};
+
+class MockSingleFeature : public MockStatelessFeatureFunction {
+  public:
+    MockSingleFeature(): MockStatelessFeatureFunction("MockSingle",1) {}
     std::string GetScoreProducerWeightShortName(unsigned) const {return "sf";}
 };
 
-class MockMultiFeature : public StatelessFeatureFunction {
+class MockMultiFeature : public MockStatelessFeatureFunction {
   public:
-    MockMultiFeature(): StatelessFeatureFunction("MockMulti",5) {}
+    MockMultiFeature(): MockStatelessFeatureFunction("MockMulti",5) {}
     std::string GetScoreProducerWeightShortName(unsigned) const {return "mf";}
 };
 
-class MockSparseFeature : public StatelessFeatureFunction {
+class MockSparseFeature : public MockStatelessFeatureFunction {
   public:
-    MockSparseFeature(): StatelessFeatureFunction("MockSparse", ScoreProducer::unlimited) {}
+    MockSparseFeature(): MockStatelessFeatureFunction("MockSparse", ScoreProducer::unlimited) {}
     std::string GetScoreProducerWeightShortName(unsigned) const {return "sf";}
 };
 
@@ -778,6 +786,41 @@ BOOST_FIXTURE_TEST_CASE(test_hildreth_5, MockProducers)
 	cerr << "sum of new error: " << sumOfNewError << endl;
 }
 
+BOOST_FIXTURE_TEST_CASE(test_hildreth_bounded, MockProducers)
+{
+	// Three orthogonal constraints: the first wants alpha 2, the second is
+	// already satisfied and the third, which is violated most, wants alpha 0.2
+	float arr1[] = { 1, 0, 0, 0, 0 };
+	float arr2[] = { 0, 1, 0, 0, 0 };
+	float arr3[] = { 0, 0, 4, 0, 0 };
+	vector< ScoreComponentCollection> featureValueDiffs(3);
+	featureValueDiffs[0].PlusEquals(&multi, vector<float>(arr1,arr1+5));
+	featureValueDiffs[1].PlusEquals(&multi, vector<float>(arr2,arr2+5));
+	featureValueDiffs[2].PlusEquals(&multi, vector<float>(arr3,arr3+5));
+	vector< float> lossMinusModelScoreDiff;
+	lossMinusModelScoreDiff.push_back(2);
+	lossMinusModelScoreDiff.push_back(-1);
+	lossMinusModelScoreDiff.push_back(3.2);
+
+	vector< float> alphas = Hildreth::optimise(featureValueDiffs, lossMinusModelScoreDiff);
+	BOOST_CHECK_CLOSE(alphas[0], 2, 0.001);
+	BOOST_CHECK_EQUAL(alphas[1], 0);
+	BOOST_CHECK_CLOSE(alphas[2], 0.2, 0.001);
+
+	// the first alpha is clamped to the slack
+	alphas = Hildreth::optimise(featureValueDiffs, lossMinusModelScoreDiff, 0.5);
+	BOOST_CHECK_CLOSE(alphas[0], 0.5, 0.001);
+	BOOST_CHECK_EQUAL(alphas[1], 0);
+	BOOST_CHECK_CLOSE(alphas[2], 0.2, 0.001);
+
+	// alphas are clamped to zero after the slack, so a negative slack
+	// leaves every constraint inactive instead of returning an alpha of -1
+	alphas = Hildreth::optimise(featureValueDiffs, lossMinusModelScoreDiff, -1);
+	for (size_t i = 0; i < alphas.size(); ++i) {
+		BOOST_CHECK_EQUAL(alphas[i], 0);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 }
@@ -11,6 +11,13 @@
 #include "moses/StaticData.h"
 #include <algorithm>
 #include <set>
+#include <sstream>
+#include <boost/unordered_map.hpp>
+#ifdef WITH_THREADS
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#endif
 
 using namespace std;
 using namespace Moses;
@@ -18,7 +25,7 @@ using namespace Moses;
 namespace MosesCmd
 {
 
-size_t bleu_order = 4;
+const size_t bleu_order = 4; // at most the four words of an NgramKey
 float UNKNGRAMLOGPROB = -20;
 void GetOutputWords(const TrellisPath &path, vector <Word> &translation)
 {
@@ -36,45 +43,88 @@ void GetOutputWords(const TrellisPath &path, vector <Word> &translation)
 }
 
 
-void extract_ngrams(const vector<Word >& sentence, map < Phrase, int >  & allngrams)
+void extract_ngrams(const vector<Word >& sentence, const NgramIds& ids, NgramCounts& allngrams)
 {
-  for (int k = 0; k < (int)bleu_order; k++) {
-    for(int i =0; i < max((int)sentence.size()-k,0); i++) {
-      Phrase ngram( k+1);
-      for ( int j = i; j<= i+k; j++) {
-        ngram.AddWord(sentence[j]);
-      }
-      ++allngrams[ngram];
+  vector<unsigned> words(sentence.size());
+  for (size_t i = 0; i < sentence.size(); ++i) {
+    words[i] = ids.Find(sentence[i]);
+  }
+  vector<NgramKey> ngrams;
+  for (size_t i = 0; i < words.size(); ++i) {
+    NgramKey ngram(0, 0);
+    for (size_t k = 0; k < bleu_order && i + k < words.size(); ++k) {
+      ngram = AppendNgramWord(ngram, k, words[i+k]);
+      ngrams.push_back(ngram);
+    }
+  }
+  sort(ngrams.begin(), ngrams.end());
+  for (vector<NgramKey>::const_iterator ngram = ngrams.begin(); ngram != ngrams.end(); ++ngram) {
+    if (!allngrams.empty() && allngrams.back().first == *ngram) {
+      ++allngrams.back().second;
+    } else {
+      allngrams.push_back(make_pair(*ngram, 1));
     }
   }
 }
 
 
-
-void NgramScores::addScore(const Hypothesis* node, const Phrase& ngram, float score)
+unsigned NgramIds::Add(const Word& word)
 {
-  set<Phrase>::const_iterator ngramIter = m_ngrams.find(ngram);
-  if (ngramIter == m_ngrams.end()) {
-    ngramIter = m_ngrams.insert(ngram).first;
-  }
-  map<const Phrase*,float>& ngramScores = m_scores[node];
-  map<const Phrase*,float>::iterator scoreIter = ngramScores.find(&(*ngramIter));
-  if (scoreIter == ngramScores.end()) {
-    ngramScores[&(*ngramIter)] = score;
-  } else {
-    ngramScores[&(*ngramIter)] = log_sum(score,scoreIter->second);
+  map<Word, unsigned>::iterator it = m_ids.lower_bound(word);
+  if (it != m_ids.end() && !(word < it->first)) {
+    return it->second;
   }
+  it = m_ids.insert(it, make_pair(word, (unsigned)m_words.size() + 1));
+  m_words.push_back(&it->first);
+  return it->second;
 }
 
-NgramScores::NodeScoreIterator NgramScores::nodeBegin(const Hypothesis* node)
+unsigned NgramIds::Find(const Word& word) const
 {
-  return m_scores[node].begin();
+  map<Word, unsigned>::const_iterator it = m_ids.find(word);
+  return it == m_ids.end() ? UNKNOWN : it->second;
 }
 
+string NgramIds::ToString(const NgramKey& ngram) const
+{
+  ostringstream out;
+  for (size_t i = 0; i < GetNgramOrder(ngram); ++i) {
+    const unsigned id = GetNgramWord(ngram, i);
+    if (id != UNKNOWN) {
+      out << GetWord(id);
+    }
+  }
+  return out.str();
+}
+
+struct NgramScoreLess {
+  bool operator()(const NgramScore& a, const NgramScore& b) const {
+    return a.first < b.first;
+  }
+};
 
-NgramScores::NodeScoreIterator NgramScores::nodeEnd(const Hypothesis* node)
+bool FindNgramScore(const NgramScores& scores, const NgramKey& ngram, float& score)
 {
-  return m_scores[node].end();
+  NgramScores::const_iterator it = lower_bound(scores.begin(), scores.end(), NgramScore(ngram, 0.0f), NgramScoreLess());
+  if (it == scores.end() || it->first != ngram) {
+    return false;
+  }
+  score = it->second;
+  return true;
+}
+
+/** logsum the scores of each ngram, in the order they were added */
+void SumNgramScores(NgramScores& scores, NgramScores& sums)
+{
+  stable_sort(scores.begin(), scores.end(), NgramScoreLess());
+  sums.clear();
+  for (NgramScores::const_iterator it = scores.begin(); it != scores.end(); ++it) {
+    if (!sums.empty() && sums.back().first == it->first) {
+      sums.back().second = log_sum(it->second, sums.back().second);
+    } else {
+      sums.push_back(*it);
+    }
+  }
 }
 
 LatticeMBRSolution::LatticeMBRSolution(const TrellisPath& path, bool isMap) :
@@ -98,24 +148,21 @@ LatticeMBRSolution::LatticeMBRSolution(const TrellisPath& path, bool isMap) :
 }
 
 
-void LatticeMBRSolution::CalcScore(map<Phrase, float>& finalNgramScores, const vector<float>& thetas, float mapWeight)
+void LatticeMBRSolution::CalcScore(const NgramIds& ids, const NgramScores& finalNgramScores, const vector<float>& thetas, float mapWeight)
 {
   m_ngramScores.assign(thetas.size()-1, -10000);
 
-  map < Phrase, int > counts;
-  extract_ngrams(m_words,counts);
+  NgramCounts counts;
+  extract_ngrams(m_words,ids,counts);
 
   //Now score this translation
   m_score = thetas[0] * m_words.size();
 
   //Calculate the ngramScores, working in log space at first
-  for (map < Phrase, int >::iterator ngrams = counts.begin(); ngrams != counts.end(); ++ngrams) {
+  for (NgramCounts::const_iterator ngrams = counts.begin(); ngrams != counts.end(); ++ngrams) {
     float ngramPosterior = UNKNGRAMLOGPROB;
-    map<Phrase,float>::const_iterator ngramPosteriorIt = finalNgramScores.find(ngrams->first);
-    if (ngramPosteriorIt != finalNgramScores.end()) {
-      ngramPosterior = ngramPosteriorIt->second;
-    }
-    size_t ngramSize = ngrams->first.GetSize();
+    FindNgramScore(finalNgramScores, ngrams->first, ngramPosterior);
+    size_t ngramSize = GetNgramOrder(ngrams->first);
     m_ngramScores[ngramSize-1] = log_sum(log((float)ngrams->second) + ngramPosterior,m_ngramScores[ngramSize-1]);
   }
 
@@ -276,204 +323,273 @@ void pruneLatticeFB(Lattice & connectedHyp, map < const Hypothesis*, set <const
 
 }
 
-void calcNgramExpectations(Lattice & connectedHyp, map<const Hypothesis*, vector<Edge> >& incomingEdges,
-                           map<Phrase, float>& finalNgramScores, bool posteriors)
+namespace
 {
 
-  sort(connectedHyp.begin(),connectedHyp.end(),ascendingCoverageCmp); //sort by increasing source word cov
-
-  /*cerr << "Lattice:" << endl;
-  for (Lattice::const_iterator i = connectedHyp.begin(); i != connectedHyp.end(); ++i) {
-      const Hypothesis* h = *i;
-      cerr << *h << endl;
-      const vector<Edge>& edges = incomingEdges[h];
-      for (size_t e = 0; e < edges.size(); ++e) {
-          cerr << edges[e];
-      }
-  }*/
-
-  map<const Hypothesis*, float> forwardScore;
-  forwardScore[connectedHyp[0]] = 0.0f; //forward score of hyp 0 is 1 (or 0 in logprob space)
-  set< const Hypothesis *> finalHyps; //store completed hyps
-
-  NgramScores ngramScores;//ngram scores for each hyp
-
-  for (size_t i = 1; i < connectedHyp.size(); ++i) {
-    const Hypothesis* currHyp = connectedHyp[i];
-    if (currHyp->GetWordsBitmap().IsComplete()) {
-      finalHyps.insert(currHyp);
-    }
-
-    VERBOSE(3, "Processing hyp: " << currHyp->GetId() << ", num words cov= " << currHyp->GetWordsBitmap().GetNumWordsCovered() <<  endl)
+/** an ngram on an edge, and the score of one path through the lattice that ends with the edge and contains the ngram */
+struct NgramPath {
+  NgramPath(const NgramKey& ngram, float score, size_t count, size_t path) : ngram(ngram), score(score), count(count), path(path) {}
+  NgramKey ngram;
+  float score; //forward score of the first node of the path + the scores of its edges
+  size_t count; //number of times the ngram is on the path
+  size_t path; //paths are numbered per edge, 0 being the edge itself
+};
+
+struct NgramPathLess {
+  bool operator()(const NgramPath& a, const NgramPath& b) const {
+    return a.ngram < b.ngram || (a.ngram == b.ngram && a.path < b.path);
+  }
+};
 
-    vector <Edge> & edges = incomingEdges[currHyp];
-    for (size_t e = 0; e < edges.size(); ++e) {
-      const Edge& edge = edges[e];
-      if (forwardScore.find(currHyp) == forwardScore.end()) {
-        forwardScore[currHyp] = forwardScore[edge.GetTailNode()] + edge.GetScore();
-        VERBOSE(3, "Fwd score["<<currHyp->GetId()<<"] = fwdScore["<<edge.GetTailNode()->GetId() << "] + edge Score: " << edge.GetScore() << endl)
-      } else {
-        forwardScore[currHyp] = log_sum(forwardScore[currHyp], forwardScore[edge.GetTailNode()] + edge.GetScore());
-        VERBOSE(3, "Fwd score["<<currHyp->GetId()<<"] += fwdScore["<<edge.GetTailNode()->GetId() << "] + edge Score: " << edge.GetScore() << endl)
-      }
+struct NgramLess {
+  bool operator()(const NgramPath& a, const NgramPath& b) const {
+    return a.ngram < b.ngram;
+  }
+};
+
+/**
+* The forward pass over a lattice, with the ngram scores of each node.
+* Nodes are indexed in topological order (by source words covered) and
+* edges by their head node, so that the scores are kept in flat arrays.
+* Nodes that cover the same number of words do not depend on each other,
+* and are shared out among threads.
+*/
+class LatticeExpectations
+{
+public:
+  LatticeExpectations(const Lattice& nodes, map<const Hypothesis*, vector<Edge> >& incomingEdges, NgramIds& ids, bool posteriors);
+
+  void Run(size_t threads);
+
+  /** logsum of the ngram scores of the final nodes, normalised by the total score of the lattice */
+  void GetFinalScores(NgramScores& finalNgramScores, const NgramIds& ids) const;
+
+private:
+  void ProcessLevel(size_t level, size_t thread, size_t threads);
+#ifdef WITH_THREADS
+  void Work(size_t thread, size_t threads, boost::barrier* barrier);
+#endif
+  void ProcessNode(size_t node);
+  void CollectNgrams(size_t edge);
+
+  const Lattice& m_nodes;
+  bool m_posteriors;
+  vector<size_t> m_levels; //nodes [m_levels[l], m_levels[l+1]) cover the same number of words
+  vector<size_t> m_nodeEdges; //incoming edges of node n are [m_nodeEdges[n], m_nodeEdges[n+1])
+  vector<size_t> m_edgeTails;
+  vector<float> m_edgeScores;
+  vector<size_t> m_edgeWords; //words of edge e are [m_edgeWords[e], m_edgeWords[e+1]) in m_words
+  vector<unsigned> m_words;
+  vector<float> m_forwardScores;
+  vector< vector<NgramPath> > m_edgeNgrams; //sorted by ngram
+  vector<NgramScores> m_nodeScores;
+};
+
+LatticeExpectations::LatticeExpectations(const Lattice& nodes, map<const Hypothesis*, vector<Edge> >& incomingEdges, NgramIds& ids, bool posteriors)
+  : m_nodes(nodes), m_posteriors(posteriors)
+{
+  boost::unordered_map<const Hypothesis*, size_t> index;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    index[nodes[i]] = i;
+    if (i == 0 || ascendingCoverageCmp(nodes[i-1], nodes[i])) {
+      m_levels.push_back(i);
     }
-
-    //Process ngrams now
-    for (size_t j =0 ; j < edges.size(); ++j) {
-      Edge& edge = edges[j];
-      const NgramHistory & incomingPhrases = edge.GetNgrams(incomingEdges);
-
-      //let's first score ngrams introduced by this edge
-      for (NgramHistory::const_iterator it = incomingPhrases.begin(); it != incomingPhrases.end(); ++it) {
-        const Phrase& ngram = it->first;
-        const PathCounts& pathCounts = it->second;
-        VERBOSE(4, "Calculating score for: " << it->first << endl)
-
-        for (PathCounts::const_iterator pathCountIt = pathCounts.begin(); pathCountIt != pathCounts.end(); ++pathCountIt) {
-          //Score of an n-gram is forward score of head node of leftmost edge + all edge scores
-          const Path&  path = pathCountIt->first;
-          //cerr << "path count for " << ngram << " is " << pathCountIt->second << endl;
-          float score = forwardScore[path[0]->GetTailNode()];
-          for (size_t i = 0; i < path.size(); ++i) {
-            score += path[i]->GetScore();
-          }
-          //if we're doing expectations, then the number of times the ngram
-          //appears on the path is relevant.
-          size_t count = posteriors ? 1 : pathCountIt->second;
-          for (size_t k = 0; k < count; ++k) {
-            ngramScores.addScore(currHyp,ngram,score);
-          }
+  }
+  m_levels.push_back(nodes.size());
+
+  m_nodeEdges.push_back(0);
+  m_edgeWords.push_back(0);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    map<const Hypothesis*, vector<Edge> >::const_iterator it = incomingEdges.find(nodes[i]);
+    if (it != incomingEdges.end()) {
+      for (vector<Edge>::const_iterator edge = it->second.begin(); edge != it->second.end(); ++edge) {
+        assert(index.find(edge->GetTailNode()) != index.end());
+        m_edgeTails.push_back(index[edge->GetTailNode()]);
+        m_edgeScores.push_back(edge->GetScore());
+        const Phrase& words = edge->GetWords();
+        for (size_t pos = 0; pos < words.GetSize(); ++pos) {
+          m_words.push_back(ids.Add(words.GetWord(pos)));
         }
+        m_edgeWords.push_back(m_words.size());
       }
+    }
+    m_nodeEdges.push_back(m_edgeTails.size());
+  }
 
-      //Now score ngrams that are just being propagated from the history
-      for (NgramScores::NodeScoreIterator it = ngramScores.nodeBegin(edge.GetTailNode());
-           it != ngramScores.nodeEnd(edge.GetTailNode()); ++it) {
-        const Phrase & currNgram = *(it->first);
-        float currNgramScore = it->second;
-        VERBOSE(4, "Calculating score for: " << currNgram << endl)
-
-        // For posteriors, don't double count ngrams
-        if (!posteriors || incomingPhrases.find(currNgram) == incomingPhrases.end()) {
-          float score = edge.GetScore() + currNgramScore;
-          ngramScores.addScore(currHyp,currNgram,score);
-        }
-      }
+  m_forwardScores.assign(nodes.size(), 0.0f); //nodes without incoming edges, like the first one, have score 1
+  m_edgeNgrams.resize(m_edgeTails.size());
+  m_nodeScores.resize(nodes.size());
+}
 
+void LatticeExpectations::Run(size_t threads)
+{
+#ifdef WITH_THREADS
+  if (threads > 1) {
+    boost::barrier barrier(threads);
+    boost::thread_group workers;
+    for (size_t thread = 1; thread < threads; ++thread) {
+      workers.create_thread(boost::bind(&LatticeExpectations::Work, this, thread, threads, &barrier));
     }
+    Work(0, threads, &barrier);
+    workers.join_all();
+    return;
+  }
+#endif
+  //the first level only holds the empty hypothesis
+  for (size_t level = 1; level + 1 < m_levels.size(); ++level) {
+    ProcessLevel(level, 0, 1);
   }
+}
 
-  float Z = 9999999; //the total score of the lattice
+#ifdef WITH_THREADS
+void LatticeExpectations::Work(size_t thread, size_t threads, boost::barrier* barrier)
+{
+  for (size_t level = 1; level + 1 < m_levels.size(); ++level) {
+    ProcessLevel(level, thread, threads);
+    barrier->wait();
+  }
+}
+#endif
 
-  //Done - Print out ngram posteriors for final hyps
-  for (set< const Hypothesis *>::iterator finalHyp = finalHyps.begin(); finalHyp != finalHyps.end(); ++finalHyp) {
-    const Hypothesis* hyp = *finalHyp;
+void LatticeExpectations::ProcessLevel(size_t level, size_t thread, size_t threads)
+{
+  for (size_t node = m_levels[level] + thread; node < m_levels[level+1]; node += threads) {
+    ProcessNode(node);
+  }
+}
 
-    for (NgramScores::NodeScoreIterator it = ngramScores.nodeBegin(hyp); it != ngramScores.nodeEnd(hyp); ++it) {
-      const Phrase& ngram = *(it->first);
-      if (finalNgramScores.find(ngram) == finalNgramScores.end()) {
-        finalNgramScores[ngram] = it->second;
-      } else {
-        finalNgramScores[ngram] = log_sum(it->second,  finalNgramScores[ngram]);
-      }
-    }
+void LatticeExpectations::ProcessNode(size_t node)
+{
+  VERBOSE(3, "Processing hyp: " << m_nodes[node]->GetId() << ", num words cov= " << m_nodes[node]->GetWordsBitmap().GetNumWordsCovered() <<  endl)
 
-    if (Z == 9999999) {
-      Z = forwardScore[hyp];
-    } else {
-      Z = log_sum(Z, forwardScore[hyp]);
-    }
+  float& forwardScore = m_forwardScores[node];
+  for (size_t edge = m_nodeEdges[node]; edge < m_nodeEdges[node+1]; ++edge) {
+    const float score = m_forwardScores[m_edgeTails[edge]] + m_edgeScores[edge];
+    forwardScore = edge == m_nodeEdges[node] ? score : log_sum(forwardScore, score);
   }
 
-  //Z *= scale;  //scale the score
+  //Process ngrams now
+  NgramScores scores;
+  for (size_t edge = m_nodeEdges[node]; edge < m_nodeEdges[node+1]; ++edge) {
+    CollectNgrams(edge);
+    const vector<NgramPath>& incomingPhrases = m_edgeNgrams[edge];
+
+    //let's first score ngrams introduced by this edge
+    for (vector<NgramPath>::const_iterator it = incomingPhrases.begin(); it != incomingPhrases.end(); ++it) {
+      //if we're doing expectations, then the number of times the ngram
+      //appears on the path is relevant.
+      size_t count = m_posteriors ? 1 : it->count;
+      for (size_t k = 0; k < count; ++k) {
+        scores.push_back(NgramScore(it->ngram, it->score));
+      }
+    }
 
-  for (map<Phrase, float>::iterator finalScoresIt = finalNgramScores.begin();  finalScoresIt != finalNgramScores.end(); ++finalScoresIt) {
-    finalScoresIt->second =  finalScoresIt->second - Z;
-    IFVERBOSE(2) {
-      VERBOSE(2,finalScoresIt->first << " [" << finalScoresIt->second << "]" << endl);
+    //Now score ngrams that are just being propagated from the history
+    const NgramScores& tailScores = m_nodeScores[m_edgeTails[edge]];
+    for (NgramScores::const_iterator it = tailScores.begin(); it != tailScores.end(); ++it) {
+      // For posteriors, don't double count ngrams
+      if (!m_posteriors || !binary_search(incomingPhrases.begin(), incomingPhrases.end(), NgramPath(it->first, 0, 0, 0), NgramLess())) {
+        scores.push_back(NgramScore(it->first, m_edgeScores[edge] + it->second));
+      }
     }
   }
-
+  SumNgramScores(scores, m_nodeScores[node]);
 }
 
-const NgramHistory& Edge::GetNgrams(map<const Hypothesis*, vector<Edge> > & incomingEdges)
+void LatticeExpectations::CollectNgrams(size_t edge)
 {
+  vector<NgramPath> ngrams;
+  const unsigned* words = &m_words[0] + m_edgeWords[edge];
+  const size_t size = m_edgeWords[edge+1] - m_edgeWords[edge];
+  const float edgeScore = m_edgeScores[edge];
+  const size_t tail = m_edgeTails[edge];
 
-  if (m_ngrams.size() > 0)
-    return m_ngrams;
-
-  const Phrase& currPhrase = GetWords();
   //Extract the n-grams local to this edge
-  for (size_t start = 0; start < currPhrase.GetSize(); ++start) {
-    for (size_t end = start; end < start + bleu_order; ++end) {
-      if (end < currPhrase.GetSize()) {
-        Phrase edgeNgram(end-start+1);
-        for (size_t index = start; index <= end; ++index) {
-          edgeNgram.AddWord(currPhrase.GetWord(index));
-        }
-        //cout << "Inserting Phrase : " << edgeNgram << endl;
-        vector<const Edge*> edgeHistory;
-        edgeHistory.push_back(this);
-        storeNgramHistory(edgeNgram, edgeHistory);
-      } else {
-        break;
-      }
+  for (size_t start = 0; start < size; ++start) {
+    NgramKey ngram(0, 0);
+    for (size_t end = start; end < size && end < start + bleu_order; ++end) {
+      ngram = AppendNgramWord(ngram, end-start, words[end]);
+      ngrams.push_back(NgramPath(ngram, m_forwardScores[tail] + edgeScore, 1, 0));
     }
   }
 
-  map<const Hypothesis*, vector<Edge> >::iterator it = incomingEdges.find(m_tailNode);
-  if (it != incomingEdges.end()) { //node has incoming edges
-    vector<Edge> & inEdges = it->second;
-
-    for (vector<Edge>::iterator edge = inEdges.begin(); edge != inEdges.end(); ++edge) {//add the ngrams straddling prev and curr edge
-      const NgramHistory & edgeIncomingNgrams = edge->GetNgrams(incomingEdges);
-      for (NgramHistory::const_iterator edgeInNgramHist = edgeIncomingNgrams.begin(); edgeInNgramHist != edgeIncomingNgrams.end(); ++edgeInNgramHist) {
-        const Phrase& edgeIncomingNgram = edgeInNgramHist->first;
-        const PathCounts &  edgeIncomingNgramPaths = edgeInNgramHist->second;
-        size_t back = min(edgeIncomingNgram.GetSize(), edge->GetWordsSize());
-        const Phrase&  edgeWords = edge->GetWords();
-        IFVERBOSE(3) {
-          cerr << "Edge: "<< *edge <<endl;
-          cerr << "edgeWords: " << edgeWords << endl;
-          cerr << "edgeInNgram: " << edgeIncomingNgram << endl;
-        }
+  //add the ngrams straddling the edges into the tail and this edge
+  map<pair<size_t, size_t>, size_t> paths;
+  for (size_t prevEdge = m_nodeEdges[tail]; prevEdge < m_nodeEdges[tail+1]; ++prevEdge) {
+    const unsigned* prevWords = &m_words[0] + m_edgeWords[prevEdge];
+    const size_t prevSize = m_edgeWords[prevEdge+1] - m_edgeWords[prevEdge];
+    const vector<NgramPath>& prevNgrams = m_edgeNgrams[prevEdge];
+    for (vector<NgramPath>::const_iterator prev = prevNgrams.begin(); prev != prevNgrams.end(); ++prev) {
+      const size_t order = GetNgramOrder(prev->ngram);
+      if (order >= bleu_order) {
+        continue;
+      }
+      //we need the ngram to end with the words of the previous edge
+      const size_t back = min(order, prevSize);
+      bool isSuffix = true;
+      for (size_t i = 0; i < back && isSuffix; ++i) {
+        isSuffix = GetNgramWord(prev->ngram, order - back + i) == prevWords[prevSize - back + i];
+      }
+      if (!isSuffix) {
+        continue;
+      }
+      const size_t path = paths.insert(make_pair(make_pair(prevEdge, prev->path), paths.size() + 1)).first->second;
+      NgramKey ngram = prev->ngram;
+      for (size_t i = 0; i < size && i + order < bleu_order; ++i) {
+        ngram = AppendNgramWord(ngram, order + i, words[i]);
+        ngrams.push_back(NgramPath(ngram, prev->score + edgeScore, prev->count, path));
+      }
+    }
+  }
 
-        Phrase edgeSuffix(ARRAY_SIZE_INCR);
-        Phrase ngramSuffix(ARRAY_SIZE_INCR);
-        GetPhraseSuffix(edgeWords,back,edgeSuffix);
-        GetPhraseSuffix(edgeIncomingNgram,back,ngramSuffix);
+  //count each ngram once per path
+  sort(ngrams.begin(), ngrams.end(), NgramPathLess());
+  vector<NgramPath>& history = m_edgeNgrams[edge];
+  for (vector<NgramPath>::const_iterator it = ngrams.begin(); it != ngrams.end(); ++it) {
+    if (!history.empty() && history.back().ngram == it->ngram && history.back().path == it->path) {
+      history.back().count += it->count;
+    } else {
+      history.push_back(*it);
+    }
+  }
+}
 
-        if (ngramSuffix == edgeSuffix) { //we've got the suffix of previous edge
-          size_t  edgeInNgramSize =  edgeIncomingNgram.GetSize();
+void LatticeExpectations::GetFinalScores(NgramScores& finalNgramScores, const NgramIds& ids) const
+{
+  float Z = 9999999; //the total score of the lattice
 
-          for (size_t i = 0; i < GetWordsSize() && i + edgeInNgramSize < bleu_order ; ++i) {
-            Phrase newNgram(edgeIncomingNgram);
-            for (size_t j = 0; j <= i ; ++j) {
-              newNgram.AddWord(GetWords().GetWord(j));
-            }
-            VERBOSE(3, "Inserting New Phrase : " << newNgram << endl)
+  NgramScores scores;
+  for (size_t node = 1; node < m_nodes.size(); ++node) {
+    if (!m_nodes[node]->GetWordsBitmap().IsComplete()) {
+      continue;
+    }
+    scores.insert(scores.end(), m_nodeScores[node].begin(), m_nodeScores[node].end());
+    if (Z == 9999999) {
+      Z = m_forwardScores[node];
+    } else {
+      Z = log_sum(Z, m_forwardScores[node]);
+    }
+  }
+  SumNgramScores(scores, finalNgramScores);
 
-            for (PathCounts::const_iterator pathIt = edgeIncomingNgramPaths.begin(); pathIt !=  edgeIncomingNgramPaths.end(); ++pathIt) {
-              Path newNgramPath = pathIt->first;
-              newNgramPath.push_back(this);
-              storeNgramHistory(newNgram, newNgramPath, pathIt->second);
-            }
-          }
-        }
-      }
+  for (NgramScores::iterator finalScoresIt = finalNgramScores.begin();  finalScoresIt != finalNgramScores.end(); ++finalScoresIt) {
+    finalScoresIt->second =  finalScoresIt->second - Z;
+    IFVERBOSE(2) {
+      VERBOSE(2,ids.ToString(finalScoresIt->first) << " [" << finalScoresIt->second << "]" << endl);
     }
   }
-  return m_ngrams;
 }
 
-//Add the last lastN words of origPhrase to targetPhrase
-void Edge::GetPhraseSuffix(const Phrase&  origPhrase, size_t lastN, Phrase& targetPhrase) const
+}
+
+void calcNgramExpectations(Lattice & connectedHyp, map<const Hypothesis*, vector<Edge> >& incomingEdges, NgramIds& ids,
+                           NgramScores& finalNgramScores, bool posteriors, size_t threads)
 {
-  size_t origSize = origPhrase.GetSize();
-  size_t startIndex = origSize - lastN;
-  for (size_t index = startIndex; index < origPhrase.GetSize(); ++index) {
-    targetPhrase.AddWord(origPhrase.GetWord(index));
-  }
+  sort(connectedHyp.begin(),connectedHyp.end(),ascendingCoverageCmp); //sort by increasing source word cov
+
+  LatticeExpectations expectations(connectedHyp, incomingEdges, ids, posteriors);
+  expectations.Run(threads);
+  expectations.GetFinalScores(finalNgramScores, ids);
 }
 
 bool Edge::operator< (const Edge& compare ) const
@@ -506,13 +622,14 @@ void getLatticeMBRNBest(Manager& manager, TrellisPathList& nBestList,
   const StaticData& staticData = StaticData::Instance();
   std::map < int, bool > connected;
   std::vector< const Hypothesis *> connectedList;
-  map<Phrase, float> ngramPosteriors;
+  NgramIds ngramIds;
+  NgramScores ngramPosteriors;
   std::map < const Hypothesis*, set <const Hypothesis*> > outgoingHyps;
   map<const Hypothesis*, vector<Edge> > incomingEdges;
   vector< float> estimatedScores;
   manager.GetForwardBackwardSearchGraph(&connected, &connectedList, &outgoingHyps, &estimatedScores);
   pruneLatticeFB(connectedList, outgoingHyps, incomingEdges, estimatedScores, manager.GetBestHypothesis(), staticData.GetLatticeMBRPruningFactor(),staticData.GetMBRScale());
-  calcNgramExpectations(connectedList, incomingEdges, ngramPosteriors,true);
+  calcNgramExpectations(connectedList, incomingEdges, ngramIds, ngramPosteriors, true, staticData.GetLatticeMBRThreads());
 
   vector<float> mbrThetas = staticData.GetLatticeMBRThetas();
   float p = staticData.GetLatticeMBRPrecision();
@@ -538,7 +655,7 @@ void getLatticeMBRNBest(Manager& manager, TrellisPathList& nBestList,
   for (iter = nBestList.begin() ; iter != nBestList.end() ; ++iter, ++ctr) {
     const TrellisPath &path = **iter;
     solutions.push_back(LatticeMBRSolution(path,iter==nBestList.begin()));
-    solutions.back().CalcScore(ngramPosteriors,mbrThetas,mapWeight);
+    solutions.back().CalcScore(ngramIds,ngramPosteriors,mbrThetas,mapWeight);
     sort(solutions.begin(), solutions.end(), comparator);
     while (solutions.size() > n) {
       solutions.pop_back();
@@ -564,22 +681,23 @@ const TrellisPath doConsensusDecoding(Manager& manager, TrellisPathList& nBestLi
   const StaticData& staticData = StaticData::Instance();
   std::map < int, bool > connected;
   std::vector< const Hypothesis *> connectedList;
-  map<Phrase, float> ngramExpectations;
+  NgramIds ngramIds;
+  NgramScores ngramExpectations;
   std::map < const Hypothesis*, set <const Hypothesis*> > outgoingHyps;
   map<const Hypothesis*, vector<Edge> > incomingEdges;
   vector< float> estimatedScores;
   manager.GetForwardBackwardSearchGraph(&connected, &connectedList, &outgoingHyps, &estimatedScores);
   pruneLatticeFB(connectedList, outgoingHyps, incomingEdges, estimatedScores, manager.GetBestHypothesis(), staticData.GetLatticeMBRPruningFactor(),staticData.GetMBRScale());
-  calcNgramExpectations(connectedList, incomingEdges, ngramExpectations,false);
+  calcNgramExpectations(connectedList, incomingEdges, ngramIds, ngramExpectations, false, staticData.GetLatticeMBRThreads());
 
   //expected length is sum of expected unigram counts
   //cerr << "Thread " << pthread_self() <<  " Ngram expectations size: " << ngramExpectations.size() << endl;
   float ref_length = 0.0f;
-  for (map<Phrase,float>::const_iterator ref_iter = ngramExpectations.begin();
+  for (NgramScores::const_iterator ref_iter = ngramExpectations.begin();
        ref_iter != ngramExpectations.end(); ++ref_iter) {
     //cerr << "Ngram: " << ref_iter->first << " score: " <<
     //    ref_iter->second << endl;
-    if (ref_iter->first.GetSize() == 1) {
+    if (GetNgramOrder(ref_iter->first) == 1) {
       ref_length += exp(ref_iter->second);
       //    cerr << "Expected for " << ref_iter->first << " is " << exp(ref_iter->second) << endl;
     }
@@ -595,14 +713,14 @@ const TrellisPath doConsensusDecoding(Manager& manager, TrellisPathList& nBestLi
   for (iter = nBestList.begin() ; iter != nBestList.end() ; ++iter) {
     const TrellisPath &path = **iter;
     vector<Word> words;
-    map<Phrase,int> ngrams;
+    NgramCounts ngrams;
     GetOutputWords(path,words);
     /*for (size_t i = 0; i < words.size(); ++i) {
         cerr << words[i].GetFactor(0)->GetString() << " ";
     }
     cerr << endl;
     */
-    extract_ngrams(words,ngrams);
+    extract_ngrams(words,ngramIds,ngrams);
 
     vector<float> comps(2*BLEU_ORDER+1);
     float logbleu = 0.0;
@@ -613,11 +731,11 @@ const TrellisPath doConsensusDecoding(Manager& manager, TrellisPathList& nBestLi
       comps[2*i+1] = max(hyp_length-i,0);
     }
 
-    for (map<Phrase,int>::const_iterator hyp_iter = ngrams.begin();
+    for (NgramCounts::const_iterator hyp_iter = ngrams.begin();
          hyp_iter != ngrams.end(); ++hyp_iter) {
-      map<Phrase,float>::const_iterator ref_iter = ngramExpectations.find(hyp_iter->first);
-      if (ref_iter != ngramExpectations.end()) {
-        comps[2*(hyp_iter->first.GetSize()-1)] += min(exp(ref_iter->second), (float)(hyp_iter->second));
+      float ref_score;
+      if (FindNgramScore(ngramExpectations, hyp_iter->first, ref_score)) {
+        comps[2*(GetNgramOrder(hyp_iter->first)-1)] += min(exp(ref_score), (float)(hyp_iter->second));
       }
 
     }
@@ -13,6 +13,7 @@
 #include <map>
 #include <vector>
 #include <set>
+#include <stdint.h>
 #include "moses/Hypothesis.h"
 #include "moses/Manager.h"
 #include "moses/TrellisPathList.h"
@@ -25,20 +26,16 @@ namespace MosesCmd
 class Edge;
 
 typedef std::vector< const Moses::Hypothesis *> Lattice;
-typedef std::vector<const Edge*> Path;
-typedef std::map<Path, size_t> PathCounts;
-typedef std::map<Moses::Phrase, PathCounts > NgramHistory;
 
 class Edge
 {
   const Moses::Hypothesis* m_tailNode;
   const Moses::Hypothesis* m_headNode;
   float m_score;
-  Moses::TargetPhrase m_targetPhrase;
-  NgramHistory m_ngrams;
+  const Moses::TargetPhrase* m_targetPhrase; // owned by the hypothesis
 
 public:
-  Edge(const Moses::Hypothesis* from, const Moses::Hypothesis* to, float score, const Moses::TargetPhrase& targetPhrase) : m_tailNode(from), m_headNode(to), m_score(score), m_targetPhrase(targetPhrase) {
+  Edge(const Moses::Hypothesis* from, const Moses::Hypothesis* to, float score, const Moses::TargetPhrase& targetPhrase) : m_tailNode(from), m_headNode(to), m_score(score), m_targetPhrase(&targetPhrase) {
     //cout << "Creating new edge from Node " << from->GetId() << ", to Node : " << to->GetId() << ", score: " << score << " phrase: " << targetPhrase << endl;
   }
 
@@ -55,48 +52,84 @@ public:
   }
 
   size_t GetWordsSize() const {
-    return m_targetPhrase.GetSize();
+    return m_targetPhrase->GetSize();
   }
 
   const Moses::Phrase& GetWords() const {
-    return m_targetPhrase;
+    return *m_targetPhrase;
   }
 
   friend std::ostream& operator<< (std::ostream& out, const Edge& edge);
 
-  const NgramHistory&  GetNgrams(  std::map<const Moses::Hypothesis*, std::vector<Edge> > & incomingEdges) ;
-
   bool operator < (const Edge & compare) const;
 
-  void GetPhraseSuffix(const Moses::Phrase& origPhrase, size_t lastN, Moses::Phrase& targetPhrase) const;
+};
 
-  void storeNgramHistory(const Moses::Phrase& phrase, Path & path, size_t count = 1) {
-    m_ngrams[phrase][path]+= count;
-  }
+/**
+* An ngram of at most four words, as the ids given to the words by NgramIds,
+* 32 bits per word in order, padded with 0. Keys compare like the word id
+* sequences, so ngram statistics are kept in vectors sorted by key.
+*/
+typedef std::pair<uint64_t, uint64_t> NgramKey;
 
-};
+inline unsigned GetNgramWord(const NgramKey& ngram, size_t pos)
+{
+  const uint64_t half = pos < 2 ? ngram.first : ngram.second;
+  return static_cast<unsigned>(pos % 2 ? half : half >> 32);
+}
+
+inline size_t GetNgramOrder(const NgramKey& ngram)
+{
+  size_t order = 0;
+  while (order < 4 && GetNgramWord(ngram, order) != 0) ++order;
+  return order;
+}
+
+/** ngram extended by word, order being the number of words in ngram */
+inline NgramKey AppendNgramWord(const NgramKey& ngram, size_t order, unsigned word)
+{
+  NgramKey ret(ngram);
+  const uint64_t shifted = order % 2 ? static_cast<uint64_t>(word) : static_cast<uint64_t>(word) << 32;
+  if (order < 2) ret.first |= shifted;
+  else ret.second |= shifted;
+  return ret;
+}
 
 /**
-* Data structure to hold the ngram scores as we traverse the lattice. Maps (hypo,ngram) to score
+* Interns the target words of a lattice to integer ids, from 1.
 */
-class NgramScores
+class NgramIds
 {
 public:
-  NgramScores() {}
+  /** id given to words that are not in the lattice */
+  static const unsigned UNKNOWN = 0xffffffff;
 
-  /** logsum this score to the existing score */
-  void addScore(const Moses::Hypothesis* node, const Moses::Phrase& ngram, float score);
+  /** id of word, interning it if new */
+  unsigned Add(const Moses::Word& word);
 
-  /** Iterate through ngrams for selected node */
-  typedef std::map<const Moses::Phrase*, float>::const_iterator NodeScoreIterator;
-  NodeScoreIterator nodeBegin(const Moses::Hypothesis* node);
-  NodeScoreIterator nodeEnd(const Moses::Hypothesis* node);
+  /** id of word, or UNKNOWN */
+  unsigned Find(const Moses::Word& word) const;
+
+  const Moses::Word& GetWord(unsigned id) const {
+    return *m_words[id-1];
+  }
+
+  /** words of ngram, unknown ones skipped */
+  std::string ToString(const NgramKey& ngram) const;
 
 private:
-  std::set<Moses::Phrase> m_ngrams;
-  std::map<const Moses::Hypothesis*, std::map<const Moses::Phrase*, float> > m_scores;
+  std::map<Moses::Word, unsigned> m_ids;
+  std::vector<const Moses::Word*> m_words;
 };
 
+typedef std::pair<NgramKey, float> NgramScore;
+/** ngram scores, one for each ngram, sorted by key */
+typedef std::vector<NgramScore> NgramScores;
+/** ngram counts, one for each ngram, sorted by key */
+typedef std::vector< std::pair<NgramKey, int> > NgramCounts;
+
+/** set score to that of ngram; false, leaving score alone, if it has none */
+bool FindNgramScore(const NgramScores& scores, const NgramKey& ngram, float& score);
 
 /** Holds a lattice mbr solution, and its scores */
 class LatticeMBRSolution
@@ -118,7 +151,7 @@ public:
   }
 
   /** Initialise ngram scores */
-  void CalcScore(std::map<Moses::Phrase, float>& finalNgramScores, const std::vector<float>& thetas, float mapWeight);
+  void CalcScore(const NgramIds& ids, const NgramScores& finalNgramScores, const std::vector<float>& thetas, float mapWeight);
 
 private:
   std::vector<Moses::Word> m_words;
@@ -139,10 +172,11 @@ void pruneLatticeFB(Lattice & connectedHyp, std::map < const Moses::Hypothesis*,
 //Use the ngram scores to rerank the nbest list, return at most n solutions
 void getLatticeMBRNBest(Moses::Manager& manager, Moses::TrellisPathList& nBestList, std::vector<LatticeMBRSolution>& solutions, size_t n);
 //calculate expectated ngram counts, clipping at 1 (ie calculating posteriors) if posteriors==true.
-void calcNgramExpectations(Lattice & connectedHyp, std::map<const Moses::Hypothesis*, std::vector<Edge> >& incomingEdges, std::map<Moses::Phrase,
-                           float>& finalNgramScores, bool posteriors);
+//The nodes covering the same number of source words are spread over the given number of threads.
+void calcNgramExpectations(Lattice & connectedHyp, std::map<const Moses::Hypothesis*, std::vector<Edge> >& incomingEdges, NgramIds& ids,
+                           NgramScores& finalNgramScores, bool posteriors, size_t threads);
 void GetOutputFactors(const Moses::TrellisPath &path, std::vector <Moses::Word> &translation);
-void extract_ngrams(const std::vector<Moses::Word >& sentence, std::map < Moses::Phrase, int >  & allngrams);
+void extract_ngrams(const std::vector<Moses::Word >& sentence, const NgramIds& ids, NgramCounts& allngrams);
 bool ascendingCoverageCmp(const Moses::Hypothesis* a, const Moses::Hypothesis* b);
 std::vector<Moses::Word> doLatticeMBR(Moses::Manager& manager, Moses::TrellisPathList& nBestList);
 const Moses::TrellisPath doConsensusDecoding(Moses::Manager& manager, Moses::TrellisPathList& nBestList);
@@ -93,7 +93,16 @@ public:
 				m_wordGraphCollector(wordGraphCollector), m_searchGraphCollector(searchGraphCollector),
 				m_detailedTranslationCollector(detailedTranslationCollector),
 				m_alignmentInfoCollector(alignmentInfoCollector),
-				m_unknownsCollector(unknownsCollector) {}
+				m_unknownsCollector(unknownsCollector),
+				m_learn(false), m_weightVersion(0) {}
+
+	/** Online learning input of this sentence, as read from its line.
+	 *  weightVersion is the number of post-edits that precede the sentence. */
+	void SetOnlineLearning(const std::string& postEdited, size_t weightVersion) {
+		m_learn = !postEdited.empty();
+		m_postEdited = postEdited;
+		m_weightVersion = weightVersion;
+	}
 
 	/** Translate one sentence
 	 * gets called by main function implemented at end of this source file */
@@ -120,14 +129,22 @@ public:
 		// I know what I am doing!
 		StaticData &SD = StaticData::InstanceNonConst();
 
+		// decode with the weights learnt from the preceding post-edits, less
+		// the ones we are allowed to skip, and keep them for the whole sentence
+		size_t staleness = staticData.GetWeightStaleness();
+		SD.WaitForWeightVersion(m_weightVersion > staleness ? m_weightVersion - staleness : 0);
+		SD.UseWeightSnapshot(SD.GetWeightSnapshot(*m_source));
+
 		manager.ProcessSentence();
-		if(SD.GetOnlineLearningModel()!=NULL && SD.GetOnlineLearningModel()->GetOnlineLearning() && !staticData.MultiTaskingOn()){
-			SD.GetOnlineLearningModel()->RunOnlineLearning(manager);
-			SD.GetOnlineLearningModel()->RemoveJunk();
+		if(SD.GetOnlineLearningModel()!=NULL && m_learn && !staticData.MultiTaskingOn()){
+			// post-edits are always learnt from in input order
+			SD.WaitForWeightVersion(m_weightVersion);
+			SD.GetOnlineLearningModel()->RunOnlineLearning(manager, m_postEdited);
+			SD.AdvanceWeightVersion();
 		}
 
-		if(SD.GetOnlineLearningModel()!=NULL && SD.GetOnlineLearningModel()->GetOnlineLearning() && staticData.MultiTaskingOn()){
-			SD.GetOnlineLearningModel()->RunOnlineMultiTaskLearning(manager, SD.GetMultiTaskLearner()->GetCurrentTask());
+		if(SD.GetOnlineLearningModel()!=NULL && m_learn && staticData.MultiTaskingOn()){
+			SD.GetOnlineLearningModel()->RunOnlineMultiTaskLearning(manager, m_postEdited, m_source->GetTaskId());
 			SD.GetOnlineLearningModel()->RemoveJunk();
 		}
 
@@ -268,24 +285,22 @@ public:
 
 			// NEW: when learning from postedition the decoder doesn't output anything!
 			if(staticData.GetOnlineLearningModel()!=NULL){
-				if(staticData.GetOnlineLearningModel()->GetOnlineLearning()==false){
-					cout<<out.str();
+				if(!m_learn){
+					m_outputCollector->Write(m_lineNumber,out.str());
 				}
 				if(!weights_file.empty()){
 					ShowWeightsforOnlineLearning(weights_file);
 				}
 			}
 			else{
-				cout<<out.str();
+				m_outputCollector->Write(m_lineNumber,out.str());
 			}
 		}
 
 		// output n-best list
 		if (m_nbestCollector && !staticData.UseLatticeMBR()) {
 			if(staticData.GetOnlineLearningModel()!=NULL){
-				std::string src = staticData.GetOnlineLearningModel()->GetSourceSentence();
-				vector<string> vecstr = TokenizeMultiCharSeparator(src, "_#_");
-				if(vecstr.size()==1){ // if sentence is translatable! yeah thats a word!
+				if(!m_learn && m_source->GetTaskId() < 0){ // if sentence is translatable! yeah thats a word!
 					TrellisPathList nBestList;
 					ostringstream out;
 					manager.CalcNBest(staticData.GetNBestSize(), nBestList,staticData.GetDistinctNBest());
@@ -339,6 +354,8 @@ public:
 		}
 		manager.CalcDecoderStatistics();
 
+		SD.UseWeightSnapshot(WeightSnapshotPtr());
+
 		VERBOSE(1, "Line " << m_lineNumber << ": Translation took " << translationTime << " seconds total" << endl);
 	}
 
@@ -365,6 +382,10 @@ public:
 
 	void ShowWeightsforOnlineLearning(std::string filename)
 	{
+#ifdef WITH_THREADS
+	  static boost::mutex weightsFileMutex;
+	  boost::mutex::scoped_lock lock(weightsFileMutex);
+#endif
 	  //TODO: Find a way of ensuring this order is synced with the nbest
 	  fix(cout,6);
 	  ofstream out;
@@ -414,6 +435,9 @@ private:
 	OutputCollector* m_alignmentInfoCollector;
 	OutputCollector* m_unknownsCollector;
 	std::ofstream *m_alignmentStream;
+	bool m_learn;
+	std::string m_postEdited;
+	size_t m_weightVersion;
 
 
 };
@@ -635,17 +659,15 @@ int main(int argc, char** argv)
 		InputType* source = NULL;
 //		size_t lineCount = staticData.GetStartTranslationId();
 		size_t lineCount = 0;
+		size_t weightUpdates = 0;
 		while(ReadInput(*ioWrapper,staticData.GetInputType(),source)) {
 			IFVERBOSE(1) {
 				ResetUserTime();
 			}
 
-			std::string src;
-			if(staticData.GetOnlineLearningModel()!=NULL){
-				src=staticData.GetOnlineLearningModel()->GetSourceSentence();
-				VERBOSE(1, "Src : "<< src << endl);
-			}
-			vector<string> vecstr=TokenizeMultiCharSeparator(src, "_#_");
+			const std::string postEdited = source->GetPostEditedSentence();
+			const bool learn = !postEdited.empty();
+			const int taskId = source->GetTaskId();
 			// set up task of translating one sentence
 			TranslationTask* task =
 					new TranslationTask(lineCount,source, outputCollector.get(),
@@ -656,21 +678,38 @@ int main(int argc, char** argv)
 							detailedTranslationCollector.get(),
 							alignmentInfoCollector.get(),
 							unknownsCollector.get() );
+			task->SetOnlineLearning(postEdited, weightUpdates);
+			if(learn && !staticData.MultiTaskingOn()){
+				++weightUpdates;
+			}
 			// execute task
-			//#ifdef WITH_THREADS
-			//    pool.Submit(task);
-			//#else
+#ifdef WITH_THREADS
+			// multi-task learning updates the weights of every task in place,
+			// so those sentences are still decoded one at a time
+			if (staticData.ThreadCount() > 1 && !staticData.MultiTaskingOn()) {
+				pool.Submit(task);
+			} else {
+				task->Run();
+				delete task;
+			}
+#else
 			task->Run();
 			delete task;
-			//#endif
-			if(vecstr.size()==1 && !staticData.MultiTaskingOn()){	// if the sentence is supposed to be translated then lineCount ++ else nothing
+#endif
+			if(!learn && !staticData.MultiTaskingOn()){	// if the sentence is supposed to be translated then lineCount ++ else nothing
 				++lineCount;
 			}
-			else if(vecstr.size()==2 && staticData.MultiTaskingOn()){	// if the sentence is supposed to be translated then lineCount ++ else nothing
+			else if(!learn && taskId >= 0 && staticData.MultiTaskingOn()){	// if the sentence is supposed to be translated then lineCount ++ else nothing
 				++lineCount;
 			}
 			source = NULL; //make sure it doesn't get deleted
 		}
+
+		// we are done, finishing up
+#ifdef WITH_THREADS
+		pool.Stop(true); //flush remaining jobs
+#endif
+
 // dump online learning model to the feature file
 		if(params->isParamSpecified("dump-online-learning-model")){
 			const vector<std::string> file = params->GetParam("dump-online-learning-model");
@@ -680,11 +719,6 @@ int main(int argc, char** argv)
 				StaticData::InstanceNonConst().GetOnlineLearningModel()->DumpFeatures(dump_features_file);
 		}
 
-		// we are done, finishing up
-		//#ifdef WITH_THREADS
-		//    pool.Stop(true); //flush remaining jobs
-		//#endif
-
 
 
 
@@ -8,6 +8,14 @@ namespace Moses {
 
 size_t BleuScoreState::bleu_order = 4;
 
+// n-grams are counted by SentenceBleu on the ids of the first factor
+static void GetWordIds(const Phrase& phrase, vector<SentenceBleu::WordId>& ids)
+{
+  ids.resize(phrase.GetSize());
+  for (size_t i = 0; i < phrase.GetSize(); ++i)
+    ids[i] = phrase.GetWord(i).GetFactor(0)->GetId();
+}
+
 BleuScoreState::BleuScoreState(): m_words(1),
                                   m_source_length(0),
                                   m_target_length(0),
@@ -107,20 +115,12 @@ void BleuScoreFeature::LoadReferences(const std::vector< std::vector< std::strin
 			vector<string> refTokens  = Tokenize(ref);
 			if (file_id == 0)
 				m_refs[sent_id] = RefValue(); 
-			pair<vector<size_t>,NGrams>& ref_pair = m_refs[sent_id];
+			pair<vector<size_t>,SentenceBleu>& ref_pair = m_refs[sent_id];
 			(ref_pair.first).push_back(refTokens.size());
-			for (size_t order = 1; order <= BleuScoreState::bleu_order; order++) {
-				for (size_t end_idx = order; end_idx <= refTokens.size(); end_idx++) {
-					Phrase ngram(1);
-					for (size_t s_idx = end_idx - order; s_idx < end_idx; s_idx++) {
-						const Factor* f = fc.AddFactor(Output, 0, refTokens[s_idx]);
-						Word w;
-						w.SetFactor(0, f);
-						ngram.AddWord(w);
-					}
-					ref_pair.second[ngram] += 1;
-				}
-			}
+			vector<SentenceBleu::WordId> ids(refTokens.size());
+			for (size_t s_idx = 0; s_idx < refTokens.size(); s_idx++)
+				ids[s_idx] = fc.AddFactor(Output, 0, refTokens[s_idx])->GetId();
+			ref_pair.second.AddReference(ids);
    	}
 	}
 
@@ -184,13 +184,14 @@ size_t BleuScoreFeature::GetShortestRefIndex(size_t ref_id) {
  * O_f = m_historySmoothing * (O_f + |f|)		input length of pseudo-document
  */
 void BleuScoreFeature::UpdateHistory(const vector< const Word* >& hypo) {
-    Phrase phrase(hypo);
+    vector<SentenceBleu::WordId> ids;
+    GetWordIds(Phrase(hypo), ids);
     std::vector< size_t > ngram_counts(BleuScoreState::bleu_order);
     std::vector< size_t > ngram_matches(BleuScoreState::bleu_order);
 
     // compute vector c(e;{r_k}):
     // vector of effective reference length, number of ngrams in e, number of ngram matches between e and r_k
-    GetNgramMatchCounts(phrase, m_cur_ref_ngrams, ngram_counts, ngram_matches, 0);
+    m_cur_ref_ngrams.CountMatches(ids, 0, ids.size(), 0, ids.size(), ngram_counts, ngram_matches);
 
     // update counts and matches for every ngram length with counts from hypo
     for (size_t i = 0; i < BleuScoreState::bleu_order; i++) {
@@ -209,7 +210,8 @@ void BleuScoreFeature::UpdateHistory(const vector< const Word* >& hypo) {
  */
 void BleuScoreFeature::UpdateHistory(const vector< vector< const Word* > >& hypos, vector<size_t>& sourceLengths, vector<size_t>& ref_ids, size_t rank, size_t epoch) {
 	for (size_t ref_id = 0; ref_id < hypos.size(); ++ref_id){
-	    Phrase phrase(hypos[ref_id]);
+	    vector<SentenceBleu::WordId> ids;
+	    GetWordIds(Phrase(hypos[ref_id]), ids);
 	    std::vector< size_t > ngram_counts(BleuScoreState::bleu_order);
 	    std::vector< size_t > ngram_matches(BleuScoreState::bleu_order);
 
@@ -217,12 +219,12 @@ void BleuScoreFeature::UpdateHistory(const vector< vector< const Word* > >& hypo
 	    size_t cur_source_length = sourceLengths[ref_id];
 	    size_t hypo_length = hypos[ref_id].size();
 	    size_t cur_ref_length = GetClosestRefLength(ref_ids[ref_id], hypo_length);
-	    NGrams cur_ref_ngrams = m_refs[ref_ids[ref_id]].second;
+	    const SentenceBleu& cur_ref_ngrams = m_refs[ref_ids[ref_id]].second;
 	    cerr << "reference length: " << cur_ref_length << endl;
 
 	    // compute vector c(e;{r_k}):
 	    // vector of effective reference length, number of ngrams in e, number of ngram matches between e and r_k
-	    GetNgramMatchCounts(phrase, cur_ref_ngrams, ngram_counts, ngram_matches, 0);
+	    cur_ref_ngrams.CountMatches(ids, 0, ids.size(), 0, ids.size(), ngram_counts, ngram_matches);
 
 	    // update counts and matches for every ngram length with counts from hypo
 	    for (size_t i = 0; i < BleuScoreState::bleu_order; i++) {
@@ -275,140 +277,6 @@ size_t BleuScoreFeature::GetClosestRefLength(size_t ref_id, int hypoLength) {
 	return (size_t)closestRefLength;
 }
 
-/*
- * Given a phrase (current translation) calculate its ngram counts and
- * its ngram matches against the ngrams in the reference translation
- */
-void BleuScoreFeature::GetNgramMatchCounts(Phrase& phrase,
-                                           const NGrams& ref_ngram_counts,
-                                           std::vector< size_t >& ret_counts,
-                                           std::vector< size_t >& ret_matches,
-                                           size_t skip_first) const
-{
-    NGrams::const_iterator ref_ngram_counts_iter;
-    size_t ngram_start_idx, ngram_end_idx;
-
-    // Chiang et al (2008) use unclipped counts of ngram matches
-    for (size_t end_idx = skip_first; end_idx < phrase.GetSize(); end_idx++) {
-        for (size_t order = 0; order < BleuScoreState::bleu_order; order++) {
-            if (order > end_idx) break;
-
-            ngram_end_idx = end_idx;
-            ngram_start_idx = end_idx - order;
-
-            Phrase ngram = phrase.GetSubString(WordsRange(ngram_start_idx, ngram_end_idx), 0);
-            ret_counts[order]++;
-
-            ref_ngram_counts_iter = ref_ngram_counts.find(ngram);
-            if (ref_ngram_counts_iter != ref_ngram_counts.end())
-                ret_matches[order]++;
-        }
-    }
-}
-
-// score ngrams of words that have been added before the previous word span
-void BleuScoreFeature::GetNgramMatchCounts_prefix(Phrase& phrase,
-                                           const NGrams& ref_ngram_counts,
-                                           std::vector< size_t >& ret_counts,
-                                           std::vector< size_t >& ret_matches,
-                                           size_t new_start_indices,
-                                           size_t last_end_index) const
-{
-    NGrams::const_iterator ref_ngram_counts_iter;
-    size_t ngram_start_idx, ngram_end_idx;
-
-    // Chiang et al (2008) use unclipped counts of ngram matches
-    for (size_t start_idx = 0; start_idx < new_start_indices; start_idx++) {
-        for (size_t order = 0; order < BleuScoreState::bleu_order; order++) {
-        		ngram_start_idx = start_idx;
-            ngram_end_idx = start_idx + order;
-            if (order > ngram_end_idx) break;
-            if (ngram_end_idx > last_end_index) break;
-
-            Phrase ngram = phrase.GetSubString(WordsRange(ngram_start_idx, ngram_end_idx), 0);
-            ret_counts[order]++;
-
-            ref_ngram_counts_iter = ref_ngram_counts.find(ngram);
-            if (ref_ngram_counts_iter != ref_ngram_counts.end())
-                ret_matches[order]++;
-        }
-    }
-}
-
-// score ngrams around the overlap of two previously scored phrases
-void BleuScoreFeature::GetNgramMatchCounts_overlap(Phrase& phrase,
-                                           const NGrams& ref_ngram_counts,
-                                           std::vector< size_t >& ret_counts,
-                                           std::vector< size_t >& ret_matches,
-                                           size_t overlap_index) const
-{
-    NGrams::const_iterator ref_ngram_counts_iter;
-    size_t ngram_start_idx, ngram_end_idx;
-
-    // Chiang et al (2008) use unclipped counts of ngram matches
-    for (size_t end_idx = overlap_index; end_idx < phrase.GetSize(); end_idx++) {
-    	if (end_idx >= (overlap_index+BleuScoreState::bleu_order-1)) break;
-    	for (size_t order = 0; order < BleuScoreState::bleu_order; order++) {
-            if (order > end_idx) break;
-
-            ngram_end_idx = end_idx;
-            ngram_start_idx = end_idx - order;
-            if (ngram_start_idx >= overlap_index) continue; // only score ngrams that span the overlap point
-
-            Phrase ngram = phrase.GetSubString(WordsRange(ngram_start_idx, ngram_end_idx), 0);
-            ret_counts[order]++;
-
-            ref_ngram_counts_iter = ref_ngram_counts.find(ngram);
-            if (ref_ngram_counts_iter != ref_ngram_counts.end())
-                ret_matches[order]++;
-        }
-    }
-}
-
-void BleuScoreFeature::GetClippedNgramMatchesAndCounts(Phrase& phrase,
-                                           const NGrams& ref_ngram_counts,
-                                           std::vector< size_t >& ret_counts,
-                                           std::vector< size_t >& ret_matches,
-                                           size_t skip_first) const
-{
-	NGrams::const_iterator ref_ngram_counts_iter;
-	size_t ngram_start_idx, ngram_end_idx;
-
-	Matches ngram_matches;
-	for (size_t end_idx = skip_first; end_idx < phrase.GetSize(); end_idx++) {
-		for (size_t order = 0; order < BleuScoreState::bleu_order; order++) {
-			if (order > end_idx) break;
-
-			ngram_end_idx = end_idx;
-			ngram_start_idx = end_idx - order;
-
-			Phrase ngram = phrase.GetSubString(WordsRange(ngram_start_idx, ngram_end_idx), 0);
-			ret_counts[order]++;
-
-			ref_ngram_counts_iter = ref_ngram_counts.find(ngram);
-			if (ref_ngram_counts_iter != ref_ngram_counts.end()) {
-				ngram_matches[order][ngram]++;
-			}
-		}
-	}
-
-	// clip ngram matches
-	for (size_t order = 0; order < BleuScoreState::bleu_order; order++) {
-		NGrams::const_iterator iter;
-
-		// iterate over ngram counts for every ngram order
-		for (iter=ngram_matches[order].begin(); iter != ngram_matches[order].end(); ++iter) {
-			ref_ngram_counts_iter = ref_ngram_counts.find(iter->first);
-			if (iter->second > ref_ngram_counts_iter->second) {
-				ret_matches[order] += ref_ngram_counts_iter->second;
-			}
-			else {
-				ret_matches[order] += iter->second;
-			}
-    }
-	}
-}
-
 /*
  * Given a previous state, compute Bleu score for the updated state with an additional target
  * phrase translated.
@@ -419,7 +287,6 @@ FFState* BleuScoreFeature::Evaluate(const Hypothesis& cur_hypo,
 {
 	if (!m_enabled) return new BleuScoreState();
 	
-	NGrams::const_iterator reference_ngrams_iter;
     const BleuScoreState& ps = dynamic_cast<const BleuScoreState&>(*prev_state);
     BleuScoreState* new_state = new BleuScoreState(ps);
     
@@ -439,12 +306,12 @@ FFState* BleuScoreFeature::Evaluate(const Hypothesis& cur_hypo,
     new_words.Append(cur_hypo.GetCurrTargetPhrase());
     //cerr << "NW: " << new_words << endl;
 
-    // get ngram matches for new words
-    GetNgramMatchCounts(new_words,
-                        m_cur_ref_ngrams,
-                        new_state->m_ngram_counts,
-                        new_state->m_ngram_matches,
-                        new_state->m_words.GetSize()); // number of words in previous states
+    // get ngram matches for new words, which follow the words in previous states
+    vector<SentenceBleu::WordId> ids;
+    GetWordIds(new_words, ids);
+    m_cur_ref_ngrams.CountMatches(ids, 0, ids.size(), ps.m_words.GetSize(), ids.size(),
+                                  new_state->m_ngram_counts,
+                                  new_state->m_ngram_matches);
 
     // Update state variables
     ctx_end_idx = new_words.GetSize()-1;
@@ -478,8 +345,6 @@ FFState* BleuScoreFeature::EvaluateChart(const ChartHypothesis& cur_hypo, int fe
 		ScoreComponentCollection* accumulator ) const {
   if (!m_enabled) return new BleuScoreState();
 	
-  NGrams::const_iterator reference_ngrams_iter;
-  
   const Phrase& curr_target_phrase = static_cast<const Phrase&>(cur_hypo.GetCurrTargetPhrase());
 //  cerr << "\nCur target phrase: " << cur_hypo.GetTargetLHS() << " --> " << curr_target_phrase << endl;
 
@@ -527,26 +392,24 @@ FFState* BleuScoreFeature::EvaluateChart(const ChartHypothesis& cur_hypo, int fe
   Phrase new_words = cur_hypo.GetOutputPhrase();
   new_state->m_words = new_words;
   size_t num_curr_words = new_words.GetSize();
+  vector<SentenceBleu::WordId> ids;
+  GetWordIds(new_words, ids);
 
   // get ngram matches for new words
   if (num_old_words == 0) {
 //  	cerr << "compute right ngram context" << endl;
-  	GetNgramMatchCounts(new_words,
-  											m_cur_ref_ngrams,
+  	m_cur_ref_ngrams.CountMatches(ids, 0, num_curr_words, 0, num_curr_words,
   											new_state->m_ngram_counts,
-  											new_state->m_ngram_matches,
-  											0);
+  											new_state->m_ngram_matches);
   }
   else if (new_words.GetSize() == num_old_words) {
   	// two hypotheses were glued together, compute new ngrams on the basis of first hypothesis
   	num_words_added_right = num_curr_words - num_words_first_prev;
   	// score around overlap point
 //  	cerr << "compute overlap ngram context (" << (num_words_first_prev) << ")" << endl;
-  	GetNgramMatchCounts_overlap(new_words,
-  											m_cur_ref_ngrams,
+  	m_cur_ref_ngrams.CountMatches(ids, 0, num_words_first_prev, num_words_first_prev, num_curr_words,
   											new_state->m_ngram_counts,
-  											new_state->m_ngram_matches,
-  											num_words_first_prev);
+  											new_state->m_ngram_matches);
   }
   else if (num_old_words + curr_target_phrase.GetNumTerminals() == num_curr_words) {
   	assert(curr_target_phrase.GetSize() == curr_target_phrase.GetNumTerminals()+1);
@@ -561,21 +424,16 @@ FFState* BleuScoreFeature::EvaluateChart(const ChartHypothesis& cur_hypo, int fe
   	// left context
 //  	cerr << "compute left ngram context" << endl;
   	if (num_words_added_left > 0)
-  		GetNgramMatchCounts_prefix(new_words,
-  											m_cur_ref_ngrams,
+  		m_cur_ref_ngrams.CountMatches(ids, 0, num_words_added_left, 0, num_curr_words - num_words_added_right,
   											new_state->m_ngram_counts,
-  											new_state->m_ngram_matches,
-  											num_words_added_left,
-  											num_curr_words - num_words_added_right - 1);
+  											new_state->m_ngram_matches);
 
   	// right context
 //  	cerr << "compute right ngram context" << endl;
   	if (num_words_added_right > 0)
-  		GetNgramMatchCounts(new_words,
-  											m_cur_ref_ngrams,
+  		m_cur_ref_ngrams.CountMatches(ids, 0, num_curr_words, num_words_added_left + num_old_words, num_curr_words,
   											new_state->m_ngram_counts,
-  											new_state->m_ngram_matches,
-  											num_words_added_left + num_old_words);
+  											new_state->m_ngram_matches);
   }
   else {
   	cerr << "undefined state.. " << endl;
@@ -624,11 +482,9 @@ float BleuScoreFeature::CalculateBleu(Phrase translation) const
   
   // get ngram matches for translation
   BleuScoreState* state = new BleuScoreState();
-  GetClippedNgramMatchesAndCounts(normTranslation,
-                        m_cur_ref_ngrams,
-                        state->m_ngram_counts,
-                        state->m_ngram_matches,
-                        0); // number of words in previous states
+  vector<SentenceBleu::WordId> ids;
+  GetWordIds(normTranslation, ids);
+  m_cur_ref_ngrams.CountClippedMatches(ids, state->m_ngram_counts, state->m_ngram_matches);
 
   // set state variables
   state->m_words = normTranslation;
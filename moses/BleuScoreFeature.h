@@ -12,6 +12,7 @@
 #include "FFState.h"
 #include "Phrase.h"
 #include "ChartHypothesis.h"
+#include "SentenceBleu.h"
 
 namespace Moses {
 
@@ -43,9 +44,8 @@ private:
 
 std::ostream& operator<<(std::ostream& out, const BleuScoreState& state);
 
-typedef boost::unordered_map< Phrase, size_t > NGrams;
-
-class RefValue : public  std::pair<std::vector<size_t>,NGrams>
+// reference lengths and the n-grams of all references of a sentence
+class RefValue : public  std::pair<std::vector<size_t>,SentenceBleu>
 {
 public:
   RefValue& operator=( const RefValue& rhs ) {
@@ -60,7 +60,6 @@ class BleuScoreFeature : public StatefulFeatureFunction {
 public:
 
   typedef boost::unordered_map<size_t, RefValue > RefCounts;
-  typedef boost::unordered_map<size_t, NGrams> Matches;
 
 	BleuScoreFeature():
 	                                 StatefulFeatureFunction("BleuScore",1),
@@ -107,28 +106,6 @@ public:
     		bool scaleByInverseLength, bool scaleByAvgInverseLength,
 			   float scaleByX, float historySmoothing, size_t scheme, bool simpleHistoryBleu);
 
-    void GetNgramMatchCounts(Phrase&,
-                             const NGrams&,
-                             std::vector< size_t >&,
-                             std::vector< size_t >&,
-                             size_t skip = 0) const;
-    void GetNgramMatchCounts_prefix(Phrase&,
-                             const NGrams&,
-                             std::vector< size_t >&,
-                             std::vector< size_t >&,
-                             size_t new_start_indices,
-                             size_t last_end_index) const;
-    void GetNgramMatchCounts_overlap(Phrase& phrase,
-    												 const NGrams& ref_ngram_counts,
-    												 std::vector< size_t >& ret_counts,
-    												 std::vector< size_t >& ret_matches,
-    												 size_t overlap_index) const;
-    void GetClippedNgramMatchesAndCounts(Phrase&,
-    												 const NGrams&,
-    												 std::vector< size_t >&,
-    												 std::vector< size_t >&,
-    												 size_t skip = 0) const;
-
     FFState* Evaluate( const Hypothesis& cur_hypo, 
                        const FFState* prev_state, 
                        ScoreComponentCollection* accumulator) const;
@@ -159,7 +136,7 @@ private:
     size_t m_cur_source_length;
     size_t m_cur_norm_source_length; // length without <s>, </s>
     RefCounts m_refs;
-    NGrams m_cur_ref_ngrams;
+    SentenceBleu m_cur_ref_ngrams;
     float m_cur_ref_length;
 
     // scale BLEU score by history of input length
@@ -1,13 +1,14 @@
 #include <utility>
 #include "util/check.hh"
 #include "StaticData.h"
+#include "FactorCollection.h"
 #include "CacheBasedLanguageModel.h"
 
 namespace Moses
 {
 //	CacheBasedLanguageModel::CacheBasedLanguageModel(const std::vector<std::string>& files, const size_t q_type, const size_t s_type):
 	CacheBasedLanguageModel::CacheBasedLanguageModel(const std::vector<std::string>& files, const size_t q_type, const size_t s_type, const unsigned int age):
-		StatelessFeatureFunction("CacheBasedLanguageModel",1){
+		StatelessFeatureFunction("CacheBasedLanguageModel",1), m_cache(new DecayingCache()), m_sessionCaches(new session_caches_t()), m_generation(0){
 
 		SetQueryType(q_type);	
 		SetScoreType(s_type);	
@@ -18,9 +19,6 @@ namespace Moses
 	
         void CacheBasedLanguageModel::SetPreComputedScores()
         {
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> lock(m_cacheLock);
-#endif          
                 precomputedScores.clear();
                 for (size_t i=0; i<maxAge; i++)
                 {
@@ -36,16 +34,32 @@ namespace Moses
 		}else{  // score_type = CBLM_SCORE_TYPE_XXXXXXXXX_REWARD
                         precomputedScores.push_back(0.0);
 		}
+
+                ageScores.clear();
+                for (int age=0; age<=CBLM_MAX_AGE; age++)
+                {
+                        ageScores.push_back(decaying_score(age));
+                }
         }
 
+	float CacheBasedLanguageModel::GetScore(const DecayingCache& cache, const CacheTrieNode& node, float notFoundScore) const
+	{
+		//the n-grams are aged lazily, at lookup
+		if (!node.found) return notFoundScore;
+		long age = cache.epoch - node.epoch;
+		if (age > CBLM_MAX_AGE) return notFoundScore;
+		return (age >= 0) ? ageScores[age] : decaying_score(age);
+	}
+
 	void CacheBasedLanguageModel::Evaluate(const TargetPhrase& tp, ScoreComponentCollection* out) const
 	{
+		decaying_cache_ptr cache = GetCache();
 		switch(query_type){
 		case CBLM_QUERY_TYPE_WHOLESTRING:
-			Evaluate_Whole_String(tp,out);
+			Evaluate_Whole_String(*cache,tp,out);
 			break;
 		case CBLM_QUERY_TYPE_ALLSUBSTRINGS:
-			Evaluate_All_Substrings(tp,out);
+			Evaluate_All_Substrings(*cache,tp,out);
 			break;
 		default:
 			CHECK(false);
@@ -64,131 +78,205 @@ namespace Moses
 		Evaluate(tp, accumulator);
 	}
 	
-	void CacheBasedLanguageModel::Evaluate_Whole_String(const TargetPhrase& tp, ScoreComponentCollection* out) const
+	void CacheBasedLanguageModel::Evaluate_Whole_String(const DecayingCache& cache, const TargetPhrase& tp, ScoreComponentCollection* out) const
 	{
 		//VERBOSE(1,"CacheBasedLanguageModel::Evaluate_Whole_String" << std::endl);
 		//consider all words in the TargetPhrase as one n-gram
 		// and compute the decaying_score for all words
 		// and return their sum
 		
-		decaying_cache_t::const_iterator it;
-		float score = 0.0;
-		std::string w = "";
+		float score = precomputedScores[maxAge]; // one score per phrase table 
+		const CacheTrieNode *node = cache.root.get();
 		size_t endpos = tp.GetSize();
 		for (size_t pos = 0 ; pos < endpos ; ++pos) {
-			if (pos > 0){ w += " "; }
-			w += tp.GetWord(pos).GetFactor(0)->GetString();
-		}
-		it = m_cache.find(w);
-		
-		if (it != m_cache.end()) //found!
-		{
-			score = ((*it).second).second;
-			VERBOSE(3,"cblm::Evaluate: found w:|" << w << "| score:|" << score << "|" << std::endl);
-		}
-		else{
-			score = precomputedScores[maxAge]; // one score per phrase table 
-			VERBOSE(3,"cblm::Evaluate: not found w:|" << w << "| score:|" << score << "|" << std::endl);
+			boost::unordered_map<const Factor*, cache_trie_ptr>::const_iterator child = node->children.find(tp.GetWord(pos).GetFactor(0));
+			if (child == node->children.end()) {
+				break;
+			}
+			node = child->second.get();
+			if (pos == endpos - 1) //found!
+			{
+				score = GetScore(cache, *node, score);
+			}
 		}
 		VERBOSE(3,"cblm::Evaluate: phrase:|" << tp << "| score:|" << score << "|" << std::endl);
 		
 		out->PlusEquals(this, score);
 	}
 	
-	void CacheBasedLanguageModel::Evaluate_All_Substrings(const TargetPhrase& tp, ScoreComponentCollection* out) const
+	void CacheBasedLanguageModel::Evaluate_All_Substrings(const DecayingCache& cache, const TargetPhrase& tp, ScoreComponentCollection* out) const
 	{
 		//VERBOSE(1,"CacheBasedLanguageModel::Evaluate_All_Substrings" << std::endl);
 		//loop over all n-grams in the TargetPhrase (no matter of n)
 		// and compute the decaying_score for all words
 		// and return their sum
+		//each start position walks the trie once; once no cached n-gram extends the current one,
+		//all the longer n-grams get the score of the unknown ones without further lookups
 		
-		decaying_cache_t::const_iterator it;
+		const float notFoundScore = precomputedScores[maxAge]; // one score per phrase table
 		float score = 0.0;
 		size_t tp_size = tp.GetSize();
 		for (size_t startpos = 0 ; startpos < tp_size ; ++startpos) {
-			std::string w = "";
+			const CacheTrieNode *node = cache.root.get();
+			bool prefix = true;
 			for (size_t endpos = startpos; endpos < tp_size ; ++endpos) {
-                                if (endpos > startpos){ w += " "; }
-				w += tp.GetWord(endpos).GetFactor(0)->GetString();
-				it = m_cache.find(w);
-				
-				float tmpsc;
-				if (it != m_cache.end()) //found!
-				{
-					tmpsc = ((*it).second).second;
-					VERBOSE(3,"cblm::Evaluate: found w:|" << w << "| score:|" << tmpsc << "|" << std::endl);
+				float tmpsc = notFoundScore;
+				if (prefix) {
+					boost::unordered_map<const Factor*, cache_trie_ptr>::const_iterator child = node->children.find(tp.GetWord(endpos).GetFactor(0));
+					if (child == node->children.end()) {
+						prefix = false;
+					} else {
+						node = child->second.get();
+						if (node->found) //found!
+						{
+							tmpsc = GetScore(cache, *node, notFoundScore);
+							VERBOSE(3,"cblm::Evaluate: found span:|" << startpos << "-" << endpos << "| score:|" << tmpsc << "|" << std::endl);
+						}
+					}
 				}
-		                else{
-        		                tmpsc = precomputedScores[maxAge]; // one score per phrase table  
-					VERBOSE(3,"cblm::Evaluate: not found w:|" << w << "| score:|" << tmpsc << "|" << std::endl);
-                		}
 				score += ( tmpsc /  ( tp_size + startpos - endpos ) );	
-				VERBOSE(3,"cblm::Evaluate: actual score:|" << score << "|" << std::endl);
 			}
 		}
 		VERBOSE(3,"cblm::Evaluate: phrase:|" << tp << "| score:|" << score << "|" << std::endl);
 		out->PlusEquals(this, score);
 	}
 	
-	void CacheBasedLanguageModel::Print() const
+	decaying_cache_ptr CacheBasedLanguageModel::GetCache() const
+	{
+		const std::string &session = StaticData::Instance().GetThreadSession();
+		if (!session.empty())
+		{
+			boost::shared_ptr<const session_caches_t> sessions = boost::atomic_load(&m_sessionCaches);
+			session_caches_t::const_iterator it = sessions->find(session);
+			if (it != sessions->end()) return it->second;
+		}
+		return boost::atomic_load(&m_cache);
+	}
+
+	void CacheBasedLanguageModel::PublishCache(const decaying_cache_ptr &cache)
+	{
+		const std::string &session = StaticData::Instance().GetThreadSession();
+		if (session.empty())
+		{
+			boost::atomic_store(&m_cache, cache);
+			return;
+		}
+		boost::shared_ptr<session_caches_t> sessions(new session_caches_t(*m_sessionCaches));
+		(*sessions)[session] = cache;
+		boost::atomic_store(&m_sessionCaches, boost::shared_ptr<const session_caches_t>(sessions));
+	}
+
+	void CacheBasedLanguageModel::DropSession(const std::string &session)
 	{
 #ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> read_lock(m_cacheLock);
-#endif          
-		decaying_cache_t::const_iterator it;
+		boost::mutex::scoped_lock lock(m_writeLock);
+#endif
+		if (m_sessionCaches->find(session) == m_sessionCaches->end()) return;
+		boost::shared_ptr<session_caches_t> sessions(new session_caches_t(*m_sessionCaches));
+		sessions->erase(session);
+		boost::atomic_store(&m_sessionCaches, boost::shared_ptr<const session_caches_t>(sessions));
+	}
+
+	void CacheBasedLanguageModel::Print() const
+	{
+		decaying_cache_ptr cache = GetCache();
+		std::map<std::string, long> ages;
+		CollectAges(*cache->root, "", cache->epoch, ages);
+		std::map<std::string, long>::const_iterator it;
 		std::cout << "Content of the cache of Cache-Based Language Model" << std::endl;
-		for ( it=m_cache.begin() ; it != m_cache.end(); it++ )
+		for ( it=ages.begin() ; it != ages.end(); it++ )
 		{
-			std::cout << "word:|" << (*it).first << "| age:|" << ((*it).second).first << "| score:|" << ((*it).second).second << "|" << std::endl;
+			std::cout << "word:|" << (*it).first << "| age:|" << (*it).second << "| score:|" << decaying_score((*it).second) << "|" << std::endl;
 		}
 	}
-	
-	void CacheBasedLanguageModel::Decay()
+
+	void CacheBasedLanguageModel::CollectAges(const CacheTrieNode &node, const std::string &ngram, long epoch, std::map<std::string, long> &ages) const
 	{
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> lock(m_cacheLock);
-#endif          
-		decaying_cache_t::iterator it;
-		
-		int age;
-		float score;
-		for ( it=m_cache.begin() ; it != m_cache.end(); it++ )
+		if (node.found && epoch - node.epoch <= CBLM_MAX_AGE)
 		{
-			age=((*it).second).first + 1;
-			if (age > 1000)
-			{
-				m_cache.erase(it);
-				it--;
-			}
-			else
-			{
-				score = decaying_score(age);
-				decaying_cache_value_t p (age, score);
-				(*it).second = p;
-			}
+			ages[ngram] = epoch - node.epoch;
+		}
+		boost::unordered_map<const Factor*, cache_trie_ptr>::const_iterator it;
+		for ( it=node.children.begin() ; it != node.children.end(); it++ )
+		{
+			CollectAges(*it->second, ngram.empty() ? it->first->GetString() : ngram + " " + it->first->GetString(), epoch, ages);
 		}
 	}
-	
-	void CacheBasedLanguageModel::Update(std::vector<std::string> words, int age)
+
+	CacheTrieNode* CacheBasedLanguageModel::Own(cache_trie_ptr &node, long generation)
 	{
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> lock(m_cacheLock);
-#endif          
+		//nodes of older generations may be read by other threads: they are copied rather than modified
+		if (!node)
+		{
+			node.reset(new CacheTrieNode(generation));
+		}
+		else if (node->generation != generation)
+		{
+			node.reset(new CacheTrieNode(*node));
+			node->generation = generation;
+		}
+		return node.get();
+	}
+
+	cache_trie_ptr CacheBasedLanguageModel::Prune(cache_trie_ptr node, long epoch, long generation)
+	{
+		//drops the n-grams which left the cache; the subtrees without any of them are kept as they are
+		cache_trie_ptr pruned = node;
+		if (node->found && epoch - node->epoch > CBLM_MAX_AGE)
+		{
+			Own(pruned, generation)->found = false;
+		}
+		boost::unordered_map<const Factor*, cache_trie_ptr>::const_iterator it;
+		for ( it=node->children.begin() ; it != node->children.end(); it++ )
+		{
+			cache_trie_ptr child = Prune(it->second, epoch, generation);
+			if (child == it->second) continue;
+			if (child) Own(pruned, generation)->children[it->first] = child;
+			else Own(pruned, generation)->children.erase(it->first);
+		}
+		if (!pruned->found && pruned->children.empty()) return cache_trie_ptr();
+		return pruned;
+	}
+
+	void CacheBasedLanguageModel::Update(DecayingCache &cache, std::vector<std::string> words, int age, long generation)
+	{
+		FactorCollection &factorCollection = FactorCollection::Instance();
 		for (size_t j=0; j<words.size(); j++)
 		{
 			words[j] = Trim(words[j]);
 			VERBOSE(3,"CacheBasedLanguageModel::Update   word[" << j << "]:"<< words[j] << " age:" << age << " decaying_score(age):" << decaying_score(age) << std::endl);
-			decaying_cache_value_t p (age,decaying_score(age));
-			std::pair<std::string, decaying_cache_value_t> e (words[j],p);
-			m_cache.erase(words[j]); //always erase the element (do nothing if the entry does not exist)
-			m_cache.insert(e); //insert the entry
+			std::vector<std::string> ngram = Tokenize(words[j]);
+			if (ngram.empty()) continue;
+
+			//only the path to the n-gram is copied
+			CacheTrieNode *node = Own(cache.root, generation);
+			for (size_t k=0; k<ngram.size(); k++)
+			{
+				node = Own(node->children[factorCollection.AddFactor(ngram[k])], generation);
+			}
+			node->found = true;
+			node->epoch = cache.epoch - age;
 		}
 	}
 	
 	void CacheBasedLanguageModel::Insert(std::vector<std::string> ngrams)
 	{
-		Decay();
-		Update(ngrams,1);
+		{
+#ifdef WITH_THREADS
+			boost::mutex::scoped_lock lock(m_writeLock);
+#endif
+			//all the n-grams age by moving to the next epoch
+			boost::shared_ptr<DecayingCache> cache(new DecayingCache(*GetCache()));
+			long generation = ++m_generation;
+			cache->epoch++;
+			if (cache->epoch % CBLM_MAX_AGE == 0)
+			{
+				cache->root = Prune(cache->root, cache->epoch, generation);
+				if (!cache->root) cache->root.reset(new CacheTrieNode(generation));
+			}
+			Update(*cache,ngrams,1,generation);
+			PublishCache(decaying_cache_ptr(cache));
+		}
 		IFVERBOSE(2) Print();
 	}
 	
@@ -252,24 +340,27 @@ namespace Moses
 		int age;
 		std::vector<std::string> words;
 		
+#ifdef WITH_THREADS
+		boost::mutex::scoped_lock lock(m_writeLock);
+#endif
+		boost::shared_ptr<DecayingCache> cache(new DecayingCache(*GetCache()));
+		long generation = ++m_generation;
 		while (getline(cacheFile, line)) {
 			std::vector<std::string> vecStr = TokenizeMultiCharSeparator( line , "||" );
 			if (vecStr.size() >= 2) {
 				age = Scan<int>(vecStr[0]);
 				vecStr.erase(vecStr.begin());
-				Update(vecStr,age);
+				Update(*cache,vecStr,age,generation);
 			} else {
 				TRACE_ERR("ERROR: The format of the loaded file is wrong: " << line << std::endl);
 				CHECK(false);
 			}
 		}
+		PublishCache(decaying_cache_ptr(cache));
 		IFVERBOSE(2) Print();
 	}
 	
         void CacheBasedLanguageModel::SetQueryType(size_t type) {
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> read_lock(m_cacheLock);
-#endif
 
 		query_type = type;
                 if ( query_type != CBLM_QUERY_TYPE_WHOLESTRING
@@ -283,9 +374,6 @@ namespace Moses
 	};
 
         void CacheBasedLanguageModel::SetScoreType(size_t type) {
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> read_lock(m_cacheLock);
-#endif
                 score_type = type;
                 if ( score_type != CBLM_SCORE_TYPE_HYPERBOLA
                         && score_type != CBLM_SCORE_TYPE_POWER
@@ -302,9 +390,6 @@ namespace Moses
         };
 
         void CacheBasedLanguageModel::SetMaxAge(unsigned int age) {
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> read_lock(m_cacheLock);
-#endif
                 maxAge = age;
                 VERBOSE(2, "CacheBasedLanguageModel MaxAge:  " << maxAge << std::endl);
         };
@@ -313,12 +398,12 @@ namespace Moses
 
         void CacheBasedLanguageModel::Clear() {
 #ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> lock(m_cacheLock);
+                boost::mutex::scoped_lock lock(m_writeLock);
 #endif
-                m_cache.clear();
+                PublishCache(decaying_cache_ptr(new DecayingCache()));
         };
 
-	float CacheBasedLanguageModel::decaying_score(const int age)
+	float CacheBasedLanguageModel::decaying_score(const int age) const
 	{
 		float sc;
                 switch(score_type){
@@ -6,14 +6,14 @@
 #include "FeatureFunction.h"
 #include "InputFileStream.h"
 
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #ifdef WITH_THREADS
-#include <boost/thread/shared_mutex.hpp>
-#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 #endif
 
-typedef std::pair<int, float> decaying_cache_value_t; 
-typedef std::map<std::string, decaying_cache_value_t > decaying_cache_t; 
-
 #define CBLM_QUERY_TYPE_ALLSUBSTRINGS 0
 #define CBLM_QUERY_TYPE_WHOLESTRING 1
 
@@ -25,11 +25,39 @@ typedef std::map<std::string, decaying_cache_value_t > decaying_cache_t;
 #define CBLM_SCORE_TYPE_POWER_REWARD 11
 #define CBLM_SCORE_TYPE_EXPONENTIAL_REWARD 12
 #define PI 3.14159265
+#define CBLM_MAX_AGE 1000 //n-grams older than that leave the cache
 
 namespace Moses
 {
 
 class WordsRange;
+class Factor;
+
+struct CacheTrieNode;
+typedef boost::shared_ptr<CacheTrieNode> cache_trie_ptr;
+
+//! node of the word trie indexing the n-grams of the cache;
+//! a node is never modified once published, so each version of the cache shares
+//! with the previous one all the nodes its change did not touch
+struct CacheTrieNode
+{
+  boost::unordered_map<const Factor*, cache_trie_ptr> children;
+  bool found; // an n-gram of the cache ends here
+  long epoch; // epoch of the (last) insertion of that n-gram
+  long generation; // the version of the cache which created the node, the only one allowed to modify it
+  CacheTrieNode(long g) : found(false), epoch(0), generation(g) {}
+};
+
+//! content of the cache: the trie of its n-grams;
+// the age of an n-gram is not stored: it is the distance between the epoch of the cache and the epoch of its (last) insertion
+struct DecayingCache
+{
+  cache_trie_ptr root;
+  long epoch; // incremented at each Insert
+  DecayingCache() : root(new CacheTrieNode(0)), epoch(0) {}
+};
+typedef boost::shared_ptr<const DecayingCache> decaying_cache_ptr;
+typedef boost::unordered_map<std::string, decaying_cache_ptr> session_caches_t;
 
 /** Calculates Cache-based Language Model score
  */
@@ -37,25 +65,39 @@ class CacheBasedLanguageModel : public StatelessFeatureFunction
 {
 // data structure for the cache;
 // the key is the word and the value is the decaying score
-  decaying_cache_t m_cache;
+// the published cache is immutable and only accessed through boost::atomic_load/atomic_store:
+// writers publish a modified copy, readers never block
+  decaying_cache_ptr m_cache;
   std::vector<float> precomputedScores;
+  std::vector<float> ageScores; //decaying_score of the ages up to CBLM_MAX_AGE
   unsigned int maxAge;
 
   size_t query_type; //way of querying the cache
   size_t score_type; //scoring type of the match
+// caches of the sessions which changed theirs; a session reads the shared
+// cache until its first change, which starts its own from a copy of it;
+// the map is published like the caches, so looking a session up takes no lock
+  boost::shared_ptr<const session_caches_t> m_sessionCaches;
+  long m_generation; //last version of the caches; only changed under m_writeLock
 #ifdef WITH_THREADS
-  //multiple readers - single writer lock
-  mutable boost::shared_mutex m_cacheLock;
+  //serializes the writers
+  boost::mutex m_writeLock;
 #endif
 
-  float decaying_score(int age);
+  float decaying_score(int age) const;
   void SetPreComputedScores();
+  float GetScore(const DecayingCache &cache, const CacheTrieNode &node, float notFoundScore) const;
+
+  decaying_cache_ptr GetCache() const; //cache of the session of the calling thread
+  void PublishCache(const decaying_cache_ptr &cache); //the caller holds m_writeLock
 
-  void Evaluate_Whole_String( const TargetPhrase&, ScoreComponentCollection* ) const;
-  void Evaluate_All_Substrings( const TargetPhrase&, ScoreComponentCollection* ) const;
+  void Evaluate_Whole_String( const DecayingCache&, const TargetPhrase&, ScoreComponentCollection* ) const;
+  void Evaluate_All_Substrings( const DecayingCache&, const TargetPhrase&, ScoreComponentCollection* ) const;
 
-  void Decay();
-  void Update(std::vector<std::string> words, int age);
+  static CacheTrieNode* Own(cache_trie_ptr &node, long generation);
+  static cache_trie_ptr Prune(cache_trie_ptr node, long epoch, long generation);
+  void Update(DecayingCache &cache, std::vector<std::string> words, int age, long generation);
+  void CollectAges(const CacheTrieNode &node, const std::string &ngram, long epoch, std::map<std::string, long> &ages) const;
   void Execute(std::string command);
   void Load(const std::string file);
 	
@@ -77,6 +119,7 @@ public:
   void Insert(std::vector<std::string> ngrams);
   void Execute(std::vector<std::string> commands);
   void Load(std::vector<std::string> files);
+  void DropSession(const std::string &session); //the session goes back to the shared cache
   void Evaluate(const PhraseBasedFeatureContext& context,	ScoreComponentCollection* accumulator) const;
   void EvaluateChart(const ChartBasedFeatureContext& context, ScoreComponentCollection* accumulator) const;
 };
@@ -25,6 +25,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "TranslationOptionCollection.h"
 #include "PartialTranslOptColl.h"
 #include "FactorCollection.h"
+#include "StaticData.h"
 
 namespace Moses
 {
@@ -46,6 +47,16 @@ TranslationOption *DecodeStepTranslation::MergeTranslation(const TranslationOpti
 }
 
 
+void DecodeStepTranslation::GetTargetPhrases(const TargetPhraseCollection &phraseColl, size_t tableLimit, bool adhereTableLimit
+    , std::vector<const TargetPhrase*> &targetPhrases) const
+{
+  if (!adhereTableLimit || tableLimit == 0 || phraseColl.GetSize() <= tableLimit) {
+    targetPhrases.assign(phraseColl.begin(), phraseColl.end());
+  } else {
+    phraseColl.NthElement(tableLimit, StaticData::Instance().GetThreadWeightSnapshot(), targetPhrases);
+  }
+}
+
 void DecodeStepTranslation::Process(const TranslationSystem* system
                                     , const TranslationOption &inputPartialTranslOpt
                                     , const DecodeStep &decodeStep
@@ -72,10 +83,11 @@ void DecodeStepTranslation::Process(const TranslationSystem* system
     phraseDictionary->GetTargetPhraseCollection(toc->GetSource(),sourceWordsRange);
 
   if (phraseColl != NULL) {
-    TargetPhraseCollection::const_iterator iterTargetPhrase, iterEnd;
-    iterEnd = (!adhereTableLimit || tableLimit == 0 || phraseColl->GetSize() < tableLimit) ? phraseColl->end() : phraseColl->begin() + tableLimit;
+    std::vector<const TargetPhrase*> targetPhrases;
+    GetTargetPhrases(*phraseColl, tableLimit, adhereTableLimit, targetPhrases);
 
-    for (iterTargetPhrase = phraseColl->begin(); iterTargetPhrase != iterEnd; ++iterTargetPhrase) {
+    std::vector<const TargetPhrase*>::const_iterator iterTargetPhrase;
+    for (iterTargetPhrase = targetPhrases.begin(); iterTargetPhrase != targetPhrases.end(); ++iterTargetPhrase) {
       const TargetPhrase& targetPhrase = **iterTargetPhrase;
       // skip if the
       if (targetPhrase.GetSize() != currSize) continue;
@@ -111,10 +123,11 @@ void DecodeStepTranslation::ProcessInitialTranslation(const TranslationSystem* s
         TRACE_ERR("[" << startPos << "-" << endPos << "]" << std::endl);
     }
 
-    TargetPhraseCollection::const_iterator iterTargetPhrase, iterEnd;
-    iterEnd = (!adhereTableLimit || tableLimit == 0 || phraseColl->GetSize() < tableLimit) ? phraseColl->end() : phraseColl->begin() + tableLimit;
+    std::vector<const TargetPhrase*> targetPhrases;
+    GetTargetPhrases(*phraseColl, tableLimit, adhereTableLimit, targetPhrases);
 
-    for (iterTargetPhrase = phraseColl->begin() ; iterTargetPhrase != iterEnd ; ++iterTargetPhrase) {
+    std::vector<const TargetPhrase*>::const_iterator iterTargetPhrase;
+    for (iterTargetPhrase = targetPhrases.begin() ; iterTargetPhrase != targetPhrases.end() ; ++iterTargetPhrase) {
       const TargetPhrase	&targetPhrase = **iterTargetPhrase;
       outputPartialTranslOptColl.Add (system, new TranslationOption(wordsRange, targetPhrase, source) );
 
@@ -60,6 +60,14 @@ private:
   	This function runs IsCompatible() to ensure the two can be merged
   */
   TranslationOption *MergeTranslation(const TranslationOption& oldTO, const TargetPhrase &targetPhrase) const;
+
+  /*! the phrases of phraseColl to expand. A collection holding more than the
+  	table limit is ranked under the weights the thread decodes with, which may
+  	have changed since the phrase table was scored. The collection keeps its
+  	ranking until it is looked up under another weight snapshot
+  */
+  void GetTargetPhrases(const TargetPhraseCollection &phraseColl, size_t tableLimit, bool adhereTableLimit
+                        , std::vector<const TargetPhrase*> &targetPhrases) const;
 };
 
 
@@ -0,0 +1,149 @@
+/***********************************************************************
+Moses - factored phrase-based language decoder
+Copyright (C) 2013- University of Edinburgh
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+***********************************************************************/
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/test/unit_test.hpp>
+
+#include "TranslationModel/DynSuffixArray.h"
+
+using namespace std;
+
+namespace Moses
+{
+
+// compares the arrays of a DynSuffixArray with those of a brute-force suffix sort
+class DynSuffixArrayTest
+{
+public:
+  explicit DynSuffixArrayTest(const vuint_t &corpus) : m_corpus(corpus) {}
+
+  void Check(DynSuffixArray &sa) const {
+    const size_t size = m_corpus.size();
+    vuint_t expected(size);
+    for (size_t i = 0; i < size; ++i) expected[i] = i;
+    sort(expected.begin(), expected.end(), SuffixLess(m_corpus));
+    BOOST_REQUIRE_EQUAL(sa.m_SA->size(), size);
+    BOOST_CHECK(*sa.m_SA == expected);
+    for (size_t i = 0; i < size; ++i) {
+      BOOST_CHECK_EQUAL(sa.m_ISA->at(expected[i]), i);
+      BOOST_CHECK_EQUAL(sa.m_F->at(i), m_corpus[expected[i]]);
+      BOOST_CHECK_EQUAL(sa.m_L->at(i), m_corpus[expected[i] == 0 ? size - 1 : expected[i] - 1]);
+    }
+  }
+
+  static const unsigned kVocab = 6;
+
+private:
+  struct SuffixLess {
+    const vuint_t &m_corpus;
+    SuffixLess(const vuint_t &corpus) : m_corpus(corpus) {}
+    bool operator()(size_t a, size_t b) const {
+      return lexicographical_compare(m_corpus.begin() + a, m_corpus.end(), m_corpus.begin() + b, m_corpus.end());
+    }
+  };
+
+  const vuint_t &m_corpus;
+};
+
+}
+
+using namespace Moses;
+
+BOOST_AUTO_TEST_SUITE(dyn_suffix_array)
+
+namespace
+{
+// random words: with a corpus this short, no two suffixes share the 20 words
+// the suffix array orders them on
+vuint_t RandomWords(size_t size)
+{
+  vuint_t words(size);
+  for (size_t i = 0; i < size; ++i) words[i] = 1 + rand() % DynSuffixArrayTest::kVocab;
+  return words;
+}
+}
+
+BOOST_AUTO_TEST_CASE(append)
+{
+  srand(1);
+  vuint_t corpus = RandomWords(200);
+  DynSuffixArray sa(&corpus);
+  DynSuffixArrayTest check(corpus);
+  check.Check(sa);
+  const vuint_t added = RandomWords(60);
+  const unsigned oldSize = corpus.size();
+  corpus.insert(corpus.end(), added.begin(), added.end());
+  sa.Append(oldSize);
+  check.Check(sa);
+}
+
+BOOST_AUTO_TEST_CASE(insert)
+{
+  srand(2);
+  vuint_t corpus = RandomWords(200);
+  DynSuffixArray sa(&corpus);
+  DynSuffixArrayTest check(corpus);
+  // at the end, at the start, then in the middle
+  const unsigned positions[] = {200, 0, 97};
+  for (size_t i = 0; i < 3; ++i) {
+    vuint_t sentence = RandomWords(8);
+    corpus.insert(corpus.begin() + positions[i], sentence.begin(), sentence.end());
+    sa.Insert(&sentence, positions[i]);
+    check.Check(sa);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(delete_words)
+{
+  srand(3);
+  vuint_t corpus = RandomWords(200);
+  DynSuffixArray sa(&corpus);
+  DynSuffixArrayTest check(corpus);
+  corpus.erase(corpus.begin() + 50, corpus.begin() + 56);
+  sa.Delete(50, 6);
+  check.Check(sa);
+  corpus.erase(corpus.begin() + 180, corpus.end());
+  sa.Delete(180, 14);
+  check.Check(sa);
+}
+
+BOOST_AUTO_TEST_CASE(mixed_updates)
+{
+  srand(4);
+  vuint_t corpus = RandomWords(100);
+  DynSuffixArray sa(&corpus);
+  DynSuffixArrayTest check(corpus);
+  for (size_t i = 0; i < 30; ++i) {
+    const unsigned index = rand() % (corpus.size() + 1);
+    if (i % 3 == 2 && index < corpus.size()) {
+      const unsigned num = std::min<unsigned>(1 + rand() % 10, corpus.size() - index);
+      corpus.erase(corpus.begin() + index, corpus.begin() + index + num);
+      sa.Delete(index, num);
+    } else {
+      vuint_t sentence = RandomWords(1 + rand() % 10);
+      corpus.insert(corpus.begin() + index, sentence.begin(), sentence.end());
+      sa.Insert(&sentence, index);
+    }
+    check.Check(sa);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
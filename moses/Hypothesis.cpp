@@ -43,10 +43,6 @@ using namespace std;
 namespace Moses
 {
 
-#ifdef USE_HYPO_POOL
-ObjectPool<Hypothesis> Hypothesis::s_objectPool("Hypothesis", 300000);
-#endif
-
 Hypothesis::Hypothesis(Manager& manager, InputType const& source, const TargetPhrase &emptyTarget)
   : m_prevHypo(NULL)
   , m_targetPhrase(emptyTarget)
@@ -113,10 +109,13 @@ Hypothesis::~Hypothesis()
     delete m_ffStates[i];
 
   if (m_arcList) {
+    // the arcs share our pool; they are not read, as the pool may already
+    // have destroyed them when it is reset
+    HypothesisPool &pool = m_manager.GetHypothesisPool();
     ArcList::iterator iter;
     for (iter = m_arcList->begin() ; iter != m_arcList->end() ; ++iter) {
 //      cerr<<"REMOVING destructor : "<<(*iter)->ToString()<<"\n";
-      FREEHYPO(*iter);
+      pool.freeObject(*iter);
     }
     m_arcList->clear();
 
@@ -196,12 +195,8 @@ Hypothesis* Hypothesis::Create(const Hypothesis &prevHypo, const TranslationOpti
 
   if (createHypothesis) {
 
-#ifdef USE_HYPO_POOL
-    Hypothesis *ptr = s_objectPool.getPtr();
+    Hypothesis *ptr = prevHypo.GetManager().GetHypothesisPool().getPtr();
     return new(ptr) Hypothesis(prevHypo, transOpt);
-#else
-    return new Hypothesis(prevHypo, transOpt);
-#endif
 
   } else {
     // If the previous hypothesis plus the proposed translation option
@@ -217,12 +212,13 @@ Hypothesis* Hypothesis::Create(const Hypothesis &prevHypo, const TranslationOpti
 
 Hypothesis* Hypothesis::Create(Manager& manager, InputType const& m_source, const TargetPhrase &emptyTarget)
 {
-#ifdef USE_HYPO_POOL
-  Hypothesis *ptr = s_objectPool.getPtr();
+  Hypothesis *ptr = manager.GetHypothesisPool().getPtr();
   return new(ptr) Hypothesis(manager, m_source, emptyTarget);
-#else
-  return new Hypothesis(manager, m_source, emptyTarget);
-#endif
+}
+
+void Hypothesis::Free(Hypothesis *hypo)
+{
+  hypo->m_manager.GetHypothesisPool().freeObject(hypo);
 }
 
 /** check, if two hypothesis can be recombined.
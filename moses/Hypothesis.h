@@ -50,6 +50,7 @@ class Manager;
 class LexicalReordering;
 
 typedef std::vector<Hypothesis*> ArcList;
+typedef ObjectPool<Hypothesis> HypothesisPool;
 
 /** Used to store a state in the beam search
     for the best translation. With its link back to the previous hypothesis
@@ -64,8 +65,6 @@ class Hypothesis
   friend std::ostream& operator<<(std::ostream&, const Hypothesis&);
 
 protected:
-  static ObjectPool<Hypothesis> s_objectPool;
-
   const Hypothesis* m_prevHypo; /*! backpointer to previous hypothesis (from which this one was created) */
 //	const Phrase			&m_targetPhrase; /*! target phrase being created at the current decoding step */
   const TargetPhrase			&m_targetPhrase; /*! target phrase being created at the current decoding step */
@@ -95,12 +94,12 @@ protected:
   Hypothesis(const Hypothesis &prevHypo, const TranslationOption &transOpt);
 
 public:
-  static ObjectPool<Hypothesis> &GetObjectPool() {
-    return s_objectPool;
-  }
-
   ~Hypothesis();
 
+  /** give the hypothesis back to the pool of the manager that created it.
+   *  It is destroyed when its memory is reused or the manager goes away */
+  static void Free(Hypothesis *hypo);
+
   /** return the subclass of Hypothesis most appropriate to the given translation option */
   static Hypothesis* Create(const Hypothesis &prevHypo, const TranslationOption &transOpt, const Phrase* constraint);
 
@@ -292,17 +291,7 @@ struct CompareHypothesisTotalScore {
   }
 };
 
-#ifdef USE_HYPO_POOL
-
-#define FREEHYPO(hypo) \
-{ \
-	ObjectPool<Hypothesis> &pool = Hypothesis::GetObjectPool(); \
-	pool.freeObject(hypo); \
-} \
- 
-#else
-#define FREEHYPO(hypo) delete hypo
-#endif
+#define FREEHYPO(hypo) Hypothesis::Free(hypo)
 
 /** defines less-than relation on hypotheses.
 * The particular order is not important for us, we need just to figure out
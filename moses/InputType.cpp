@@ -28,7 +28,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 namespace Moses
 {
 
-InputType::InputType(long translationId) : m_translationId(translationId)
+InputType::InputType(long translationId) : m_translationId(translationId), m_taskId(-1)
 {
   m_frontSpanCoveredLength = 0;
   m_sourceCompleted.resize(0);
@@ -65,6 +65,7 @@ public:
   std::string m_initialTargetPhrase;
   size_t m_frontSpanCoveredLength;
   std::string m_postedited;
+  int m_taskId; // task of multi-task learning, -1 if none
   // how many words from the beginning are covered
 
   InputType(long translationId = 0);
@@ -81,6 +82,15 @@ public:
   void SetPostEditedSentence(std::string s) {
 	  m_postedited = s;
   }
+  const std::string &GetPostEditedSentence() const {
+    return m_postedited;
+  }
+  void SetTaskId(int taskId) {
+    m_taskId = taskId;
+  }
+  int GetTaskId() const {
+    return m_taskId;
+  }
   long GetDocumentId() const {
     return m_documentId;
   }
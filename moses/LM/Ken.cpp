@@ -41,6 +41,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "moses/Incremental.h"
 
 #include <boost/shared_ptr.hpp>
+#ifdef WITH_THREADS
+#include <boost/thread/tss.hpp>
+#endif
 
 using namespace std;
 
@@ -57,6 +60,116 @@ struct KenLMState : public FFState {
   }
 };
 
+/*
+ * Memo of Model::FullScore queries made while decoding one sentence.  Large
+ * beams keep asking for the same (context, word) pairs, and a hit here is
+ * cheaper than the probing/trie lookup.  Open addressing with a short linear
+ * probe over a power-of-two table; a slot only counts if it carries the
+ * stamp of the current sentence, so NewSentence() is O(1).
+ */
+class KenLMQueryMemo {
+  public:
+    explicit KenLMQueryMemo(std::size_t size) : m_stamp(1), m_hits(0), m_lookups(0) {
+      std::size_t capacity = 1;
+      while (capacity < size) capacity <<= 1;
+      m_table.resize(capacity);
+      m_mask = capacity - 1;
+    }
+
+    void NewSentence() {
+      if (++m_stamp == 0) {
+        for (std::size_t i = 0; i < m_table.size(); ++i) m_table[i].stamp = 0;
+        m_stamp = 1;
+      }
+      m_hits = 0;
+      m_lookups = 0;
+    }
+
+    template <class Model> lm::FullScoreReturn FullScore(const Model &model, const lm::ngram::State &in_state, lm::WordIndex word, lm::ngram::State &out_state) {
+      ++m_lookups;
+      std::size_t slot = lm::ngram::hash_value(in_state, word) & m_mask;
+      std::size_t victim = slot;
+      for (std::size_t probe = 0; probe < kMaxProbes; ++probe, slot = (slot + 1) & m_mask) {
+        Entry &entry = m_table[slot];
+        if (entry.stamp != m_stamp) {
+          victim = slot;
+          break;
+        }
+        if (entry.word == word && entry.in == in_state) {
+          ++m_hits;
+          out_state = entry.out;
+          return entry.ret;
+        }
+      }
+      // miss: take the first free slot, or evict the home slot if the probe ran full
+      Entry &entry = m_table[victim];
+      entry.stamp = m_stamp;
+      entry.word = word;
+      entry.in = in_state;
+      entry.ret = model.FullScore(entry.in, word, entry.out);
+      out_state = entry.out;
+      return entry.ret;
+    }
+
+    uint64_t GetHits() const {
+      return m_hits;
+    }
+    uint64_t GetLookups() const {
+      return m_lookups;
+    }
+
+  private:
+    static const std::size_t kMaxProbes = 4;
+
+    struct Entry {
+      Entry() : stamp(0) {}
+      unsigned int stamp;
+      lm::WordIndex word;
+      lm::ngram::State in;
+      lm::ngram::State out;
+      lm::FullScoreReturn ret;
+    };
+
+    std::vector<Entry> m_table;
+    std::size_t m_mask;
+    unsigned int m_stamp;
+    uint64_t m_hits, m_lookups;
+};
+
+/*
+ * Presents a model to lm::ngram::RuleScore with FullScore going through the
+ * memo, so chart decoding shares the cache with phrase-based decoding.
+ */
+template <class Model> class MemoizedModel {
+  public:
+    MemoizedModel(const Model &model, KenLMQueryMemo *memo) : m_model(model), m_memo(memo) {}
+
+    const lm::ngram::State &BeginSentenceState() const {
+      return m_model.BeginSentenceState();
+    }
+
+    unsigned char Order() const {
+      return m_model.Order();
+    }
+
+    lm::FullScoreReturn FullScore(const lm::ngram::State &in_state, lm::WordIndex word, lm::ngram::State &out_state) const {
+      if (m_memo) return m_memo->FullScore(m_model, in_state, word, out_state);
+      return m_model.FullScore(in_state, word, out_state);
+    }
+
+    lm::FullScoreReturn ExtendLeft(const lm::WordIndex *add_rbegin, const lm::WordIndex *add_rend, const float *backoff_in, uint64_t extend_pointer, unsigned char extend_length, float *backoff_out, unsigned char &next_use) const {
+      return m_model.ExtendLeft(add_rbegin, add_rend, backoff_in, extend_pointer, extend_length, backoff_out, next_use);
+    }
+
+    float UnRest(const uint64_t *pointers_begin, const uint64_t *pointers_end, unsigned char first_length) const {
+      return m_model.UnRest(pointers_begin, pointers_end, first_length);
+    }
+
+  private:
+    const Model &m_model;
+    KenLMQueryMemo *m_memo;
+};
+
 /*
  * An implementation of single factor LM using Ken's code.
  */
@@ -92,9 +205,31 @@ template <class Model> class LanguageModelKen : public LanguageModel {
       manager.LMCallback(*m_ngram, m_lmIdLookup);
     }
 
+    void InitializeBeforeSentenceProcessing() {
+      if (KenLMQueryMemo *memo = Memo()) memo->NewSentence();
+    }
+
+    void CleanUpAfterSentenceProcessing(const InputType& /*source*/) {
+      if (m_memoSize && m_memo.get()) {
+        VERBOSE(2, GetScoreProducerDescription(0) << " memo: " << m_memo->GetHits() << " hits in " << m_memo->GetLookups() << " lookups" << std::endl);
+      }
+    }
+
   private:
     LanguageModelKen(const LanguageModelKen<Model> &copy_from);
 
+    // memo of the calling thread, NULL if memoization is off
+    KenLMQueryMemo *Memo() const {
+      if (!m_memoSize) return NULL;
+      if (!m_memo.get()) m_memo.reset(new KenLMQueryMemo(m_memoSize));
+      return m_memo.get();
+    }
+
+    float Score(KenLMQueryMemo *memo, const lm::ngram::State &in_state, lm::WordIndex word, lm::ngram::State &out_state) const {
+      if (memo) return memo->FullScore(*m_ngram, in_state, word, out_state).prob;
+      return m_ngram->Score(in_state, word, out_state);
+    }
+
     lm::WordIndex TranslateID(const Word &word) const {
       std::size_t factor = word.GetFactor(m_factorType)->GetId();
       return (factor >= m_lmIdLookup.size() ? 0 : m_lmIdLookup[factor]);
@@ -122,6 +257,13 @@ template <class Model> class LanguageModelKen : public LanguageModel {
     FactorType m_factorType;
 
     const Factor *m_beginSentenceFactor;
+
+    std::size_t m_memoSize;
+#ifdef WITH_THREADS
+    mutable boost::thread_specific_ptr<KenLMQueryMemo> m_memo;
+#else
+    mutable std::auto_ptr<KenLMQueryMemo> m_memo;
+#endif
 };
 
 class MappingBuilder : public lm::EnumerateVocab {
@@ -143,7 +285,7 @@ private:
   std::vector<lm::WordIndex> &m_mapping;
 };
 
-template <class Model> LanguageModelKen<Model>::LanguageModelKen(const std::string &file, FactorType factorType, bool lazy) : m_factorType(factorType) {
+template <class Model> LanguageModelKen<Model>::LanguageModelKen(const std::string &file, FactorType factorType, bool lazy) : m_factorType(factorType), m_memoSize(StaticData::Instance().GetLMMemoSize()) {
   lm::ngram::Config config;
   IFVERBOSE(1) {
     config.messages = &std::cerr;
@@ -169,7 +311,8 @@ template <class Model> LanguageModelKen<Model>::LanguageModelKen(const LanguageM
     // TODO: don't copy this.  
     m_lmIdLookup(copy_from.m_lmIdLookup),
     m_factorType(copy_from.m_factorType),
-    m_beginSentenceFactor(copy_from.m_beginSentenceFactor) {
+    m_beginSentenceFactor(copy_from.m_beginSentenceFactor),
+    m_memoSize(copy_from.m_memoSize) {
 }
 
 template <class Model> void LanguageModelKen<Model>::CalcScore(const Phrase &phrase, float &fullScore, float &ngramScore, size_t &oovCount) const {
@@ -240,11 +383,12 @@ template <class Model> FFState *LanguageModelKen<Model>::Evaluate(const Hypothes
   std::size_t position = begin;
   typename Model::State aux_state;
   typename Model::State *state0 = &ret->state, *state1 = &aux_state;
+  KenLMQueryMemo *memo = Memo();
 
-  float score = m_ngram->Score(in_state, TranslateID(hypo.GetWord(position)), *state0);
+  float score = Score(memo, in_state, TranslateID(hypo.GetWord(position)), *state0);
   ++position;
   for (; position < adjust_end; ++position) {
-    score += m_ngram->Score(*state0, TranslateID(hypo.GetWord(position)), *state1);
+    score += Score(memo, *state0, TranslateID(hypo.GetWord(position)), *state1);
     std::swap(state0, state1);
   }
 
@@ -297,7 +441,8 @@ class LanguageModelChartStateKenLM : public FFState {
 
 template <class Model> FFState *LanguageModelKen<Model>::EvaluateChart(const ChartHypothesis& hypo, int featureID, ScoreComponentCollection *accumulator) const {
   LanguageModelChartStateKenLM *newState = new LanguageModelChartStateKenLM();
-  lm::ngram::RuleScore<Model> ruleScore(*m_ngram, newState->GetChartState());
+  MemoizedModel<Model> model(*m_ngram, Memo());
+  lm::ngram::RuleScore<MemoizedModel<Model> > ruleScore(model, newState->GetChartState());
   const TargetPhrase &target = hypo.GetCurrTargetPhrase();
   const AlignmentInfo::NonTermIndexMap &nonTermIndexMap =
         target.GetAlignNonTerm().GetNonTermIndexMap();
@@ -0,0 +1,145 @@
+/***********************************************************************
+Moses - factored phrase-based language decoder
+Copyright (C) 2013- University of Edinburgh
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+***********************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include "OnlineLearning/LearnerStore.h"
+
+using namespace Moses;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(learner_store)
+
+struct StoreFixture {
+  StoreFixture() {
+    char dir[] = "/tmp/learnerstoreXXXXXX";
+    BOOST_REQUIRE(mkdtemp(dir));
+    m_dir = dir;
+    m_prefix = m_dir + "/model";
+  }
+  ~StoreFixture() {
+    remove((m_prefix + ".snapshot").c_str());
+    remove((m_prefix + ".snapshot.tmp").c_str());
+    remove((m_prefix + ".journal").c_str());
+    rmdir(m_dir.c_str());
+  }
+  string m_dir, m_prefix;
+};
+
+BOOST_FIXTURE_TEST_CASE(journal_replay, StoreFixture)
+{
+  {
+    LearnerStore store(m_prefix);
+    store.LogPair("la casa|||the house", 0.5);
+    store.LogPair("la casa|||the house", 0.75);
+    vector<float> weights(3, 0.25);
+    store.LogCoreWeights(weights);
+    store.Flush();
+  }
+  LearnerStore store(m_prefix);
+  LearnerStore::PairValues pairs;
+  vector<float> weights;
+  store.ReadJournal(pairs, weights);
+  BOOST_REQUIRE_EQUAL(pairs.size(), 2);
+  BOOST_CHECK_EQUAL(pairs[1].first, "la casa|||the house");
+  BOOST_CHECK_EQUAL(pairs[1].second, 0.75);
+  BOOST_CHECK_EQUAL(weights.size(), 3);
+  BOOST_CHECK_EQUAL(store.GetSnapshotSize(), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(snapshot_roundtrip, StoreFixture)
+{
+  vector<float> weights(2);
+  weights[0] = 1;
+  weights[1] = -1;
+  {
+    LearnerStore store(m_prefix);
+    LearnerStore::PairValues pairs;
+    pairs.push_back(make_pair(string("la casa|||the house"), 0.5f));
+    pairs.push_back(make_pair(string("casa|||home"), -0.25f));
+    store.WriteSnapshot(pairs, weights);
+    store.InstallSnapshot();
+    store.LogPair("casa|||home", 2);
+    store.Flush();
+  }
+  LearnerStore store(m_prefix);
+  BOOST_CHECK_EQUAL(store.GetSnapshotSize(), 2);
+  float score;
+  BOOST_REQUIRE(store.Find(LearnerStore::PairId("la casa|||the house"), "la casa|||the house", score));
+  BOOST_CHECK_EQUAL(score, 0.5);
+  BOOST_CHECK(store.HasId(LearnerStore::PairId("casa|||home")));
+  BOOST_CHECK(!store.HasId(LearnerStore::PairId("la|||the")));
+  BOOST_CHECK(!store.Find(LearnerStore::PairId("la|||the"), "la|||the", score));
+  // an id shared with another pair does not give away its score
+  BOOST_CHECK(!store.Find(LearnerStore::PairId("la casa|||the house"), "casa|||home", score));
+
+  // the journal holds what was learnt after the snapshot
+  LearnerStore::PairValues pairs;
+  vector<float> stored;
+  store.ReadJournal(pairs, stored);
+  BOOST_REQUIRE_EQUAL(pairs.size(), 1);
+  BOOST_CHECK_EQUAL(pairs[0].second, 2);
+  BOOST_REQUIRE_EQUAL(stored.size(), 2);
+  BOOST_CHECK_EQUAL(stored[1], -1);
+
+  // a new snapshot merges both and empties the journal
+  store.WriteSnapshot(pairs, stored);
+  store.InstallSnapshot();
+  BOOST_REQUIRE(store.Find(LearnerStore::PairId("casa|||home"), "casa|||home", score));
+  BOOST_CHECK_EQUAL(score, 2);
+  BOOST_CHECK_EQUAL(store.GetSnapshotSize(), 2);
+  store.ReadJournal(pairs, stored);
+  BOOST_CHECK(pairs.empty());
+}
+
+BOOST_FIXTURE_TEST_CASE(truncated_journal, StoreFixture)
+{
+  {
+    LearnerStore store(m_prefix);
+    store.LogPair("casa|||house", 1);
+    store.Flush();
+  }
+  // a record cut short by a crash
+  FILE *journal = fopen((m_prefix + ".journal").c_str(), "ab");
+  fputs("P\x10", journal);
+  fclose(journal);
+  {
+    LearnerStore store(m_prefix);
+    store.LogPair("casa|||home", 2);
+    store.Flush();
+  }
+  LearnerStore store(m_prefix);
+  LearnerStore::PairValues pairs;
+  vector<float> weights;
+  store.ReadJournal(pairs, weights);
+  BOOST_REQUIRE_EQUAL(pairs.size(), 2);
+  BOOST_CHECK_EQUAL(pairs[1].first, "casa|||home");
+}
+
+BOOST_AUTO_TEST_CASE(pair_id_ignores_spacing)
+{
+  BOOST_CHECK_EQUAL(LearnerStore::PairId("la casa|||the house"), LearnerStore::PairId("la  casa ||| the house"));
+  BOOST_CHECK(LearnerStore::PairId("la casa|||the house") != LearnerStore::PairId("la|||casa the house"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -41,6 +41,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "DummyScoreProducers.h"
 #include "Timer.h"
 
+#ifdef WITH_THREADS
+#include <boost/thread/tss.hpp>
+#endif
+
 #ifdef HAVE_PROTOBUF
 #include "hypergraph.pb.h"
 #include "rule.pb.h"
@@ -50,9 +54,39 @@ using namespace std;
 
 namespace Moses
 {
+namespace
+{
+// Hypothesis pools whose memory is kept for the next sentence decoded on the
+// same thread, so the arena does not have to grow again from scratch.
+#ifdef WITH_THREADS
+boost::thread_specific_ptr<HypothesisPool> s_sparePool;
+#else
+std::auto_ptr<HypothesisPool> s_sparePool;
+#endif
+
+HypothesisPool *AcquireHypothesisPool()
+{
+  if (s_sparePool.get()) {
+    return s_sparePool.release();
+  }
+  return new HypothesisPool("Hypothesis", 10000);
+}
+
+void ReleaseHypothesisPool(HypothesisPool *pool)
+{
+  pool->reset();
+  if (s_sparePool.get()) {
+    delete pool;
+  } else {
+    s_sparePool.reset(pool);
+  }
+}
+}
+
 Manager::Manager(size_t lineNumber, InputType const& source, SearchAlgorithm searchAlgorithm, const TranslationSystem* system)
   :m_lineNumber(lineNumber)
   ,m_system(system)
+  ,m_hypoPool(AcquireHypothesisPool())
   ,m_transOptColl(source.CreateTranslationOptionCollection(system))
   ,m_search(Search::CreateSearch(*this, source, searchAlgorithm, *m_transOptColl))
   ,interrupted_flag(0)
@@ -66,6 +100,8 @@ Manager::~Manager()
 {
   delete m_transOptColl;
   delete m_search;
+  // destroys every hypothesis still alive, i.e. those in the arc lists
+  ReleaseHypothesisPool(m_hypoPool);
 
   m_system->CleanUpAfterSentenceProcessing(m_source);
 }
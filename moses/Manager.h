@@ -96,6 +96,7 @@ class Manager
 protected:
   // data
 //	InputType const& m_source; /**< source sentence to be translated */
+  HypothesisPool *m_hypoPool; /**< all hypotheses of this sentence live here, released in one go */
   TranslationOptionCollection *m_transOptColl; /**< pre-computed list of translation options for the phrases in this sentence */
   Search *m_search;
 
@@ -132,6 +133,9 @@ public:
   void printThisHypothesis(long translationId, const Hypothesis* hypo, const std::vector <const TargetPhrase* > & remainingPhrases, float remainingScore , std::ostream& outputStream) const;
   void GetWordGraph(long translationId, std::ostream &outputWordGraphStream) const;
   int GetNextHypoId();
+  HypothesisPool &GetHypothesisPool() {
+    return *m_hypoPool;
+  }
 #ifdef HAVE_PROTOBUF
   void SerializeSearchGraphPB(long translationId, std::ostream& outputStream) const;
 #endif
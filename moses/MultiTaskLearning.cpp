@@ -24,25 +24,33 @@ void MultiTaskLearning::SetInteractionMatrix(boost::numeric::ublas::matrix<doubl
 	m_intMatrix = interactionMatrix;
 }
 
-void MultiTaskLearning::SetKdKdMatrix(boost::numeric::ublas::matrix<double>& kdkdmatrix){
-	m_kdkdmatrix=kdkdmatrix;
-}
-
 ScoreComponentCollection MultiTaskLearning::GetWeightsVector(int user) {
-	if(m_user2weightvec.find(user) != m_user2weightvec.end()){
-		return m_user2weightvec[user];
+	boost::shared_ptr<const ScoreComponentCollection> weights = GetWeightSnapshot(user);
+	if(weights){
+		return *weights;
 	}
 	else{
 		UserMessage::Add("Requested weights from a wrong user");
+		return ScoreComponentCollection();
 	}
 }
 
+// Decoding threads read the snapshot of their task while it learns, so the
+// pointer is swapped atomically; the map itself is only filled at start-up.
+boost::shared_ptr<const ScoreComponentCollection> MultiTaskLearning::GetWeightSnapshot(int user) const {
+	map<int, boost::shared_ptr<const ScoreComponentCollection> >::const_iterator it = m_user2weightvec.find(user);
+	if(it == m_user2weightvec.end())
+		return boost::shared_ptr<const ScoreComponentCollection>();
+	return boost::atomic_load(&it->second);
+}
+
 boost::numeric::ublas::matrix<double> MultiTaskLearning::GetWeightsMatrix() {
-	boost::numeric::ublas::matrix<double> A(m_user2weightvec.begin()->second.Size(), m_users);
+	boost::numeric::ublas::matrix<double> A(m_user2weightvec.begin()->second->Size(), m_users);
 	for(int i=0;i<m_users;i++){
-		FVector weightVector = m_user2weightvec[i].GetScoresVector();
+		boost::shared_ptr<const ScoreComponentCollection> weights = GetWeightSnapshot(i);
+		FVector weightVector = weights->GetScoresVector();
 		weightVector.printCoreFeatures();
-		const std::valarray<float>& scoreVector = m_user2weightvec[i].GetScoresVector().getCoreFeatures();
+		const std::valarray<float>& scoreVector = weights->GetScoresVector().getCoreFeatures();
 		for(size_t j=0; j<scoreVector.size(); j++){
 			A(j,i) = scoreVector[j];
 		}
@@ -52,7 +60,12 @@ boost::numeric::ublas::matrix<double> MultiTaskLearning::GetWeightsMatrix() {
 
 void MultiTaskLearning::SetWeightsVector(int user, ScoreComponentCollection weightVec){
 	if(user < m_users){	// < because the indexing starts from 0
-		m_user2weightvec[user] = weightVec;
+		boost::shared_ptr<const ScoreComponentCollection> weights(new ScoreComponentCollection(weightVec));
+		map<int, boost::shared_ptr<const ScoreComponentCollection> >::iterator it = m_user2weightvec.find(user);
+		if(it == m_user2weightvec.end())
+			m_user2weightvec[user] = weights;
+		else
+			boost::atomic_store(&it->second, weights);
 	}
 	return;
 }
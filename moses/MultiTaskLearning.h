@@ -14,6 +14,7 @@
 #include <map>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/numeric/ublas/matrix.hpp>
 #include <boost/numeric/ublas/vector.hpp>
 #include <boost/numeric/ublas/io.hpp>
@@ -28,12 +29,11 @@ namespace Moses {
 // this is a stateless function because we need to add an additional bias feature
 class MultiTaskLearning : public StatelessFeatureFunction {
 	int m_users;
-	map<int, ScoreComponentCollection> m_user2weightvec;
+	map<int, boost::shared_ptr<const ScoreComponentCollection> > m_user2weightvec;	// replaced, never modified, when a task learns
 	int m_currtask;
 	float m_learningrate;
 	bool m_learnmatrix;
 	UpdateInteractionMatrixType m_implementation;
-	boost::numeric::ublas::matrix<double> m_kdkdmatrix;
 	boost::numeric::ublas::matrix<double> m_intMatrix;
 
 public:
@@ -42,9 +42,9 @@ public:
 	int GetCurrentTask() const {return m_currtask;};
 	void SetInteractionMatrix(boost::numeric::ublas::matrix<double>& interactionMatrix);
 	boost::numeric::ublas::matrix<double>& GetInteractionMatrix(){return m_intMatrix;};
-	void SetKdKdMatrix(boost::numeric::ublas::matrix<double>&);
-	boost::numeric::ublas::matrix<double>& GetKdKdMatrix(){return m_kdkdmatrix;};
 	ScoreComponentCollection GetWeightsVector(int);
+	//! weights of a task, the same object until the task learns, so that caches can be keyed on it
+	boost::shared_ptr<const ScoreComponentCollection> GetWeightSnapshot(int) const;
 	void SetWeightsVector(int, ScoreComponentCollection);
 	MultiTaskLearning(int, float, UpdateInteractionMatrixType);
 	MultiTaskLearning(int);
@@ -5,6 +5,7 @@
 
 #include "OnlineLearner.h"
 #include "StaticData.h"
+#include "FactorCollection.h"
 #include "math.h"
 #include "Util.h"
 
@@ -20,25 +21,6 @@
 using namespace Optimizer;
 
 namespace MatrixOps{
-	//    ------------------- Kronecker Product code ---------------------------- //
-
-	bool KroneckerProduct (const boost::numeric::ublas::matrix<double>& A, const boost::numeric::ublas::matrix<double>& B, boost::numeric::ublas::matrix<double>& C) {
-		int rowA=-1,colA=-1,rowB=0,colB=0,prowB=1,pcolB=1;
-		for(int i=0; i<C.size1(); i++){
-			for(int j=0; j<C.size2(); j++){
-				rowB=i%B.size1();
-				colB=j%B.size2();
-				if(pcolB!=0 && colB == 0) colA++;
-				if(prowB!=0 && rowB==0) rowA++;
-				prowB=rowB;
-				pcolB=colB;
-				if(colA >= A.size2()){colA=0; colB=0;pcolB=1;}
-				C(i, j) = A(rowA, colA) * B(rowB, colB) ;
-			}
-		}
-		return true;
-	}
-	//    ------------------------------- ends here ---------------------------- //
     //    ------------------- matrix inversion code ---------------------------- //
     template<class T>
     bool InvertMatrix (const boost::numeric::ublas::matrix<T>& input, boost::numeric::ublas::matrix<T>& inverse) {
@@ -90,88 +72,146 @@ int OnlineLearner::split_marker_perl(string str, string marker, vector<string> &
 	return array.size() - 1;
 }
 
-int OnlineLearner::getNGrams(std::string str, map<string, int>& ngrams) {
-	vector<string> words;
-	int numWords = split_marker_perl(str, " ", words);
-	for (int i = 1; i <= 4; i++) {
-		for (int start = 0; start < numWords - i + 1; start++) {
-			string str = "";
-			for (int pos = 0; pos < i; pos++) {
-				str += words[start + pos] + " ";
-			}
-			ngrams[str]++;
-		}
+LearningExample::LearningExample(const Manager& manager, size_t nBestSize)
+{
+	boost::unordered_map<const Hypothesis*, size_t> index;
+	std::vector<size_t> reversed;
+	for (const Hypothesis* hypo = manager.GetBestHypothesis(); hypo != NULL; hypo = hypo->GetPrevHypo())
+		reversed.push_back(AddEdge(hypo, index));
+	best.edges.assign(reversed.rbegin(), reversed.rend());
+	best.totalScore = manager.GetBestHypothesis()->GetScore();
+
+	TrellisPathList nBestList;
+	manager.CalcNBest(nBestSize, nBestList, true);
+	nBest.resize(nBestList.GetSize());
+	size_t whichpath = 0;
+	for (TrellisPathList::const_iterator iter = nBestList.begin(); iter != nBestList.end(); ++iter, ++whichpath) {
+		const std::vector<const Hypothesis *> &pathEdges = (*iter)->GetEdges();
+		Path& path = nBest[whichpath];
+		for (int currEdge = (int) pathEdges.size() - 1; currEdge >= 0; currEdge--)
+			path.edges.push_back(AddEdge(pathEdges[currEdge], index));
+		path.totalScore = (*iter)->GetTotalScore();
+		path.scoreBreakdown = (*iter)->GetScoreBreakdown();
 	}
-	return str.size();
 }
 
-void OnlineLearner::compareNGrams(map<string, int>& hyp, map<string, int>& ref, map<int, float>& countNgrams, map<int, float>& TotalNgrams) {
-	for (map<string, int>::const_iterator itr = hyp.begin(); itr != hyp.end(); itr++) {
-		vector<string> temp;
-		int ngrams = split_marker_perl((*itr).first, " ", temp);
-		TotalNgrams[ngrams] += hyp[(*itr).first];
-		if (ref.find((*itr).first) != ref.end()) {
-			if (hyp[(*itr).first] >= ref[(*itr).first]) {
-				countNgrams[ngrams] += hyp[(*itr).first];
-			} else {
-				countNgrams[ngrams] += ref[(*itr).first];
-			}
-		}
-	}
-	for (int i = 1; i <= 4; i++) {
-		TotalNgrams[i]+=0.1;
-		countNgrams[i]+=0.1;
+size_t LearningExample::AddEdge(const Hypothesis* hypo, boost::unordered_map<const Hypothesis*, size_t>& index)
+{
+	std::pair<boost::unordered_map<const Hypothesis*, size_t>::iterator, bool> found = index.insert(std::make_pair(hypo, edges.size()));
+	if (!found.second)
+		return found.first->second;
+	edges.push_back(Edge());
+	Edge& edge = edges.back();
+	const Phrase& target = hypo->GetCurrTargetPhrase();
+	edge.translates = false;
+	if (hypo->GetPrevHypo() != NULL) {
+		edge.phrasePair = OnlineLearner::MakePhrasePairKey(*hypo->GetSourcePhrase(), target);
+		edge.translates = hypo->GetSourcePhrase()->GetSize() > 0 && target.GetSize() > 0;
 	}
-	return;
+	const FactorType factorType = StaticData::Instance().GetOutputFactorOrder()[0];
+	for (size_t pos = 0; pos < target.GetSize(); pos++)
+		edge.words.push_back(target.GetFactor(pos, factorType));
+	return edges.size() - 1;
 }
 
-float OnlineLearner::GetBleu(std::string hypothesis, std::string reference)
-{
-	double bp=1;
-	map<string, int> hypNgrams, refNgrams;
-	map<int, float> countNgrams, TotalNgrams;
-	map<int, double> BLEU;
-	int length_translation = getNGrams(hypothesis, hypNgrams);
-	int length_reference = getNGrams(reference, refNgrams);
-	compareNGrams(hypNgrams, refNgrams, countNgrams, TotalNgrams);
+namespace {
+// n-best paths merged on their common prefix of edges
+struct NBestPrefix {
+	static const size_t kRoot = static_cast<size_t>(-1);
+	NBestPrefix(size_t e) : edge(e) {}
+	size_t edge;
+	std::map<size_t, size_t> children;
+	std::vector<size_t> paths;	// n-best entries which end here
+};
 
-	for(int i=1; i<=4; i++)
-	{
-		BLEU[i] = (countNgrams[i]*1.0)/(TotalNgrams[i]*1.0);
+void ScoreNBestPrefix(const LearningExample& example, const std::vector<NBestPrefix>& prefixes, size_t i,
+		SentenceBleu& bleu, std::vector<float>& bleuScores)
+{
+	const NBestPrefix& prefix = prefixes[i];
+	size_t size = 0;
+	if (prefix.edge != NBestPrefix::kRoot) {
+		const std::vector<const Factor*>& words = example.edges[prefix.edge].words;
+		size = words.size();
+		for (size_t pos = 0; pos < size; pos++)
+			bleu.Push(words[pos]);
 	}
-	double ratio = ((length_reference*1.0+1.0) / (length_translation*1.0+1.0) );
-	if(length_translation < length_reference)
-		bp = exp(1 - ratio);
-	return ((bp * exp( ( log(BLEU[1]) + log(BLEU[2]) + log(BLEU[3]) + log(BLEU[4]) ) / 4))*100);
+	for (size_t p = 0; p < prefix.paths.size(); p++)
+		bleuScores[prefix.paths[p]] = bleu.GetBleu();
+	std::map<size_t, size_t>::const_iterator it;
+	for (it = prefix.children.begin(); it != prefix.children.end(); ++it)
+		ScoreNBestPrefix(example, prefixes, it->second, bleu, bleuScores);
+	for (size_t pos = 0; pos < size; pos++)
+		bleu.Pop();
+}
 }
 
-
-bool OnlineLearner::has_only_spaces(const std::string& str) {
-	return (str.find_first_not_of (' ') == str.npos);
+float OnlineLearner::GetBleu(SentenceBleu& bleu, const LearningExample& example, const LearningExample::Path& path) const
+{
+	size_t words = 0;
+	for (size_t i = 0; i < path.edges.size(); i++) {
+		const std::vector<const Factor*>& edgeWords = example.edges[path.edges[i]].words;
+		for (size_t pos = 0; pos < edgeWords.size(); pos++, words++)
+			bleu.Push(edgeWords[pos]);
+	}
+	float score = bleu.GetBleu();
+	for (; words > 0; words--)
+		bleu.Pop();
+	return score;
 }
 
-bool OnlineLearner::SetPostEditedSentence(std::string s)
+// BLEU of every path of the n-best list, visiting the edges shared by
+// several paths only once
+void OnlineLearner::GetNBestBleu(SentenceBleu& bleu, const LearningExample& example, std::vector<float>& bleuScores) const
 {
-	if(m_postedited.empty())
-	{
-		m_postedited=s;
-		return true;
+	std::vector<NBestPrefix> prefixes(1, NBestPrefix(NBestPrefix::kRoot));
+	for (size_t whichpath = 0; whichpath < example.nBest.size(); ++whichpath) {
+		const std::vector<size_t>& edges = example.nBest[whichpath].edges;
+		size_t prefix = 0;
+		for (size_t currEdge = 0; currEdge < edges.size(); currEdge++) {
+			std::map<size_t, size_t>::const_iterator child = prefixes[prefix].children.find(edges[currEdge]);
+			if (child == prefixes[prefix].children.end()) {
+				prefixes.push_back(NBestPrefix(edges[currEdge]));
+				prefixes[prefix].children[edges[currEdge]] = prefixes.size() - 1;
+				prefix = prefixes.size() - 1;
+			} else {
+				prefix = child->second;
+			}
+		}
+		prefixes[prefix].paths.push_back(whichpath);
 	}
-	else
-	{
-		cerr<<"post edited already exists.. "<<m_postedited<<endl;
-		return false;
+	bleuScores.assign(example.nBest.size(), 0);
+	ScoreNBestPrefix(example, prefixes, 0, bleu, bleuScores);
+}
+
+std::string OnlineLearner::GetPathString(const LearningExample& example, const LearningExample::Path& path) const
+{
+	stringstream oracle;
+	for (size_t i = 0; i < path.edges.size(); i++) {
+		const std::vector<const Factor*>& words = example.edges[path.edges[i]].words;
+		for (size_t pos = 0; pos < words.size(); pos++) {
+			oracle << *words[pos];
+			oracle << " ";
+		}
 	}
+	return oracle.str();
+}
+
+bool OnlineLearner::has_only_spaces(const std::string& str) {
+	return (str.find_first_not_of (' ') == str.npos);
 }
 
 OnlineLearner::OnlineLearner(OnlineAlgorithm algorithm, float w_learningrate, float f_learningrate,
 		bool normaliseScore):StatelessFeatureFunction("OnlineLearner",0){
 	flr = f_learningrate;
 	wlr = w_learningrate;
-	m_learn=false;
 	m_PPindex=0;
 	m_normaliseScore=normaliseScore;
 	implementation=algorithm;
+	m_store=NULL;
+	m_snapshotInterval=0;
+	m_updatesSinceSnapshot=0;
+	m_sessionFeatures.reset(new session_features());
+	m_sessionUpdate=NULL;
 	cerr<<"Initialization Online Learning Model\n";
 }
 
@@ -182,54 +222,227 @@ OnlineLearner::OnlineLearner(OnlineAlgorithm algorithm, float w_learningrate, fl
 	flr = f_learningrate;
 	wlr = w_learningrate;
 	m_PPindex=0;
-	m_learn=false;
 	m_normaliseScore=normaliseScore;
 	implementation=algorithm;
+	m_store=NULL;
+	m_snapshotInterval=0;
+	m_updatesSinceSnapshot=0;
+	m_sessionFeatures.reset(new session_features());
+	m_sessionUpdate=NULL;
 	optimiser = new Optimizer::MiraOptimiser(slack, scale_margin, scale_margin_precision, scale_update,
 			scale_update_precision, boost, normaliseMargin, sigmoidParam, onlyOnlineScoreProducerUpdate);
 	cerr<<"Initialization Online Learning Model\n";
 }
 
 
-void OnlineLearner::ShootUp(std::string sp, std::string tp, float margin){
-	if(m_feature.find(sp)!=m_feature.end())
-	{
-		if(m_feature[sp].find(tp)!=m_feature[sp].end())
-		{
-			float val=m_feature[sp][tp];
-			val += flr * margin;
-			m_feature[sp][tp]=val;
+PhrasePairKey OnlineLearner::MakePhrasePairKey(const Phrase& sp, const Phrase& tp)
+{
+	PhrasePairKey key;
+	key.reserve(sp.GetSize() + 1 + tp.GetSize());
+	for (size_t pos = 0; pos < sp.GetSize(); ++pos)
+		key.push_back(sp.GetFactor(pos, 0));
+	key.push_back(NULL);
+	for (size_t pos = 0; pos < tp.GetSize(); ++pos)
+		key.push_back(tp.GetFactor(pos, 0));
+	return key;
+}
+
+PhrasePairKey OnlineLearner::MakePhrasePairKey(const std::string& sp, const std::string& tp)
+{
+	FactorCollection &factorCollection = FactorCollection::Instance();
+	PhrasePairKey key;
+	std::vector<std::string> words = Tokenize(sp);
+	for (size_t i = 0; i < words.size(); ++i)
+		key.push_back(factorCollection.AddFactor(words[i]));
+	key.push_back(NULL);
+	words = Tokenize(tp);
+	for (size_t i = 0; i < words.size(); ++i)
+		key.push_back(factorCollection.AddFactor(words[i]));
+	return key;
+}
+
+// "source words|||target words", the name of the sparse feature of the pair
+std::string OnlineLearner::GetPhrasePairName(const PhrasePairKey& pp)
+{
+	std::string name;
+	bool first = true;
+	for (PhrasePairKey::const_iterator it = pp.begin(); it != pp.end(); ++it) {
+		if (*it == NULL) {
+			name += "|||";
+			first = true;
+			continue;
 		}
+		if (!first) name += " ";
+		name += (*it)->GetString();
+		first = false;
+	}
+	return name;
+}
+
+void OnlineLearner::ShootUp(const PhrasePairKey& pp, float margin){
+	if(m_sessionUpdate)
+	{
+		pp_feature::iterator it = FindInSession(pp);
+		if(it!=m_sessionUpdate->end())
+			it->second.score += flr * margin;
 		else
-		{
-			m_feature[sp][tp]=flr*margin;
-		}
+			m_sessionUpdate->insert(std::make_pair(pp, PhrasePairValue(FName(GetPhrasePairName(pp)), flr*margin)));
+		return;
+	}
+#ifdef WITH_THREADS
+	boost::unique_lock<boost::shared_mutex> lock(m_featureLock);
+#endif
+	pp_feature::iterator it = FindOrLoad(pp);
+	if(it!=m_feature.end())
+	{
+		it->second.score += flr * margin;
 	}
 	else
 	{
-		m_feature[sp][tp]=flr*margin;
+		it = m_feature.insert(std::make_pair(pp, PhrasePairValue(FName(GetPhrasePairName(pp)), flr*margin))).first;
 	}
+	if(m_store)
+		m_store->LogPair(it->second.name.name(), it->second.score);
 	//if(m_feature[sp][tp]>1){m_feature[sp][tp]==1;}
 }
-void OnlineLearner::ShootDown(std::string sp, std::string tp, float margin){
-	if(m_feature.find(sp)!=m_feature.end())
+void OnlineLearner::ShootDown(const PhrasePairKey& pp, float margin){
+	if(m_sessionUpdate)
 	{
-		if(m_feature[sp].find(tp)!=m_feature[sp].end())
-		{
-			float val=m_feature[sp][tp];
-			val -= flr * margin;
-			m_feature[sp][tp]=val;
-		}
+		pp_feature::iterator it = FindInSession(pp);
+		if(it!=m_sessionUpdate->end())
+			it->second.score -= flr * margin;
 		else
-		{
-			m_feature[sp][tp]= 0;
-		}
+			m_sessionUpdate->insert(std::make_pair(pp, PhrasePairValue(FName(GetPhrasePairName(pp)), 0)));
+		return;
+	}
+#ifdef WITH_THREADS
+	boost::unique_lock<boost::shared_mutex> lock(m_featureLock);
+#endif
+	pp_feature::iterator it = FindOrLoad(pp);
+	if(it!=m_feature.end())
+	{
+		it->second.score -= flr * margin;
 	}
 	else
 	{
-		m_feature[sp][tp]= 0;
+		it = m_feature.insert(std::make_pair(pp, PhrasePairValue(FName(GetPhrasePairName(pp)), 0))).first;
 	}
-	if(m_feature[sp][tp]<0){m_feature[sp][tp]==0;}
+	if(m_store)
+		m_store->LogPair(it->second.name.name(), it->second.score);
+}
+
+// Looks the pair up among the values learnt in this process, then in the
+// snapshot, copying a snapshot value over so that it can be updated and
+// its feature name is resolved once.
+// The caller holds the write lock.
+pp_feature::iterator OnlineLearner::FindOrLoad(const PhrasePairKey& pp) const
+{
+	pp_feature::iterator it = m_feature.find(pp);
+	if(it!=m_feature.end() || !m_store)
+		return it;
+	float score;
+	const std::string name = GetPhrasePairName(pp);
+	if(!m_store->Find(GetPhrasePairId(pp), name, score))
+		return it;
+	return m_feature.insert(std::make_pair(pp, PhrasePairValue(FName(name), score))).first;
+}
+
+// Looks the pair up among the values of the session being learnt, then
+// copies the shared value over, if any, so that the session updates its own.
+pp_feature::iterator OnlineLearner::FindInSession(const PhrasePairKey& pp)
+{
+	pp_feature::iterator it = m_sessionUpdate->find(pp);
+	if(it!=m_sessionUpdate->end())
+		return it;
+#ifdef WITH_THREADS
+	boost::shared_lock<boost::shared_mutex> read_lock(m_featureLock);
+#endif
+	pp_feature::const_iterator shared = m_feature.find(pp);
+	if(shared!=m_feature.end())
+		return m_sessionUpdate->insert(*shared).first;
+	float score;
+	const std::string name = GetPhrasePairName(pp);
+	if(!m_store || !m_store->Find(GetPhrasePairId(pp), name, score))
+		return it;
+	return m_sessionUpdate->insert(std::make_pair(pp, PhrasePairValue(FName(name), score))).first;
+}
+
+uint64_t OnlineLearner::GetPhrasePairId(const PhrasePairKey& pp)
+{
+	uint64_t id = 0;
+	for (PhrasePairKey::const_iterator it = pp.begin(); it != pp.end(); ++it)
+		id = (*it == NULL) ? LearnerStore::HashSeparator(id) : LearnerStore::HashWord(id, (*it)->GetString());
+	return id;
+}
+
+// must agree with the above for the key built from the same pair
+uint64_t OnlineLearner::GetPhrasePairId(const PhrasePairRef& pp)
+{
+	uint64_t id = 0;
+	for (size_t pos = 0; pos < pp.source.GetSize(); ++pos)
+		id = LearnerStore::HashWord(id, pp.source.GetFactor(pos, 0)->GetString());
+	id = LearnerStore::HashSeparator(id);
+	for (size_t pos = 0; pos < pp.target.GetSize(); ++pos)
+		id = LearnerStore::HashWord(id, pp.target.GetFactor(pos, 0)->GetString());
+	return id;
+}
+
+void OnlineLearner::OpenStore(const std::string& prefix, size_t snapshotInterval)
+{
+	m_store = new LearnerStore(prefix);
+	m_snapshotInterval = snapshotInterval;
+	LearnerStore::PairValues pairs;
+	std::vector<float> coreWeights;
+	m_store->ReadJournal(pairs, coreWeights);
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		const size_t separator = pairs[i].first.find("|||");
+		if (separator == std::string::npos)
+			continue;
+		const PhrasePairKey pp = MakePhrasePairKey(pairs[i].first.substr(0, separator), pairs[i].first.substr(separator + 3));
+		pp_feature::iterator it = m_feature.find(pp);
+		if(it!=m_feature.end())
+			it->second.score = pairs[i].second;
+		else
+			m_feature.insert(std::make_pair(pp, PhrasePairValue(FName(pairs[i].first), pairs[i].second)));
+	}
+	ScoreComponentCollection weights = StaticData::Instance().GetAllWeights();
+	if (coreWeights.size() == weights.getCoreFeatures().size()) {
+		for (size_t i = 0; i < coreWeights.size(); ++i)
+			weights.Assign(i, coreWeights[i]);
+		StaticData::InstanceNonConst().SetAllWeights(weights);
+	} else if (!coreWeights.empty()) {
+		TRACE_ERR("Ignoring the stored core weights of " << prefix << ": " << coreWeights.size()
+				<< " weights for " << weights.getCoreFeatures().size() << " features" << endl);
+	}
+	VERBOSE(1, "Online learning store " << prefix << ": " << m_store->GetSnapshotSize() << " phrase pairs in the snapshot, "
+			<< pairs.size() << " updates replayed" << endl);
+}
+
+// Writes the learnt values to a new snapshot. Only the swap of the mapping
+// blocks decoding; the caller holds m_learnLock, so no value is changing
+// while it is written, though decoding may still load snapshot values.
+// The core weights are passed in: the caller's GetAllWeights() may be the
+// snapshot its sentence was decoded with, older than the journalled ones.
+void OnlineLearner::Checkpoint(const ScoreComponentCollection& weights)
+{
+	LearnerStore::PairValues pairs;
+	{
+#ifdef WITH_THREADS
+		boost::shared_lock<boost::shared_mutex> read_lock(m_featureLock);
+#endif
+		pairs.reserve(m_feature.size());
+		for (pp_feature::const_iterator it = m_feature.begin(); it != m_feature.end(); ++it)
+			pairs.push_back(std::make_pair(it->second.name.name(), it->second.score));
+	}
+	const std::valarray<FValue>& core = weights.getCoreFeatures();
+	m_store->WriteSnapshot(pairs, std::vector<float>(&core[0], &core[0] + core.size()));
+	{
+#ifdef WITH_THREADS
+		boost::unique_lock<boost::shared_mutex> lock(m_featureLock);
+#endif
+		m_store->InstallSnapshot();
+	}
+	m_updatesSinceSnapshot = 0;
 }
 
 void OnlineLearner::DumpFeatures(std::string filename)
@@ -238,17 +451,20 @@ void OnlineLearner::DumpFeatures(std::string filename)
 	file.open(filename.c_str(), ios::out);
 	if(file.is_open())
 	{
-		pp_feature::iterator itr1=m_feature.begin();
+		pp_feature::const_iterator itr1=m_feature.begin();
 		while(itr1!=m_feature.end())
 		{
-			std::map<std::string, float>::iterator itr2=(*itr1).second.begin();
-			while(itr2!=(*itr1).second.end())
-			{
-				file << itr1->first <<"|||"<<itr2->first<<"|||"<<itr2->second<<endl;
-				itr2++;
-			}
+			file << itr1->second.name.name() <<"|||"<<itr1->second.score<<endl;
 			itr1++;
 		}
+		// snapshot values not overridden by a value learnt since
+		for (size_t i = 0; m_store && i < m_store->GetSnapshotSize(); ++i)
+		{
+			const std::string name = m_store->GetSnapshotName(i).as_string();
+			const size_t separator = name.find("|||");
+			if(m_feature.find(MakePhrasePairKey(name.substr(0, separator), name.substr(separator + 3)))==m_feature.end())
+				file << name <<"|||"<<m_store->GetSnapshotScore(i)<<endl;
+		}
 	}
 	file.close();
 }
@@ -266,7 +482,12 @@ void OnlineLearner::ReadFeatures(std::string filename)
 			if(splits.size()==3){
 				float score;
 				stringstream(splits[2])>>score;
-				m_feature[splits[0]][splits[1]] = score;
+				const PhrasePairKey pp = MakePhrasePairKey(splits[0], splits[1]);
+				pp_feature::iterator it = m_feature.find(pp);
+				if(it!=m_feature.end())
+					it->second.score = score;
+				else
+					m_feature.insert(std::make_pair(pp, PhrasePairValue(FName(GetPhrasePairName(pp)), score)));
 			}
 			else{
 				TRACE_ERR("The format of feature file does not comply!");
@@ -283,87 +504,84 @@ void OnlineLearner::ReadFeatures(std::string filename)
 // clears history
 void OnlineLearner::RemoveJunk()
 {
-	m_postedited.clear();
 	PP_ORACLE.clear();
 	PP_BEST.clear();
 }
 // insertion of sparse features .. for now its the phrase pair
 // have to generalize this later !
-void OnlineLearner::Insert(std::string sp, std::string tp)
+void OnlineLearner::Insert(const PhrasePairKey& pp)
 {
-	if(m_featureIdx.find(sp)==m_featureIdx.end())
+	if(m_featureIdx.find(pp)==m_featureIdx.end())
 	{
-		if(m_featureIdx[sp].find(tp)==m_featureIdx[sp].end())
-		{
-			m_featureIdx[sp][tp]=sparseweightvector.GetSize();
-			sparseweightvector.AddFeat(0.001);
-			m_PPindex++;
-			return;
-		}
+		m_featureIdx[pp]=sparseweightvector.GetSize();
+		sparseweightvector.AddFeat(0.001);
+		m_PPindex++;
 	}
-	else if(m_featureIdx.find(sp)!=m_featureIdx.end())
-	{
-		if(m_featureIdx[sp].find(tp)==m_featureIdx[sp].end())
-		{
-			m_featureIdx[sp][tp]=sparseweightvector.GetSize();
-			sparseweightvector.AddFeat(0.001);
-			m_PPindex++;
-		}
-		return;
-	}
-	return;
 }
 
-int OnlineLearner::RetrieveIdx(std::string sp,std::string tp)
+int OnlineLearner::RetrieveIdx(const PhrasePairKey& pp)
 {
-	if(m_featureIdx.find(sp)!=m_featureIdx.end())
+	pp_index::const_iterator it = m_featureIdx.find(pp);
+	if(it!=m_featureIdx.end())
 	{
-		if(m_featureIdx[sp].find(tp)!=m_featureIdx[sp].end())
-		{
-			return m_featureIdx[sp][tp];
-		}
+		return it->second;
 	}
 	return m_PPindex;
 }
 
 OnlineLearner::~OnlineLearner() {
-	pp_feature::iterator iter;
-	for(iter=m_feature.begin(); iter!=m_feature.end(); iter++)
-	{
-		(*iter).second.clear();
-	}
+	m_feature.clear();
+	delete m_store;
 }
 
+// Pairs that were never learnt score 0 and add nothing to the breakdown.
+// A pair found in the snapshot is copied into m_feature the first time, so
+// that its feature name is resolved once rather than at every lookup.
 void OnlineLearner::Evaluate(const TargetPhrase& tp, ScoreComponentCollection* out) const
 {
-	float score=0.0;
-	std::string s="",t="";
-	size_t endpos = tp.GetSize();
-	for (size_t pos = 0 ; pos < endpos ; ++pos) {
-		if (pos > 0){ t += " "; }
-		t += tp.GetWord(pos).GetFactor(0)->GetString();
-	}
-	endpos = tp.GetSourcePhrase().GetSize();
-	for (size_t pos = 0 ; pos < endpos ; ++pos) {
-		if (pos > 0){ s += " "; }
-		s += tp.GetSourcePhrase().GetWord(pos).GetFactor(0)->GetString();
+	const PhrasePairRef pp(tp.GetSourcePhrase(), tp);
+	float score;
+	const std::string& session = StaticData::Instance().GetThreadSession();
+	if(!session.empty())
+	{
+		boost::shared_ptr<const session_features> sessions = boost::atomic_load(&m_sessionFeatures);
+		session_features::const_iterator features = sessions->find(session);
+		if(features!=sessions->end()) {
+			pp_feature::const_iterator it = features->second->find(pp, PhrasePairKeyHash(), PhrasePairKeyEqual());
+			if(it!=features->second->end()) {
+				score = it->second.score;
+				if(m_normaliseScore)
+					score = (2/(1+exp(-score))) - 1;
+				out->SparsePlusEquals(it->second.name, score);
+				return;
+			}
+		}
 	}
-	pp_feature::const_iterator it;
-	it=m_feature.find(s);
-	if(it!=m_feature.end())
 	{
-		std::map<std::string, float>::const_iterator it2;
-		it2=it->second.find(t);
-		if(it2!=it->second.end())
-		{
-			score=it2->second;
+#ifdef WITH_THREADS
+		boost::shared_lock<boost::shared_mutex> read_lock(m_featureLock);
+#endif
+		pp_feature::const_iterator it = m_feature.find(pp, PhrasePairKeyHash(), PhrasePairKeyEqual());
+		if(it!=m_feature.end()) {
+			score = it->second.score;
+			if(m_normaliseScore)
+				score = (2/(1+exp(-score))) - 1;	// normalising score!
+			out->SparsePlusEquals(it->second.name, score);
+			return;
 		}
+		if(!m_store || !m_store->HasId(GetPhrasePairId(pp)))
+			return;
 	}
+#ifdef WITH_THREADS
+	boost::unique_lock<boost::shared_mutex> write_lock(m_featureLock);
+#endif
+	pp_feature::const_iterator it = FindOrLoad(MakePhrasePairKey(pp.source, pp.target));
+	if(it==m_feature.end())
+		return;
+	score = it->second.score;
 	if(m_normaliseScore)
-		score = (2/(1+exp(-score))) - 1;	// normalising score!
-	//cerr<<"Source : "<<s<<"\tTarget : "<<t<<"\tScore : "<<score<<endl;
-	const std::string featureName = s+"|||"+t;
-	out->SparsePlusEquals(featureName, score);
+		score = (2/(1+exp(-score))) - 1;
+	out->SparsePlusEquals(it->second.name, score);
 }
 
 
@@ -379,111 +597,184 @@ void OnlineLearner::EvaluateChart(const ChartBasedFeatureContext& context, Score
 	Evaluate(tp, accumulator);
 }
 
-void OnlineLearner::PrintHypo(const Hypothesis* hypo, ostream& HypothesisStringStream) {
-	if (hypo->GetPrevHypo() != NULL) {
-		PrintHypo(hypo->GetPrevHypo(), HypothesisStringStream);
-		Phrase p = hypo->GetCurrTargetPhrase();
-		for (size_t pos = 0; pos < p.GetSize(); pos++) {
-			const Factor *factor = p.GetFactor(pos, 0);
-			HypothesisStringStream << *factor << " ";
-		}
-		std::string sourceP = hypo->GetSourcePhraseStringRep();
-		std::string targetP = hypo->GetTargetPhraseStringRep();
-		PP_BEST[sourceP][targetP]=1;
-	}
-}
 void OnlineLearner::Decay(int lineNum)
 {
 	float decay_value = 1.0/(exp(lineNum)*1.0);
 	pp_feature::iterator itr1=m_feature.begin();
 	while(itr1!=m_feature.end())
 	{
-		std::map<std::string, float>::iterator itr2=(*itr1).second.begin();
-		while(itr2!=(*itr1).second.end())
-		{
-			float score=m_feature[itr1->first][itr2->first];
-			score *= decay_value;
-			m_feature[itr1->first][itr2->first]=score;
-			itr2++;
-		}
+		itr1->second.score *= decay_value;
 		itr1++;
 	}
 }
-void OnlineLearner::RunOnlineLearning(Manager& manager)
+// The update starts from the latest published weights rather than the
+// snapshot the sentence was decoded with, so that no update is lost when
+// several sentences are decoded concurrently.
+void OnlineLearner::RunOnlineLearning(const Manager& manager, const std::string& postEdited)
+{
+	RunOnlineLearning(LearningExample(manager, StaticData::Instance().GetOnlineLearningNBestSize()), postEdited);
+}
+
+void OnlineLearner::RunOnlineLearning(const LearningExample& example, const std::string& postEdited)
+{
+#ifdef WITH_THREADS
+	boost::mutex::scoped_lock lock(m_learnLock);
+#endif
+	ScoreComponentCollection weights = *StaticData::Instance().GetWeightSnapshot();
+	if(Learn(example, postEdited, weights)) {
+		StaticData::InstanceNonConst().SetAllWeights(weights);
+		if(m_store) {
+			const std::valarray<FValue>& core = weights.getCoreFeatures();
+			m_store->LogCoreWeights(std::vector<float>(&core[0], &core[0] + core.size()));
+		}
+	}
+	if(m_store) {
+		m_store->Flush();
+		if(m_snapshotInterval && ++m_updatesSinceSnapshot >= m_snapshotInterval)
+			Checkpoint(weights);
+	}
+}
+
+// The weights of a session are its own, so they are neither published nor
+// stored; so are the phrase-pair features it learns, which start from copies
+// of the shared ones and are neither journalled nor seen by other sessions.
+WeightSnapshotPtr OnlineLearner::RunOnlineLearning(const LearningExample& example, const std::string& postEdited, const std::string& session,
+		const WeightSnapshotPtr& weights)
+{
+#ifdef WITH_THREADS
+	boost::mutex::scoped_lock lock(m_learnLock);
+#endif
+	// the published values may be read meanwhile: the update works on a copy
+	session_features::const_iterator found = m_sessionFeatures->find(session);
+	boost::shared_ptr<pp_feature> features(found!=m_sessionFeatures->end() ? new pp_feature(*found->second) : new pp_feature());
+	boost::shared_ptr<ScoreComponentCollection> updated(new ScoreComponentCollection(*weights));
+	bool changed;
+	m_sessionUpdate = features.get();
+	try {
+		changed = Learn(example, postEdited, *updated);
+	} catch (...) {
+		m_sessionUpdate = NULL;
+		throw;
+	}
+	m_sessionUpdate = NULL;
+	PublishSession(session, features);
+	return changed ? WeightSnapshotPtr(updated) : weights;
+}
+
+// The values of the session replace the shared ones, and are journalled like
+// those learnt without a session.
+void OnlineLearner::MergeSession(const std::string& session)
+{
+#ifdef WITH_THREADS
+	boost::mutex::scoped_lock lock(m_learnLock);
+#endif
+	session_features::const_iterator found = m_sessionFeatures->find(session);
+	if(found==m_sessionFeatures->end())
+		return;
+	const boost::shared_ptr<const pp_feature> features = found->second;
+	{
+#ifdef WITH_THREADS
+		boost::unique_lock<boost::shared_mutex> write_lock(m_featureLock);
+#endif
+		for (pp_feature::const_iterator it = features->begin(); it != features->end(); ++it) {
+			pp_feature::iterator shared = m_feature.find(it->first);
+			if(shared!=m_feature.end())
+				shared->second.score = it->second.score;
+			else
+				m_feature.insert(*it);
+			if(m_store)
+				m_store->LogPair(it->second.name.name(), it->second.score);
+		}
+	}
+	PublishSession(session, boost::shared_ptr<const pp_feature>());
+	if(m_store) {
+		m_store->Flush();
+		if(m_snapshotInterval && ++m_updatesSinceSnapshot >= m_snapshotInterval)
+			Checkpoint(*StaticData::Instance().GetWeightSnapshot());
+	}
+}
+
+void OnlineLearner::DropSession(const std::string& session)
+{
+#ifdef WITH_THREADS
+	boost::mutex::scoped_lock lock(m_learnLock);
+#endif
+	PublishSession(session, boost::shared_ptr<const pp_feature>());
+}
+
+// Replaces the values of a session, or removes them if features is empty.
+// The caller holds m_learnLock, which serializes the writers of the map.
+void OnlineLearner::PublishSession(const std::string& session, const boost::shared_ptr<const pp_feature>& features)
+{
+	boost::shared_ptr<session_features> sessions(new session_features(*m_sessionFeatures));
+	if(features)
+		(*sessions)[session] = features;
+	else if(sessions->erase(session)==0)
+		return;
+	boost::atomic_store(&m_sessionFeatures, boost::shared_ptr<const session_features>(sessions));
+}
+
+// updates the phrase-pair features, and weightUpdate if the algorithm learns
+// the weights too, in which case it returns true; the caller holds m_learnLock
+bool OnlineLearner::Learn(const LearningExample& example, const std::string& postEdited, ScoreComponentCollection& weightUpdate)
 {
-	const TranslationSystem &trans_sys = StaticData::Instance().GetTranslationSystem(TranslationSystem::DEFAULT);
-	const StaticData& staticData = StaticData::Instance();
-	const std::vector<Moses::FactorType>& outputFactorOrder=staticData.GetOutputFactorOrder();
-	ScoreComponentCollection weightUpdate = staticData.GetAllWeights();
 	cerr<<"Total number of scores are :"<<weightUpdate.Size()<<"\n";
-	const Hypothesis* hypo = manager.GetBestHypothesis();
 	//	Decay(manager.m_lineNumber);
-	stringstream bestHypothesis;
 	PP_BEST.clear();
-	PrintHypo(hypo, bestHypothesis);
-	float bestbleu = GetBleu(bestHypothesis.str(), m_postedited);
-	float bestScore=hypo->GetScore();
-	cerr<<"Best Hypothesis : "<<bestHypothesis.str()<<endl;
-	cerr<<"Post Edit       : "<<m_postedited<<endl;
-	TrellisPathList nBestList;
-	int nBestSize = 100;
-	manager.CalcNBest(nBestSize, nBestList, true);
+	for (size_t i = 0; i < example.best.edges.size(); i++)
+		if (!example.edges[example.best.edges[i]].phrasePair.empty())
+			PP_BEST.insert(example.edges[example.best.edges[i]].phrasePair);
+	SentenceBleu bleu(postEdited);
+	float bestbleu = GetBleu(bleu, example, example.best);
+	float bestScore=example.best.totalScore;
+	cerr<<"Best Hypothesis : "<<GetPathString(example, example.best)<<endl;
+	cerr<<"Post Edit       : "<<postEdited<<endl;
+	std::vector<float> nBestBleu;
+	GetNBestBleu(bleu, example, nBestBleu);
 
 	std::string bestOracle;
-	std::vector<string> HypothesisList, HypothesisHope, HypothesisFear;
+	std::vector<string> HypothesisHope, HypothesisFear;
 	std::vector<float> loss, BleuScore, BleuScoreHope, BleuScoreFear, oracleBleuScores, lossHope, lossFear, modelScore, oracleModelScores;
 	std::vector<std::vector<float> > losses, BleuScores, BleuScoresHope, BleuScoresFear, lossesHope, lossesFear, modelScores;
 	std::vector<ScoreComponentCollection> featureValue,featureValueHope, featureValueFear, oraclefeatureScore;
 	std::vector<std::vector<ScoreComponentCollection> > featureValues, featureValuesHope, featureValuesFear;
-	std::map<int, map<string, map<string, int> > > OracleList;
-	TrellisPathList::const_iterator iter;
+	std::map<int, pp_list> OracleList;
 	pp_list BestOracle,ShootemUp, ShootemDown,Visited;
 	float maxBleu=0.0, maxScore=0.0,oracleScore=0.0;
 	int whichoracle=-1;
-	for (iter = nBestList.begin(); iter != nBestList.end(); ++iter) {
+	for (size_t p = 0; p < example.nBest.size(); ++p) {
 		whichoracle++;
-		const TrellisPath &path = **iter;
+		const LearningExample::Path &path = example.nBest[p];
 		PP_ORACLE.clear();
-		const std::vector<const Hypothesis *> &edges = path.GetEdges();
-		stringstream oracle;
-		for (int currEdge = (int) edges.size() - 1; currEdge >= 0; currEdge--) {
-			const Hypothesis &edge = *edges[currEdge];
-			CHECK(outputFactorOrder.size() > 0);
-			size_t size = edge.GetCurrTargetPhrase().GetSize();
-			for (size_t pos = 0; pos < size; pos++) {
-				const Factor *factor = edge.GetCurrTargetPhrase().GetFactor(pos, outputFactorOrder[0]);
-				oracle << *factor;
-				oracle << " ";
-			}
-			std::string sourceP = edge.GetSourcePhraseStringRep();  // Source Phrase
-			std::string targetP = edge.GetTargetPhraseStringRep();  // Target Phrase
-			if(!has_only_spaces(sourceP) && !has_only_spaces(targetP) )
+		for (size_t currEdge = 0; currEdge < path.edges.size(); currEdge++) {
+			const LearningExample::Edge &edge = example.edges[path.edges[currEdge]];
+			if(edge.translates)
 			{
-				PP_ORACLE[sourceP][targetP]=1;	// phrase pairs in the current nbest_i
-				OracleList[whichoracle][sourceP][targetP]=1;	// list of all phrase pairs given the nbest_i
-//				Insert(sourceP, targetP);	// I insert all the phrase pairs that I see in NBEST list
+				const PhrasePairKey& pp = edge.phrasePair;
+				PP_ORACLE.insert(pp);	// phrase pairs in the current nbest_i
+				OracleList[whichoracle].insert(pp);	// list of all phrase pairs given the nbest_i
+//				Insert(pp);	// I insert all the phrase pairs that I see in NBEST list
 			}
 		}
-		oracleScore=path.GetTotalScore();
-		float oraclebleu = GetBleu(oracle.str(), m_postedited);
+		oracleScore=path.totalScore;
+		float oraclebleu = nBestBleu[whichoracle];
 		if(implementation != FOnlyPerceptron){
-			HypothesisList.push_back(oracle.str());
 			BleuScore.push_back(oraclebleu);
-			featureValue.push_back(path.GetScoreBreakdown());
+			featureValue.push_back(path.scoreBreakdown);
 			modelScore.push_back(oracleScore);
 		}
 		if(oraclebleu > maxBleu)
 		{
-			cerr<<"NBEST : "<<oracle.str()<<"\t|||\tBLEU : "<<oraclebleu<<endl;
+			bestOracle = GetPathString(example, path);
+			cerr<<"NBEST : "<<bestOracle<<"\t|||\tBLEU : "<<oraclebleu<<endl;
 			maxBleu=oraclebleu;
 			maxScore=oracleScore;
-			bestOracle = oracle.str();
 			pp_list::const_iterator it1;
 			oracleBleuScores.clear();
 			oraclefeatureScore.clear();
 			BestOracle=PP_ORACLE;
 			oracleBleuScores.push_back(oraclebleu);
-			oraclefeatureScore.push_back(path.GetScoreBreakdown());
+			oraclefeatureScore.push_back(path.scoreBreakdown);
 		}
 // ------------------------trial--------------------------------//
 		if(implementation==FPercepWMira)
@@ -493,26 +784,16 @@ void OnlineLearner::RunOnlineLearning(Manager& manager)
 				pp_list::const_iterator it1;
 				for(it1=PP_ORACLE.begin(); it1!=PP_ORACLE.end(); it1++)
 				{
-					std::map<std::string, int>::const_iterator itr1;
-					for(itr1=(it1->second).begin(); itr1!=(it1->second).end(); itr1++)
+					if(PP_BEST.find(*it1)==PP_BEST.end() && Visited.insert(*it1).second)
 					{
-						if(PP_BEST[it1->first][itr1->first]!=1 && Visited[it1->first][itr1->first]!=1)
-						{
-							ShootUp(it1->first, itr1->first, abs(oracleScore-bestScore));
-							Visited[it1->first][itr1->first]=1;
-						}
+						ShootUp(*it1, abs(oracleScore-bestScore));
 					}
 				}
 				for(it1=PP_BEST.begin(); it1!=PP_BEST.end(); it1++)
 				{
-					std::map<std::string, int>::const_iterator itr1;
-					for(itr1=(it1->second).begin(); itr1!=(it1->second).end(); itr1++)
+					if(PP_ORACLE.find(*it1)==PP_ORACLE.end() && Visited.insert(*it1).second)
 					{
-						if(PP_ORACLE[it1->first][itr1->first]!=1 && Visited[it1->first][itr1->first]!=1)
-						{
-							ShootDown(it1->first, itr1->first, abs(oracleScore-bestScore));
-							Visited[it1->first][itr1->first]=1;
-						}
+						ShootDown(*it1, abs(oracleScore-bestScore));
 					}
 				}
 			}
@@ -521,26 +802,16 @@ void OnlineLearner::RunOnlineLearning(Manager& manager)
 				pp_list::const_iterator it1;
 				for(it1=PP_ORACLE.begin(); it1!=PP_ORACLE.end(); it1++)
 				{
-					std::map<std::string, int>::const_iterator itr1;
-					for(itr1=(it1->second).begin(); itr1!=(it1->second).end(); itr1++)
+					if(PP_BEST.find(*it1)==PP_BEST.end() && Visited.insert(*it1).second)
 					{
-						if(PP_BEST[it1->first][itr1->first]!=1 && Visited[it1->first][itr1->first]!=1)
-						{
-							ShootDown(it1->first, itr1->first, abs(oracleScore-bestScore));
-							Visited[it1->first][itr1->first]=1;
-						}
+						ShootDown(*it1, abs(oracleScore-bestScore));
 					}
 				}
 				for(it1=PP_BEST.begin(); it1!=PP_BEST.end(); it1++)
 				{
-					std::map<std::string, int>::const_iterator itr1;
-					for(itr1=(it1->second).begin(); itr1!=(it1->second).end(); itr1++)
+					if(PP_ORACLE.find(*it1)==PP_ORACLE.end() && Visited.insert(*it1).second)
 					{
-						if(PP_ORACLE[it1->first][itr1->first]!=1 && Visited[it1->first][itr1->first]!=1)
-						{
-							ShootUp(it1->first, itr1->first, abs(oracleScore-bestScore));
-							Visited[it1->first][itr1->first]=1;
-						}
+						ShootUp(*it1, abs(oracleScore-bestScore));
 					}
 				}
 			}
@@ -552,7 +823,7 @@ void OnlineLearner::RunOnlineLearning(Manager& manager)
 	//	Update the weights
 	if(implementation == FPercepWMira || implementation == Mira)
 	{
-		for (int i=0;i<HypothesisList.size();i++) // same loop used for feature values, modelscores
+		for (int i=0;i<BleuScore.size();i++) // same loop used for feature values, modelscores
 		{
 			float bleuscore = BleuScore[i];
 			loss.push_back(maxBleu-bleuscore);
@@ -565,18 +836,17 @@ void OnlineLearner::RunOnlineLearning(Manager& manager)
 		cerr<<"Updating the Weights\n";
 		size_t update_status = optimiser->updateWeights(weightUpdate,featureValues, losses,
 				BleuScores, modelScores, oraclefeatureScore,oracleBleuScores, oracleModelScores,wlr);
-		StaticData::InstanceNonConst().SetAllWeights(weightUpdate);
 		weightUpdate.PrintCoreFeatures();
 		cerr<<endl;
+		return true;
 	}
-	return;
+	return false;
 }
 
-void OnlineLearner::RunOnlineMultiTaskLearning(Manager& manager, int task)
+void OnlineLearner::RunOnlineMultiTaskLearning(const Manager& manager, const std::string& postEdited, int task)
 {
 	const TranslationSystem &trans_sys = StaticData::Instance().GetTranslationSystem(TranslationSystem::DEFAULT);
 	const StaticData& staticData = StaticData::Instance();
-	const std::vector<Moses::FactorType>& outputFactorOrder=staticData.GetOutputFactorOrder();
 	ScoreComponentCollection weightUpdate = staticData.GetAllWeights();
 	std::vector<const ScoreProducer*> sps = trans_sys.GetFeatureFunctions();
 	ScoreProducer* sp = const_cast<ScoreProducer*>(sps[0]);
@@ -590,18 +860,19 @@ void OnlineLearner::RunOnlineMultiTaskLearning(Manager& manager, int task)
 	}
 //	m_weight=weightUpdate.GetScoreForProducer(sp);	// permanent weight stored in decoder
 
-	const Hypothesis* hypo = manager.GetBestHypothesis();
+	const LearningExample example(manager, staticData.GetOnlineLearningNBestSize());
 	//	Decay(manager.m_lineNumber);
-	stringstream bestHypothesis;
 	PP_BEST.clear();
-	PrintHypo(hypo, bestHypothesis);
-	float bestbleu = GetBleu(bestHypothesis.str(), m_postedited);
-	float bestScore=hypo->GetScore();
-	cerr<<"Best Hypothesis : "<<bestHypothesis.str()<<endl;
-	cerr<<"Post Edit       : "<<m_postedited<<endl;
-	TrellisPathList nBestList;
-	int nBestSize = 100;
-	manager.CalcNBest(nBestSize, nBestList, true);
+	for (size_t i = 0; i < example.best.edges.size(); i++)
+		if (!example.edges[example.best.edges[i]].phrasePair.empty())
+			PP_BEST.insert(example.edges[example.best.edges[i]].phrasePair);
+	SentenceBleu bleu(postEdited);
+	float bestbleu = GetBleu(bleu, example, example.best);
+	float bestScore=example.best.totalScore;
+	cerr<<"Best Hypothesis : "<<GetPathString(example, example.best)<<endl;
+	cerr<<"Post Edit       : "<<postEdited<<endl;
+	std::vector<float> nBestBleu;
+	GetNBestBleu(bleu, example, nBestBleu);
 
 	//------setting the hyperparameters online-----
 	if(staticData.GetHyperParameterAsWeight()){
@@ -613,59 +884,47 @@ void OnlineLearner::RunOnlineMultiTaskLearning(Manager& manager, int task)
 
 
 	std::string bestOracle;
-	std::vector<string> HypothesisList, HypothesisHope, HypothesisFear;
+	std::vector<string> HypothesisHope, HypothesisFear;
 	std::vector<float> loss, BleuScore, BleuScoreHope, BleuScoreFear, oracleBleuScores, lossHope, lossFear, modelScore, oracleModelScores;
 	std::vector<std::vector<float> > losses, BleuScores, BleuScoresHope, BleuScoresFear, lossesHope, lossesFear, modelScores;
 	std::vector<ScoreComponentCollection> featureValue,featureValueHope, featureValueFear, oraclefeatureScore;
 	std::vector<std::vector<ScoreComponentCollection> > featureValues, featureValuesHope, featureValuesFear;
-	std::map<int, map<string, map<string, int> > > OracleList;
-	TrellisPathList::const_iterator iter;
+	std::map<int, pp_list> OracleList;
 	pp_list BestOracle,ShootemUp, ShootemDown,Visited;
 	float maxBleu=0.0, maxScore=0.0,oracleScore=0.0;
 	int whichoracle=-1;
-	for (iter = nBestList.begin(); iter != nBestList.end(); ++iter) {
+	for (size_t p = 0; p < example.nBest.size(); ++p) {
 		whichoracle++;
-		const TrellisPath &path = **iter;
+		const LearningExample::Path &path = example.nBest[p];
 		PP_ORACLE.clear();
-		const std::vector<const Hypothesis *> &edges = path.GetEdges();
-		stringstream oracle;
-		for (int currEdge = (int) edges.size() - 1; currEdge >= 0; currEdge--) {
-			const Hypothesis &edge = *edges[currEdge];
-			CHECK(outputFactorOrder.size() > 0);
-			size_t size = edge.GetCurrTargetPhrase().GetSize();
-			for (size_t pos = 0; pos < size; pos++) {
-				const Factor *factor = edge.GetCurrTargetPhrase().GetFactor(pos, outputFactorOrder[0]);
-				oracle << *factor;
-				oracle << " ";
-			}
-			std::string sourceP = edge.GetSourcePhraseStringRep();  // Source Phrase
-			std::string targetP = edge.GetTargetPhraseStringRep();  // Target Phrase
-			if(!has_only_spaces(sourceP) && !has_only_spaces(targetP) )
+		for (size_t currEdge = 0; currEdge < path.edges.size(); currEdge++) {
+			const LearningExample::Edge &edge = example.edges[path.edges[currEdge]];
+			if(edge.translates)
 			{
-				PP_ORACLE[sourceP][targetP]=1;	// phrase pairs in the current nbest_i
-				OracleList[whichoracle][sourceP][targetP]=1;	// list of all phrase pairs given the nbest_i
+				const PhrasePairKey& pp = edge.phrasePair;
+				PP_ORACLE.insert(pp);	// phrase pairs in the current nbest_i
+				OracleList[whichoracle].insert(pp);	// list of all phrase pairs given the nbest_i
 			}
 		}
-		oracleScore=path.GetTotalScore();
-		float oraclebleu = GetBleu(oracle.str(), m_postedited);
+		oracleScore=path.totalScore;
+		float oraclebleu = nBestBleu[whichoracle];
 		if(implementation != FOnlyPerceptron){
-			HypothesisList.push_back(oracle.str());
 			BleuScore.push_back(oraclebleu);
-			featureValue.push_back(path.GetScoreBreakdown());
+			featureValue.push_back(path.scoreBreakdown);
 			modelScore.push_back(oracleScore);
 		}
 		if(oraclebleu > maxBleu)
 		{
-			cerr<<"NBEST : "<<oracle.str()<<"\t|||\tBLEU : "<<oraclebleu<<endl;
+			bestOracle = GetPathString(example, path);
+			cerr<<"NBEST : "<<bestOracle<<"\t|||\tBLEU : "<<oraclebleu<<endl;
 			maxBleu=oraclebleu;
 			maxScore=oracleScore;
-			bestOracle = oracle.str();
 			pp_list::const_iterator it1;
 			oracleBleuScores.clear();
 			oraclefeatureScore.clear();
 			BestOracle=PP_ORACLE;
 			oracleBleuScores.push_back(oraclebleu);
-			oraclefeatureScore.push_back(path.GetScoreBreakdown());
+			oraclefeatureScore.push_back(path.scoreBreakdown);
 		}
 		// ------------------------trial--------------------------------//
 		if(implementation==FSparsePercepWSparseMira || implementation==FPercepWMira)
@@ -675,26 +934,16 @@ void OnlineLearner::RunOnlineMultiTaskLearning(Manager& manager, int task)
 				pp_list::const_iterator it1;
 				for(it1=PP_ORACLE.begin(); it1!=PP_ORACLE.end(); it1++)
 				{
-					std::map<std::string, int>::const_iterator itr1;
-					for(itr1=(it1->second).begin(); itr1!=(it1->second).end(); itr1++)
+					if(PP_BEST.find(*it1)==PP_BEST.end() && Visited.insert(*it1).second)
 					{
-						if(PP_BEST[it1->first][itr1->first]!=1 && Visited[it1->first][itr1->first]!=1)
-						{
-							ShootUp(it1->first, itr1->first, abs(oracleScore-bestScore));
-							Visited[it1->first][itr1->first]=1;
-						}
+						ShootUp(*it1, abs(oracleScore-bestScore));
 					}
 				}
 				for(it1=PP_BEST.begin(); it1!=PP_BEST.end(); it1++)
 				{
-					std::map<std::string, int>::const_iterator itr1;
-					for(itr1=(it1->second).begin(); itr1!=(it1->second).end(); itr1++)
+					if(PP_ORACLE.find(*it1)==PP_ORACLE.end() && Visited.insert(*it1).second)
 					{
-						if(PP_ORACLE[it1->first][itr1->first]!=1 && Visited[it1->first][itr1->first]!=1)
-						{
-							ShootDown(it1->first, itr1->first, abs(oracleScore-bestScore));
-							Visited[it1->first][itr1->first]=1;
-						}
+						ShootDown(*it1, abs(oracleScore-bestScore));
 					}
 				}
 			}
@@ -703,26 +952,16 @@ void OnlineLearner::RunOnlineMultiTaskLearning(Manager& manager, int task)
 				pp_list::const_iterator it1;
 				for(it1=PP_ORACLE.begin(); it1!=PP_ORACLE.end(); it1++)
 				{
-					std::map<std::string, int>::const_iterator itr1;
-					for(itr1=(it1->second).begin(); itr1!=(it1->second).end(); itr1++)
+					if(PP_BEST.find(*it1)==PP_BEST.end() && Visited.insert(*it1).second)
 					{
-						if(PP_BEST[it1->first][itr1->first]!=1 && Visited[it1->first][itr1->first]!=1)
-						{
-							ShootDown(it1->first, itr1->first, abs(oracleScore-bestScore));
-							Visited[it1->first][itr1->first]=1;
-						}
+						ShootDown(*it1, abs(oracleScore-bestScore));
 					}
 				}
 				for(it1=PP_BEST.begin(); it1!=PP_BEST.end(); it1++)
 				{
-					std::map<std::string, int>::const_iterator itr1;
-					for(itr1=(it1->second).begin(); itr1!=(it1->second).end(); itr1++)
+					if(PP_ORACLE.find(*it1)==PP_ORACLE.end() && Visited.insert(*it1).second)
 					{
-						if(PP_ORACLE[it1->first][itr1->first]!=1 && Visited[it1->first][itr1->first]!=1)
-						{
-							ShootUp(it1->first, itr1->first, abs(oracleScore-bestScore));
-							Visited[it1->first][itr1->first]=1;
-						}
+						ShootUp(*it1, abs(oracleScore-bestScore));
 					}
 				}
 			}
@@ -733,7 +972,7 @@ void OnlineLearner::RunOnlineMultiTaskLearning(Manager& manager, int task)
 	//	Update the weights
 	if(implementation == FPercepWMira || implementation == Mira)
 	{
-		for (int i=0;i<HypothesisList.size();i++) // same loop used for feature values, modelscores
+		for (int i=0;i<BleuScore.size();i++) // same loop used for feature values, modelscores
 		{
 			float bleuscore = BleuScore[i];
 			loss.push_back(maxBleu-bleuscore);
@@ -750,7 +989,7 @@ void OnlineLearner::RunOnlineMultiTaskLearning(Manager& manager, int task)
 			weightUpdate = StaticData::InstanceNonConst().GetMultiTaskLearner()->GetWeightsVector(z);
 			size_t update_status = optimiser->updateMultiTaskLearningWeights(weightUpdate,sp,featureValues, losses,
 					BleuScores, modelScores, oraclefeatureScore,oracleBleuScores, oracleModelScores,
-					staticData.GetMultiTaskLearner()->GetKdKdMatrix(),
+					staticData.GetMultiTaskLearner()->GetInteractionMatrix(),
 					staticData.GetMultiTaskLearner()->GetNumberOfTasks(),task);
 			// set the weights in the memory for ith task
 			weightUpdate.PrintCoreFeatures();
@@ -764,6 +1003,8 @@ void OnlineLearner::RunOnlineMultiTaskLearning(Manager& manager, int task)
 	    	updateIntMatrix();
 	    }
 	}
+	if(m_store)
+		m_store->Flush();
 	return;
 }
 
@@ -778,9 +1019,9 @@ void OnlineLearner::updateIntMatrix(){
 		// log (A^{-1}_t) = log (A^{-1}_{t-1}) - \frac{\eta} * (W^T_{t-1} \times W_{t-1} + W_{t-1} \times W^T_{t-1})
 		float eta = StaticData::Instance().GetMultiTaskLearner()->GetLearningRateIntMatrix();
 		boost::numeric::ublas::matrix<double> sub = prod(trans(W), W) + trans(prod(trans(W), W)) ;
-		std::transform(updated.data().begin(), updated.data().end(), updated.data().begin(), ::log);
+		std::transform(updated.data().begin(), updated.data().end(), updated.data().begin(), static_cast<double (*)(double)>(::log));
 		updated -= eta * sub;
-		std::transform(updated.data().begin(), updated.data().end(), updated.data().begin(), ::exp);
+		std::transform(updated.data().begin(), updated.data().end(), updated.data().begin(), static_cast<double (*)(double)>(::exp));
 		StaticData::InstanceNonConst().GetMultiTaskLearner()->SetInteractionMatrix(updated);
 		std::cerr << "Updated = ";
 		std::cerr << updated << endl;
@@ -796,14 +1037,6 @@ void OnlineLearner::updateIntMatrix(){
 		std::cerr << updated << endl;
 
 	}
-	// update kd x kd matrix because it is used in weight update not the interaction matrix
-	int size = StaticData::Instance().GetAllWeights().Size();
-	int tasks= StaticData::InstanceNonConst().GetMultiTaskLearner()->GetNumberOfTasks();
-	boost::numeric::ublas::matrix<double> kdkdmatrix (tasks*size, tasks*size);
-	boost::numeric::ublas::identity_matrix<double> m (size);
-	MatrixOps::KroneckerProduct(updated, m, kdkdmatrix);
-	StaticData::InstanceNonConst().GetMultiTaskLearner()->SetKdKdMatrix(kdkdmatrix);
-
 }
 
 }
@@ -24,12 +24,21 @@
 #include "Manager.h"
 #include "OnlineLearning/SparseVec.h"
 #include "OnlineLearning/Optimiser.h"
+#include "OnlineLearning/LearnerStore.h"
+#include "SentenceBleu.h"
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+
+#ifdef WITH_THREADS
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#endif
 
 #ifndef ONLINELEARNER_H_
 #define ONLINELEARNER_H_
 
-typedef std::map<std::string, std::map<std::string, float> > pp_feature;
-typedef std::map<std::string, std::map<std::string, int> > pp_list;
 typedef float learningrate;
 
 using namespace std;
@@ -40,63 +49,171 @@ class Optimiser;
 class Phrase;
 class Search;
 
+/** A phrase pair as the factor 0 pointers of its source words, a NULL
+ *  separator, then those of its target words. Factors are unique per
+ *  string, so pairs are compared and hashed without building strings.
+ */
+typedef std::vector<const Factor*> PhrasePairKey;
+
+/** Look-up view of a phrase pair that has not been copied into a key */
+struct PhrasePairRef {
+	PhrasePairRef(const Phrase& s, const Phrase& t) : source(s), target(t) {}
+	const Phrase& source;
+	const Phrase& target;
+};
+
+struct PhrasePairKeyHash {
+	std::size_t operator()(const PhrasePairKey& key) const {
+		return boost::hash_range(key.begin(), key.end());
+	}
+	// must agree with the above for the key built from the same pair
+	std::size_t operator()(const PhrasePairRef& ref) const {
+		std::size_t seed = 0;
+		for (size_t pos = 0; pos < ref.source.GetSize(); ++pos)
+			boost::hash_combine(seed, ref.source.GetFactor(pos, 0));
+		boost::hash_combine(seed, static_cast<const Factor*>(NULL));
+		for (size_t pos = 0; pos < ref.target.GetSize(); ++pos)
+			boost::hash_combine(seed, ref.target.GetFactor(pos, 0));
+		return seed;
+	}
+};
+
+struct PhrasePairKeyEqual {
+	bool operator()(const PhrasePairRef& ref, const PhrasePairKey& key) const {
+		const size_t sourceSize = ref.source.GetSize();
+		if (key.size() != sourceSize + 1 + ref.target.GetSize()) return false;
+		for (size_t pos = 0; pos < sourceSize; ++pos)
+			if (key[pos] != ref.source.GetFactor(pos, 0)) return false;
+		if (key[sourceSize] != NULL) return false;
+		for (size_t pos = 0; pos < ref.target.GetSize(); ++pos)
+			if (key[sourceSize + 1 + pos] != ref.target.GetFactor(pos, 0)) return false;
+		return true;
+	}
+};
+
+/** Online feature value of a phrase pair, with its sparse feature name
+ *  resolved once when the pair is first learnt.
+ */
+struct PhrasePairValue {
+	PhrasePairValue(const FName& n, float s) : name(n), score(s) {}
+	FName name;
+	float score;
+};
+
+typedef boost::unordered_map<PhrasePairKey, PhrasePairValue, PhrasePairKeyHash> pp_feature;
+typedef boost::unordered_map<std::string, boost::shared_ptr<const pp_feature> > session_features;
+typedef boost::unordered_set<PhrasePairKey, PhrasePairKeyHash> pp_list;
+typedef boost::unordered_map<PhrasePairKey, int, PhrasePairKeyHash> pp_index;
+
+/** What learning needs of a decoded sentence: its best hypothesis and its
+ *  n-best list as phrase pairs, output words and scores. It is taken from the
+ *  Manager on the decoding thread, so that the search can be cleaned up there
+ *  and the example learnt from later on another thread.
+ */
+struct LearningExample {
+	//! one hypothesis of the search, stored once however many paths go through it
+	struct Edge {
+		PhrasePairKey phrasePair;	// empty for the initial hypothesis
+		bool translates;	// covers source words and produces target words
+		std::vector<const Factor*> words;	// first output factor
+	};
+	struct Path {
+		std::vector<size_t> edges;	// indexes into LearningExample::edges, first edge first
+		float totalScore;
+		ScoreComponentCollection scoreBreakdown;
+	};
+
+	LearningExample(const Manager& manager, size_t nBestSize);
+	//! an example without hypotheses, to be filled in directly
+	LearningExample() {}
+
+	std::vector<Edge> edges;
+	Path best;
+	std::vector<Path> nBest;
+
+private:
+	size_t AddEdge(const Hypothesis* hypo, boost::unordered_map<const Hypothesis*, size_t>& index);
+};
+
 class OnlineLearner : public StatelessFeatureFunction {
+	friend struct LearningExample;
 
 private:
 	float m_sparseProducerWeight;
 	UpdateInteractionMatrixType updateType;
 	OnlineAlgorithm implementation;
-	pp_feature m_feature;
-	pp_list m_featureIdx;
+	mutable pp_feature m_feature;	// decoding copies in the snapshot values it looks up
+	// values learnt by each session, read before m_feature when decoding for
+	// that session; the map is immutable once published, so reading it takes no lock
+	boost::shared_ptr<const session_features> m_sessionFeatures;
+	pp_feature* m_sessionUpdate;	// values the running session update writes to, NULL when it writes m_feature
+	pp_index m_featureIdx;
 	pp_list PP_ORACLE, PP_BEST;
 	learningrate flr, wlr;
 	int m_PPindex;
-	std::string m_postedited, m_source;
-	bool m_learn, m_normaliseScore;
+	bool m_normaliseScore;
 	MiraOptimiser* optimiser;
 	std::vector<std::string> function_words_english;
 	std::vector<std::string> function_words_italian;
+	LearnerStore* m_store;	// NULL unless the model is persisted
+	size_t m_snapshotInterval, m_updatesSinceSnapshot;
+#ifdef WITH_THREADS
+	mutable boost::shared_mutex m_featureLock;	// m_feature is read by decoding threads while learning updates it
+	boost::mutex m_learnLock;	// one update at a time
+#endif
 	void Evaluate(const TargetPhrase& tp, ScoreComponentCollection* out) const;
-	void ShootUp(std::string sp, std::string tp, float margin);
-	void ShootDown(std::string sp, std::string tp, float margin);
+	void ShootUp(const PhrasePairKey& pp, float margin);
+	void ShootDown(const PhrasePairKey& pp, float margin);
 //	float calcMargin(Hypothesis* oracle, Hypothesis* bestHyp);
-	void PrintHypo(const Hypothesis* hypo, ostream& HypothesisStringStream);
+	float GetBleu(SentenceBleu& bleu, const LearningExample& example, const LearningExample::Path& path) const;
+	void GetNBestBleu(SentenceBleu& bleu, const LearningExample& example, std::vector<float>& bleuScores) const;
+	std::string GetPathString(const LearningExample& example, const LearningExample::Path& path) const;
 	bool has_only_spaces(const std::string& str);
-	float GetBleu(std::string hypothesis, std::string reference);
-	void compareNGrams(map<string, int>& hyp, map<string, int>& ref, map<int, float>& countNgrams, map<int, float>& TotalNgrams);
-	int getNGrams(std::string str, map<string, int>& ngrams);
 	int split_marker_perl(string str, string marker, vector<string> &array);
 	void ReadFunctionWords();
 	void chop(string &str);
 	void Decay(int);
-	void Insert(std::string sp, std::string tp);
+	void Insert(const PhrasePairKey& pp);
+	static PhrasePairKey MakePhrasePairKey(const Phrase& sp, const Phrase& tp);
+	static PhrasePairKey MakePhrasePairKey(const std::string& sp, const std::string& tp);
+	static std::string GetPhrasePairName(const PhrasePairKey& pp);
+	static uint64_t GetPhrasePairId(const PhrasePairKey& pp);
+	static uint64_t GetPhrasePairId(const PhrasePairRef& pp);
+	pp_feature::iterator FindOrLoad(const PhrasePairKey& pp) const;
+	pp_feature::iterator FindInSession(const PhrasePairKey& pp);
+	void PublishSession(const std::string& session, const boost::shared_ptr<const pp_feature>& features);
+	bool Learn(const LearningExample& example, const std::string& postEdited, ScoreComponentCollection& weightUpdate);
+	void Checkpoint(const ScoreComponentCollection& weights);
 	void updateIntMatrix();
 public:
 	SparseVec sparsefeaturevector, sparseweightvector;
 	OnlineLearner(OnlineAlgorithm algorithm, float w_learningrate, float f_learningrate, bool normaliseScore);
 	OnlineLearner(OnlineAlgorithm algorithm, float w_learningrate, float f_learningrate, float slack, float scale_margin, float scale_margin_precision,	float scale_update,
 			float scale_update_precision, bool boost, bool normaliseMargin, bool normaliseScore, int sigmoidParam, bool onlyOnlineScoreProducerUpdate);
-	bool SetPostEditedSentence(std::string s);
-	void SetSourceSentence(std::string line){m_source=line;};
-	std::string GetSourceSentence(){return m_source;};
-	void RunOnlineLearning(Manager& manager);
-	void RunOnlineMultiTaskLearning(Manager& manager, int task);
+	void RunOnlineLearning(const Manager& manager, const std::string& postEdited);
+	void RunOnlineLearning(const LearningExample& example, const std::string& postEdited);
+	/** learns from a post-edit of a session, returns its updated weights; the
+	 *  phrase-pair features it learns stay with the session until merged */
+	boost::shared_ptr<const ScoreComponentCollection> RunOnlineLearning(const LearningExample& example, const std::string& postEdited,
+			const std::string& session, const boost::shared_ptr<const ScoreComponentCollection>& weights);
+	/** makes the phrase-pair features learnt by a session those of every user */
+	void MergeSession(const std::string& session);
+	/** forgets the phrase-pair features learnt by a session */
+	void DropSession(const std::string& session);
+	void RunOnlineMultiTaskLearning(const Manager& manager, const std::string& postEdited, int task);
 	void RemoveJunk();
 	virtual ~OnlineLearner();
 
 	inline size_t GetNumScoreComponents() const { return 0; };
-	void SetOnlineLearningTrue() { m_learn=true;};
-	void SetOnlineLearningFalse() { m_learn=false;};
-	bool GetOnlineLearning() const { return m_learn; };
-
 	inline std::string GetScoreProducerWeightShortName(unsigned) const { return "ol"; };
 	void Evaluate(const PhraseBasedFeatureContext& context,	ScoreComponentCollection* accumulator) const;
 	void EvaluateChart(const ChartBasedFeatureContext& context, ScoreComponentCollection* accumulator) const;
 
 	void ReadFeatures(std::string filename);
 	void DumpFeatures(std::string filename);
+	void OpenStore(const std::string& prefix, size_t snapshotInterval);
 
-	int RetrieveIdx(std::string sp, std::string tp);
+	int RetrieveIdx(const PhrasePairKey& pp);
 
 	void SetSparseProducerWeight(float weight) { m_sparseProducerWeight = weight; }
 	float GetSparseProducerWeight() const { return m_sparseProducerWeight; }
@@ -0,0 +1,117 @@
+/***********************************************************************
+Moses - factored phrase-based language decoder
+Copyright (C) 2013- University of Edinburgh
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+***********************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include "FactorCollection.h"
+#include "OnlineLearner.h"
+#include "StaticData.h"
+#include "Util.h"
+
+using namespace Moses;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(online_learner)
+
+class MockCoreFeature : public StatelessFeatureFunction {
+  public:
+    MockCoreFeature() : StatelessFeatureFunction("MockCore",2) {}
+    virtual void Evaluate(const PhraseBasedFeatureContext&, ScoreComponentCollection*) const {}
+    virtual void EvaluateChart(const ChartBasedFeatureContext&, ScoreComponentCollection*) const {}
+    std::string GetScoreProducerWeightShortName(unsigned) const {return "mc";}
+};
+
+struct LearnerFixture {
+  LearnerFixture() {
+    char dir[] = "/tmp/onlinelearnerXXXXXX";
+    BOOST_REQUIRE(mkdtemp(dir));
+    m_dir = dir;
+    m_prefix = m_dir + "/model";
+  }
+  ~LearnerFixture() {
+    StaticData::Instance().UseWeightSnapshot(WeightSnapshotPtr());
+    remove((m_prefix + ".snapshot").c_str());
+    remove((m_prefix + ".snapshot.tmp").c_str());
+    remove((m_prefix + ".journal").c_str());
+    rmdir(m_dir.c_str());
+  }
+  string m_dir, m_prefix;
+};
+
+// one path per string, whose only edge outputs its words and scores values
+static void AddPath(LearningExample &example, const string &words, float value0, float value1,
+    const MockCoreFeature &feature)
+{
+  LearningExample::Edge edge;
+  edge.translates = false;
+  vector<string> tokens = Tokenize(words);
+  for (size_t i = 0; i < tokens.size(); ++i)
+    edge.words.push_back(FactorCollection::Instance().AddFactor(tokens[i]));
+  example.edges.push_back(edge);
+
+  LearningExample::Path path;
+  path.edges.push_back(example.edges.size() - 1);
+  vector<float> values;
+  values.push_back(value0);
+  values.push_back(value1);
+  path.scoreBreakdown.Assign(&feature, values);
+  path.totalScore = value1;
+  example.nBest.push_back(path);
+}
+
+BOOST_FIXTURE_TEST_CASE(checkpoint_keeps_update, LearnerFixture)
+{
+  MockCoreFeature feature;
+  ScoreComponentCollection weights;
+  weights.Assign(&feature, vector<float>(2, 1));
+  StaticData::InstanceNonConst().SetAllWeights(weights);
+
+  OnlineLearner learner(Mira, 1, 0.1, 0.01, 0, 0, 0, 0, false, false, false, 1, false);
+  learner.OpenStore(m_prefix, 1);
+
+  // the model prefers the path that the post-edit does not match
+  LearningExample example;
+  AddPath(example, "the house is small today", 1, 0, feature);
+  AddPath(example, "a small house of today", 0, 1, feature);
+  example.best = example.nBest[1];
+
+  // as when learning on the thread that decoded the sentence
+  StaticData::Instance().UseWeightSnapshot(StaticData::Instance().GetWeightSnapshot());
+  learner.RunOnlineLearning(example, "the house is small today");
+  const vector<float> updated = StaticData::Instance().GetWeightSnapshot()->GetScoresForProducer(&feature);
+  BOOST_REQUIRE(updated[0] > 1);
+  BOOST_REQUIRE(updated[1] < 1);
+
+  // the update was checkpointed, so the journal is empty and the snapshot has it
+  LearnerStore store(m_prefix);
+  LearnerStore::PairValues pairs;
+  vector<float> core;
+  store.ReadJournal(pairs, core);
+  BOOST_CHECK(pairs.empty());
+  const size_t start = ScoreComponentCollection::GetFirstIndex(&feature);
+  BOOST_REQUIRE(core.size() >= start + 2);
+  BOOST_CHECK_EQUAL(core[start], updated[0]);
+  BOOST_CHECK_EQUAL(core[start + 1], updated[1]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,3 +1,7 @@
+#include <limits>
+
+#include <boost/unordered_map.hpp>
+
 #include "Hildreth.h"
 #include "SparseVec.h"
 using namespace Moses;
@@ -21,129 +25,85 @@ float Hildreth::inner_product(const SparseVec& a, const SparseVec& b)
 
 
 
-vector<float> Hildreth::optimise (const vector<ScoreComponentCollection>& a, const vector<float>& b) {
-
-	size_t i;
-	int max_iter = 10000;
-	float eps = 0.00000001;
-	float zero = 0.000000000001;
-
-	vector<float> alpha ( b.size() );
-	vector<float> F ( b.size() );
-	vector<float> kkt ( b.size() );
-
-	float max_kkt = -1e100;
-
-	size_t K = b.size();
+namespace {
 
-	float A[K][K];
-	bool is_computed[K];
-	for ( i = 0; i < K; i++ )
+// four independent sums, so the loop vectorises without reassociating floats
+float dot(const float* x, const float* y, size_t n)
+{
+	float s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+	size_t j = 0;
+	for ( ; j + 4 <= n; j += 4 )
 	{
-		A[i][i] = a[i].InnerProduct(a[i]);
-		is_computed[i] = false;
+		s0 += x[j] * y[j];
+		s1 += x[j+1] * y[j+1];
+		s2 += x[j+2] * y[j+2];
+		s3 += x[j+3] * y[j+3];
 	}
+	for ( ; j < n; j++ )
+		s0 += x[j] * y[j];
+	return (s0 + s1) + (s2 + s3);
+}
 
-	int max_kkt_i = -1;
-
-
-	for ( i = 0; i < b.size(); i++ )
+// Gram matrix of the constraints, K x K row-major. The vectors are first
+// projected once onto a dense K x D matrix: the core features, then each
+// sparse feature used by any of them, so no product goes through the maps
+void gram(const vector<ScoreComponentCollection>& a, vector<float>& A)
+{
+	const size_t K = a.size();
+	const size_t core = K ? a[0].GetScoresVector().coreSize() : 0;
+	boost::unordered_map<FName, size_t, FNameHash, FNameEquals> columns;
+	for ( size_t i = 0; i < K; i++ )
 	{
-		F[i] = b[i];
-		kkt[i] = F[i];
-		if ( kkt[i] > max_kkt )
-		{
-			max_kkt = kkt[i];
-			max_kkt_i = i;
-		}
+		const FVector& v = a[i].GetScoresVector();
+		CHECK(v.coreSize() == core);
+		for ( FVector::const_iterator f = v.cbegin(); f != v.cend(); ++f )
+			columns.insert(make_pair(f->first, core + columns.size()));
 	}
 
-	int iter = 0;
-	float diff_alpha;
-	float try_alpha;
-	float add_alpha;
-
-	while ( max_kkt >= eps && iter < max_iter )
+	const size_t D = core + columns.size();
+	if ( D == 0 )
 	{
-
-		diff_alpha = A[max_kkt_i][max_kkt_i] <= zero ? 0.0 : F[max_kkt_i]/A[max_kkt_i][max_kkt_i];
-		try_alpha = alpha[max_kkt_i] + diff_alpha;
-		add_alpha = 0.0;
-
-		if ( try_alpha < 0.0 )
-			add_alpha = -1.0 * alpha[max_kkt_i];
-		else
-			add_alpha = diff_alpha;
-
-		alpha[max_kkt_i] = alpha[max_kkt_i] + add_alpha;
-
-		if ( !is_computed[max_kkt_i] )
-		{
-			for ( i = 0; i < K; i++ )
-			{
-				A[i][max_kkt_i] = a[i].InnerProduct(a[max_kkt_i] ); // for version 1
-				//A[i][max_kkt_i] = 0; // for version 1
-				is_computed[max_kkt_i] = true;
-			}
-		}
-
-		for ( i = 0; i < F.size(); i++ )
-		{
-			F[i] -= add_alpha * A[i][max_kkt_i];
-			kkt[i] = F[i];
-			if ( alpha[i] > zero )
-				kkt[i] = abs ( F[i] );
-		}
-		max_kkt = -1e100;
-		max_kkt_i = -1;
-		for ( i = 0; i < F.size(); i++ )
-			if ( kkt[i] > max_kkt )
-			{
-				max_kkt = kkt[i];
-				max_kkt_i = i;
-			}
-
-		iter++;
+		A.assign ( K * K, 0.0 );
+		return;
+	}
+	vector<float> rows ( K * D );
+	for ( size_t i = 0; i < K; i++ )
+	{
+		const FVector& v = a[i].GetScoresVector();
+		float* row = &rows[0] + i * D;
+		for ( size_t j = 0; j < core; j++ )
+			row[j] = v.getCoreFeatures()[j];
+		for ( FVector::const_iterator f = v.cbegin(); f != v.cend(); ++f )
+			row[columns[f->first]] = f->second;
 	}
 
-	return alpha;
+	A.resize ( K * K );
+	for ( size_t i = 0; i < K; i++ )
+		for ( size_t j = 0; j <= i; j++ )
+			A[i*K + j] = A[j*K + i] = dot(&rows[0] + i * D, &rows[0] + j * D, D);
 }
 
-vector<float> Hildreth::optimise (const vector<ScoreComponentCollection>& a, const vector<float>& b, float C) {
+// Hildreth's iterations on a precomputed Gram matrix, alphas bounded by C
+vector<float> solve(const vector<float>& A, const vector<float>& b, float C)
+{
 	size_t i;
 	int max_iter = 10000;
 	float eps = 0.00000001;
 	float zero = 0.000000000001;
 
-	vector<float> alpha ( b.size() );
-	vector<float> F ( b.size() );
-	vector<float> kkt ( b.size() );
+	const size_t K = b.size();
+	vector<float> alpha ( K );
+	vector<float> F ( b );
+	vector<float> kkt ( b );
 
 	float max_kkt = -1e100;
-
-	size_t K = b.size();
-
-	float A[K][K];
-	bool is_computed[K];
-	for ( i = 0; i < K; i++ )
-	{
-		A[i][i] = a[i].InnerProduct(a[i]);
-		is_computed[i] = false;
-	}
-
 	int max_kkt_i = -1;
-
-
-	for ( i = 0; i < b.size(); i++ )
-	{
-		F[i] = b[i];
-		kkt[i] = F[i];
+	for ( i = 0; i < K; i++ )
 		if ( kkt[i] > max_kkt )
 		{
 			max_kkt = kkt[i];
 			max_kkt_i = i;
 		}
-	}
 
 	int iter = 0;
 	float diff_alpha;
@@ -152,7 +112,8 @@ vector<float> Hildreth::optimise (const vector<ScoreComponentCollection>& a, con
 
 	while ( max_kkt >= eps && iter < max_iter )
 	{
-		diff_alpha = A[max_kkt_i][max_kkt_i] <= zero ? 0.0 : F[max_kkt_i]/A[max_kkt_i][max_kkt_i];
+		const float* column = &A[0] + max_kkt_i * K;	// symmetric, so also the column
+		diff_alpha = column[max_kkt_i] <= zero ? 0.0 : F[max_kkt_i]/column[max_kkt_i];
 		try_alpha = alpha[max_kkt_i] + diff_alpha;
 		add_alpha = 0.0;
 
@@ -166,29 +127,18 @@ vector<float> Hildreth::optimise (const vector<ScoreComponentCollection>& a, con
 		alpha[max_kkt_i] = alpha[max_kkt_i] + add_alpha;
 		if(alpha[max_kkt_i] <= 0) alpha[max_kkt_i]=0;
 
-		if ( !is_computed[max_kkt_i] )
+		for ( i = 0; i < K; i++ )
 		{
-			for ( i = 0; i < K; i++ )
-			{
-				A[i][max_kkt_i] = a[i].InnerProduct(a[max_kkt_i] ); // for version 1
-				//A[i][max_kkt_i] = 0; // for version 1
-				is_computed[max_kkt_i] = true;
-			}
-		}
-
-		for ( i = 0; i < F.size(); i++ )
-		{
-			F[i] -= add_alpha * A[i][max_kkt_i];
+			F[i] -= add_alpha * column[i];
 			kkt[i] = F[i];
 			if (alpha[i] > C - zero)
 				kkt[i]=-kkt[i];
 			else if (alpha[i] > zero)
 				kkt[i] = abs(F[i]);
-
 		}
 		max_kkt = -1e100;
 		max_kkt_i = -1;
-		for ( i = 0; i < F.size(); i++ )
+		for ( i = 0; i < K; i++ )
 			if ( kkt[i] > max_kkt )
 			{
 				max_kkt = kkt[i];
@@ -201,6 +151,19 @@ vector<float> Hildreth::optimise (const vector<ScoreComponentCollection>& a, con
 	return alpha;
 }
 
+}
+
+vector<float> Hildreth::optimise (const vector<ScoreComponentCollection>& a, const vector<float>& b) {
+	return optimise(a, b, numeric_limits<float>::infinity());
+}
+
+vector<float> Hildreth::optimise (const vector<ScoreComponentCollection>& a, const vector<float>& b, float C) {
+	CHECK(a.size() == b.size());
+	vector<float> A;
+	gram(a, A);
+	return solve(A, b, C);
+}
+
 vector<float> Hildreth::optimise (const vector<Moses::SparseVec>& a, const vector<float>& b, float C) {
 
 	size_t i;
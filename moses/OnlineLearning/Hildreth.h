@@ -6,6 +6,8 @@ namespace Optimizer {
 
   class Hildreth {
     public :
+      /** the constraints are projected once onto a dense matrix over the
+       *  features they use, and the iterations run on its Gram matrix */
       static std::vector<float> optimise (const std::vector<Moses::ScoreComponentCollection>& a, const std::vector<float>& b );
       static std::vector<float> optimise (const std::vector<Moses::ScoreComponentCollection>& a, const std::vector<float>& b, float C);
       static std::vector<float> optimise (const std::vector<Moses::SparseVec>& a, const std::vector<float>& b, float C);
@@ -0,0 +1,248 @@
+/*
+ * LearnerStore.cpp
+ *
+ */
+
+#include "LearnerStore.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdio.h>
+
+#include <boost/unordered_map.hpp>
+
+#include "util/exception.hh"
+#include "util/file.hh"
+#include "util/murmur_hash.hh"
+#include "util/string_piece_hash.hh"
+#include "util/tokenize_piece.hh"
+
+namespace Moses {
+
+namespace {
+
+const char kSnapshotMagic[8] = {'O', 'L', 'S', 'N', 'A', 'P', '0', '1'};
+const char kPairRecord = 'P';
+const char kWeightsRecord = 'W';
+
+struct SnapshotEntry {
+	uint64_t id;
+	StringPiece name;
+	float score;
+	bool operator<(const SnapshotEntry &other) const {
+		return id < other.id || (id == other.id && name < other.name);
+	}
+};
+
+template <class T> bool ReadValue(std::FILE *file, T &value) {
+	return std::fread(&value, sizeof(T), 1, file) == 1;
+}
+
+}
+
+uint64_t LearnerStore::HashWord(uint64_t seed, const StringPiece &word) {
+	return util::MurmurHashNative(word.data(), word.size(), seed + 1);
+}
+
+uint64_t LearnerStore::HashSeparator(uint64_t seed) {
+	return HashWord(seed, StringPiece("|||"));
+}
+
+uint64_t LearnerStore::PairId(const std::string &name) {
+	const size_t separator = name.find("|||");
+	uint64_t id = 0;
+	for (util::TokenIter<util::AnyCharacter, true> word(StringPiece(name.data(), std::min(separator, name.size())), util::AnyCharacter(" \t")); word; ++word)
+		id = HashWord(id, *word);
+	id = HashSeparator(id);
+	if (separator != std::string::npos) {
+		for (util::TokenIter<util::AnyCharacter, true> word(StringPiece(name.data() + separator + 3, name.size() - separator - 3), util::AnyCharacter(" \t")); word; ++word)
+			id = HashWord(id, *word);
+	}
+	return id;
+}
+
+LearnerStore::LearnerStore(const std::string &prefix)
+	: m_snapshotPath(prefix + ".snapshot"), m_journalPath(prefix + ".journal"),
+	  m_numPairs(0), m_numCore(0), m_ids(NULL), m_offsets(NULL), m_scores(NULL),
+	  m_core(NULL), m_names(NULL), m_journal(NULL)
+{
+	if (std::FILE *exists = std::fopen(m_snapshotPath.c_str(), "rb")) {
+		std::fclose(exists);
+		MapSnapshot(m_snapshotPath);
+	}
+	OpenJournal();
+}
+
+LearnerStore::~LearnerStore() {
+	if (m_journal) std::fclose(m_journal);
+}
+
+void LearnerStore::MapSnapshot(const std::string &path) {
+	util::scoped_fd fd(util::OpenReadOrThrow(path.c_str()));
+	const uint64_t size = util::SizeOrThrow(fd.get());
+	UTIL_THROW_IF(size < sizeof(Header), util::Exception, path << " is too short to be a learner snapshot");
+	Header header;
+	util::PReadOrThrow(fd.get(), &header, sizeof(header), 0);
+	UTIL_THROW_IF(std::memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)), util::Exception, path << " is not a learner snapshot");
+	UTIL_THROW_IF(size != sizeof(Header) + header.numPairs * (2 * sizeof(uint64_t) + sizeof(float)) + sizeof(uint64_t)
+			+ header.numCore * sizeof(float) + header.namesBytes, util::Exception, path << " is truncated");
+
+	util::MapRead(util::POPULATE_OR_LAZY, fd.get(), 0, size, m_mapping);
+	const char *base = m_mapping.begin() + sizeof(Header);
+	m_numPairs = header.numPairs;
+	m_numCore = header.numCore;
+	m_ids = reinterpret_cast<const uint64_t*>(base);
+	m_offsets = m_ids + m_numPairs;
+	m_scores = reinterpret_cast<const float*>(m_offsets + m_numPairs + 1);
+	m_core = m_scores + m_numPairs;
+	m_names = reinterpret_cast<const char*>(m_core + m_numCore);
+}
+
+// reads what the journal holds and truncates it after the last whole record
+void LearnerStore::OpenJournal() {
+	m_journalPairs.clear();
+	m_journalCore.clear();
+	long good = 0;
+	if (std::FILE *in = std::fopen(m_journalPath.c_str(), "rb")) {
+		char type;
+		uint32_t length;
+		while (ReadValue(in, type) && ReadValue(in, length)) {
+			if (type == kPairRecord) {
+				std::string name(length, ' ');
+				float score;
+				if (length && std::fread(&name[0], 1, length, in) != length) break;
+				if (!ReadValue(in, score)) break;
+				m_journalPairs.push_back(std::make_pair(name, score));
+			} else if (type == kWeightsRecord) {
+				std::vector<float> weights(length);
+				if (length && std::fread(&weights[0], sizeof(float), length, in) != length) break;
+				m_journalCore.swap(weights);
+			} else {
+				break;
+			}
+			good = std::ftell(in);
+		}
+		std::fclose(in);
+		util::scoped_fd fd(open(m_journalPath.c_str(), O_RDWR));
+		if (fd.get() != -1) util::ResizeOrThrow(fd.get(), good);
+	}
+	m_journal = std::fopen(m_journalPath.c_str(), "ab");
+	UTIL_THROW_IF(!m_journal, util::ErrnoException, "Could not open " << m_journalPath);
+}
+
+bool LearnerStore::HasId(uint64_t id) const {
+	return std::binary_search(m_ids, m_ids + m_numPairs, id);
+}
+
+// pairs whose ids collide are next to each other, and told apart by name
+bool LearnerStore::Find(uint64_t id, const StringPiece &name, float &score) const {
+	for (const uint64_t *found = std::lower_bound(m_ids, m_ids + m_numPairs, id); found != m_ids + m_numPairs && *found == id; ++found) {
+		const size_t i = found - m_ids;
+		if (GetSnapshotName(i) == name) {
+			score = m_scores[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+void LearnerStore::ReadJournal(PairValues &pairs, std::vector<float> &coreWeights) const {
+	pairs = m_journalPairs;
+	if (!m_journalCore.empty()) {
+		coreWeights = m_journalCore;
+	} else {
+		coreWeights.assign(m_core, m_core + m_numCore);
+	}
+}
+
+void LearnerStore::LogPair(const std::string &name, float score) {
+	const uint32_t length = name.size();
+	util::WriteOrThrow(m_journal, &kPairRecord, 1);
+	util::WriteOrThrow(m_journal, &length, sizeof(length));
+	util::WriteOrThrow(m_journal, name.data(), length);
+	util::WriteOrThrow(m_journal, &score, sizeof(score));
+}
+
+void LearnerStore::LogCoreWeights(const std::vector<float> &weights) {
+	const uint32_t length = weights.size();
+	util::WriteOrThrow(m_journal, &kWeightsRecord, 1);
+	util::WriteOrThrow(m_journal, &length, sizeof(length));
+	if (length) util::WriteOrThrow(m_journal, &weights[0], length * sizeof(float));
+}
+
+void LearnerStore::Flush() {
+	UTIL_THROW_IF(std::fflush(m_journal), util::ErrnoException, "Could not flush " << m_journalPath);
+}
+
+void LearnerStore::WriteSnapshot(const PairValues &pairs, const std::vector<float> &coreWeights) {
+	std::vector<SnapshotEntry> entries;
+	entries.reserve(m_numPairs + pairs.size());
+	boost::unordered_map<StringPiece, size_t> updated;
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		SnapshotEntry entry;
+		entry.id = PairId(pairs[i].first);
+		entry.name = StringPiece(pairs[i].first);
+		entry.score = pairs[i].second;
+		std::pair<boost::unordered_map<StringPiece, size_t>::iterator, bool> ins = updated.insert(std::make_pair(entry.name, entries.size()));
+		if (ins.second) {
+			entries.push_back(entry);
+		} else {
+			entries[ins.first->second] = entry;	// the later value of the same pair wins
+		}
+	}
+	for (size_t i = 0; i < m_numPairs; ++i) {
+		if (updated.find(GetSnapshotName(i)) != updated.end()) continue;
+		SnapshotEntry entry;
+		entry.id = m_ids[i];
+		entry.name = GetSnapshotName(i);
+		entry.score = m_scores[i];
+		entries.push_back(entry);
+	}
+	std::sort(entries.begin(), entries.end());
+
+	Header header;
+	std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+	header.numPairs = entries.size();
+	header.numCore = coreWeights.size();
+	header.namesBytes = 0;
+	for (size_t i = 0; i < entries.size(); ++i)
+		header.namesBytes += entries[i].name.size();
+
+	const std::string tmpPath = m_snapshotPath + ".tmp";
+	util::scoped_fd fd(util::CreateOrThrow(tmpPath.c_str()));
+	util::scoped_FILE file(util::FDOpenOrThrow(fd));
+	std::FILE *out = file.get();
+	util::WriteOrThrow(out, &header, sizeof(header));
+	for (size_t i = 0; i < entries.size(); ++i)
+		util::WriteOrThrow(out, &entries[i].id, sizeof(uint64_t));
+	uint64_t offset = 0;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		util::WriteOrThrow(out, &offset, sizeof(uint64_t));
+		offset += entries[i].name.size();
+	}
+	util::WriteOrThrow(out, &offset, sizeof(uint64_t));
+	for (size_t i = 0; i < entries.size(); ++i)
+		util::WriteOrThrow(out, &entries[i].score, sizeof(float));
+	if (!coreWeights.empty())
+		util::WriteOrThrow(out, &coreWeights[0], coreWeights.size() * sizeof(float));
+	for (size_t i = 0; i < entries.size(); ++i)
+		util::WriteOrThrow(out, entries[i].name.data(), entries[i].name.size());
+	UTIL_THROW_IF(std::fflush(out), util::ErrnoException, "Could not flush " << tmpPath);
+	util::FSyncOrThrow(fileno(out));
+}
+
+// the journal is emptied only once the new snapshot is in place; a crash in
+// between replays values the snapshot already holds
+void LearnerStore::InstallSnapshot() {
+	const std::string tmpPath = m_snapshotPath + ".tmp";
+	UTIL_THROW_IF(std::rename(tmpPath.c_str(), m_snapshotPath.c_str()), util::ErrnoException, "Could not rename " << tmpPath);
+	MapSnapshot(m_snapshotPath);
+	std::fclose(m_journal);
+	m_journal = std::fopen(m_journalPath.c_str(), "wb");
+	UTIL_THROW_IF(!m_journal, util::ErrnoException, "Could not open " << m_journalPath);
+	m_journalPairs.clear();
+	m_journalCore.clear();
+}
+
+}
@@ -0,0 +1,95 @@
+/*
+ * LearnerStore.h
+ *
+ */
+
+#ifndef LEARNERSTORE_H_
+#define LEARNERSTORE_H_
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "util/mmap.hh"
+#include "util/string_piece.hh"
+
+namespace Moses {
+
+/** Persistent state of the online learner under one path prefix.
+ *
+ *  <prefix>.snapshot is a compact binary image of the phrase-pair feature
+ *  values and the core weights. It is memory-mapped rather than parsed, so
+ *  start-up does not depend on its size. Pairs are identified by a 64-bit
+ *  hash of their words and found by binary search over the sorted ids,
+ *  then by name among the pairs sharing an id.
+ *
+ *  <prefix>.journal is appended to after every update made since the
+ *  snapshot. Records hold absolute values, so replaying one twice is
+ *  harmless. A record cut short by a crash is dropped when the journal is
+ *  opened again.
+ */
+class LearnerStore {
+public:
+	typedef std::vector<std::pair<std::string, float> > PairValues;
+
+	/** pair ids are chained over the words, with a separator between the
+	 *  source and the target words */
+	static uint64_t HashWord(uint64_t seed, const StringPiece &word);
+	static uint64_t HashSeparator(uint64_t seed);
+	static uint64_t PairId(const std::string &name);	// name: "source words|||target words"
+
+	explicit LearnerStore(const std::string &prefix);
+	~LearnerStore();
+
+	/** whether some pair of the snapshot has this id, a cheap check before
+	 *  building the name Find needs */
+	bool HasId(uint64_t id) const;
+	bool Find(uint64_t id, const StringPiece &name, float &score) const;
+	size_t GetSnapshotSize() const {
+		return m_numPairs;
+	}
+	StringPiece GetSnapshotName(size_t i) const {
+		return StringPiece(m_names + m_offsets[i], m_offsets[i + 1] - m_offsets[i]);
+	}
+	float GetSnapshotScore(size_t i) const {
+		return m_scores[i];
+	}
+
+	/** pair values logged since the snapshot, oldest first, and the latest
+	 *  core weights known (empty if none were ever stored) */
+	void ReadJournal(PairValues &pairs, std::vector<float> &coreWeights) const;
+
+	void LogPair(const std::string &name, float score);
+	void LogCoreWeights(const std::vector<float> &weights);
+	void Flush();
+
+	/** write a new snapshot holding the current one overridden by pairs, then
+	 *  start an empty journal. The old mapping stays valid until
+	 *  InstallSnapshot, so lookups can go on while the file is written */
+	void WriteSnapshot(const PairValues &pairs, const std::vector<float> &coreWeights);
+	void InstallSnapshot();
+
+private:
+	struct Header {
+		char magic[8];
+		uint64_t numPairs, numCore, namesBytes;
+	};
+
+	void MapSnapshot(const std::string &path);
+	void OpenJournal();
+
+	std::string m_snapshotPath, m_journalPath;
+	util::scoped_memory m_mapping;
+	size_t m_numPairs, m_numCore;
+	const uint64_t *m_ids, *m_offsets;
+	const float *m_scores, *m_core;
+	const char *m_names;
+	std::vector<float> m_journalCore;	// last core weights read from the journal
+	PairValues m_journalPairs;
+	std::FILE *m_journal;
+};
+
+}
+
+#endif /* LEARNERSTORE_H_ */
@@ -28,10 +28,10 @@ size_t MiraOptimiser::updateMultiTaskLearningWeights(
     const vector<ScoreComponentCollection>& oracleFeatureValues,
     const vector<float> oracleBleuScores,
     const vector<float> oracleModelScores,
-    const boost::numeric::ublas::matrix<double>& regularizer,
+    const boost::numeric::ublas::matrix<double>& interactionMatrix,
     const int task,
     const int task_id) {
-	cerr<<"Dimensions of regularizer : "<<regularizer.size1()<<" x "<<regularizer.size2()<<endl;
+	CHECK(interactionMatrix.size1() == (size_t) task && interactionMatrix.size2() == (size_t) task);
 	// vector of feature values differences for all created constraints
 	vector<ScoreComponentCollection> featureValueDiffs;
 	vector<float> lossMinusModelScoreDiffs;
@@ -109,37 +109,17 @@ size_t MiraOptimiser::updateMultiTaskLearningWeights(
 		if(alpha != 0){
 	  	ScoreComponentCollection update(featureValueDiffs[k]);
 
-	    // build the feature matrix \phi_t
-	    boost::numeric::ublas::matrix<double> featureMatrix(update.Size()*task,1);
-	    boost::numeric::ublas::matrix<double> W(task,update.Size());
-	    const Moses::FVector x = update.GetScoresVector();
-	    for(size_t i=0; i<task; i++){
-	    	if(i == task_id){
-	    		for(int j=0;j<x.size(); j++){
-	    			featureMatrix (i*update.Size()+j,0) = x[j];
-	    		}
-	    	}
-	    	else{
-	    		for(int j=0;j<update.Size(); j++){
-	    			featureMatrix (i*update.Size()+j,0) = 0;
-	    		}
-	    	}
-	    }
-	    cerr<<"Dimensions of feature matrix : "<<featureMatrix.size1()<<" x "<<featureMatrix.size2()<<endl;
-	    // take dot prod. of kdkd matrix and feature matrix
-	    boost::numeric::ublas::matrix<double> C = boost::numeric::ublas::prod(regularizer, featureMatrix);
-	    cerr<<"Dimensions of product : "<<C.size1()<<" x "<<C.size2()<<endl;
+	    // The update is block task_id of (A \otimes I_d) \phi_t, where the feature
+	    // vector \phi_t holds the update in block task_id and zeros elsewhere.
+	    // Block i of that product is A(i, task_id) times the update, so only
+	    // one entry of the interaction matrix is needed and the kd x kd
+	    // Kronecker product is never formed.
 	    ScoreComponentCollection temp(update);
-	    for(size_t i=0;i<update.Size();i++){
-		float x = C(task_id*update.Size()+i, 0);
-		cerr<<"("<<i<<" , "<<x<<")\t";
-	    	temp.Assign(i, x);
-	    }
+	    temp.MultiplyEquals(interactionMatrix(task_id, task_id));
 	    // here we also multiply with the co-regularization vector
 	    temp.MultiplyEquals(alpha); 
 	    // sum updates
 	    summedUpdate.PlusEquals(temp);
-	    cerr<<endl;
 
 	    }
 	  }
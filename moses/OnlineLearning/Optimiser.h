@@ -62,7 +62,7 @@ namespace Optimizer {
   	   const std::vector< Moses::ScoreComponentCollection>& oracleFeatureValues,
   	   const std::vector<float> oracleBleuScores,
   	   const std::vector<float> oracleModelScores,
-  	   const boost::numeric::ublas::matrix<double>& regularizer,
+  	   const boost::numeric::ublas::matrix<double>& interactionMatrix,
   	   const int task,
   	   const int task_id);
 
@@ -56,6 +56,7 @@ Parameter::Parameter()
   AddParam("lmodel-file", "location and properties of the language models");
   AddParam("lmodel-dub", "dictionary upper bounds of language models");
   AddParam("lmodel-oov-feature", "add language model oov feature, one per model");
+  AddParam("lmodel-memo-size", "number of entries in the per-sentence KenLM query memo (default 0 = no memo)");
   AddParam("mapping", "description of decoding steps");
   AddParam("max-partial-trans-opt", "maximum number of partial translation options per input span (during mapping steps)");
   AddParam("max-trans-opt-per-coverage", "maximum number of translation options per input span (after applying mapping steps)");
@@ -120,6 +121,7 @@ Parameter::Parameter()
   AddParam("lmbr-p", "unigram precision value for lattice mbr");
   AddParam("lmbr-r", "ngram precision decay value for lattice mbr");
   AddParam("lmbr-map-weight", "weight given to map solution when doing lattice MBR (default 0)");
+  AddParam("lmbr-threads", "number of threads computing the n-gram posteriors of a lattice in lattice MBR and consensus decoding (default 1)");
   AddParam("lattice-hypo-set", "to use lattice as hypo set during lattice MBR");
   AddParam("clean-lm-cache", "clean language model caches after N translations (default N=1)");
   AddParam("use-persistent-cache", "cache translation options across sentences (default true)");
@@ -203,6 +205,8 @@ Parameter::Parameter()
   AddParam("w_algorithm","algorithm to be used for online learning of weights : mira");
   AddParam("w_learningrate", "online learning rate for weights");
   AddParam("f_learningrate", "online learning rate for features");
+  AddParam("online-learning-store", "path prefix of the snapshot and journal that persist the online learning model");
+  AddParam("online-learning-snapshot-interval", "number of online learning updates between snapshots (default 1000, 0 = journal only)");
   AddParam("normaliseScore", "Normalise the online feature score: squash between 0 and 1");
   AddParam("weight-ol", "ol", "initial weight for online learning feature");
   AddParam("numIterations", "number of iterations for online learning feature");
@@ -217,6 +221,8 @@ Parameter::Parameter()
   AddParam("dump-weights-online", "dump online weights to a file [option passed with a filename]");
   AddParam("read-online-learning-model", "path to read online learning model");
   AddParam("dump-online-learning-model", "path to write online learning model");
+  AddParam("online-learning-nbest-size", "number of translations searched for the oracle of each post-edit (default 100)");
+  AddParam("online-learning-staleness", "number of post-edit updates a sentence may be decoded without when running multi-threaded; 0 = apply post-edits strictly in input order (default)");
   AddParam("use-hyper-parameters-as-weights", "do you wish to use hyper parameters as normal feature weights ? use me : don't");
   AddParam("weight-hpw", "hpw", "hyper parameters in this order : slack, feature learning rate, weight learning rate");
 
@@ -135,6 +135,12 @@ public:
     }
   }
 
+  //! position of the first dense score of a producer
+  static size_t GetFirstIndex(const ScoreProducer* sp)
+  {
+    return GetIndexes(sp).first;
+  }
+
   /** Create and FVector with the right number of core features */
   static FVector CreateFVector()
   {
@@ -254,6 +260,12 @@ public:
     m_scores[fname] += score;
   }
 
+  //For features whose name was resolved beforehand
+  void SparsePlusEquals(const FName& fname, float score)
+  {
+    m_scores[fname] += score;
+  }
+
   void Assign(const ScoreProducer* sp, const std::vector<float>& scores)
   {
     IndexPair indexes = GetIndexes(sp);
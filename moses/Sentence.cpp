@@ -69,61 +69,23 @@ int Sentence::Read(std::istream& in,const std::vector<FactorType>& factorOrder)
   if (getline(in, line, '\n').eof())
     return 0;
   const StaticData &staticData = StaticData::Instance();
-  if(staticData.GetOnlineLearningModel()!=NULL){
-  	  StaticData::InstanceNonConst().SetSourceOnlineLearning(line);
-  }
-  if(staticData.GetOnlineLearningModel()!=NULL && !staticData.MultiTaskingOn())
+  // the post-edit and the task id stay on the input rather than in the
+  // learner, since several threads may be reading inputs at once
+  if(staticData.GetOnlineLearningModel()!=NULL)
   {
 	  std::vector<string> strs;
 	  int splits=split_marker_perl(line, "_#_", strs);
-	  OnlineLearner* ol=StaticData::InstanceNonConst().GetOnlineLearningModel();
-	  if(splits>1){
-		  ol->SetOnlineLearningTrue();
-		  if(ol!=NULL){
-			  if(!ol->SetPostEditedSentence(strs[1])) return 0;
-		  }
-		  else{
-			  VERBOSE(1, "online learning module not activated!!");
-			  return 0;
+	  if(!staticData.MultiTaskingOn()){
+		  if(splits>1){
+			  SetPostEditedSentence(strs[1]);
 		  }
 	  }
-	  else{
-		  ol->SetOnlineLearningFalse();
-	  }
-	  line=strs[0];
-  }
-
-  if(staticData.GetOnlineLearningModel()!=NULL && staticData.MultiTaskingOn())
-  {
-	  std::vector<string> strs;
-	  int splits=split_marker_perl(line, "_#_", strs);
-	  OnlineLearner* ol=StaticData::InstanceNonConst().GetOnlineLearningModel();
-	  if(splits>2){
-		  ol->SetOnlineLearningTrue();
-		  if(ol!=NULL){
-			  if(!ol->SetPostEditedSentence(strs[1])) return 0;
-			  int task = atoi(strs[2].c_str());
-			  StaticData::InstanceNonConst().GetMultiTaskLearner()->SetCurrentTask(task);
-			  StaticData::InstanceNonConst().SetAllWeights(StaticData::InstanceNonConst().GetMultiTaskLearner()->GetWeightsVector(task));
-			  cerr<<"Using weights for task id "<<task<<"\t";
-			  ScoreComponentCollection weightUpdate = staticData.GetAllWeights();
-			  weightUpdate.PrintCoreFeatures();
-			  cerr<<endl;
-		  }
-		  else{
-			  VERBOSE(1, "online learning module not activated!!");
-			  return 0;
-		  }
+	  else if(splits>2){
+		  SetPostEditedSentence(strs[1]);
+		  SetTaskId(atoi(strs[2].c_str()));
 	  }
 	  else if(splits==2){	// even while decoding normal sentence we need task id
-		  ol->SetOnlineLearningFalse();
-		  int task = atoi(strs[1].c_str());
-		  StaticData::InstanceNonConst().GetMultiTaskLearner()->SetCurrentTask(task);
-		  StaticData::InstanceNonConst().SetAllWeights(StaticData::InstanceNonConst().GetMultiTaskLearner()->GetWeightsVector(task));
-		  cerr<<"Using weights for task id "<<task<<"\t";\
-		  ScoreComponentCollection weightUpdate = staticData.GetAllWeights();
-		  weightUpdate.PrintCoreFeatures();
-		  cerr<<endl;
+		  SetTaskId(atoi(strs[1].c_str()));
 	  }
 	  else {
 		  UserMessage::Add("Multi tasking is on : you did not provide the task id. FAILED\n");
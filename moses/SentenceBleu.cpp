@@ -0,0 +1,308 @@
+/***********************************************************************
+Moses - factored phrase-based language decoder
+Copyright (C) 2013- University of Edinburgh
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+***********************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include "FactorCollection.h"
+#include "SentenceBleu.h"
+
+namespace Moses
+{
+
+const size_t SentenceBleu::kMaxOrder;
+const SentenceBleu::WordId SentenceBleu::kNoWord;
+
+SentenceBleu::NGramTable::NGramTable()
+  : m_entries(16), m_size(0)
+{
+  for (size_t i = 0; i < m_entries.size(); ++i) {
+    m_entries[i].ngram.words[0] = kNoWord;
+    m_entries[i].count = 0;
+  }
+}
+
+size_t SentenceBleu::NGramTable::Slot(const NGram &ngram) const
+{
+  uint64_t hash = 0;
+  for (size_t i = 0; i < kMaxOrder; ++i) {
+    hash = (hash + ngram.words[i]) * 0x9E3779B97F4A7C15ULL;
+  }
+  return (hash ^ (hash >> 32)) & (m_entries.size() - 1);
+}
+
+int &SentenceBleu::NGramTable::operator[](const NGram &ngram)
+{
+  if (2 * (m_size + 1) > m_entries.size()) Grow();
+  const size_t mask = m_entries.size() - 1;
+  for (size_t slot = Slot(ngram); ; slot = (slot + 1) & mask) {
+    Entry &entry = m_entries[slot];
+    if (IsEmpty(slot)) {
+      entry.ngram = ngram;
+      entry.count = 0;
+      m_touched.push_back(slot);
+      ++m_size;
+      return entry.count;
+    }
+    if (std::equal(ngram.words, ngram.words + kMaxOrder, entry.ngram.words)) {
+      return entry.count;
+    }
+  }
+}
+
+int SentenceBleu::NGramTable::Find(const NGram &ngram) const
+{
+  const size_t mask = m_entries.size() - 1;
+  for (size_t slot = Slot(ngram); !IsEmpty(slot); slot = (slot + 1) & mask) {
+    const Entry &entry = m_entries[slot];
+    if (std::equal(ngram.words, ngram.words + kMaxOrder, entry.ngram.words)) {
+      return entry.count;
+    }
+  }
+  return 0;
+}
+
+int SentenceBleu::NGramTable::Decrement(const NGram &ngram)
+{
+  const size_t mask = m_entries.size() - 1;
+  for (size_t slot = Slot(ngram); !IsEmpty(slot); slot = (slot + 1) & mask) {
+    Entry &entry = m_entries[slot];
+    if (std::equal(ngram.words, ngram.words + kMaxOrder, entry.ngram.words)) {
+      const int count = entry.count--;
+      if (entry.count == 0) EraseSlot(slot);
+      return count;
+    }
+  }
+  return 0;
+}
+
+// moves later entries of the probe sequence back into the hole, so lookups
+// never need tombstones. Every slot an entry moves to was filled before, so
+// it is already among the touched slots
+void SentenceBleu::NGramTable::EraseSlot(size_t hole)
+{
+  const size_t mask = m_entries.size() - 1;
+  for (size_t slot = (hole + 1) & mask; !IsEmpty(slot); slot = (slot + 1) & mask) {
+    const size_t home = Slot(m_entries[slot].ngram);
+    // the entry may fill the hole unless its home lies cyclically in (hole, slot]
+    const bool reachable = (hole <= slot) ? (hole < home && home <= slot) : (hole < home || home <= slot);
+    if (!reachable) {
+      m_entries[hole] = m_entries[slot];
+      hole = slot;
+    }
+  }
+  m_entries[hole].ngram.words[0] = kNoWord;
+  m_entries[hole].count = 0;
+  --m_size;
+}
+
+void SentenceBleu::NGramTable::Clear()
+{
+  for (size_t i = 0; i < m_touched.size(); ++i) {
+    Entry &entry = m_entries[m_touched[i]];
+    entry.ngram.words[0] = kNoWord;
+    entry.count = 0;
+  }
+  m_touched.clear();
+  m_size = 0;
+}
+
+void SentenceBleu::NGramTable::Grow()
+{
+  std::vector<Entry> old(m_entries.size() * 2);
+  old.swap(m_entries);
+  for (size_t i = 0; i < m_entries.size(); ++i) {
+    m_entries[i].ngram.words[0] = kNoWord;
+    m_entries[i].count = 0;
+  }
+  std::vector<size_t> touched;
+  touched.swap(m_touched);
+  m_size = 0;
+  for (size_t i = 0; i < touched.size(); ++i) {
+    // slots may have been emptied since, or be listed twice
+    const Entry &entry = old[touched[i]];
+    if (entry.ngram.words[0] != kNoWord) {
+      (*this)[entry.ngram] = entry.count;
+    }
+  }
+}
+
+SentenceBleu::SentenceBleu()
+  : m_refLength(0), m_hypLength(0)
+{
+  std::fill(m_matches, m_matches + kMaxOrder, 0);
+  std::fill(m_totals, m_totals + kMaxOrder, 0);
+}
+
+SentenceBleu::SentenceBleu(const std::string &reference)
+  : m_refLength(0), m_hypLength(0)
+{
+  std::fill(m_matches, m_matches + kMaxOrder, 0);
+  std::fill(m_totals, m_totals + kMaxOrder, 0);
+
+  FactorCollection &factorCollection = FactorCollection::Instance();
+  std::vector<WordId> words;
+  size_t prev = 0;
+  size_t found = reference.find(' ');
+  while (found != std::string::npos) {
+    words.push_back(factorCollection.AddFactor(StringPiece(reference.data() + prev, found - prev))->GetId());
+    prev = found + 1;
+    found = reference.find(' ', prev);
+  }
+  SetReference(words, reference.size());
+}
+
+void SentenceBleu::SetReference(const std::vector<WordId> &words, size_t length)
+{
+  m_refCounts.Clear();
+  m_refLength = length;
+  AddReference(words);
+}
+
+void SentenceBleu::AddReference(const std::vector<WordId> &words)
+{
+  for (size_t n = 1; n <= kMaxOrder; n++) {
+    for (size_t start = 0; start + n <= words.size(); start++) {
+      m_refCounts[MakeNGram(&words[start], n)]++;
+    }
+  }
+  Rescore();
+}
+
+// the matches depend on the reference
+void SentenceBleu::Rescore()
+{
+  std::vector<std::pair<WordId, size_t> > hypothesis(m_words);
+  ClearHypothesis();
+  for (size_t i = 0; i < hypothesis.size(); ++i) {
+    Push(hypothesis[i].first, hypothesis[i].second);
+  }
+}
+
+SentenceBleu::NGram SentenceBleu::MakeNGram(const WordId *words, size_t n)
+{
+  NGram ngram;
+  std::fill(ngram.words, ngram.words + kMaxOrder, kNoWord);
+  std::copy(words, words + n, ngram.words);
+  return ngram;
+}
+
+SentenceBleu::NGram SentenceBleu::GetLastNGram(size_t n) const
+{
+  NGram ngram;
+  std::fill(ngram.words, ngram.words + kMaxOrder, kNoWord);
+  for (size_t i = 0; i < n; ++i) {
+    ngram.words[i] = m_words[m_words.size() - n + i].first;
+  }
+  return ngram;
+}
+
+// a hypothesis n-gram found in the reference is credited with the larger of
+// the two counts, so the n-gram adds the reference count the first time it
+// occurs and one for each occurrence beyond that count
+int SentenceBleu::GetMatchIncrement(const NGram &ngram, int hypCount) const
+{
+  const int refCount = m_refCounts.Find(ngram);
+  if (refCount == 0) return 0;
+  if (hypCount == 1) return refCount;
+  return (hypCount > refCount) ? 1 : 0;
+}
+
+void SentenceBleu::Push(WordId word, size_t length)
+{
+  m_words.push_back(std::make_pair(word, length));
+  m_hypLength += length;
+  for (size_t n = 1; n <= kMaxOrder && n <= m_words.size(); n++) {
+    const NGram ngram = GetLastNGram(n);
+    int &count = m_hypCounts[ngram];
+    count++;
+    m_totals[n-1]++;
+    m_matches[n-1] += GetMatchIncrement(ngram, count);
+  }
+}
+
+void SentenceBleu::Pop()
+{
+  for (size_t n = 1; n <= kMaxOrder && n <= m_words.size(); n++) {
+    const NGram ngram = GetLastNGram(n);
+    m_matches[n-1] -= GetMatchIncrement(ngram, m_hypCounts.Decrement(ngram));
+    m_totals[n-1]--;
+  }
+  m_hypLength -= m_words.back().second;
+  m_words.pop_back();
+}
+
+void SentenceBleu::ClearHypothesis()
+{
+  m_hypCounts.Clear();
+  m_words.clear();
+  m_hypLength = 0;
+  std::fill(m_matches, m_matches + kMaxOrder, 0);
+  std::fill(m_totals, m_totals + kMaxOrder, 0);
+}
+
+float SentenceBleu::GetBleu() const
+{
+  double bp=1;
+  double logBleu=0;
+  for(size_t i=0; i<kMaxOrder; i++) {
+    float count = m_matches[i];
+    float total = m_totals[i];
+    count+=0.1;
+    total+=0.1;
+    logBleu += log((count*1.0)/(total*1.0));
+  }
+  double ratio = ((m_refLength*1.0+1.0) / (m_hypLength*1.0+1.0) );
+  if(m_hypLength < m_refLength)
+    bp = exp(1 - ratio);
+  return ((bp * exp(logBleu / 4))*100);
+}
+
+void SentenceBleu::CountMatches(const std::vector<WordId> &words,
+                                size_t startBegin, size_t startEnd,
+                                size_t endBegin, size_t endEnd,
+                                std::vector<size_t> &counts, std::vector<size_t> &matches) const
+{
+  const size_t maxOrder = std::min(counts.size(), kMaxOrder);
+  endEnd = std::min(endEnd, words.size());
+  for (size_t end = endBegin; end < endEnd; ++end) {
+    for (size_t n = 1; n <= maxOrder && n <= end + 1; ++n) {
+      const size_t start = end + 1 - n;
+      if (start < startBegin || start >= startEnd) continue;
+      counts[n-1]++;
+      if (m_refCounts.Find(MakeNGram(&words[start], n))) matches[n-1]++;
+    }
+  }
+}
+
+void SentenceBleu::CountClippedMatches(const std::vector<WordId> &words,
+                                       std::vector<size_t> &counts, std::vector<size_t> &matches) const
+{
+  const size_t maxOrder = std::min(counts.size(), kMaxOrder);
+  NGramTable hypCounts;
+  for (size_t end = 0; end < words.size(); ++end) {
+    for (size_t n = 1; n <= maxOrder && n <= end + 1; ++n) {
+      const NGram ngram = MakeNGram(&words[end + 1 - n], n);
+      counts[n-1]++;
+      if (++hypCounts[ngram] <= m_refCounts.Find(ngram)) matches[n-1]++;
+    }
+  }
+}
+
+}
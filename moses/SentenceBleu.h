@@ -0,0 +1,130 @@
+/***********************************************************************
+Moses - factored phrase-based language decoder
+Copyright (C) 2013- University of Edinburgh
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+***********************************************************************/
+
+#ifndef moses_SentenceBleu_h
+#define moses_SentenceBleu_h
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Factor.h"
+
+namespace Moses
+{
+
+/** Sentence-BLEU of hypotheses against one reference: n-grams up to 4,
+ *  counts smoothed by 0.1 and a brevity penalty on lengths supplied by the
+ *  caller (characters when words are given as factors).
+ *
+ *  Words are ids, e.g. factor ids. The reference n-grams are counted once,
+ *  and the hypothesis is built word by word with Push and Pop, so scoring
+ *  hypotheses that share a prefix only counts that prefix once. N-gram
+ *  counts live in flat open-addressing tables.
+ */
+class SentenceBleu
+{
+public:
+  typedef size_t WordId;
+
+  SentenceBleu();
+  /** the reference is split on single spaces and the text after the last
+   *  space is not counted, as the online learner has always done */
+  explicit SentenceBleu(const std::string &reference);
+
+  void SetReference(const std::vector<WordId> &words, size_t length);
+  /** adds the n-grams of a further reference; the length stays that of
+   *  SetReference */
+  void AddReference(const std::vector<WordId> &words);
+
+  void Push(WordId word, size_t length);  // appends a word to the hypothesis
+  void Push(const Factor *word) {
+    Push(word->GetId(), word->GetString().size() + 1);
+  }
+  void Pop();  // removes the last word of the hypothesis
+  void ClearHypothesis();
+
+  size_t GetHypothesisSize() const {
+    return m_words.size();
+  }
+  float GetBleu() const;
+
+  /** Statistics for callers that do their own smoothing (BleuScoreFeature).
+   *  Adds to counts[n-1] every n-gram of words that starts in
+   *  [startBegin, startEnd) and ends in [endBegin, endEnd), and to
+   *  matches[n-1] those that occur in the reference at all: matches are
+   *  unclipped, as in Chiang et al. (2008). Orders go up to counts.size()
+   *  or 4, whichever is less */
+  void CountMatches(const std::vector<WordId> &words,
+                    size_t startBegin, size_t startEnd,
+                    size_t endBegin, size_t endEnd,
+                    std::vector<size_t> &counts, std::vector<size_t> &matches) const;
+  /** the same for all n-grams of words, with matches clipped by the
+   *  reference counts */
+  void CountClippedMatches(const std::vector<WordId> &words,
+                           std::vector<size_t> &counts, std::vector<size_t> &matches) const;
+
+private:
+  static const size_t kMaxOrder = 4;
+  static const WordId kNoWord = static_cast<WordId>(-1);
+
+  struct NGram {
+    WordId words[kMaxOrder];  // unused trailing positions are kNoWord
+  };
+
+  /** n-gram counts, linear probing over a power-of-two table kept at most
+   *  half full. Clear only resets the slots touched since the last Clear */
+  class NGramTable
+  {
+  public:
+    NGramTable();
+    int &operator[](const NGram &ngram);
+    int Find(const NGram &ngram) const;
+    int Decrement(const NGram &ngram);  // erases the n-gram at 0, returns the old count
+    void Clear();
+  private:
+    struct Entry {
+      NGram ngram;
+      int count;
+    };
+    size_t Slot(const NGram &ngram) const;
+    bool IsEmpty(size_t slot) const {
+      return m_entries[slot].ngram.words[0] == kNoWord;
+    }
+    void EraseSlot(size_t hole);
+    void Grow();
+    std::vector<Entry> m_entries;
+    std::vector<size_t> m_touched;  // slots filled since the last Clear
+    size_t m_size;
+  };
+
+  static NGram MakeNGram(const WordId *words, size_t n);
+  NGram GetLastNGram(size_t n) const;
+  void Rescore();
+  int GetMatchIncrement(const NGram &ngram, int hypCount) const;
+
+  NGramTable m_refCounts, m_hypCounts;
+  std::vector<std::pair<WordId, size_t> > m_words;  // hypothesis words and their lengths
+  size_t m_refLength, m_hypLength;
+  int m_matches[kMaxOrder], m_totals[kMaxOrder];
+};
+
+}
+
+#endif
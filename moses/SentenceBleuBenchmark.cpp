@@ -0,0 +1,104 @@
+/***********************************************************************
+Moses - factored phrase-based language decoder
+Copyright (C) 2013- University of Edinburgh
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+***********************************************************************/
+
+// Times sentence-BLEU of random n-best lists, scored from scratch and by
+// popping back to the prefix each entry shares with the previous one.
+// Build with: bjam moses//sentence_bleu_benchmark
+// Usage: sentence_bleu_benchmark [sentences] [nbest size] [length] [vocabulary]
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "SentenceBleu.h"
+#include "Timer.h"
+
+using namespace Moses;
+using namespace std;
+
+namespace
+{
+typedef vector<SentenceBleu::WordId> Sentence;
+
+Sentence RandomSentence(size_t length, size_t vocabulary)
+{
+  Sentence sentence(length);
+  for (size_t i = 0; i < length; ++i) sentence[i] = rand() % vocabulary;
+  return sentence;
+}
+
+// each n-best entry differs from the one before in a short random suffix,
+// as neighbouring entries of a decoder's n-best list mostly do
+void RandomNBest(size_t size, size_t length, size_t vocabulary, vector<Sentence> &nbest)
+{
+  nbest.assign(1, RandomSentence(length, vocabulary));
+  for (size_t i = 1; i < size; ++i) {
+    Sentence entry(nbest.back().begin(), nbest.back().end() - 1 - rand() % (length / 4 + 1));
+    const Sentence suffix = RandomSentence(length - entry.size(), vocabulary);
+    entry.insert(entry.end(), suffix.begin(), suffix.end());
+    nbest.push_back(entry);
+  }
+}
+}
+
+int main(int argc, char *argv[])
+{
+  const size_t sentences = argc > 1 ? atoi(argv[1]) : 1000;
+  const size_t nbestSize = argc > 2 ? atoi(argv[2]) : 100;
+  const size_t length = argc > 3 ? atoi(argv[3]) : 25;
+  const size_t vocabulary = argc > 4 ? atoi(argv[4]) : 50;
+  srand(1);
+
+  double fromScratch = 0, incremental = 0;
+  float checksum[2] = {0, 0};
+  vector<Sentence> nbest;
+  SentenceBleu bleu;
+  for (size_t s = 0; s < sentences; ++s) {
+    const Sentence reference = RandomSentence(length, vocabulary);
+    RandomNBest(nbestSize, length, vocabulary, nbest);
+    bleu.SetReference(reference, reference.size());
+
+    Timer scratchTimer;
+    scratchTimer.start();
+    for (size_t i = 0; i < nbest.size(); ++i) {
+      bleu.ClearHypothesis();
+      for (size_t w = 0; w < nbest[i].size(); ++w) bleu.Push(nbest[i][w], 1);
+      checksum[0] += bleu.GetBleu();
+    }
+    fromScratch += scratchTimer.get_elapsed_time();
+
+    Timer incrementalTimer;
+    incrementalTimer.start();
+    bleu.ClearHypothesis();
+    for (size_t i = 0; i < nbest.size(); ++i) {
+      const Sentence &previous = nbest[i ? i - 1 : 0];
+      size_t common = 0;
+      while (i && common < nbest[i].size() && common < previous.size() && nbest[i][common] == previous[common]) ++common;
+      while (bleu.GetHypothesisSize() > common) bleu.Pop();
+      for (size_t w = common; w < nbest[i].size(); ++w) bleu.Push(nbest[i][w], 1);
+      checksum[1] += bleu.GetBleu();
+    }
+    incremental += incrementalTimer.get_elapsed_time();
+  }
+
+  const double hypotheses = sentences * nbestSize;
+  cout << "from scratch: " << fromScratch << " s, " << fromScratch / hypotheses * 1e6 << " us per hypothesis, checksum " << checksum[0] << endl;
+  cout << "incremental: " << incremental << " s, " << incremental / hypotheses * 1e6 << " us per hypothesis, checksum " << checksum[1] << endl;
+  return 0;
+}
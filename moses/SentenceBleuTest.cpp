@@ -0,0 +1,125 @@
+/***********************************************************************
+Moses - factored phrase-based language decoder
+Copyright (C) 2013- University of Edinburgh
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+***********************************************************************/
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/floating_point_comparison.hpp>
+
+#include "FactorCollection.h"
+#include "SentenceBleu.h"
+
+using namespace Moses;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sentence_bleu)
+
+namespace
+{
+vector<SentenceBleu::WordId> Ids(const char *words)
+{
+  vector<SentenceBleu::WordId> ids;
+  for (const char *word = words; *word; ++word) {
+    if (*word != ' ') ids.push_back(*word);
+  }
+  return ids;
+}
+}
+
+BOOST_AUTO_TEST_CASE(identical)
+{
+  SentenceBleu bleu("a b c d e ");
+  FactorCollection &factors = FactorCollection::Instance();
+  const char *words[] = {"a", "b", "c", "d", "e"};
+  for (size_t i = 0; i < 5; ++i) {
+    bleu.Push(factors.AddFactor(words[i]));
+  }
+  BOOST_CHECK_CLOSE(bleu.GetBleu(), 100, 0.001);
+}
+
+BOOST_AUTO_TEST_CASE(incremental_matches_fresh)
+{
+  const vector<SentenceBleu::WordId> ref = Ids("a b c a b d");
+  SentenceBleu incremental;
+  incremental.SetReference(ref, ref.size());
+
+  const char *hypotheses[] = {"a b c a", "a b d", "a b c b b a", "c c c"};
+  vector<SentenceBleu::WordId> previous;
+  for (size_t h = 0; h < 4; ++h) {
+    const vector<SentenceBleu::WordId> hyp = Ids(hypotheses[h]);
+    // keep the prefix shared with the previous hypothesis
+    size_t common = 0;
+    while (common < hyp.size() && common < previous.size() && hyp[common] == previous[common]) ++common;
+    while (incremental.GetHypothesisSize() > common) incremental.Pop();
+    for (size_t i = common; i < hyp.size(); ++i) incremental.Push(hyp[i], 1);
+    previous = hyp;
+
+    SentenceBleu fresh;
+    fresh.SetReference(ref, ref.size());
+    for (size_t i = 0; i < hyp.size(); ++i) fresh.Push(hyp[i], 1);
+    BOOST_CHECK_CLOSE(incremental.GetBleu(), fresh.GetBleu(), 0.001);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(grows_past_initial_table)
+{
+  vector<SentenceBleu::WordId> ref;
+  for (size_t i = 0; i < 200; ++i) ref.push_back(i);
+  SentenceBleu bleu;
+  bleu.SetReference(ref, ref.size());
+  for (size_t i = 0; i < ref.size(); ++i) bleu.Push(ref[i], 1);
+  BOOST_CHECK_CLOSE(bleu.GetBleu(), 100, 0.001);
+  for (size_t i = 0; i < ref.size(); ++i) bleu.Pop();
+  BOOST_CHECK_EQUAL(bleu.GetHypothesisSize(), 0);
+  bleu.Push(ref[0], 1);
+  bleu.Push(ref[1], 1);
+  SentenceBleu fresh;
+  fresh.SetReference(ref, ref.size());
+  fresh.Push(ref[0], 1);
+  fresh.Push(ref[1], 1);
+  BOOST_CHECK_CLOSE(bleu.GetBleu(), fresh.GetBleu(), 0.001);
+}
+
+BOOST_AUTO_TEST_CASE(counts_matches)
+{
+  SentenceBleu bleu;
+  bleu.AddReference(Ids("a b c"));
+  bleu.AddReference(Ids("a a d"));
+  const vector<SentenceBleu::WordId> hyp = Ids("a a a b");
+
+  vector<size_t> counts(4), matches(4);
+  bleu.CountMatches(hyp, 0, hyp.size(), 0, hyp.size(), counts, matches);
+  const size_t allCounts[] = {4, 3, 2, 1}, unclipped[] = {4, 3, 0, 0};
+  BOOST_CHECK_EQUAL_COLLECTIONS(counts.begin(), counts.end(), allCounts, allCounts + 4);
+  BOOST_CHECK_EQUAL_COLLECTIONS(matches.begin(), matches.end(), unclipped, unclipped + 4);
+
+  // only the n-grams that span the boundary before the last word
+  vector<size_t> spanCounts(4), spanMatches(4);
+  bleu.CountMatches(hyp, 0, 3, 3, hyp.size(), spanCounts, spanMatches);
+  const size_t spanning[] = {0, 1, 1, 1}, spanningMatches[] = {0, 1, 0, 0};
+  BOOST_CHECK_EQUAL_COLLECTIONS(spanCounts.begin(), spanCounts.end(), spanning, spanning + 4);
+  BOOST_CHECK_EQUAL_COLLECTIONS(spanMatches.begin(), spanMatches.end(), spanningMatches, spanningMatches + 4);
+
+  // "a a" occurs once over both references
+  vector<size_t> clippedCounts(4), clippedMatches(4);
+  bleu.CountClippedMatches(hyp, clippedCounts, clippedMatches);
+  const size_t clipped[] = {4, 2, 0, 0};
+  BOOST_CHECK_EQUAL_COLLECTIONS(clippedCounts.begin(), clippedCounts.end(), allCounts, allCounts + 4);
+  BOOST_CHECK_EQUAL_COLLECTIONS(clippedMatches.begin(), clippedMatches.end(), clipped, clipped + 4);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
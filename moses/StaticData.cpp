@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <string>
 #include "util/check.hh"
+#include "util/exception.hh"
 #include "moses/TranslationModel/PhraseDictionaryMemory.h"
 #include "DecodeStepTranslation.h"
 #include "DecodeStepGeneration.h"
@@ -35,6 +36,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "Util.h"
 #include "FactorCollection.h"
 #include "Timer.h"
+#include "InputType.h"
 #include "LM/Factory.h"
 #include "LexicalReordering.h"
 #include "GlobalLexicalModel.h"
@@ -75,28 +77,6 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 using namespace std;
 
-namespace TempUtil{
-	//    ------------------- Kronecker Product code ---------------------------- //
-
-	bool KroneckerProduct (const boost::numeric::ublas::matrix<double>& A, const boost::numeric::ublas::matrix<double>& B, boost::numeric::ublas::matrix<double>& C) {
-		int rowA=-1,colA=-1,rowB=0,colB=0,prowB=1,pcolB=1;
-		for(int i=0; i<C.size1(); i++){
-			for(int j=0; j<C.size2(); j++){
-				rowB=i%B.size1();
-				colB=j%B.size2();
-				if(pcolB!=0 && colB == 0) colA++;
-				if(prowB!=0 && rowB==0) rowA++;
-				prowB=rowB;
-				pcolB=colB;
-				if(colA >= A.size2()){colA=0; colB=0;pcolB=1;}
-				C(i, j) = A(rowA, colA) * B(rowB, colB) ;
-			}
-		}
-		return true;
-	}
-	//    ------------------------------- ends here ---------------------------- //
-}
-
 namespace Moses {
 
 
@@ -119,7 +99,9 @@ namespace Moses {
     StaticData StaticData::s_instance;
 
     StaticData::StaticData()
-    : m_targetBigramFeature(NULL)
+    : m_weightVersion(0)
+    , m_weightStaleness(0)
+    , m_targetBigramFeature(NULL)
     , m_phraseBoundaryFeature(NULL)
     , m_phraseLengthFeature(NULL)
     , m_CacheBasedLanguageModel(NULL)
@@ -137,6 +119,8 @@ namespace Moses {
     , m_onlyDistinctNBest(false)
     , m_factorDelimiter("|") // default delimiter between factors
     , m_lmEnableOOVFeature(false)
+    , m_lmMemoSize(0)
+    , m_transOptCache(NULL)
     , m_isAlwaysCreateDirectTranslationOption(false)
     , m_needAlignmentInfo(false) {
         m_maxFactorIdx[0] = 0; // source side
@@ -313,6 +297,8 @@ namespace Moses {
             SetBooleanParameter(&m_useTransOptCache, "use-persistent-cache", true);
             m_transOptCacheMaxSize = (m_parameter->GetParam("persistent-cache-size").size() > 0)
                     ? Scan<size_t>(m_parameter->GetParam("persistent-cache-size")[0]) : DEFAULT_MAX_TRANS_OPT_CACHE_SIZE;
+            delete m_transOptCache;
+            m_transOptCache = new TransOptCache(m_transOptCacheMaxSize);
         } else {
             m_useTransOptCache = false;
         }
@@ -428,6 +414,9 @@ namespace Moses {
         SetBooleanParameter(&m_dropUnknown, "drop-unknown", false);
 
         SetBooleanParameter(&m_lmEnableOOVFeature, "lmodel-oov-feature", false);
+        if (m_parameter->GetParam("lmodel-memo-size").size() > 0) {
+          m_lmMemoSize = Scan<size_t>(m_parameter->GetParam("lmodel-memo-size")[0]);
+        }
 
         // minimum Bayes risk decoding
         SetBooleanParameter(&m_mbr, "minimum-bayes-risk", false);
@@ -463,6 +452,8 @@ namespace Moses {
                 Scan<float>(m_parameter->GetParam("lmbr-r")[0]) : 0.6f;
         m_lmbrMapWeight = (m_parameter->GetParam("lmbr-map-weight").size() > 0) ?
                 Scan<float>(m_parameter->GetParam("lmbr-map-weight")[0]) : 0.0f;
+        m_lmbrThreads = (m_parameter->GetParam("lmbr-threads").size() > 0) ?
+                Scan<size_t>(m_parameter->GetParam("lmbr-threads")[0]) : 1;
 
         //consensus decoding
         SetBooleanParameter(&m_useConsensusDecoding, "consensus-decoding", false);
@@ -513,6 +504,9 @@ namespace Moses {
             }
         }
 
+        m_weightStaleness = (m_parameter->GetParam("online-learning-staleness").size() > 0) ?
+                Scan<size_t>(m_parameter->GetParam("online-learning-staleness")[0]) : 0;
+
         m_startTranslationId = (m_parameter->GetParam("start-translation-id").size() > 0) ?
                 Scan<long>(m_parameter->GetParam("start-translation-id")[0]) : 0;
 
@@ -849,20 +843,26 @@ namespace Moses {
 
             m_allWeights.PlusEquals(extraWeights);
         }
+        // resume online learning from the state a previous run persisted
+        if (m_onlinelearner != NULL && m_parameter->GetParam("online-learning-store").size() > 0) {
+            const size_t snapshotInterval = (m_parameter->GetParam("online-learning-snapshot-interval").size() > 0) ?
+                    Scan<size_t>(m_parameter->GetParam("online-learning-snapshot-interval")[0]) : 1000;
+            try {
+                m_onlinelearner->OpenStore(m_parameter->GetParam("online-learning-store")[0], snapshotInterval);
+            } catch (const util::Exception &e) {
+                UserMessage::Add(string("Unable to open the online learning store: ") + e.what());
+                return false;
+            }
+        }
         if(m_multitasklearner!=NULL){
-        	int size = this->GetAllWeights().Size();	// add 1 for the bias feature
         	int tasks=m_multitasklearner->GetNumberOfTasks();
-        	boost::numeric::ublas::matrix<double> kdkdmatrix (tasks*size, tasks*size);
-        	boost::numeric::ublas::identity_matrix<double> m (size);
-        	boost::numeric::ublas::matrix<double>& interactionMatrix = m_multitasklearner->GetInteractionMatrix();
-        	TempUtil::KroneckerProduct(interactionMatrix, m, kdkdmatrix);
-        	m_multitasklearner->SetKdKdMatrix(kdkdmatrix);
         	ScoreComponentCollection weightVec = this->GetAllWeights();
         	for(int i=0;i<tasks;i++){
         		m_multitasklearner->SetWeightsVector(i, weightVec);	// initialization complete.. I believe so!
         	}
         }
 
+        RefreshWeightSnapshot();
         return true;
     }
 
@@ -886,11 +886,118 @@ namespace Moses {
     void StaticData::SetWeight(const ScoreProducer* sp, float weight) {
         m_allWeights.Resize();
         m_allWeights.Assign(sp, weight);
+        RefreshWeightSnapshot();
     }
 
     void StaticData::SetWeights(const ScoreProducer* sp, const std::vector<float>& weights) {
         m_allWeights.Resize();
         m_allWeights.Assign(sp, weights);
+        RefreshWeightSnapshot();
+    }
+
+    void StaticData::SetAllWeights(const ScoreComponentCollection& weights) {
+        m_allWeights = weights;
+        RefreshWeightSnapshot();
+    }
+
+    // Decoding threads keep whatever snapshot they took at the start of a
+    // sentence, so publishing only swaps the pointer; old snapshots are
+    // freed once the last thread using them lets go.
+    void StaticData::RefreshWeightSnapshot() {
+        WeightSnapshotPtr snapshot(new ScoreComponentCollection(m_allWeights));
+#ifdef WITH_THREADS
+        boost::mutex::scoped_lock lock(m_weightSnapshotMutex);
+#endif
+        m_weightSnapshot = snapshot;
+    }
+
+    WeightSnapshotPtr StaticData::GetWeightSnapshot() const {
+#ifdef WITH_THREADS
+        boost::mutex::scoped_lock lock(m_weightSnapshotMutex);
+#endif
+        return m_weightSnapshot;
+    }
+
+    WeightSnapshotPtr StaticData::GetWeightSnapshot(const InputType &input) const {
+        if (m_multitask && input.GetTaskId() >= 0) {
+            VERBOSE(1, "Using weights for task id " << input.GetTaskId() << endl);
+            // the task's own snapshot, so that its sentences share cached translation options
+            WeightSnapshotPtr weights = m_multitasklearner->GetWeightSnapshot(input.GetTaskId());
+            if (weights) {
+                return weights;
+            }
+            UserMessage::Add("Requested weights from a wrong user");
+        }
+        return GetWeightSnapshot();
+    }
+
+    WeightSnapshotPtr StaticData::GetThreadWeightSnapshot() const {
+#ifdef WITH_THREADS
+        const WeightSnapshotPtr *snapshot = m_threadWeights.get();
+        if (snapshot != NULL && *snapshot) {
+            return *snapshot;
+        }
+#endif
+        return GetWeightSnapshot();
+    }
+
+    void StaticData::UseWeightSnapshot(const WeightSnapshotPtr &snapshot) const {
+#ifdef WITH_THREADS
+        if (snapshot) {
+            m_threadWeights.reset(new WeightSnapshotPtr(snapshot));
+        } else {
+            m_threadWeights.reset();
+        }
+#endif
+    }
+
+    void StaticData::UseSession(const std::string &session) const {
+#ifdef WITH_THREADS
+        if (!session.empty()) {
+            m_threadSession.reset(new std::string(session));
+        } else {
+            m_threadSession.reset();
+        }
+#endif
+    }
+
+    const std::string &StaticData::GetThreadSession() const {
+        static const std::string noSession;
+#ifdef WITH_THREADS
+        const std::string *session = m_threadSession.get();
+        if (session != NULL) {
+            return *session;
+        }
+#endif
+        return noSession;
+    }
+
+    size_t StaticData::GetWeightVersion() const {
+#ifdef WITH_THREADS
+        boost::mutex::scoped_lock lock(m_weightSnapshotMutex);
+#endif
+        return m_weightVersion;
+    }
+
+    void StaticData::AdvanceWeightVersion() {
+#ifdef WITH_THREADS
+        boost::mutex::scoped_lock lock(m_weightSnapshotMutex);
+#endif
+        ++m_weightVersion;
+#ifdef WITH_THREADS
+        m_weightVersionChanged.notify_all();
+#endif
+    }
+
+    void StaticData::WaitForWeightVersion(size_t version) const {
+#ifdef WITH_THREADS
+        boost::mutex::scoped_lock lock(m_weightSnapshotMutex);
+        while (m_weightVersion < version) {
+            m_weightVersionChanged.wait(lock);
+        }
+#else
+        CHECK(m_weightVersion >= version);
+#endif
     }
 
     StaticData::~StaticData() {
@@ -911,7 +1018,7 @@ namespace Moses {
         m_languageModel.CleanUp();
 
         // delete trans opt
-        ClearTransOptionCache();
+        delete m_transOptCache;
 
         // small score producers
         delete m_unknownWordPenaltyProducer;
@@ -1511,9 +1618,6 @@ namespace Moses {
     	if(m_hyperparameterasweight!=NULL) return true;
     	return false;
     }
-    void StaticData::SetSourceOnlineLearning(std::string line){
-    	m_onlinelearner->SetSourceSentence(line);
-    }
     OnlineLearner* StaticData::GetOnlineLearningModel() const {
         return m_onlinelearner;
     }
@@ -1526,6 +1630,8 @@ namespace Moses {
         return numIter;
     }
     bool StaticData::LoadOnlineLearningModel() { // optional model ... returns true
+        m_onlineLearningNBestSize = (m_parameter->GetParam("online-learning-nbest-size").size() > 0) ?
+                Scan<size_t>(m_parameter->GetParam("online-learning-nbest-size")[0]) : 100;
         const std::string w_algorithm = (m_parameter->GetParam("w_algorithm").size() > 0) ? Scan<std::string>(m_parameter->GetParam("w_algorithm")[0]) : "NULL";
         bool normaliseScore = (m_parameter->isParamSpecified("normaliseScore")) ? true : false;
         const float f_learningrate = (m_parameter->GetParam("f_learningrate").size() > 0) ?
@@ -2143,63 +2249,17 @@ namespace Moses {
         return true;
     }
 
-    const TranslationOptionList* StaticData::FindTransOptListInCache(const DecodeGraph &decodeGraph, const Phrase &sourcePhrase) const {
-        std::pair<size_t, Phrase> key(decodeGraph.GetPosition(), sourcePhrase);
-#ifdef WITH_THREADS
-        boost::mutex::scoped_lock lock(m_transOptCacheMutex);
-#endif
-        std::map<std::pair<size_t, Phrase>, std::pair<TranslationOptionList*, clock_t> >::iterator iter
-                = m_transOptCache.find(key);
-        if (iter == m_transOptCache.end())
-            return NULL;
-        iter->second.second = clock(); // update last used time
-        return iter->second.first;
-    }
-
-    void StaticData::ReduceTransOptCache() const {
-        if (m_transOptCache.size() <= m_transOptCacheMaxSize) return; // not full
-        clock_t t = clock();
-
-        // find cutoff for last used time
-        priority_queue< clock_t > lastUsedTimes;
-        std::map<std::pair<size_t, Phrase>, std::pair<TranslationOptionList*, clock_t> >::iterator iter;
-        iter = m_transOptCache.begin();
-        while (iter != m_transOptCache.end()) {
-            lastUsedTimes.push(iter->second.second);
-            iter++;
-        }
-        for (size_t i = 0; i < lastUsedTimes.size() - m_transOptCacheMaxSize / 2; i++)
-            lastUsedTimes.pop();
-        clock_t cutoffLastUsedTime = lastUsedTimes.top();
-
-        // remove all old entries
-        iter = m_transOptCache.begin();
-        while (iter != m_transOptCache.end()) {
-            if (iter->second.second < cutoffLastUsedTime) {
-                std::map<std::pair<size_t, Phrase>, std::pair<TranslationOptionList*, clock_t> >::iterator iterRemove = iter++;
-                delete iterRemove->second.first;
-                m_transOptCache.erase(iterRemove);
-            } else iter++;
-        }
-        VERBOSE(2, "Reduced persistent translation option cache in " << ((clock() - t) / (float) CLOCKS_PER_SEC) << " seconds." << std::endl);
+    TransOptListPtr StaticData::FindTransOptListInCache(const DecodeGraph &decodeGraph, const Phrase &sourcePhrase) const {
+        return m_transOptCache->Find(decodeGraph.GetPosition(), sourcePhrase, GetThreadWeightSnapshot());
     }
 
     void StaticData::AddTransOptListToCache(const DecodeGraph &decodeGraph, const Phrase &sourcePhrase, const TranslationOptionList &transOptList) const {
-        if (m_transOptCacheMaxSize == 0) return;
-        std::pair<size_t, Phrase> key(decodeGraph.GetPosition(), sourcePhrase);
-        TranslationOptionList* storedTransOptList = new TranslationOptionList(transOptList);
-#ifdef WITH_THREADS
-        boost::mutex::scoped_lock lock(m_transOptCacheMutex);
-#endif
-        m_transOptCache[key] = make_pair(storedTransOptList, clock());
-        ReduceTransOptCache();
+        m_transOptCache->Add(decodeGraph.GetPosition(), sourcePhrase, transOptList, GetThreadWeightSnapshot());
     }
 
     void StaticData::ClearTransOptionCache() const {
-        map<std::pair<size_t, Phrase>, std::pair< TranslationOptionList*, clock_t > >::iterator iterCache;
-        for (iterCache = m_transOptCache.begin(); iterCache != m_transOptCache.end(); ++iterCache) {
-            TranslationOptionList *transOptList = iterCache->second.first;
-            delete transOptList;
+        if (m_transOptCache != NULL) {
+            m_transOptCache->Clear();
         }
     }
 
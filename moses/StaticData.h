@@ -32,8 +32,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <fstream>
 #include <string>
 
+#include <boost/shared_ptr.hpp>
+
 #ifdef WITH_THREADS
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
 #endif
 
 #include "TypeDef.h"
@@ -44,6 +48,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "SentenceStats.h"
 #include "DecodeGraph.h"
 #include "TranslationOptionList.h"
+#include "TransOptCache.h"
 #include "TranslationSystem.h"
 #include "ScoreComponentCollection.h"
 #include "MultiTaskLearning.h"
@@ -79,6 +84,9 @@ class SyntacticLanguageModel;
 #endif
 class TranslationSystem;
 
+//! immutable copy of the global weight vector, shared by the threads decoding with it
+typedef boost::shared_ptr<const ScoreComponentCollection> WeightSnapshotPtr;
+
 typedef std::pair<std::string, float> UnknownLHSEntry;
 typedef std::vector<UnknownLHSEntry>  UnknownLHSList;
 
@@ -102,6 +110,15 @@ protected:
   std::vector<FactorType>	m_inputFactorOrder, m_outputFactorOrder;
   LMList									m_languageModel;
   ScoreComponentCollection m_allWeights;
+  WeightSnapshotPtr m_weightSnapshot; //! last published copy of m_allWeights
+  size_t m_weightVersion; //! number of online weight updates published so far
+  size_t m_weightStaleness; //! number of updates a decoding thread may lag behind (0 = strict order)
+#ifdef WITH_THREADS
+  mutable boost::mutex m_weightSnapshotMutex;
+  mutable boost::condition_variable m_weightVersionChanged;
+  mutable boost::thread_specific_ptr<WeightSnapshotPtr> m_threadWeights; //! snapshot the current thread decodes with
+  mutable boost::thread_specific_ptr<std::string> m_threadSession; //! session the current thread works for
+#endif
   std::vector<LexicalReordering*>                   m_reorderModels;
   std::vector<GlobalLexicalModel*>                   m_globalLexicalModels;
   std::vector<GlobalLexicalModelUnlimited*>          m_globalLexicalModelsUnlimited;
@@ -136,6 +153,7 @@ protected:
 		  m_flr,
 		  m_wlr;
   bool m_multitask;
+  size_t m_onlineLearningNBestSize; //! size of the n-best list searched for oracles
   // PhraseTrans, Generation & LanguageModelScore has multiple weights.
   int				m_maxDistortion;
   // do it differently from old pharaoh
@@ -214,21 +232,18 @@ protected:
   float m_lmbrPrecision; //! unigram precision theta - see Tromble et al 08 for more details
   float m_lmbrPRatio; //! decaying factor for ngram thetas - see Tromble et al 08 for more details
   float m_lmbrMapWeight; //! Weight given to the map solution. See Kumar et al 09 for details
+  size_t m_lmbrThreads; //! threads computing the n-gram posteriors of one lattice
 
   size_t m_lmcache_cleanup_threshold; //! number of translations after which LM claenup is performed (0=never, N=after N translations; default is 1)
   bool m_lmEnableOOVFeature;
+  size_t m_lmMemoSize; //! entries in the per-thread KenLM query memo (0=off)
 
   bool m_timeout; //! use timeout
   size_t m_timeout_threshold; //! seconds after which time out is activated
 
   bool m_useTransOptCache; //! flag indicating, if the persistent translation option cache should be used
-  mutable std::map<std::pair<size_t, Phrase>, std::pair<TranslationOptionList*,clock_t> > m_transOptCache; //! persistent translation option cache
+  mutable TransOptCache *m_transOptCache; //! persistent translation option cache
   size_t m_transOptCacheMaxSize; //! maximum size for persistent translation option cache
-  //FIXME: Single lock for cache not most efficient. However using a
-  //reader-writer for LRU cache is tricky - how to record last used time?
-#ifdef WITH_THREADS
-  mutable boost::mutex m_transOptCacheMutex;
-#endif
   bool m_isAlwaysCreateDirectTranslationOption;
   //! constructor. only the 1 static variable can be created
 
@@ -300,7 +315,7 @@ protected:
   bool LoadSourceWordDeletionFeature();
   bool LoadWordTranslationFeature();
   bool GetHyperParameterAsWeight() const;
-  void ReduceTransOptCache() const;
+  void RefreshWeightSnapshot();
   bool m_continuePartialTranslation;
 
   std::string m_binPath;
@@ -310,13 +325,15 @@ public:
   std::string m_postedited;
   bool LoadOnlineLearningModel();
   bool LoadMultiTaskLearning();
-  void SetSourceOnlineLearning(std::string);
   bool LoadHyperParameters();
   void SetSourceSentenceforSTM(std::string);
   bool IfActiveSTM() const;
   OnlineLearner* GetOnlineLearningModel() const;
   SingleTriggerModel* GetSingleTriggerModel() const;
   int GetNumIterationsOnlineLearning() const;
+  size_t GetOnlineLearningNBestSize() const {
+    return m_onlineLearningNBestSize;
+  }
 
   bool IsAlwaysCreateDirectTranslationOption() const {
     return m_isAlwaysCreateDirectTranslationOption;
@@ -563,17 +580,56 @@ public:
     return m_numInputScores;
   }
 
+  //! weights of the snapshot the calling thread decodes with, or the global weights if it has none
   const ScoreComponentCollection& GetAllWeights() const {
+#ifdef WITH_THREADS
+    const WeightSnapshotPtr *snapshot = m_threadWeights.get();
+    if (snapshot != NULL && *snapshot) {
+      return **snapshot;
+    }
+#endif
     return m_allWeights;
   }
 
-  void SetAllWeights(const ScoreComponentCollection& weights) {
-    m_allWeights = weights;
+  void SetAllWeights(const ScoreComponentCollection& weights);
+
+  //! most recently published weights. Never modified once returned.
+  WeightSnapshotPtr GetWeightSnapshot() const;
+
+  //! weights to decode input with: those of its task under multi-task learning, else the most recently published
+  WeightSnapshotPtr GetWeightSnapshot(const InputType &input) const;
+
+  //! the snapshot returned by GetAllWeights() for the calling thread
+  WeightSnapshotPtr GetThreadWeightSnapshot() const;
+
+  /** make the calling thread read its weights from snapshot until it is replaced.
+   *  An empty pointer reverts the thread to the global weights */
+  void UseWeightSnapshot(const WeightSnapshotPtr &snapshot) const;
+
+  /** make the calling thread read and update the state kept per session by
+   *  the adaptive models (e.g. the caches) until it is replaced. An empty id
+   *  reverts the thread to the state shared by all sessions */
+  void UseSession(const std::string &session) const;
+
+  //! session of the calling thread, empty if none
+  const std::string &GetThreadSession() const;
+
+  //! number of online weight updates published so far
+  size_t GetWeightVersion() const;
+
+  //! announce that one more online update has been applied, whether or not it changed the weights
+  void AdvanceWeightVersion();
+
+  //! block until at least version updates have been published
+  void WaitForWeightVersion(size_t version) const;
+
+  size_t GetWeightStaleness() const {
+    return m_weightStaleness;
   }
 
   //Weight for a single-valued feature
   float GetWeight(const ScoreProducer* sp) const {
-    return m_allWeights.GetScoreForProducer(sp);
+    return GetAllWeights().GetScoreForProducer(sp);
   }
 
   //Weight for a single-valued feature
@@ -582,11 +638,11 @@ public:
 
   //Weights for feature with fixed number of values
   std::vector<float> GetWeights(const ScoreProducer* sp) const {
-    return m_allWeights.GetScoresForProducer(sp);
+    return GetAllWeights().GetScoresForProducer(sp);
   }
 
   float GetSparseWeight(const FName& featureName) const {
-    return m_allWeights.GetSparseWeight(featureName);
+    return GetAllWeights().GetSparseWeight(featureName);
   }
   
   //Weights for feature with fixed number of values
@@ -653,6 +709,9 @@ public:
   float GetLatticeMBRMapWeight() const {
     return m_lmbrMapWeight;
   }
+  size_t GetLatticeMBRThreads() const {
+    return m_lmbrThreads;
+  }
 
   bool UseTimeout() const {
     return m_timeout;
@@ -669,6 +728,10 @@ public:
     return m_lmEnableOOVFeature;
   }
 
+  size_t GetLMMemoSize() const {
+    return m_lmMemoSize;
+  }
+
   bool GetOutputSearchGraph() const {
     return m_outputSearchGraph;
   }
@@ -712,7 +775,8 @@ public:
   void ClearTransOptionCache() const;
 
 
-  const TranslationOptionList* FindTransOptListInCache(const DecodeGraph &decodeGraph, const Phrase &sourcePhrase) const;
+  //! cached options computed with the weights the calling thread decodes with, or an empty pointer
+  TransOptListPtr FindTransOptListInCache(const DecodeGraph &decodeGraph, const Phrase &sourcePhrase) const;
 
   bool PrintTranslationOptions() const {
     return m_printTranslationOptions;
@@ -140,6 +140,7 @@ void TargetPhrase::SetScore(const ScoreProducer* translationScoreProducer,
   float transScore = std::inner_product(scoreVector.begin(), scoreVector.end(), weightT.begin(), 0.0f);
   m_scoreBreakdown.PlusEquals(translationScoreProducer, scoreVector);
   m_scoreBreakdown.PlusEquals(sparseScoreVector);
+  m_futureOnlyScores.clear();
 
   // Replicated from TranslationOptions.cpp
   float totalNgramScore  = 0;
@@ -170,6 +171,8 @@ void TargetPhrase::SetScore(const ScoreProducer* translationScoreProducer,
       }
 
 
+      m_futureOnlyScores.push_back(std::make_pair(ScoreComponentCollection::GetFirstIndex(&lm), fullScore - nGramScore));
+
       // total LM score so far
       totalNgramScore  += nGramScore * weightLM;
       totalFullScore   += fullScore * weightLM;
@@ -179,6 +182,9 @@ void TargetPhrase::SetScore(const ScoreProducer* translationScoreProducer,
 
   m_fullScore = transScore + totalFullScore + totalOOVScore
                 - (this->GetSize() * weightWP);	 // word penalty
+
+  const WordPenaltyProducer *wpProducer = StaticData::Instance().GetFirstWordPenaltyProducer();
+  m_futureOnlyScores.push_back(std::make_pair(ScoreComponentCollection::GetFirstIndex(wpProducer), - (float) GetSize()));
 }
 
 void TargetPhrase::SetScoreChart(const ScoreProducer* translationScoreProducer,
@@ -191,6 +197,7 @@ void TargetPhrase::SetScoreChart(const ScoreProducer* translationScoreProducer,
   
   // calc average score if non-best
   m_scoreBreakdown.PlusEquals(translationScoreProducer, scoreVector);
+  m_futureOnlyScores.clear();
 
   // Replicated from TranslationOptions.cpp
   float totalNgramScore  = 0;
@@ -222,6 +229,8 @@ void TargetPhrase::SetScoreChart(const ScoreProducer* translationScoreProducer,
         m_scoreBreakdown.Assign(&lm, nGramScore);
       }
 
+      m_futureOnlyScores.push_back(std::make_pair(ScoreComponentCollection::GetFirstIndex(&lm), fullScore - nGramScore));
+
       // total LM score so far
       totalNgramScore  += nGramScore * weightLM;
       totalFullScore   += fullScore * weightLM;
@@ -254,10 +263,21 @@ void TargetPhrase::SetWeights(const ScoreProducer* translationScoreProducer, con
   */
 }
 
+float TargetPhrase::GetFutureScore(const ScoreComponentCollection &weights) const
+{
+  const std::valarray<FValue> &coreWeights = weights.getCoreFeatures();
+  float score = m_scoreBreakdown.InnerProduct(weights);
+  for (size_t i = 0; i < m_futureOnlyScores.size(); ++i) {
+    score += coreWeights[m_futureOnlyScores[i].first] * m_futureOnlyScores[i].second;
+  }
+  return score;
+}
+
 void TargetPhrase::ResetScore()
 {
   m_fullScore = 0;
   m_scoreBreakdown.ZeroAll();
+  m_futureOnlyScores.clear();
 }
 
 TargetPhrase *TargetPhrase::MergeNext(const TargetPhrase &inputPhrase) const
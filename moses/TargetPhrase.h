@@ -50,6 +50,9 @@ class TargetPhrase: public Phrase
 protected:
   float m_fullScore;
   ScoreComponentCollection m_scoreBreakdown;
+  //! unweighted scores in the future score that are not in the breakdown, by dense index:
+  //! LM estimates beyond the n-gram scores, and the word penalty in phrase-based decoding
+  std::vector<std::pair<size_t, float> > m_futureOnlyScores;
 
 	// in case of confusion net, ptr to source phrase
 	Phrase m_sourcePhrase; 
@@ -123,6 +126,8 @@ public:
   inline void SetFutureScore(float fullScore) {
     m_fullScore = fullScore;
   }
+  //! the future score under other weights than the ones the phrase was scored with
+  float GetFutureScore(const ScoreComponentCollection &weights) const;
 	inline const ScoreComponentCollection &GetScoreBreakdown() const
 	{
 		return m_scoreBreakdown;
@@ -40,6 +40,39 @@ void TargetPhraseCollection::NthElement(size_t tableLimit)
 
   //std::sort(m_collection.begin(), m_collection.end(), CompareTargetPhrase());
   std::nth_element(m_collection.begin(), iterMiddle, m_collection.end(), CompareTargetPhrase());
+  m_ranking.reset();
+}
+
+void TargetPhraseCollection::NthElement(size_t tableLimit, const ScoreComponentCollection &weights, vector<const TargetPhrase*> &top) const
+{
+  // each phrase is scored once, not once per comparison
+  vector<pair<float, const TargetPhrase*> > scored(m_collection.size());
+  for (size_t i = 0; i < m_collection.size(); ++i) {
+    scored[i] = make_pair(- m_collection[i]->GetFutureScore(weights), m_collection[i]);
+  }
+  vector<pair<float, const TargetPhrase*> >::iterator
+  iterMiddle = (tableLimit == 0 || scored.size() < tableLimit) ? scored.end() : scored.begin() + tableLimit;
+  std::nth_element(scored.begin(), iterMiddle, scored.end());
+
+  top.clear();
+  for (vector<pair<float, const TargetPhrase*> >::const_iterator iter = scored.begin(); iter != iterMiddle; ++iter) {
+    top.push_back(iter->second);
+  }
+}
+
+void TargetPhraseCollection::NthElement(size_t tableLimit, const WeightsPtr &weights, vector<const TargetPhrase*> &top) const
+{
+  boost::shared_ptr<const Ranking> ranking = boost::atomic_load(&m_ranking);
+  if (!ranking || ranking->weights != weights || ranking->tableLimit != tableLimit) {
+    Ranking *reranked = new Ranking();
+    reranked->weights = weights;
+    reranked->tableLimit = tableLimit;
+    NthElement(tableLimit, *weights, reranked->top);
+    ranking.reset(reranked);
+    // threads racing here rank under the same or other weights, so any of them may win
+    boost::atomic_store(&m_ranking, ranking);
+  }
+  top = ranking->top;
 }
 
 void TargetPhraseCollection::Prune(bool adhereTableLimit, size_t tableLimit)
@@ -72,6 +105,7 @@ void TargetPhraseCollection::Sort(bool adhereTableLimit, size_t tableLimit)
     }
     m_collection.erase(m_collection.begin()+tableLimit, m_collection.end());
   }
+  m_ranking.reset();
 }
 
 }
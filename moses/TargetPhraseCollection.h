@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define moses_TargetPhraseCollection_h
 
 #include <vector>
+#include <boost/shared_ptr.hpp>
 #include "TargetPhrase.h"
 #include "Util.h"
 
@@ -32,9 +33,22 @@ namespace Moses
 //! a list of target phrases that is translated from the same source phrase
 class TargetPhraseCollection
 {
+public:
+  typedef boost::shared_ptr<const ScoreComponentCollection> WeightsPtr;
+
 protected:
   std::vector<TargetPhrase*> m_collection;
 
+  //! top phrases found by the last ranking under a weight snapshot
+  struct Ranking {
+    WeightsPtr weights;
+    size_t tableLimit;
+    std::vector<const TargetPhrase*> top;
+  };
+  /** read and replaced with boost::atomic_load/atomic_store, since lookups
+   *  share the collection. Dropped whenever the collection changes */
+  mutable boost::shared_ptr<const Ranking> m_ranking;
+
 public:
   // iters
   typedef std::vector<TargetPhrase*>::iterator iterator;
@@ -63,6 +77,15 @@ public:
   //! divide collection into 2 buckets using std::nth_element, the top & bottom according to table limit
   void NthElement(size_t tableLimit);
 
+  /** the top phrases according to table limit under weights, which may differ
+   *  from the ones the phrases were scored with. Leaves the collection as it is */
+  void NthElement(size_t tableLimit, const ScoreComponentCollection &weights, std::vector<const TargetPhrase*> &top) const;
+
+  /** the same under a weight snapshot. The ranking is kept with the snapshot
+   *  it was made under, so a collection is only ranked again once the
+   *  weights have been updated */
+  void NthElement(size_t tableLimit, const WeightsPtr &weights, std::vector<const TargetPhrase*> &top) const;
+
   //! number of target phrases in this collection
   size_t GetSize() const {
     return m_collection.size();
@@ -74,6 +97,14 @@ public:
   //! add a new entry into collection
   void Add(TargetPhrase *targetPhrase) {
     m_collection.push_back(targetPhrase);
+    m_ranking.reset();
+  }
+  //! delete the entry at pos; the last entry is moved into its place
+  void Remove(size_t pos) {
+    delete m_collection[pos];
+    m_collection[pos] = m_collection.back();
+    m_collection.pop_back();
+    m_ranking.reset();
   }
 
   void Prune(bool adhereTableLimit, size_t tableLimit);
@@ -0,0 +1,115 @@
+#include "TransOptCache.h"
+#include "TranslationOption.h"
+
+#ifdef WITH_THREADS
+#include <boost/thread/locks.hpp>
+#endif
+
+namespace Moses
+{
+
+TransOptCache::TransOptCache(size_t maxSize)
+  : m_shardSize((maxSize + TRANS_OPT_CACHE_SHARDS - 1) / TRANS_OPT_CACHE_SHARDS)
+{
+}
+
+TransOptCache::Shard &TransOptCache::GetShard(const Key &key)
+{
+  return m_shards[hash_value(key.second) % TRANS_OPT_CACHE_SHARDS];
+}
+
+TransOptListPtr TransOptCache::Find(size_t decodeGraph, const Phrase &source, const WeightsPtr &weights)
+{
+  if (m_shardSize == 0) return TransOptListPtr();
+  Key key(decodeGraph, source);
+  Shard &shard = GetShard(key);
+#ifdef WITH_THREADS
+  boost::mutex::scoped_lock lock(shard.mutex);
+#endif
+  boost::unordered_map<Key, size_t>::const_iterator iter = shard.index.find(key);
+  if (iter == shard.index.end())
+    return TransOptListPtr();
+  Slot &slot = shard.slots[iter->second];
+  if (slot.weights != weights) {
+    // future scores are out of date
+    Erase(shard, iter->second);
+    return TransOptListPtr();
+  }
+  slot.referenced = true;
+  return slot.transOptList;
+}
+
+void TransOptCache::Add(size_t decodeGraph, const Phrase &source, const TranslationOptionList &transOptList, const WeightsPtr &weights)
+{
+  if (m_shardSize == 0) return;
+  Key key(decodeGraph, source);
+  // copy outside the lock
+  TransOptListPtr stored(new TranslationOptionList(transOptList));
+  Shard &shard = GetShard(key);
+#ifdef WITH_THREADS
+  boost::mutex::scoped_lock lock(shard.mutex);
+#endif
+  size_t pos;
+  boost::unordered_map<Key, size_t>::const_iterator iter = shard.index.find(key);
+  if (iter != shard.index.end()) {
+    pos = iter->second;
+  } else {
+    pos = FreeSlot(shard);
+    shard.index[key] = pos;
+    shard.slots[pos].key = key;
+  }
+  Slot &slot = shard.slots[pos];
+  slot.transOptList = stored;
+  slot.weights = weights;
+  slot.referenced = false;
+}
+
+/* grows the shard up to its share of the maximum size, then evicts the
+ * first entry not referenced since the clock hand last passed it */
+size_t TransOptCache::FreeSlot(Shard &shard)
+{
+  if (shard.slots.size() < m_shardSize) {
+    shard.slots.push_back(Slot());
+    return shard.slots.size() - 1;
+  }
+  while (true) {
+    size_t pos = shard.hand;
+    shard.hand = (shard.hand + 1) % shard.slots.size();
+    Slot &slot = shard.slots[pos];
+    if (!slot.transOptList) {
+      return pos;
+    }
+    if (slot.referenced) {
+      slot.referenced = false;
+    } else {
+      shard.index.erase(slot.key);
+      slot.transOptList.reset();
+      slot.weights.reset();
+      return pos;
+    }
+  }
+}
+
+void TransOptCache::Erase(Shard &shard, size_t pos)
+{
+  Slot &slot = shard.slots[pos];
+  shard.index.erase(slot.key);
+  slot.transOptList.reset();
+  slot.weights.reset();
+  slot.referenced = false;
+}
+
+void TransOptCache::Clear()
+{
+  for (size_t i = 0; i < TRANS_OPT_CACHE_SHARDS; ++i) {
+    Shard &shard = m_shards[i];
+#ifdef WITH_THREADS
+    boost::mutex::scoped_lock lock(shard.mutex);
+#endif
+    shard.index.clear();
+    shard.slots.clear();
+    shard.hand = 0;
+  }
+}
+
+}
@@ -0,0 +1,74 @@
+#ifndef moses_TransOptCache_h
+#define moses_TransOptCache_h
+
+#include <vector>
+#include <utility>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+#ifdef WITH_THREADS
+#include <boost/thread/mutex.hpp>
+#endif
+
+#include "Phrase.h"
+#include "ScoreComponentCollection.h"
+#include "TranslationOptionList.h"
+
+#define TRANS_OPT_CACHE_SHARDS 64
+
+namespace Moses
+{
+
+typedef boost::shared_ptr<const TranslationOptionList> TransOptListPtr;
+
+/** Persistent (cross-sentence) cache of translation options, keyed by
+ * decode graph and source phrase. The cache is split into independently
+ * locked shards, each evicting with the CLOCK approximation of LRU. Every
+ * entry remembers the weights its future scores were computed with and is
+ * dropped when looked up under different weights, so the cache can stay on
+ * while online learning changes them.
+ */
+class TransOptCache
+{
+public:
+  typedef boost::shared_ptr<const ScoreComponentCollection> WeightsPtr;
+
+  TransOptCache(size_t maxSize);
+
+  //! cached options for source, or an empty pointer if missing or computed with other weights
+  TransOptListPtr Find(size_t decodeGraph, const Phrase &source, const WeightsPtr &weights);
+  void Add(size_t decodeGraph, const Phrase &source, const TranslationOptionList &transOptList, const WeightsPtr &weights);
+  void Clear();
+
+protected:
+  typedef std::pair<size_t, Phrase> Key;
+
+  struct Slot {
+    Key key;
+    TransOptListPtr transOptList;
+    WeightsPtr weights;
+    bool referenced;
+    Slot() : key(0, Phrase(0)), referenced(false) {}
+  };
+
+  struct Shard {
+    boost::unordered_map<Key, size_t> index; //! key -> position in slots
+    std::vector<Slot> slots;
+    size_t hand; //! next slot the clock looks at
+#ifdef WITH_THREADS
+    boost::mutex mutex;
+#endif
+    Shard() : hand(0) {}
+  };
+
+  size_t m_shardSize; //! capacity of each shard, 0 if the cache is disabled
+  Shard m_shards[TRANS_OPT_CACHE_SHARDS];
+
+  Shard &GetShard(const Key &key);
+  size_t FreeSlot(Shard &shard);
+  void Erase(Shard &shard, size_t pos);
+};
+
+}
+
+#endif
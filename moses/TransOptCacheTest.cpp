@@ -0,0 +1,115 @@
+/***********************************************************************
+Moses - factored phrase-based language decoder
+Copyright (C) 2013- University of Edinburgh
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+***********************************************************************/
+
+#include <boost/test/unit_test.hpp>
+
+#include "FactorCollection.h"
+#include "MultiTaskLearning.h"
+#include "TransOptCache.h"
+#include "Util.h"
+
+using namespace Moses;
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(trans_opt_cache)
+
+static Phrase MakePhrase(const string &words)
+{
+  Phrase phrase(0);
+  vector<string> tokens = Tokenize(words);
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    Word word;
+    word.SetFactor(0, FactorCollection::Instance().AddFactor(tokens[i]));
+    phrase.AddWord(word);
+  }
+  return phrase;
+}
+
+BOOST_AUTO_TEST_CASE(find_added)
+{
+  TransOptCache cache(100);
+  TransOptCache::WeightsPtr weights(new ScoreComponentCollection());
+  Phrase source = MakePhrase("das haus");
+  BOOST_CHECK(!cache.Find(0, source, weights));
+  cache.Add(0, source, TranslationOptionList(), weights);
+  BOOST_CHECK(cache.Find(0, source, weights));
+  BOOST_CHECK(!cache.Find(1, source, weights));
+  BOOST_CHECK(!cache.Find(0, MakePhrase("das"), weights));
+  cache.Clear();
+  BOOST_CHECK(!cache.Find(0, source, weights));
+}
+
+BOOST_AUTO_TEST_CASE(stale_weights)
+{
+  TransOptCache cache(100);
+  TransOptCache::WeightsPtr oldWeights(new ScoreComponentCollection());
+  TransOptCache::WeightsPtr newWeights(new ScoreComponentCollection());
+  Phrase source = MakePhrase("das haus");
+  cache.Add(0, source, TranslationOptionList(), oldWeights);
+  BOOST_CHECK(!cache.Find(0, source, newWeights));
+  // the stale entry is gone, not just hidden
+  BOOST_CHECK(!cache.Find(0, source, oldWeights));
+}
+
+BOOST_AUTO_TEST_CASE(task_weights)
+{
+  TransOptCache cache(100);
+  MultiTaskLearning tasks(2);
+  tasks.SetWeightsVector(0, ScoreComponentCollection());
+  tasks.SetWeightsVector(1, ScoreComponentCollection());
+  Phrase source = MakePhrase("das haus");
+  cache.Add(0, source, TranslationOptionList(), tasks.GetWeightSnapshot(0));
+  // a later sentence of the same task finds what the first one added
+  BOOST_CHECK(cache.Find(0, source, tasks.GetWeightSnapshot(0)));
+  // until the task learns
+  tasks.SetWeightsVector(0, ScoreComponentCollection());
+  BOOST_CHECK(!cache.Find(0, source, tasks.GetWeightSnapshot(0)));
+  cache.Add(0, source, TranslationOptionList(), tasks.GetWeightSnapshot(0));
+  BOOST_CHECK(!cache.Find(0, source, tasks.GetWeightSnapshot(1)));
+}
+
+BOOST_AUTO_TEST_CASE(bounded_size)
+{
+  TransOptCache cache(64);
+  TransOptCache::WeightsPtr weights(new ScoreComponentCollection());
+  vector<Phrase> sources;
+  for (size_t i = 0; i < 1000; ++i) {
+    sources.push_back(MakePhrase("w" + SPrint(i)));
+    cache.Add(0, sources.back(), TranslationOptionList(), weights);
+  }
+  size_t found = 0;
+  for (size_t i = 0; i < sources.size(); ++i) {
+    if (cache.Find(0, sources[i], weights)) ++found;
+  }
+  BOOST_CHECK(found > 0);
+  BOOST_CHECK(found <= 64);
+  // the most recent addition always survives
+  BOOST_CHECK(cache.Find(0, sources.back(), weights));
+}
+
+BOOST_AUTO_TEST_CASE(disabled)
+{
+  TransOptCache cache(0);
+  TransOptCache::WeightsPtr weights(new ScoreComponentCollection());
+  Phrase source = MakePhrase("das haus");
+  cache.Add(0, source, TranslationOptionList(), weights);
+  BOOST_CHECK(!cache.Find(0, source, weights));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
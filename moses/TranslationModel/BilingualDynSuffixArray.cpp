@@ -543,6 +543,43 @@ void BilingualDynSuffixArray::addSntPair(string& source, string& target, string&
     //ClearWordInCache(sIDs[i]);
   
 }
+/* appends a batch of sentence pairs to both corpora first and then merges
+ * all new source suffixes into the suffix array in a single pass */
+void BilingualDynSuffixArray::addSntPairs(const std::vector<string>& sources,
+    const std::vector<string>& targets, const std::vector<string>& alignments) {
+  CHECK(sources.size() == targets.size() && sources.size() == alignments.size());
+  const std::string& factorDelimiter = StaticData::Instance().GetFactorDelimiter();
+  const unsigned oldSrcCrpSize = m_srcCorpus->size();
+  m_srcVocab->MakeOpen();
+  m_trgVocab->MakeOpen();
+  for(size_t k = 0; k < sources.size(); ++k) {
+    Phrase sphrase(ARRAY_SIZE_INCR);
+    sphrase.CreateFromString(m_inputFactors, sources[k], factorDelimiter);
+    vuint_t srcFactor(sphrase.GetSize());
+    for(int i = sphrase.GetSize()-1; i >= 0; --i) {
+      srcFactor[i] = m_srcVocab->GetWordID(sphrase.GetWord(i));  // get vocab id backwards
+    }
+    m_srcSntBreaks.push_back(m_srcCorpus->size());
+    m_srcCorpus->insert(m_srcCorpus->end(), srcFactor.begin(), srcFactor.end());
+
+    Phrase tphrase(ARRAY_SIZE_INCR);
+    tphrase.CreateFromString(m_outputFactors, targets[k], factorDelimiter);
+    vuint_t trgFactor(tphrase.GetSize());
+    for(int i = tphrase.GetSize()-1; i >= 0; --i) {
+      trgFactor[i] = m_trgVocab->GetWordID(tphrase.GetWord(i));  // get vocab id
+    }
+    m_trgSntBreaks.push_back(m_trgCorpus->size());
+    m_trgCorpus->insert(m_trgCorpus->end(), trgFactor.begin(), trgFactor.end());
+
+    string alignment(alignments[k]);
+    LoadRawAlignments(alignment);
+  }
+  m_srcVocab->MakeClosed();
+  m_trgVocab->MakeClosed();
+  m_srcSA->Append(oldSrcCrpSize);
+  cerr << "Inserted " << sources.size() << " sentence pairs, source corpus size = "
+       << m_srcCorpus->size() << endl;
+}
 void BilingualDynSuffixArray::ClearWordInCache(wordID_t srcWord) {
   if(m_freqWordsCached.find(srcWord) != m_freqWordsCached.end())
     return;
@@ -100,6 +100,8 @@ public:
 	void GetTargetPhrasesByLexicalWeight(const Phrase& src, std::vector< std::pair<Scores, TargetPhrase*> >& target) const;
 	void CleanUp(const InputType& source);
   void addSntPair(string& source, string& target, string& alignment);
+  void addSntPairs(const std::vector<string>& sources, const std::vector<string>& targets,
+                   const std::vector<string>& alignments);
 private:
 	DynSuffixArray* m_srcSA;
 	DynSuffixArray* m_trgSA;
@@ -133,6 +133,14 @@ PhraseDictionaryCompact::GetTargetPhraseCollection(const Phrase &sourcePhrase) c
     TargetPhraseVector::iterator nth =
       (m_tableLimit == 0 || tpv->size() < m_tableLimit) ?
       tpv->end() : tpv->begin() + m_tableLimit;
+    
+    // Decoded phrases are cached across sentences with the scores of the
+    // weights at load time, so rank them under the current ones
+    if(nth != tpv->end()) {
+      const ScoreComponentCollection &weights = StaticData::Instance().GetAllWeights();
+      for(TargetPhraseVector::iterator it = tpv->begin(); it != tpv->end(); it++)
+        it->SetFutureScore(it->GetFutureScore(weights));
+    }
     std::nth_element(tpv->begin(), nth, tpv->end(), CompareTargetPhrase());
     for(TargetPhraseVector::iterator it = tpv->begin(); it != nth; it++)
       phraseColl->Add(new TargetPhrase(*it));
@@ -57,156 +57,125 @@ void DynSuffixArray::BuildAuxArrays()
   }
 }
 
-int DynSuffixArray::Rank(unsigned word, unsigned idx)
+/* The corpus already holds newSent at newIndex */
+void DynSuffixArray::Insert(vuint_t* newSent, unsigned newIndex)
 {
-  /* use Gerlach's code to make rank faster */
-  // the number of words in L[0..i] (minus 1 which is why 'i < idx', not '<=')
-  int r(0);
-  for(unsigned i=0; i < idx; ++i)
-    if(m_L->at(i) == word) ++r;
-  return r;
+  CHECK(newIndex <= m_SA->size());
+  Update(newIndex, 0, newSent->size());
 }
 
-/* count function should be implemented
- * with binary search over suffix array!! */
-int DynSuffixArray::F_firstIdx(unsigned word)
+/* Adds the suffixes of all text appended to the corpus since position
+ * newIndex in one pass. */
+void DynSuffixArray::Append(unsigned newIndex)
 {
-  // return index of first row where word is found in m_F
-  /*for(int i=0; i < m_F->size(); ++i) {
-    if(m_F->at(i) == word) {
-      return i; 
-    }
-  }
-  return -1;*/
-  //NOTE: lower_bound  is faster than linear search above but may cause issues 
-  //      if ordering of vocab is not consecutive (ie..after deletions) 
-  int low = std::lower_bound(m_F->begin(), m_F->end(), word) - m_F->begin();
-  //cerr << "in F_firstIdx with word = " << word << " and low = " << low <<  " and F->size() =" << m_F->size() << endl;
-  if((size_t)low >= m_F->size())
-    return -1;
-  else
-    return low;
+  CHECK(newIndex == m_SA->size());
+  if(newIndex == m_corpus->size()) return;
+  Update(newIndex, 0, m_corpus->size() - newIndex);
 }
 
-/* uses rank() and c() to obtain the LastFirstFunc function */
-int DynSuffixArray::LastFirstFunc(unsigned L_idx)
+/* The corpus no longer holds the num2del words that were at index */
+void DynSuffixArray::Delete(unsigned index, unsigned num2del)
 {
-  int fIdx(-1);
-  //cerr << "in LastFirstFcn() with L_idx = " << L_idx << endl;
-  unsigned word = m_L->at(L_idx);
-  if((fIdx = F_firstIdx(word)) != -1) {
-    //cerr << "fidx + Rank(" << word << "," << L_idx << ") = " << fIdx << "+" << Rank(word, L_idx) << endl;
-    fIdx += Rank(word, L_idx);
-  }
-  return fIdx;
+  CHECK(index + num2del <= m_SA->size());
+  Update(index, num2del, 0);
 }
 
-void DynSuffixArray::Insert(vuint_t* newSent, unsigned newIndex)
+/* The corpus had removed words at index replaced by added ones. Suffixes
+ * are ordered on their first 20 words, so only those starting less than 20
+ * words before index can change order, besides the new ones. The others keep
+ * their order and their F and L entries; the re-sorted ones are placed among
+ * them by binary search, and the arrays are only rewritten from the first
+ * rank that changes. */
+void DynSuffixArray::Update(unsigned index, unsigned removed, unsigned added)
 {
-  // for sentences
-  //stages 1, 2, 4 stay same from 1char case
-  //(use last word of new text in step 2 and save Ltmp until last insert?)
-  //stage 3...all words of new sentence are inserted backwards
-  // stage 2: k=ISA[newIndex], tmp= L[k], L[k]  = newChar
-  //PrintAuxArrays();
-  CHECK(newIndex <= m_SA->size());
-  int k(-1), kprime(-1);
-  k = (newIndex < m_SA->size() ? m_ISA->at(newIndex) : m_ISA->at(0)); // k is now index of the cycle that starts at newindex
-  int true_pos = LastFirstFunc(k); // track cycle shift (newIndex - 1)
-  int Ltmp = m_L->at(k);
-  m_L->at(k) = newSent->at(newSent->size()-1);  // cycle k now ends with correct word
-  for(int j = newSent->size()-1; j > -1; --j) {
-    kprime = LastFirstFunc(k);  // find cycle that starts with (newindex - 1)
-    //kprime += ((m_L[k] == Ltmp) && (k > isa[k]) ? 1 : 0); // yada yada
-    // only terminal char can be 0 so add new vocab at end
-    kprime = (kprime > 0 ? kprime : m_SA->size());
-    true_pos += (kprime <= true_pos ? 1 : 0); // track changes
-    // insert everything
-    m_F->insert(m_F->begin() + kprime, newSent->at(j));
-    int theLWord = (j == 0 ? Ltmp : newSent->at(j-1));
+  const unsigned size = m_corpus->size();
+  const unsigned oldSize = m_SA->size();
+  CHECK(index + added <= size && oldSize + added == size + removed);
+  const unsigned tail = (index > 20 ? index - 20 : 0);
 
-    m_L->insert(m_L->begin() + kprime, theLWord);
-    for (vuint_t::iterator itr = m_SA->begin(); itr != m_SA->end(); ++itr) {
-      if(*itr >= newIndex) ++(*itr);
-    }
-    m_SA->insert(m_SA->begin() + kprime, newIndex);
-    for (vuint_t::iterator itr = m_ISA->begin(); itr != m_ISA->end(); ++itr) {
-      if((int)*itr >= kprime) ++(*itr);
-    }
+  // old ranks of the suffixes that are removed or re-sorted
+  vuint_t holes;
+  for(unsigned pos = tail; pos < index + removed; ++pos)
+    holes.push_back((*m_ISA)[pos]);
+  std::sort(holes.begin(), holes.end());
 
-    m_ISA->insert(m_ISA->begin() + newIndex, kprime);
-    k = kprime;
-    //PrintAuxArrays();
+  // move the positions after the change to where they are now
+  if(added != removed) {
+    for(vuint_t::iterator itr = m_SA->begin(); itr != m_SA->end(); ++itr)
+      if(*itr >= index + removed) *itr = *itr - removed + added;
+    m_ISA->erase(m_ISA->begin() + index, m_ISA->begin() + index + removed);
+    m_ISA->insert(m_ISA->begin() + index, added, 0);
   }
-  // Begin stage 4
-  Reorder(true_pos, LastFirstFunc(kprime)); // actual position vs computed position of cycle (newIndex-1)
-}
 
-void DynSuffixArray::Reorder(unsigned j, unsigned jprime)
-{
-  set<pair<unsigned, unsigned> > seen;
-  while(j != jprime) {
-    // this 'seenit' check added for data with many loops. will remove after double 
-    // checking.  
-    bool seenit = seen.insert(std::make_pair(j, jprime)).second;
-    if(seenit) {
-      for(size_t i=1; i < m_SA->size(); ++i) {
-        if(m_corpus->at(m_SA->at(i)) < m_corpus->at(m_SA->at(i-1))) {
-          cerr << "PROBLEM WITH SUFFIX ARRAY REORDERING. EXITING...\n";
-          exit(1);
-        }
-      }
-      return;
+  vuint_t moved;
+  for(unsigned pos = tail; pos < index + added; ++pos)
+    moved.push_back(pos);
+  SuffixLess less(this);
+  std::sort(moved.begin(), moved.end(), less);
+  vuint_t ranks(moved.size());
+  for(size_t i = 0; i < moved.size(); ++i)
+    ranks[i] = InsertionRank(moved[i], holes, i ? ranks[i-1] : 0);
+
+  // ranks from begin to end are rewritten; after end, if as many suffixes
+  // were added as removed, nothing has changed
+  const unsigned begin = std::min(holes.empty() ? oldSize : holes.front(), ranks.empty() ? oldSize : ranks.front());
+  unsigned end = oldSize;
+  if(added == removed)
+    end = std::max(holes.empty() ? begin : holes.back() + 1, ranks.empty() ? begin : ranks.back());
+  vuint_t SA, F, L;
+  size_t next = 0, hole = 0;
+  while(hole < holes.size() && holes[hole] < begin) ++hole;
+  for(unsigned r = begin; r <= end; ++r) {
+    for(; next < moved.size() && ranks[next] <= r; ++next) {
+      const unsigned pos = moved[next];
+      SA.push_back(pos);
+      F.push_back((*m_corpus)[pos]);
+      L.push_back((*m_corpus)[pos == 0 ? size-1 : pos-1]);
     }
-    //cerr << "j=" << j << "\tj'=" << jprime << endl;
-    int isaIdx(-1);
-    int new_j = LastFirstFunc(j);
-    CHECK(j <= jprime);
-    // for SA and L, the element at pos j is moved to pos j'
-    m_L->insert(m_L->begin() + jprime + 1, m_L->at(j)); 
-    m_L->erase(m_L->begin() + j);
-    m_SA->insert(m_SA->begin() + jprime + 1, m_SA->at(j)); 
-    m_SA->erase(m_SA->begin() + j);
-    // all ISA values between (j...j'] decremented
-    for(size_t i = 0; i < m_ISA->size(); ++i) {
-      if((m_ISA->at(i) == j) && (isaIdx == -1))
-        isaIdx = i; // store index of ISA[i] = j
-      if((m_ISA->at(i) > j) && (m_ISA->at(i) <= jprime)) --(*m_ISA)[i];
+    if(r == end) break;
+    if(hole < holes.size() && holes[hole] == r) {
+      ++hole;
+      continue;
     }
-    // replace j with j' in ISA
-    //isa[isaIdx] = jprime;
-    m_ISA->at(isaIdx) = jprime;
-    j = new_j;
-    jprime = LastFirstFunc(jprime);
+    SA.push_back((*m_SA)[r]);
+    F.push_back((*m_F)[r]);
+    L.push_back((*m_L)[r]);
   }
-  //cerr << "j=" << j << "\tj'=" << jprime << endl;
-}
+  m_SA->erase(m_SA->begin() + begin, m_SA->begin() + end);
+  m_SA->insert(m_SA->begin() + begin, SA.begin(), SA.end());
+  m_F->erase(m_F->begin() + begin, m_F->begin() + end);
+  m_F->insert(m_F->begin() + begin, F.begin(), F.end());
+  m_L->erase(m_L->begin() + begin, m_L->begin() + end);
+  m_L->insert(m_L->begin() + begin, L.begin(), L.end());
 
-void DynSuffixArray::Delete(unsigned index, unsigned num2del)
-{
-  int ltmp = m_L->at(m_ISA->at(index));
-  int true_pos = LastFirstFunc(m_ISA->at(index)); // track cycle shift (newIndex - 1)
-  for(size_t q = 0; q < num2del; ++q) {
-    int row = m_ISA->at(index); // gives the position of index in SA and m_F
-    //std::cerr << "row = " << row << std::endl;
-    //std::cerr << "SA[r]/index = " << m_SA->at(row) << "/" << index << std::endl;
-    true_pos -= (row <= true_pos ? 1 : 0); // track changes
-    m_L->erase(m_L->begin() + row);
-    m_F->erase(m_F->begin() + row);
+  // ranks after the rewritten ones moved by the change in size
+  const unsigned last = (added == removed ? begin + SA.size() : size);
+  for(unsigned r = begin; r < last; ++r)
+    (*m_ISA)[(*m_SA)[r]] = r;
 
-    m_ISA->erase(m_ISA->begin() + index);  // order is important
-    for (vuint_t::iterator itr = m_ISA->begin(); itr != m_ISA->end(); ++itr) {
-      if((int)*itr > row) --(*itr);
-    }
+  // the words before the suffix following the change and before the first
+  // suffix may have changed
+  if(index + added < size)
+    (*m_L)[(*m_ISA)[index + added]] = (*m_corpus)[index + added == 0 ? size-1 : index + added - 1];
+  if(size > 0)
+    (*m_L)[(*m_ISA)[0]] = (*m_corpus)[size-1];
+}
 
-    m_SA->erase(m_SA->begin() + row);
-    for (vuint_t::iterator itr = m_SA->begin(); itr != m_SA->end(); ++itr) {
-      if(*itr > index) --(*itr);
-    }
+/* First old rank whose suffix does not sort before or with the one at pos,
+ * from begin on; the ranks in holes are skipped. */
+unsigned DynSuffixArray::InsertionRank(unsigned pos, const vuint_t& holes, unsigned begin) const
+{
+  unsigned low = begin, high = m_SA->size();
+  while(low < high) {
+    const unsigned mid = low + (high - low) / 2;
+    unsigned r = mid;
+    while(r < high && std::binary_search(holes.begin(), holes.end(), r)) ++r;
+    if(r < high && Compare((*m_SA)[r], pos, 20) <= 0)
+      low = r + 1;
+    else
+      high = mid;
   }
-  m_L->at(m_ISA->at(index))= ltmp;
-  Reorder(LastFirstFunc(m_ISA->at(index)), true_pos);
-  //PrintAuxArrays();
+  return low;
 }
 
 void DynSuffixArray::Substitute(vuint_t* /* newSents */, unsigned /* newIndex */)
@@ -261,7 +230,7 @@ void DynSuffixArray::Load(FILE* fin)
   fReadVector(fin, *m_SA);
 }
 
-int DynSuffixArray::Compare(int pos1, int pos2, int max)
+int DynSuffixArray::Compare(int pos1, int pos2, int max) const
 {
   for (size_t i = 0; i < (unsigned)max; ++i) {
     if((pos1 + i < m_corpus->size()) && (pos2 + i >= m_corpus->size()))
@@ -18,6 +18,7 @@ typedef std::vector<unsigned> vuint_t;
  */
 class DynSuffixArray
 {
+  friend class DynSuffixArrayTest;
 
 public:
   DynSuffixArray();
@@ -26,7 +27,11 @@ public:
   bool GetCorpusIndex(const vuint_t*, vuint_t*);
   void Load(FILE*);
   void Save(FILE*);
+  //! the corpus already holds the new sentence at the index
   void Insert(vuint_t*, unsigned);
+  //! the corpus already holds the words appended since the index
+  void Append(unsigned);
+  //! the corpus no longer holds the words deleted at the index
   void Delete(unsigned, unsigned);
   void Substitute(vuint_t*, unsigned);
 
@@ -37,12 +42,17 @@ private:
   vuint_t* m_L;
   vuint_t* m_corpus;
   void BuildAuxArrays();
+  void Update(unsigned, unsigned, unsigned);
+  unsigned InsertionRank(unsigned, const vuint_t&, unsigned) const;
   void Qsort(int* array, int begin, int end);
-  int Compare(int, int, int);
-  void Reorder(unsigned, unsigned);
-  int LastFirstFunc(unsigned);
-  int Rank(unsigned, unsigned);
-  int F_firstIdx(unsigned);
+  int Compare(int, int, int) const;
+  struct SuffixLess {
+    const DynSuffixArray* m_sa;
+    SuffixLess(const DynSuffixArray* sa) : m_sa(sa) {}
+    bool operator()(unsigned a, unsigned b) const {
+      return m_sa->Compare(a, b, 20) < 0;
+    }
+  };
   void PrintAuxArrays() {
     std::cerr << "SA\tISA\tF\tL\n";
     for(size_t i=0; i < m_SA->size(); ++i)
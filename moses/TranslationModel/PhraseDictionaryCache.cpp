@@ -30,6 +30,21 @@
 namespace Moses {
 	
 	namespace {
+		// a source phrase has few target phrases, so they are searched linearly
+		template <class It> It FindTarget(It it, It end, const Phrase &phrase)
+		{
+			while (it != end && !(it->phrase == phrase)) ++it;
+			return it;
+		}
+		CacheTargets::iterator FindTarget(CacheTargets &targets, const Phrase &phrase)
+		{
+			return FindTarget(targets.begin(), targets.end(), phrase);
+		}
+		CacheTargets::const_iterator FindTarget(const CacheTargets &targets, const Phrase &phrase)
+		{
+			return FindTarget(targets.begin(), targets.end(), phrase);
+		}
+
 		void ParserDeath(const std::string &file, size_t line_num) {
 			std::stringstream strme;
 			strme << "Syntax error at " << file << ":" << line_num;
@@ -45,6 +60,15 @@ namespace Moses {
 //	PhraseDictionaryCache::PhraseDictionaryCache(size_t numScoreComponent, const std::string filePath, PhraseDictionaryFeature* feature): PhraseDictionary(numScoreComponent,feature)	{
 	PhraseDictionaryCache::PhraseDictionaryCache(size_t numScoreComponent, const std::string filePath, PhraseDictionaryFeature* feature, size_t s_type, unsigned int age): PhraseDictionary(numScoreComponent,feature)	{
 
+		boost::shared_ptr<CacheGeneration> empty(new CacheGeneration());
+		empty->epoch = 0;
+		for (size_t i=0; i<CBTM_NUM_SHARDS; i++)
+		{
+			empty->shards.push_back(CacheShardPtr(new CacheShard()));
+		}
+		m_shared.generation = empty;
+		m_lineage = NULL;
+
                 SetScoreType(s_type);
 
 		SetMaxAge(age);
@@ -62,7 +86,6 @@ namespace Moses {
 	
 	PhraseDictionaryCache::~PhraseDictionaryCache()
 	{
-		Clear();
 	}
 	
 	void PhraseDictionaryCache::LoadCacheFile(const std::string &filePath)
@@ -73,7 +96,10 @@ namespace Moses {
 		util::FilePiece inFile(filePath.c_str(), staticData.GetVerboseLevel() >= 1 ? &std::cerr : NULL);
 		
 		size_t line_num = 0;
-		const std::string& factorDelimiter = staticData.GetFactorDelimiter();
+#ifdef WITH_THREADS
+		boost::mutex::scoped_lock lock(m_writeLock);
+#endif
+		BeginUpdate();
 		
 		while(true) {
 			++line_num;
@@ -91,6 +117,7 @@ namespace Moses {
 
 			Update(sourcePhraseString.as_string(), targetPhraseString.as_string(), ageString.as_string());
 		}
+		EndUpdate();
 		return;
 	}
 	
@@ -126,9 +153,16 @@ namespace Moses {
 
         void PhraseDictionaryCache::Execute(std::vector<std::string> commands)
         {
-                for (size_t j=0; j<commands.size(); j++)
                 {
-                        Execute(commands[j]);
+#ifdef WITH_THREADS
+                        boost::mutex::scoped_lock lock(m_writeLock);
+#endif
+                        BeginUpdate();
+                        for (size_t j=0; j<commands.size(); j++)
+                        {
+                                Execute(commands[j]);
+                        }
+                        EndUpdate();
                 }
                 IFVERBOSE(2) Print();
         }
@@ -160,120 +194,203 @@ namespace Moses {
 	{
 		return m_numScoreComponent;
 	}
+	void CacheSentenceView::Reset(CacheGenerationPtr g)
+	{
+		boost::unordered_map<const CacheTargets*, TargetPhraseCollection*>::iterator it;
+		for (it = collections.begin(); it != collections.end(); it++)
+		{
+			delete it->second;
+		}
+		collections.clear();
+		generation = g;
+	}
+
+	CacheSentenceView &PhraseDictionaryCache::GetView() const
+	{
+		if (!m_views.get())
+		{
+			m_views.reset(new CacheSentenceView());
+		}
+		return *m_views;
+	}
+
+	void PhraseDictionaryCache::InitializeForInput(InputType const&)
+	{
+		GetView().Reset(GetGeneration());
+	}
+
+	void PhraseDictionaryCache::CleanUp(const InputType&)
+	{
+		GetView().Reset(CacheGenerationPtr());
+	}
+
 	/*
 	 * gets the collection given the target phrase
+	 * the collection is scored according to the ages in the generation pinned by the calling thread,
+	 * and it lives until the thread moves to the next sentence
 	 */
 	const TargetPhraseCollection *PhraseDictionaryCache::GetTargetPhraseCollection(const Phrase &source) const
 	{
-#ifdef WITH_THREADS
-		boost::shared_lock<boost::shared_mutex> read_lock(m_cacheLock);
-#endif
-		const TargetPhraseCollection* tpc = NULL;
-		std::map<Phrase, TargetCollectionAgePair>::const_iterator it = m_cacheTM.find(source);
-		if(it != m_cacheTM.end())
+		CacheSentenceView &view = GetView();
+		if (!view.generation)
+		{
+			// lookup outside of a sentence
+			view.Reset(GetGeneration());
+		}
+		const CacheGeneration &generation = *view.generation;
+		const CacheShard &shard = *generation.shards[hash_value(source) % CBTM_NUM_SHARDS];
+		CacheShard::const_iterator it = shard.find(source);
+		if (it == shard.end())
 		{
-			tpc = (it->second).first;
+			return NULL;
+		}
+
+		const CacheTargets *targets = (it->second).get();
+		TargetPhraseCollection* &tpc = view.collections[targets];
+		if (tpc == NULL)
+		{
+			tpc = new TargetPhraseCollection();
+			CacheTargets::const_iterator target;
+			for (target = targets->begin(); target != targets->end(); target++)
+			{
+				std::auto_ptr<TargetPhrase> targetPhrase(new TargetPhrase(target->phrase));
+				targetPhrase->SetSourcePhrase(source);
+				targetPhrase->SetScore(m_feature,GetPreComputedScores(generation.epoch - target->epoch));
+				tpc->Add(targetPhrase.release());
+			}
 		}
 		return tpc;
 	}
+
+	/*
+	 * scores of an entry of the given age; entries older than maxAge share the score of maxAge
+	 */
+	const Scores &PhraseDictionaryCache::GetPreComputedScores(long age) const
+	{
+		if (age < 0) age = 0;
+		if (age > (long) maxAge) age = maxAge;
+		return precomputedScores[age];
+	}
 	
 	void PhraseDictionaryCache::Print() const
 	{
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> read_lock(m_cacheLock);
-#endif          
-		std::map<Phrase, TargetCollectionAgePair>::const_iterator it;
-		for(it = m_cacheTM.begin(); it!=m_cacheTM.end(); it++)
+		CacheGenerationPtr generation = GetGeneration();
+		for (size_t i=0; i<generation->shards.size(); i++)
 		{
-			std::vector<size_t>::size_type sz;
-			std::string source = (it->first).ToString();
-			TargetPhraseCollection* tpc = (it->second).first;
-			std::vector<TargetPhrase*> TPCvector;// = tpc->GetCollection();
-			sz = TPCvector.capacity();
-			TPCvector.reserve(tpc->GetSize());
-			TPCvector = tpc->GetCollection();
-			std::vector<TargetPhrase*>::iterator itr;
-			for(itr = TPCvector.begin(); itr != TPCvector.end(); itr++)
+			CacheShard::const_iterator it;
+			for(it = generation->shards[i]->begin(); it!=generation->shards[i]->end(); it++)
 			{
-				std::string target = (*itr)->ToString();
-				VERBOSE(1, source << " ||| " << target << std::endl);
+				std::string source = (it->first).ToString();
+				CacheTargets::const_iterator tem_it;
+				for(tem_it = (it->second)->begin(); tem_it != (it->second)->end(); tem_it++)
+				{
+					std::string target = (tem_it->phrase).ToString();
+					VERBOSE(1, source << " ||| " << target << std::endl);
+				}
 			}
-			TPCvector.clear();
-			source.clear();
 		}
 	}
 	
+	/*
+	 * copy-on-write helpers of the writer
+	 */
+	CacheGenerationPtr PhraseDictionaryCache::GetGeneration() const
+	{
+		const std::string &session = StaticData::Instance().GetThreadSession();
+		if (!session.empty())
+		{
+#ifdef WITH_THREADS
+			boost::mutex::scoped_lock lock(m_sessionLock);
+#endif
+			std::map<std::string, CacheLineagePtr>::const_iterator it = m_sessions.find(session);
+			if (it != m_sessions.end()) return boost::atomic_load(&it->second->generation);
+		}
+		return boost::atomic_load(&m_shared.generation);
+	}
+
+	CacheLineage &PhraseDictionaryCache::GetWritableLineage()
+	{
+		const std::string &session = StaticData::Instance().GetThreadSession();
+		if (session.empty()) return m_shared;
+
+#ifdef WITH_THREADS
+		boost::mutex::scoped_lock lock(m_sessionLock);
+#endif
+		CacheLineagePtr &lineage = m_sessions[session];
+		if (!lineage)
+		{
+			VERBOSE(2, "PhraseDictionaryCache starting the cache of session " << session << std::endl);
+			lineage.reset(new CacheLineage());
+			lineage->generation = boost::atomic_load(&m_shared.generation);
+			lineage->insertions = m_shared.insertions;
+		}
+		return *lineage;
+	}
+
+	void PhraseDictionaryCache::BeginUpdate()
+	{
+		m_lineage = &GetWritableLineage();
+		m_next.reset(new CacheGeneration(*boost::atomic_load(&m_lineage->generation)));
+		m_copiedShards.assign(m_next->shards.size(), false);
+	}
+
+	void PhraseDictionaryCache::EndUpdate()
+	{
+		CacheGenerationPtr published(m_next);
+		boost::atomic_store(&m_lineage->generation, published);
+		m_next.reset();
+		m_lineage = NULL;
+	}
+
+	void PhraseDictionaryCache::DropSession(const std::string &session)
+	{
+		// the writer may be updating the lineage of the session
+#ifdef WITH_THREADS
+		boost::mutex::scoped_lock writeLock(m_writeLock);
+		boost::mutex::scoped_lock lock(m_sessionLock);
+#endif
+		m_sessions.erase(session);
+	}
+
+	CacheShard &PhraseDictionaryCache::GetWritableShard(const Phrase &p)
+	{
+		size_t i = hash_value(p) % CBTM_NUM_SHARDS;
+		if (!m_copiedShards[i])
+		{
+			m_next->shards[i].reset(new CacheShard(*m_next->shards[i]));
+			m_copiedShards[i] = true;
+		}
+		return *m_next->shards[i];
+	}
+
 	/*
 	 * Updates the cache table with new entry
 	 */
 	void PhraseDictionaryCache::Update(Phrase sp, Phrase tp, int age)
 	{
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> lock(m_cacheLock);
-#endif          
 		VERBOSE(2, "PhraseDictionaryCache inserting sp:" << sp << " tp:" << tp << " age:" << age << std::endl);
-		
-		std::map<Phrase, TargetCollectionAgePair>::const_iterator it = m_cacheTM.find(sp);
-		if(it!=m_cacheTM.end())
+
+		long epoch = m_next->epoch - age;
+
+		// the entry may be shared with the published generation, so it is replaced by a modified copy
+		CacheTargetsPtr &entry = GetWritableShard(sp)[sp];
+		CacheTargetsPtr updated(entry ? new CacheTargets(*entry) : new CacheTargets());
+		CacheTargets::iterator target = FindTarget(*updated, tp);
+		if (target != updated->end())
 		{
-			// p is found
-			// here we have to remove the target phrase from targetphrasecollection and from the TargetAgeMap
-			// and then add new entry
-			TargetCollectionAgePair TgtCollAgePair = it->second;
-			TargetPhraseCollection* tpc = TgtCollAgePair.first;
-			TargetAgeMap* tam = TgtCollAgePair.second;
-			TargetAgeMap::iterator tam_it = tam->find(tp);
-			if (tam_it!=tam->end())
-			{
-				//tp is found
-				size_t tp_pos = ((*tam_it).second).second;
-				((*tam_it).second).first = age;
-				TargetPhrase* tp_ptr = tpc->GetTargetPhrase(tp_pos);
-				tp_ptr->SetScore(m_feature,precomputedScores[age]);
-			}
-			else
-			{
-				//tp is not found
-		    std::auto_ptr<TargetPhrase> targetPhrase(new TargetPhrase(tp));
-		    //Now that the source phrase is ready, we give the target phrase a copy
-		    targetPhrase->SetSourcePhrase(sp);
-		    targetPhrase->SetScore(m_feature,precomputedScores[age]);
-		    tpc->Add(targetPhrase.release());
-		    size_t tp_pos = tpc->GetSize()-1;
-		    AgePosPair app(age,tp_pos);
-		    TargetAgePosPair taap(tp,app);
-		    tam->insert(taap);
-			}
+			target->epoch = epoch;
 		}
 		else
 		{
-			// p is not found
-			// create target collection
-			// we have to create new target collection age pair and add new entry to target collection age pair
-			
-			TargetPhraseCollection* tpc = new TargetPhraseCollection();
-			TargetAgeMap* tam = new TargetAgeMap();
-			m_cacheTM.insert(make_pair(sp,make_pair(tpc,tam)));
-			
-			//tp is not found
-	    std::auto_ptr<TargetPhrase> targetPhrase(new TargetPhrase(tp));
-	    //Now that the source phrase is ready, we give the target phrase a copy
-	    targetPhrase->SetSourcePhrase(sp);
-			
-	    targetPhrase->SetScore(m_feature,precomputedScores.at(age));
-	    tpc->Add(targetPhrase.release());
-	    size_t tp_pos = tpc->GetSize()-1;
-	    AgePosPair app(age,tp_pos);
-	    TargetAgePosPair taap(tp,app);
-	    tam->insert(taap);
+			updated->push_back(CacheTarget(tp, epoch));
 		}
+		entry = updated;
+
+		m_lineage->insertions.push_back(CacheInsertion(epoch,sp,tp));
 	}
 	
 	void PhraseDictionaryCache::SetPreComputedScores(int numScoreComponent)
 	{
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> lock(m_cacheLock);
-#endif        
 		float sc;
 		for (size_t i=0; i<=maxAge; i++)
 		{
@@ -303,6 +420,10 @@ namespace Moses {
 
         void PhraseDictionaryCache::Insert(std::vector<std::string> entries)
         {
+#ifdef WITH_THREADS
+                boost::mutex::scoped_lock lock(m_writeLock);
+#endif
+                BeginUpdate();
                 Decay();
 
 		std::vector<std::string>::iterator itr = entries.begin();
@@ -318,59 +439,57 @@ namespace Moses {
                                                                                 
                         itr++;
                 }
+                EndUpdate();
 
                 IFVERBOSE(2) Print();
         }
 	
 	/*
-	 * Traverse through the cache and ages every phrase pair.
+	 * Ages every phrase pair by moving to the next epoch; the scores are brought up to date lazily
+	 * by GetTargetPhraseCollection, so only the entries which expire now are touched.
 	 */
 	void PhraseDictionaryCache::Decay()
 	{
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> lock(m_cacheLock);
-#endif          
-		std::map<Phrase, TargetCollectionAgePair>::iterator it;
-		for(it = m_cacheTM.begin(); it!=m_cacheTM.end(); it++)
+		m_next->epoch++;
+
+		// insertions are recorded in epoch order, except for the entries loaded from a file,
+		// which are then evicted as soon as the older insertions in front of them are
+		while (!m_lineage->insertions.empty() && m_next->epoch - m_lineage->insertions.front().epoch > (long) maxAge)
 		{
-			Decay((*it).first);
+			Evict(m_lineage->insertions.front());
+			m_lineage->insertions.pop_front();
 		}
 	}
 	
-	void PhraseDictionaryCache::Decay(Phrase p)
+	void PhraseDictionaryCache::Evict(const CacheInsertion &insertion)
 	{
-		std::map<Phrase, TargetCollectionAgePair>::const_iterator it = m_cacheTM.find(p);
-		if (it != m_cacheTM.end())
+		const CacheShard &shard = *m_next->shards[hash_value(insertion.source) % CBTM_NUM_SHARDS];
+		CacheShard::const_iterator it = shard.find(insertion.source);
+		if (it == shard.end()) return;
+
+		const CacheTargets &targets = *(it->second);
+		CacheTargets::const_iterator target = FindTarget(targets, insertion.target);
+		if (target == targets.end() || target->epoch != insertion.epoch)
 		{
-			//p is found
-			
-			TargetCollectionAgePair TgtCollAgePair = it->second;
-			TargetPhraseCollection* tpc = TgtCollAgePair.first;
-			TargetAgeMap* tam = TgtCollAgePair.second;
-			
-			TargetAgeMap::iterator tam_it;
-			for (tam_it=tam->begin(); tam_it!=tam->end();tam_it++)
-			{
-				int tp_age = ((*tam_it).second).first + 1; //increase the age by 1
-				((*tam_it).second).first = tp_age;
-				size_t tp_pos = ((*tam_it).second).second;
-				
-				TargetPhrase* tp_ptr = tpc->GetTargetPhrase(tp_pos);
-				tp_ptr->SetScore(m_feature,precomputedScores[tp_age]);
-			}
+			// already evicted, or inserted again after this insertion
+			return;
+		}
+
+		VERBOSE(2, "PhraseDictionaryCache evicting sp:" << insertion.source << " tp:" << insertion.target << std::endl);
+		CacheShard &writable = GetWritableShard(insertion.source);
+		if (targets.size() == 1)
+		{
+			writable.erase(insertion.source);
 		}
 		else
 		{
-			//do nothing
+			CacheTargetsPtr updated(new CacheTargets(targets));
+			updated->erase(updated->begin() + (target - targets.begin()));
+			writable[insertion.source] = updated;
 		}
-		
-		//put here the removal of entries with age greater than maxAge
 	}
 
         void PhraseDictionaryCache::SetScoreType(size_t type) {
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> read_lock(m_cacheLock);
-#endif
 
                 score_type = type;
                 if ( score_type != CBTM_SCORE_TYPE_HYPERBOLA
@@ -389,27 +508,18 @@ namespace Moses {
         };
 
         void PhraseDictionaryCache::SetMaxAge(unsigned int age) {
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> read_lock(m_cacheLock);
-#endif
                 maxAge = age;
                 VERBOSE(2, "PhraseDictionaryCache MaxAge:  " << maxAge << std::endl);
         };
 	
 	void PhraseDictionaryCache::Clear()
 	{
-#ifdef WITH_THREADS
-                boost::shared_lock<boost::shared_mutex> lock(m_cacheLock);
-#endif          
-		std::map<Phrase, TargetCollectionAgePair>::iterator it;
-		for(it = m_cacheTM.begin(); it!=m_cacheTM.end(); it++)
+		for (size_t i=0; i<m_next->shards.size(); i++)
 		{
-			delete ((*it).second).first;
-			(((*it).second).second)->clear();
-			delete ((*it).second).second;
+			m_next->shards[i].reset(new CacheShard());
+			m_copiedShards[i] = true;
 		}
-		
-		m_cacheTM.clear();
+		m_lineage->insertions.clear();
 	}
 	
         float PhraseDictionaryCache::decaying_score(const int age)
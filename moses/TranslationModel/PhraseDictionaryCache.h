@@ -11,9 +11,12 @@
 #include "moses/FeatureFunction.h"
 #include "moses/InputFileStream.h"
 #include "moses/TargetPhraseCollection.h"
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #ifdef WITH_THREADS
-#include <boost/thread/shared_mutex.hpp>
-#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 #endif
 
 #define CBTM_SCORE_TYPE_HYPERBOLA 0
@@ -25,33 +28,106 @@
 #define CBTM_SCORE_TYPE_EXPONENTIAL_REWARD 12
 #define PI 3.14159265
 
+#define CBTM_NUM_SHARDS 256
+
 namespace Moses {
-typedef std::pair<int, size_t> AgePosPair;
-typedef std::pair<Phrase, AgePosPair> TargetAgePosPair;
-typedef std::map<Phrase, AgePosPair> TargetAgeMap;
-typedef std::pair<TargetPhraseCollection*, TargetAgeMap*> TargetCollectionAgePair;
+// the age of an entry is not stored: it is the distance between the epoch of the generation and the epoch of its (last) insertion
+struct CacheTarget
+{
+	Phrase phrase;
+	long epoch;	// epoch of its (last) insertion
+	CacheTarget(const Phrase &p, long e) : phrase(p), epoch(e) {}
+};
+typedef std::vector<CacheTarget> CacheTargets;	// the target phrases of one source phrase, in order of first insertion
+typedef boost::shared_ptr<CacheTargets> CacheTargetsPtr;
+typedef boost::unordered_map<Phrase, CacheTargetsPtr> CacheShard;	// source phrase, its target phrases
+typedef boost::shared_ptr<CacheShard> CacheShardPtr;
+
+/*
+ * Immutable state of the cache seen by the readers.
+ * The writer builds the next generation by copying only the shards and the entries it modifies,
+ * and publishes it with an atomic pointer swap.
+ */
+struct CacheGeneration
+{
+	std::vector<CacheShardPtr> shards;
+	long epoch;	// incremented at each Insert
+};
+typedef boost::shared_ptr<const CacheGeneration> CacheGenerationPtr;
+
+/*
+ * Generation used by one thread for the sentence it is translating,
+ * together with the scored collections built from it.
+ */
+struct CacheSentenceView
+{
+	CacheGenerationPtr generation;
+	boost::unordered_map<const CacheTargets*, TargetPhraseCollection*> collections;
+
+	~CacheSentenceView() { Reset(CacheGenerationPtr()); }
+	void Reset(CacheGenerationPtr g);
+};
+
+// one record per insertion, in insertion order, used to evict the expired entries incrementally
+struct CacheInsertion
+{
+	long epoch;
+	Phrase source;
+	Phrase target;
+	CacheInsertion(long e, const Phrase &sp, const Phrase &tp) : epoch(e), source(sp), target(tp) {}
+};
 
+/*
+ * Generations published one after the other to the readers of one session, or to those of all sessions,
+ * with the insertions still held by the latest one.
+ */
+struct CacheLineage
+{
+	CacheGenerationPtr generation;	// published generation, only accessed through boost::atomic_load/atomic_store
+	std::deque<CacheInsertion> insertions;	// only accessed by the writer
+};
+typedef boost::shared_ptr<CacheLineage> CacheLineagePtr;
 
 class PhraseDictionaryCache : public PhraseDictionary
 {
-	std::map<Phrase, TargetCollectionAgePair> m_cacheTM;
+	CacheLineage m_shared;	// the cache of the threads which do not work for a session
+	// sessions which changed their cache; a session reads the shared cache until its first change,
+	// which starts its own lineage sharing every shard with the shared generation
+	std::map<std::string, CacheLineagePtr> m_sessions;
+#ifdef WITH_THREADS
+	mutable boost::thread_specific_ptr<CacheSentenceView> m_views;
+	boost::mutex m_writeLock;	// serializes the writers; readers never take it
+	mutable boost::mutex m_sessionLock;	// guards m_sessions
+#else
+	mutable std::auto_ptr<CacheSentenceView> m_views;
+#endif
+
+	// state of the writer
+	CacheLineage *m_lineage;	// lineage being updated
+	boost::shared_ptr<CacheGeneration> m_next;	// generation under construction
+	std::vector<bool> m_copiedShards;	// shards of m_next not shared with the published generation
+
 	std::vector<Scores> precomputedScores;
 	unsigned int maxAge;
         size_t score_type; //scoring type of the match
-#ifdef WITH_THREADS
-  //multiple readers - single writer lock
-  mutable boost::shared_mutex m_cacheLock;
-#endif
 
 protected:
 	float decaying_score(int age);	// calculates the decay score given the age
 
-	void Decay();	// traverse through the cache and decay each entry
-	void Decay(Phrase p);	// traverse through the cache and decay each entry for a given Phrase
+	CacheGenerationPtr GetGeneration() const;	// published generation of the session of the calling thread
+	CacheLineage &GetWritableLineage();	// the caller holds m_writeLock
+	void BeginUpdate();	// starts the next generation from the published one of the calling thread's session; the caller holds m_writeLock
+	void EndUpdate();	// publishes the next generation
+	CacheShard &GetWritableShard(const Phrase &p);
+
+	void Decay();	// ages all entries by one and evicts those older than maxAge
+	void Evict(const CacheInsertion &insertion);	// removes the entry of the given insertion, unless it was inserted again later
+	const Scores &GetPreComputedScores(long age) const;
+	CacheSentenceView &GetView() const;
         void Update(std::string sourceString, std::string targetString, std::string ageString);
 	void Update(Phrase p, Phrase tp, int age);
 	void Execute(std::string command);
-	void Clear();		// clears the cache
+	void Clear();		// clears the next generation
 	void SetPreComputedScores(int numScoreComponent);
 	void LoadCacheFile(const std::string &filePath);
 
@@ -77,9 +153,11 @@ public:
 	
 	const TargetPhraseCollection *GetTargetPhraseCollection(const Phrase &source) const;
 
-	virtual void InitializeForInput(InputType const&) {
-		/* Don't do anything source specific here as this object is shared between threads.*/
-	}
+	void DropSession(const std::string &session);	// the session goes back to the shared cache
+
+	// pins the current generation for the sentence translated by the calling thread
+	virtual void InitializeForInput(InputType const&);
+	virtual void CleanUp(const InputType& source);
 
 	virtual ChartRuleLookupManager *CreateRuleLookupManager(
 			const InputType &,
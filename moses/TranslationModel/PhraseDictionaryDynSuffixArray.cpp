@@ -74,6 +74,11 @@ void PhraseDictionaryDynSuffixArray::insertSnt(string& source, string& target, s
   m_biSA->addSntPair(source, target, alignment); // insert sentence pair into suffix arrays
   //StaticData::Instance().ClearTransOptionCache(); // clear translation option cache 
 }
+void PhraseDictionaryDynSuffixArray::insertSnts(const std::vector<string>& sources,
+    const std::vector<string>& targets, const std::vector<string>& alignments)
+{
+  m_biSA->addSntPairs(sources, targets, alignments);
+}
 void PhraseDictionaryDynSuffixArray::deleteSnt(unsigned /* idx */, unsigned /* num2Del */)
 {
   // need to implement --
@@ -31,6 +31,7 @@ public:
   void InitializeForInput(const InputType& i);
   void CleanUp(const InputType &source);
   void insertSnt(string&, string&, string&);
+  void insertSnts(const std::vector<string>&, const std::vector<string>&, const std::vector<string>&);
   void deleteSnt(unsigned, unsigned);
   ChartRuleLookupManager *CreateRuleLookupManager(const InputType&, const ChartCellCollectionBase&);
 private:
@@ -23,9 +23,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
-#include <sys/types.h>
-#include <unistd.h>
-#include <dirent.h>
 
 #include <fstream>
 #include <string>
@@ -37,7 +34,6 @@
 #include "moses/FactorCollection.h"
 #include "moses/Word.h"
 #include "moses/Util.h"
-#include "moses/InputFileStream.h"
 #include "moses/StaticData.h"
 #include "moses/WordsRange.h"
 #include "moses/UserMessage.h"
@@ -90,157 +86,59 @@ namespace Moses
   }
     
   
-  int removedirectoryrecursively(const char *dirname)
-  {
-    DIR *dir;
-    struct dirent *entry;
-    char path[PATH_MAX];
-    
-    if (path == NULL) {
-      fprintf(stderr, "Out of memory error\n");
-      return 0;
-    }
-    dir = opendir(dirname);
-    if (dir == NULL) {
-      perror("Error opendir()");
-      return 0;
-    }
-    
-    while ((entry = readdir(dir)) != NULL) {
-      if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
-        snprintf(path, (size_t) PATH_MAX, "%s/%s", dirname, entry->d_name);
-        if (entry->d_type == DT_DIR) {
-          removedirectoryrecursively(path);
-        }
-        
-        remove(path);
-        /*
-         * Here, the actual deletion must be done.  Beacuse this is
-         * quite a dangerous thing to do, and this program is not very
-         * well tested, we are just printing as if we are deleting.
-         */
-        //printf("(not really) Deleting: %s\n", path);
-        /*
-         * When you are finished testing this and feel you are ready to do the real
-         * deleting, use this: remove*STUB*(path);
-         * (see "man 3 remove")
-         * Please note that I DONT TAKE RESPONSIBILITY for data you delete with this!
-         */
-      }
-      
-    }
-    closedir(dir);
-    
-    rmdir(dirname);
-    /*
-     * Now the directory is emtpy, finally delete the directory itself. (Just
-     * printing here, see above) 
-     */
-    //printf("(not really) Deleting: %s\n", dirname);
-    
-    return 1;
-  }
-
   void PhraseDictionaryFuzzyMatch::InitializeForInput(InputType const& inputSentence)
   {
-    char dirName[] = "/tmp/moses.XXXXXX";
-    char *temp = mkdtemp(dirName);
-    CHECK(temp);
-    string dirNameStr(dirName);
-    
-    string inFileName(dirNameStr + "/in");
-    
-    ofstream inFile(inFileName.c_str());
-    
+    stringstream inStrme;
     for (size_t i = 1; i < inputSentence.GetSize() - 1; ++i)
     {
-      inFile << inputSentence.GetWord(i);
+      inStrme << inputSentence.GetWord(i);
     }
-    inFile << endl;
-    inFile.close();
-        
+
     long translationId = inputSentence.GetTranslationId();
-    string ptFileName = m_FuzzyMatchWrapper->Extract(translationId, dirNameStr);
+    vector<tmmt::ScoredRule> rules;
+    m_FuzzyMatchWrapper->Extract(translationId, inStrme.str(), rules);
 
     // populate with rules for this sentence
     PhraseDictionaryNodeSCFG &rootNode = m_collection[translationId];
-    FormatType format = MosesFormat;
-        
-    // data from file
-    InputFileStream inStream(ptFileName);
-    
-    // copied from class LoaderStandard
+
     PrintUserTime("Start loading fuzzy-match phrase model");
     
     const StaticData &staticData = StaticData::Instance();
     const std::string& factorDelimiter = staticData.GetFactorDelimiter();
+    const size_t numScoreComponents = GetFeature()->GetNumScoreComponents();
     
-    
-    string lineOrig;
-    size_t count = 0;
-    
-    while(getline(inStream, lineOrig)) {
-      const string *line;
-      if (format == HieroFormat) { // reformat line
-        assert(false);
-        //line = ReformatHieroRule(lineOrig);
-      }
-      else
-      { // do nothing to format of line
-        line = &lineOrig;
-      }
+    for (size_t count = 0; count < rules.size(); ++count) {
+      const tmmt::ScoredRule &rule = rules[count];
+      vector<float> scoreVector(rule.scores);
       
-      vector<string> tokens;
-      vector<float> scoreVector;
-      
-      TokenizeMultiCharSeparator(tokens, *line , "|||" );
-      
-      if (tokens.size() != 4 && tokens.size() != 5) {
-        stringstream strme;
-        strme << "Syntax error at " << ptFileName << ":" << count;
-        UserMessage::Add(strme.str());
-        abort();
-      }
-      
-      const string &sourcePhraseString = tokens[0]
-      , &targetPhraseString = tokens[1]
-      , &scoreString        = tokens[2]
-      , &alignString        = tokens[3];
-      
-      bool isLHSEmpty = (sourcePhraseString.find_first_not_of(" \t", 0) == string::npos);
+      bool isLHSEmpty = (rule.source.find_first_not_of(" \t", 0) == string::npos);
       if (isLHSEmpty && !staticData.IsWordDeletionEnabled()) {
-        TRACE_ERR( ptFileName << ":" << count << ": pt entry contains empty target, skipping\n");
+        TRACE_ERR("fuzzy-match rule " << count << " contains empty target, skipping\n");
         continue;
       }
       
-      Tokenize<float>(scoreVector, scoreString);
-      const size_t numScoreComponents = GetFeature()->GetNumScoreComponents();
       if (scoreVector.size() != numScoreComponents) {
         stringstream strme;
         strme << "Size of scoreVector != number (" << scoreVector.size() << "!="
-        << numScoreComponents << ") of score components on line " << count;
+        << numScoreComponents << ") of score components of fuzzy-match rule " << count;
         UserMessage::Add(strme.str());
         abort();
       }
-      CHECK(scoreVector.size() == numScoreComponents);
-      
-      // parse source & find pt node
       
       // constituent labels
       Word sourceLHS, targetLHS;
       
       // source
       Phrase sourcePhrase( 0);
-      sourcePhrase.CreateFromStringNewFormat(Input, *m_input, sourcePhraseString, factorDelimiter, sourceLHS);
+      sourcePhrase.CreateFromStringNewFormat(Input, *m_input, rule.source, factorDelimiter, sourceLHS);
       
       // create target phrase obj
       TargetPhrase *targetPhrase = new TargetPhrase();
-      targetPhrase->CreateFromStringNewFormat(Output, *m_output, targetPhraseString, factorDelimiter, targetLHS);
+      targetPhrase->CreateFromStringNewFormat(Output, *m_output, rule.target, factorDelimiter, targetLHS);
       
       // rest of target phrase
-      targetPhrase->SetAlignmentInfo(alignString);
+      targetPhrase->SetAlignmentInfo(rule.alignment);
       targetPhrase->SetTargetLHS(targetLHS);
-      //targetPhrase->SetDebugOutput(string("New Format pt ") + line);
       
       // component score, for n-best output
       std::transform(scoreVector.begin(),scoreVector.end(),scoreVector.begin(),TransformScore);
@@ -250,22 +148,10 @@ namespace Moses
       
       TargetPhraseCollection &phraseColl = GetOrCreateTargetPhraseCollection(rootNode, sourcePhrase, *targetPhrase, sourceLHS);
       phraseColl.Add(targetPhrase);
-      
-      count++;
-      
-      if (format == HieroFormat) { // reformat line
-        delete line;
-      }
-      else
-      { // do nothing
-      }
-      
     }
     
     // sort and prune each target phrase collection
     SortAndPrune(rootNode);
-   
-    //removedirectoryrecursively(dirName);
   }
   
   TargetPhraseCollection &PhraseDictionaryFuzzyMatch::GetOrCreateTargetPhraseCollection(PhraseDictionaryNodeSCFG &rootNode
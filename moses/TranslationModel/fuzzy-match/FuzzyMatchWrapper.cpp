@@ -49,55 +49,73 @@ namespace tmmt
     cerr << "loading completed" << endl;
   }
 
-  string FuzzyMatchWrapper::Extract(long translationId, const string &dirNameStr)
+  void FuzzyMatchWrapper::Extract(long translationId, const string &input, vector<ScoredRule> &rules)
   {
-    const Moses::StaticData &staticData = Moses::StaticData::Instance();
-
     WordIndex wordIndex;
 
-    string fuzzyMatchFile = ExtractTM(wordIndex, translationId, dirNameStr);
-    
-    // create extrac files
-    create_xml(fuzzyMatchFile);
+    vector<FuzzyMatchRecord> matches;
+    ExtractTM(wordIndex, translationId, input, matches);
 
-    // create phrase table with usual Moses scoring and consolidate programs
-    string cmd;
-    cmd = "LC_ALL=C sort " + fuzzyMatchFile + ".extract | gzip -c > "
-    	+ fuzzyMatchFile + ".extract.sorted.gz";
-    system(cmd.c_str());
-    cmd = "LC_ALL=C sort " + fuzzyMatchFile + ".extract.inv | gzip -c > "
-    	+ fuzzyMatchFile + ".extract.inv.sorted.gz";
-    system(cmd.c_str());
+    // create extract
+    vector<FuzzyMatchRule> extracted;
+    create_xml(matches, extracted);
 
-#ifdef IS_XCODE
-    cmd = "/Users/hieuhoang/unison/workspace/github/moses-smt/bin";
-#elif IS_ECLIPSE
-    cmd = "/home/hieu/workspace/github/moses-smt/bin";
-#else
-    cmd = staticData.GetBinDirectory();
-#endif
+    // score them as train-model.perl -hierarchical -score-options --NoLex would
+    ScoreRules(extracted, rules);
+  }
 
-    cmd += string("/../scripts/training/train-model.perl -dont-zip -first-step 6 -last-step 6 -f en -e fr -hierarchical ")
-		    	+ " -extract-file " + fuzzyMatchFile + ".extract -lexical-file - -score-options \"--NoLex\" "
-		    	+ " -phrase-translation-table " + fuzzyMatchFile + ".pt";
-    system(cmd.c_str());
+  /* Relative frequencies of the extracted rules in both directions, as
+   * computed by score and consolidate: each distinct rule keeps its most
+   * frequent alignment, the lexicographically first one on ties. */
+  void FuzzyMatchWrapper::ScoreRules(const vector<FuzzyMatchRule> &extracted, vector<ScoredRule> &rules) const
+  {
+    typedef pair<string, string> RulePair;
+    map<string, float> sourceCount, targetCount;
+    map<RulePair, map<string, float> > pairCount;
 
+    for (size_t i = 0; i < extracted.size(); ++i) {
+      const FuzzyMatchRule &rule = extracted[i];
+      // normalise whitespace, score reads the extract file token by token
+      string source = Moses::Join(" ", Moses::Tokenize(rule.source));
+      string target = Moses::Join(" ", Moses::Tokenize(rule.target));
+      string alignment = Moses::Join(" ", Moses::Tokenize(rule.alignment));
+      sourceCount[source] += rule.count;
+      targetCount[target] += rule.count;
+      pairCount[RulePair(source, target)][alignment] += rule.count;
+    }
+
+    rules.reserve(pairCount.size());
+    map<RulePair, map<string, float> >::const_iterator iterPair;
+    for (iterPair = pairCount.begin(); iterPair != pairCount.end(); ++iterPair) {
+      const RulePair &rulePair = iterPair->first;
+      const map<string, float> &alignments = iterPair->second;
 
-    return fuzzyMatchFile + ".pt.gz";
+      float count = 0, bestCount = -1;
+      map<string, float>::const_iterator iterAlign, bestAlign;
+      for (iterAlign = alignments.begin(); iterAlign != alignments.end(); ++iterAlign) {
+        count += iterAlign->second;
+        if (iterAlign->second > bestCount) {
+          bestCount = iterAlign->second;
+          bestAlign = iterAlign;
+        }
+      }
+
+      rules.push_back(ScoredRule());
+      ScoredRule &scored = rules.back();
+      scored.source = rulePair.first;
+      scored.target = rulePair.second;
+      scored.alignment = bestAlign->first;
+      scored.scores.push_back(count / targetCount.find(rulePair.second)->second);
+      scored.scores.push_back(count / sourceCount.find(rulePair.first)->second);
+      scored.scores.push_back(2.718);
+    }
   }
   
-  string FuzzyMatchWrapper::ExtractTM(WordIndex &wordIndex, long translationId, const string &dirNameStr)
+  void FuzzyMatchWrapper::ExtractTM(WordIndex &wordIndex, long translationId, const string &inputLine, vector<FuzzyMatchRecord> &matches)
   {
     const std::vector< std::vector< WORD_ID > > &source = suffixArray->GetCorpus();
 
-    string inputPath = dirNameStr + "/in";    
-    string fuzzyMatchFile = dirNameStr + "/fuzzyMatchFile";
-    ofstream fuzzyMatchStream(fuzzyMatchFile.c_str());
- 
-    vector< vector< WORD_ID > > input;
-    load_corpus(inputPath, input);
-    
-    assert(input.size() == 1);
+    vector< vector< WORD_ID > > input(1, GetVocabulary().Tokenize(inputLine.c_str()));
     size_t sentenceInd = 0;
     
 		clock_t start_clock = clock();
@@ -354,7 +372,7 @@ namespace tmmt
         
         const vector<WORD_ID> &sourceSentence = source[s];
         vector<SentenceAlignment> &targets = targetAndAlignment[s];
-        create_extract(sentenceInd, best_cost, sourceSentence, targets, inputStr, path, fuzzyMatchStream);
+        create_extract(sentenceInd, best_cost, sourceSentence, targets, inputStr, path, matches);
         
 			}
 		} // if (multiple_flag)
@@ -411,13 +429,9 @@ namespace tmmt
       // creat xml & extracts
       const vector<WORD_ID> &sourceSentence = source[best_match];
       vector<SentenceAlignment> &targets = targetAndAlignment[best_match];
-      create_extract(sentenceInd, best_cost, sourceSentence, targets, inputStr, best_path, fuzzyMatchStream);
+      create_extract(sentenceInd, best_cost, sourceSentence, targets, inputStr, best_path, matches);
       
     } // else if (multiple_flag)
-    
-    fuzzyMatchStream.close();
-    
-    return fuzzyMatchFile;
   }
 
   void FuzzyMatchWrapper::load_corpus( const std::string &fileName, vector< vector< WORD_ID > > &corpus )
@@ -1094,7 +1108,7 @@ int FuzzyMatchWrapper::parse_matches( vector< Match > &match, int input_length,
 }
 
 
-void FuzzyMatchWrapper::create_extract(int sentenceInd, int cost, const vector< WORD_ID > &sourceSentence, const vector<SentenceAlignment> &targets, const string &inputStr, const string  &path, ofstream &outputFile)
+void FuzzyMatchWrapper::create_extract(int sentenceInd, int cost, const vector< WORD_ID > &sourceSentence, const vector<SentenceAlignment> &targets, const string &inputStr, const string  &path, vector<FuzzyMatchRecord> &matches)
 {
   string sourceStr;
   for (size_t pos = 0; pos < sourceSentence.size(); ++pos) {
@@ -1104,19 +1118,17 @@ void FuzzyMatchWrapper::create_extract(int sentenceInd, int cost, const vector<
     
   for (size_t targetInd = 0; targetInd < targets.size(); ++targetInd) {
     const SentenceAlignment &sentenceAlignment = targets[targetInd]; 
-    string targetStr = sentenceAlignment.getTargetString(GetVocabulary());
-    string alignStr = sentenceAlignment.getAlignmentString();
-    
-    outputFile
-    << sentenceInd << endl
-    << cost << endl
-    << sourceStr << endl 
-    << inputStr << endl
-    << targetStr << endl
-    << alignStr << endl
-    << path << endl
-    << sentenceAlignment.count << endl;
-    
+
+    FuzzyMatchRecord match;
+    match.sentenceInd = sentenceInd;
+    match.cost = cost;
+    match.source = sourceStr;
+    match.input = inputStr;
+    match.target = sentenceAlignment.getTargetString(GetVocabulary());
+    match.alignment = sentenceAlignment.getAlignmentString();
+    match.path = path;
+    match.count = sentenceAlignment.count;
+    matches.push_back(match);
   }
 }
 
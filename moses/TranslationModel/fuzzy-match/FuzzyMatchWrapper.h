@@ -18,19 +18,28 @@
 #include "SuffixArray.h"
 #include "Vocabulary.h"
 #include "Match.h"
+#include "create_xml.h"
 #include "moses/InputType.h"
 
 namespace tmmt 
 {
 class Match;
 class SentenceAlignment;
+
+/** a rule of the per-sentence fuzzy-match rule table, scored like
+ * train-model.perl step 6 with --NoLex: p(f|e) p(e|f) phrase-penalty */
+struct ScoredRule
+{
+  std::string source, target, alignment;
+  std::vector<float> scores;
+};
   
 class FuzzyMatchWrapper
 {
 public:
   FuzzyMatchWrapper(const std::string &source, const std::string &target, const std::string &alignment);
 
-  std::string Extract(long translationId, const std::string &dirNameStr);
+  void Extract(long translationId, const std::string &input, std::vector<ScoredRule> &rules);
   
 protected:
   // tm-mt
@@ -74,9 +83,10 @@ protected:
   std::vector< Match > prune_matches( const std::vector< Match > &match, int best_cost );
   int parse_matches( std::vector< Match > &match, int input_length, int tm_length, int &best_cost );
 
-  void create_extract(int sentenceInd, int cost, const std::vector< WORD_ID > &sourceSentence, const std::vector<SentenceAlignment> &targets, const std::string &inputStr, const std::string  &path, std::ofstream &outputFile);
+  void create_extract(int sentenceInd, int cost, const std::vector< WORD_ID > &sourceSentence, const std::vector<SentenceAlignment> &targets, const std::string &inputStr, const std::string  &path, std::vector<FuzzyMatchRecord> &matches);
 
-  std::string ExtractTM(WordIndex &wordIndex, long translationId, const std::string &inputPath);
+  void ExtractTM(WordIndex &wordIndex, long translationId, const std::string &inputLine, std::vector<FuzzyMatchRecord> &matches);
+  void ScoreRules(const std::vector<FuzzyMatchRule> &extracted, std::vector<ScoredRule> &rules) const;
   Vocabulary &GetVocabulary()
   { return suffixArray->GetVocabulary(); }
 
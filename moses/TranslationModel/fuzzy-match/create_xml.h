@@ -1,5 +1,28 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
-void create_xml(const std::string &inPath);
+namespace tmmt
+{
+
+/** a TM segment matched against the input, with the target side and
+ * alignment of one of its translations */
+struct FuzzyMatchRecord
+{
+  int sentenceInd;
+  int cost;
+  std::string source, input, target, alignment, path;
+  int count;
+};
+
+/** a hierarchical rule in extract file format, both directions */
+struct FuzzyMatchRule
+{
+  std::string source, target, alignment, alignmentInv;
+  int count;
+};
+
+}
+
+void create_xml(const std::vector<tmmt::FuzzyMatchRecord> &matches, std::vector<tmmt::FuzzyMatchRule> &rules);
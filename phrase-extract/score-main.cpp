@@ -26,6 +26,7 @@
 #include <assert.h>
 #include <cstring>
 #include <set>
+#include <deque>
 #include <algorithm>
 
 #include "SafeGetline.h"
@@ -36,11 +37,14 @@
 #include "score.h"
 #include "InputFileStream.h"
 #include "OutputFileStream.h"
+#include "moses/OutputCollector.h"
+#include "moses/ThreadPool.h"
 
 using namespace std;
 using namespace MosesTraining;
 
 #define LINE_MAX_LENGTH 100000
+#define PHRASE_PAIRS_PER_TASK 10000
 
 namespace MosesTraining
 {
@@ -62,21 +66,41 @@ bool unalignedFWFlag = false;
 bool outputNTLengths = false;
 bool singletonFeature = false;
 bool crossedNonTerm = false;
-int countOfCounts[COC_MAX+1];
-int totalDistinct = 0;
 float minCountHierarchical = 0;
 
 Vocabulary vcbT;
 Vocabulary vcbS;
+WORD_ID nullS = 0;
+
+// count of counts statistics for Good Turing and Kneser Ney discounting
+struct CountOfCounts {
+  int counts[COC_MAX+1];
+  int totalDistinct;
+
+  CountOfCounts() : totalDistinct(0) {
+    fill(counts, counts+COC_MAX+1, 0);
+  }
+
+  void add( const CountOfCounts &other ) {
+    totalDistinct += other.totalDistinct;
+    for(int i=1; i<=COC_MAX; i++) counts[i] += other.counts[i];
+  }
+};
+CountOfCounts countOfCounts;
+
+#ifdef WITH_THREADS
+Moses::ThreadPool *scoringPool = NULL;
+boost::mutex countOfCountsMutex;
+#endif
   
 } // namespace
 
 vector<string> tokenize( const char [] );
 
 void writeCountOfCounts( const string &fileNameCountOfCounts );
-void processPhrasePairs( vector< PhraseAlignment > & , ostream &phraseTableFile, bool isSingleton, const ScoreFeatureManager& featureManager, const MaybeLog& maybeLog);
+void processPhrasePairs( vector< PhraseAlignment > & , ostream &phraseTableFile, bool isSingleton, CountOfCounts &counts, const ScoreFeatureManager& featureManager, const MaybeLog& maybeLog);
 const PhraseAlignment &findBestAlignment(const PhraseAlignmentCollection &phrasePair );
-void outputPhrasePair(const PhraseAlignmentCollection &phrasePair, float, int, ostream &phraseTableFile, bool isSingleton, const ScoreFeatureManager& featureManager, const MaybeLog& maybeLog );
+void outputPhrasePair(const PhraseAlignmentCollection &phrasePair, float, int, ostream &phraseTableFile, bool isSingleton, CountOfCounts &counts, const ScoreFeatureManager& featureManager, const MaybeLog& maybeLog );
 double computeLexicalTranslation( const PHRASE &, const PHRASE &, const PhraseAlignment & );
 double computeUnalignedPenalty( const PHRASE &, const PHRASE &, const PhraseAlignment & );
 set<string> functionWordList;
@@ -88,6 +112,65 @@ void calcNTLengthProb(const vector< PhraseAlignment* > &phrasePairs
 void printSourcePhrase(const PHRASE &, const PHRASE &, const PhraseAlignment &, ostream &);
 void printTargetPhrase(const PHRASE &, const PHRASE &, const PhraseAlignment &, ostream &);
 
+/**
+ * Scores the phrase pairs of a run of consecutive source phrases. Runs are
+ * scored in parallel, and the collector writes their output in input order.
+ */
+class ScoringTask : public Moses::Task
+{
+public:
+  ScoringTask(int id, Moses::OutputCollector &collector, const ScoreFeatureManager &featureManager, const MaybeLog &maybeLog)
+    : m_id(id), m_size(0), m_collector(collector), m_featureManager(featureManager), m_maybeLog(maybeLog) {}
+
+  // takes over the phrase pairs of one source phrase, leaving phrasePairs empty
+  void Add(vector< PhraseAlignment > &phrasePairs, bool isSingleton) {
+    m_size += phrasePairs.size();
+    m_phrasePairs.push_back( vector< PhraseAlignment >() );
+    m_phrasePairs.back().swap( phrasePairs );
+    m_isSingleton.push_back( isSingleton );
+  }
+
+  size_t GetSize() const { return m_size; }
+
+  virtual void Run() {
+    ostringstream out;
+    CountOfCounts counts;
+    for(size_t i=0; i<m_phrasePairs.size(); i++) {
+      processPhrasePairs( m_phrasePairs[i], out, m_isSingleton[i], counts, m_featureManager, m_maybeLog );
+    }
+    m_collector.Write( m_id, out.str() );
+
+    if (goodTuringFlag || kneserNeyFlag) {
+#ifdef WITH_THREADS
+      boost::mutex::scoped_lock lock(countOfCountsMutex);
+#endif
+      countOfCounts.add( counts );
+    }
+  }
+
+private:
+  int m_id;
+  size_t m_size;
+  deque< vector< PhraseAlignment > > m_phrasePairs; // never copies the pairs as it grows
+  vector< bool > m_isSingleton;
+  Moses::OutputCollector &m_collector;
+  const ScoreFeatureManager &m_featureManager;
+  const MaybeLog &m_maybeLog;
+};
+
+// hands the task to the thread pool, or scores it right away
+void scoreTask( ScoringTask *task )
+{
+#ifdef WITH_THREADS
+  if (scoringPool != NULL) {
+    scoringPool->Submit( task );
+    return;
+  }
+#endif
+  task->Run();
+  delete task;
+}
+
 int main(int argc, char* argv[])
 {
   cerr << "Score v2.0 written by Philipp Koehn\n"
@@ -95,7 +178,7 @@ int main(int argc, char* argv[])
 
   ScoreFeatureManager featureManager;
   if (argc < 4) {
-    cerr << "syntax: score extract lex phrase-table [--Inverse] [--Hierarchical] [--LogProb] [--NegLogProb] [--NoLex] [--GoodTuring] [--KneserNey] [--NoWordAlignment] [--UnalignedPenalty] [--UnalignedFunctionWordPenalty function-word-file] [--MinCountHierarchical count] [--OutputNTLengths] [--PCFG] [--UnpairedExtractFormat] [--ConditionOnTargetLHS] [--Singleton] [--CrossedNonTerm] \n";
+    cerr << "syntax: score extract lex phrase-table [--Inverse] [--Hierarchical] [--LogProb] [--NegLogProb] [--NoLex] [--GoodTuring] [--KneserNey] [--NoWordAlignment] [--UnalignedPenalty] [--UnalignedFunctionWordPenalty function-word-file] [--MinCountHierarchical count] [--OutputNTLengths] [--PCFG] [--UnpairedExtractFormat] [--ConditionOnTargetLHS] [--Singleton] [--CrossedNonTerm] [--Threads count] \n";
     cerr << featureManager.usage() << endl;
     exit(1);
   }
@@ -104,6 +187,7 @@ int main(int argc, char* argv[])
   string fileNamePhraseTable = argv[3];
   string fileNameCountOfCounts;
   char* fileNameFunctionWords = NULL;
+  size_t threads = 1;
   vector<string> featureArgs; //all unknown args passed to feature manager
 
   for(int i=4; i<argc; i++) {
@@ -166,6 +250,17 @@ int main(int argc, char* argv[])
     } else if (strcmp(argv[i],"--CrossedNonTerm") == 0) {
       crossedNonTerm = true;
       cerr << "crossed non-term reordering feature\n";
+    } else if (strcmp(argv[i],"--Threads") == 0) {
+      if (i+1==argc) {
+        cerr << "ERROR: specify the number of threads!\n";
+        exit(1);
+      }
+      threads = atoi(argv[++i]);
+#ifdef WITH_THREADS
+      cerr << "scoring with " << threads << " threads\n";
+#else
+      cerr << "WARNING: compiled without threading, scoring with 1 thread\n";
+#endif
     } else {
       featureArgs.push_back(argv[i]);
       ++i;
@@ -184,16 +279,12 @@ int main(int argc, char* argv[])
   // lexical translation table
   if (lexFlag)
     lexTable.load( fileNameLex );
+  nullS = vcbS.getWordID("NULL");
 
   // function word list
   if (unalignedFWFlag)
     loadFunctionWords( fileNameFunctionWords );
 
-  // compute count of counts for Good Turing discounting
-  if (goodTuringFlag || kneserNeyFlag) {
-    for(int i=1; i<=COC_MAX; i++) countOfCounts[i] = 0;
-  }
-
   // sorted phrase extraction file
   Moses::InputFileStream extractFile(fileNameExtract);
 
@@ -219,7 +310,18 @@ int main(int argc, char* argv[])
 		}
 		phraseTableFile = outputFile;
 	}
-	
+
+  // runs of source phrases are scored by the pool, in order of input
+  Moses::OutputCollector collector(phraseTableFile);
+#ifdef WITH_THREADS
+  if (threads > 1) {
+    scoringPool = new Moses::ThreadPool(threads);
+    scoringPool->SetQueueLimit(2*threads);
+  }
+#endif
+  int taskId = 0;
+  ScoringTask *task = new ScoringTask(taskId++, collector, featureManager, maybeLogProb);
+
   // loop through all extracted phrase translations
   float lastCount = 0.0f;
   float lastPcfgSum = 0.0f;
@@ -261,9 +363,12 @@ int main(int argc, char* argv[])
     // if new source phrase, process last batch
     if (lastPhrasePair != NULL &&
         lastPhrasePair->GetSource() != phrasePair.GetSource()) {
-      processPhrasePairs( phrasePairsWithSameF, *phraseTableFile, isSingleton, featureManager, maybeLogProb );
+      task->Add( phrasePairsWithSameF, isSingleton );
+      if (task->GetSize() >= PHRASE_PAIRS_PER_TASK) {
+        scoreTask( task );
+        task = new ScoringTask(taskId++, collector, featureManager, maybeLogProb);
+      }
       
-      phrasePairsWithSameF.clear();
       isSingleton = false;
       lastPhrasePair = NULL;
     }
@@ -276,7 +381,14 @@ int main(int argc, char* argv[])
     phrasePairsWithSameF.push_back( phrasePair );
     lastPhrasePair = &phrasePairsWithSameF.back();
   }
-  processPhrasePairs( phrasePairsWithSameF, *phraseTableFile, isSingleton, featureManager, maybeLogProb );
+  task->Add( phrasePairsWithSameF, isSingleton );
+  scoreTask( task );
+#ifdef WITH_THREADS
+  if (scoringPool != NULL) {
+    scoringPool->Stop(true);
+    delete scoringPool;
+  }
+#endif
 	
 	phraseTableFile->flush();
 	if (phraseTableFile != &cout) {
@@ -301,16 +413,16 @@ void writeCountOfCounts( const string &fileNameCountOfCounts )
 	}
 
   // Kneser-Ney needs the total number of phrase pairs
-  countOfCountsFile << totalDistinct << endl;
+  countOfCountsFile << countOfCounts.totalDistinct << endl;
 
   // write out counts
   for(int i=1; i<=COC_MAX; i++) {
-    countOfCountsFile << countOfCounts[ i ] << endl;
+    countOfCountsFile << countOfCounts.counts[ i ] << endl;
   }
 	countOfCountsFile.Close();
 }
 
-void processPhrasePairs( vector< PhraseAlignment > &phrasePair, ostream &phraseTableFile, bool isSingleton, const ScoreFeatureManager& featureManager, const MaybeLog& maybeLogProb )
+void processPhrasePairs( vector< PhraseAlignment > &phrasePair, ostream &phraseTableFile, bool isSingleton, CountOfCounts &counts, const ScoreFeatureManager& featureManager, const MaybeLog& maybeLogProb )
 {
   if (phrasePair.size() == 0) return;
 
@@ -351,7 +463,7 @@ void processPhrasePairs( vector< PhraseAlignment > &phrasePair, ostream &phraseT
   for(iter = sortedColl.begin(); iter != sortedColl.end(); ++iter) 
   {
     const PhraseAlignmentCollection &group = **iter;
-    outputPhrasePair( group, totalSource, phrasePairGroup.GetSize(), phraseTableFile, isSingleton, featureManager, maybeLogProb );
+    outputPhrasePair( group, totalSource, phrasePairGroup.GetSize(), phraseTableFile, isSingleton, counts, featureManager, maybeLogProb );
   }
   
 }
@@ -522,7 +634,7 @@ int calcCrossedNonTerm(const PHRASE &phraseS, const PhraseAlignment &bestAlignme
   return 0;
 }
 
-void outputPhrasePair(const PhraseAlignmentCollection &phrasePair, float totalCount, int distinctCount, ostream &phraseTableFile, bool isSingleton, const ScoreFeatureManager& featureManager,
+void outputPhrasePair(const PhraseAlignmentCollection &phrasePair, float totalCount, int distinctCount, ostream &phraseTableFile, bool isSingleton, CountOfCounts &counts, const ScoreFeatureManager& featureManager,
   const MaybeLog& maybeLogProb )
 {
   if (phrasePair.size() == 0) return;
@@ -539,10 +651,10 @@ void outputPhrasePair(const PhraseAlignmentCollection &phrasePair, float totalCo
 
   // collect count of count statistics
   if (goodTuringFlag || kneserNeyFlag) {
-    totalDistinct++;
+    counts.totalDistinct++;
     int countInt = count + 0.99999;
     if(countInt <= COC_MAX)
-      countOfCounts[ countInt ]++;
+      counts.counts[ countInt ]++;
   }
 
   // compute PCFG score
@@ -760,13 +872,12 @@ double computeLexicalTranslation( const PHRASE &phraseS, const PHRASE &phraseT,
 {
   // lexical translation probability
   double lexScore = 1.0;
-  int null = vcbS.getWordID("NULL");
   // all target words have to be explained
   for(size_t ti=0; ti<alignment.alignedToT.size(); ti++) {
     const set< size_t > & srcIndices = alignment.alignedToT[ ti ];
     if (srcIndices.empty()) {
       // explain unaligned word by NULL
-      lexScore *= lexTable.permissiveLookup( null, phraseT[ ti ] );
+      lexScore *= lexTable.permissiveLookup( nullS, phraseT[ ti ] );
     } else {
       // go through all the aligned words to compute average
       double thisWordScore = 0;
@@ -810,7 +921,7 @@ void LexicalTable::load( const string &fileName )
     double prob = atof( token[2].c_str() );
     WORD_ID wordT = vcbT.storeIfNew( token[0] );
     WORD_ID wordS = vcbS.storeIfNew( token[1] );
-    ltable[ wordS ][ wordT ] = prob;
+    ltable[ key( wordS, wordT ) ] = prob;
   }
   cerr << endl;
 }
@@ -10,20 +10,26 @@
 #include <string>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+
 namespace MosesTraining
 {
 class LexicalTable
 {
 public:
-  std::map< WORD_ID, std::map< WORD_ID, double > > ltable;
   void load( const std::string &filePath );
-  double permissiveLookup( WORD_ID wordS, WORD_ID wordT ) {
-    // cout << endl << vcbS.getWord( wordS ) << "-" << vcbT.getWord( wordT ) << ":";
-    if (ltable.find( wordS ) == ltable.end()) return 1.0;
-    if (ltable[ wordS ].find( wordT ) == ltable[ wordS ].end()) return 1.0;
-    // cout << ltable[ wordS ][ wordT ];
-    return ltable[ wordS ][ wordT ];
+  // read-only after load, so it may be shared by scoring threads
+  double permissiveLookup( WORD_ID wordS, WORD_ID wordT ) const {
+    Table::const_iterator i = ltable.find( key( wordS, wordT ) );
+    if (i == ltable.end()) return 1.0;
+    return i->second;
+  }
+private:
+  typedef boost::unordered_map< unsigned long long, double > Table;
+  static unsigned long long key( WORD_ID wordS, WORD_ID wordT ) {
+    return (static_cast<unsigned long long>(wordS) << 32) | wordT;
   }
+  Table ltable;
 };
 
 // other functions *********************************************
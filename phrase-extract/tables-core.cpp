@@ -37,6 +37,18 @@ bool isNonTerminal( const WORD &symbol ) {
    return symbol.substr(0, 1) == "[" && symbol.substr(symbol.size()-1, 1) == "]";
 }
 
+Vocabulary::Vocabulary()
+  : blocks( (static_cast<size_t>(1) << (8*sizeof(WORD_ID) - BLOCK_BITS)), NULL )
+  , size( 0 )
+{
+}
+
+Vocabulary::~Vocabulary()
+{
+  for(size_t i=0; i<blocks.size() && blocks[i] != NULL; i++)
+    delete [] blocks[i];
+}
+
 WORD_ID Vocabulary::storeIfNew( const WORD& word )
 {
   map<WORD, WORD_ID>::iterator i = lookup.find( word );
@@ -44,8 +56,12 @@ WORD_ID Vocabulary::storeIfNew( const WORD& word )
   if( i != lookup.end() )
     return i->second;
 
-  WORD_ID id = vocab.size();
-  vocab.push_back( word );
+  WORD_ID id = size;
+  WORD *&block = blocks[ id >> BLOCK_BITS ];
+  if (block == NULL)
+    block = new WORD[ BLOCK_SIZE ];
+  block[ id & (BLOCK_SIZE-1) ] = word;
+  ++size;
   lookup[ word ] = id;
   return id;
 }
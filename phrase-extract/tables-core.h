@@ -10,6 +10,7 @@
 #include <string>
 #include <queue>
 #include <map>
+#include <vector>
 #include <cmath>
 
 extern std::vector<std::string> tokenize( const char*);
@@ -20,16 +21,27 @@ namespace MosesTraining
 typedef std::string WORD;
 typedef unsigned int WORD_ID;
 
+// Words are kept in fixed-size blocks that never move, so a word that has
+// been stored may be read by other threads while new words are added.
+// Storing and looking up ids is not thread-safe.
 class Vocabulary
 {
 public:
+  Vocabulary();
+  ~Vocabulary();
   std::map<WORD, WORD_ID>  lookup;
-  std::vector< WORD > vocab;
   WORD_ID storeIfNew( const WORD& );
   WORD_ID getWordID( const WORD& );
   inline WORD &getWord( WORD_ID id ) {
-    return vocab[ id ];
+    return blocks[ id >> BLOCK_BITS ][ id & (BLOCK_SIZE-1) ];
   }
+private:
+  enum { BLOCK_BITS = 14, BLOCK_SIZE = 1 << BLOCK_BITS };
+  std::vector< WORD* > blocks; // sized once, never reallocated
+  WORD_ID size;
+
+  Vocabulary( const Vocabulary& );
+  void operator=( const Vocabulary& );
 };
 
 typedef std::vector< WORD_ID > PHRASE;
@@ -0,0 +1,2 @@
+#!/bin/sh
+./bjam -j2 link=static debug-symbols=off cxxflags=-std=gnu++98 mira//mira mira//mira_test